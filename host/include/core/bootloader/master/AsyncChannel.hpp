@@ -0,0 +1,89 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <core/bootloader/master/Engine.hpp>
+#include <core/bootloader/master/Pacer.hpp>
+
+namespace bootloader {
+namespace master {
+// Channel, for coroutines: the acknowledge waits park the coroutine in the
+// Engine instead of blocking the thread
+//
+// One request in flight, as the slaves have no WINDOWING.
+class AsyncChannel
+{
+public:
+    AsyncChannel(
+        Engine&                     engine,
+        uint16_t                    slaveID = ANY_NODE,
+        const Pacer::Configuration& configuration = Pacer::Configuration()
+    );
+
+    void
+    setSequence(
+        uint8_t sequence
+    );
+
+    uint8_t
+    sequence() const;
+
+    void
+    setSlaveID(
+        uint16_t slaveID
+    );
+
+    uint16_t
+    slaveID() const;
+
+    void
+    setDirect(
+        bool direct
+    );
+
+    void
+    setRetries(
+        unsigned retries
+    );
+
+    // As Channel::transact
+    Task<AcknowledgeStatus>
+    transact(
+        Request& request,
+        Frame*   acknowledge = nullptr,
+        bool     sequenced = true
+    );
+
+    Pacer&
+    pacer();
+
+    Engine&
+    engine();
+
+private:
+    Task<AcknowledgeStatus>
+    exchange(
+        const Request& request,
+        Frame*         acknowledge,
+        bool           sequenced
+    );
+
+    bool
+    send(
+        const Request& request
+    );
+
+private:
+    Engine&  _engine;
+    Pacer    _pacer;
+    uint16_t _slaveID;
+    uint8_t  _sequence;
+    bool     _direct;
+    unsigned _retries;
+};
+}
+}
@@ -0,0 +1,147 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <string>
+
+#include <core/bootloader/master/AsyncChannel.hpp>
+#include <core/bootloader/master/Master.hpp>
+
+namespace bootloader {
+namespace master {
+// Session, for coroutines: same flows, same requests
+class AsyncSession
+{
+public:
+    AsyncSession(
+        Engine&                     engine,
+        ModuleUID                   uid,
+        uint16_t                    slaveID = ANY_NODE,
+        const Pacer::Configuration& configuration = Pacer::Configuration()
+    );
+
+    Task<AcknowledgeStatus>
+    open(
+        bool shared = false
+    );
+
+    Task<AcknowledgeStatus>
+    close();
+
+    bool
+    isOpen() const;
+
+    uint32_t
+    mode() const;
+
+    const std::string&
+    version() const;
+
+    Task<AcknowledgeStatus>
+    describe(
+        payload::DescribeV2& description
+    );
+
+    Task<AcknowledgeStatus>
+    eraseProgram();
+
+    Task<AcknowledgeStatus>
+    write(
+        const Image&             image,
+        const Session::Progress& progress = Session::Progress()
+    );
+
+    Task<AcknowledgeStatus>
+    write(
+        const Plan&              plan,
+        const Session::Progress& progress = Session::Progress()
+    );
+
+    Task<AcknowledgeStatus>
+    verify(
+        const Image& image
+    );
+
+    Task<AcknowledgeStatus>
+    verify(
+        const Plan& plan
+    );
+
+    Task<AcknowledgeStatus>
+    rangeCRC(
+        uint32_t  address,
+        uint32_t  length,
+        uint32_t& crc
+    );
+
+    Task<AcknowledgeStatus>
+    writeProgramCRC(
+        uint32_t crc
+    );
+
+    Task<AcknowledgeStatus>
+    reset();
+
+    AsyncChannel&
+    channel();
+
+    ModuleUID
+    uid() const;
+
+private:
+    Task<AcknowledgeStatus>
+    simple(
+        Request request
+    );
+
+    Task<AcknowledgeStatus>
+    waitJob(
+        AcknowledgeStatus status,
+        uint32_t*         crc = nullptr
+    );
+
+private:
+    AsyncChannel _channel;
+    ModuleUID    _uid;
+    bool         _open;
+    bool         _aligned;
+    uint32_t     _mode;
+    std::string  _version;
+};
+
+// Master::identify, for coroutines
+Task<AcknowledgeStatus>
+identify(
+    Engine&                     engine,
+    ModuleUID                   uid,
+    uint16_t*                   slaveID = nullptr,
+    const Pacer::Configuration& configuration = Pacer::Configuration()
+);
+
+// Master::flash, for coroutines. Slaves that announced themselves are not
+// identified again
+Task<Master::Result>
+flash(
+    Engine&                     engine,
+    ModuleUID                   uid,
+    const Image&                image,
+    const Master::Options&      options,
+    const Pacer::Configuration& configuration = Pacer::Configuration(),
+    Session::Progress           progress = Session::Progress()
+);
+
+Task<Master::Result>
+flash(
+    Engine&                     engine,
+    ModuleUID                   uid,
+    const Plan&                 plan,
+    const Master::Options&      options,
+    const Pacer::Configuration& configuration = Pacer::Configuration(),
+    Session::Progress           progress = Session::Progress()
+);
+}
+}
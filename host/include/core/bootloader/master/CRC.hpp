@@ -0,0 +1,75 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace bootloader {
+namespace master {
+// What the STM32 CRC unit computes: CRC-32 polynomial, no reflection, no
+// final XOR, fed with little endian words. length must be a multiple of 4
+//
+// Same as core::stm32_crc::CRC::CRCBlock after a reset (with the initial
+// value, that is how the module UID is made), and as the RANGE_CRC jobs and
+// the program CRC, which continue from STM32_CRC_INITIAL.
+static const uint32_t STM32_CRC_INITIAL    = 0xFFFFFFFF;
+static const uint32_t STM32_CRC_POLYNOMIAL = 0x04C11DB7;
+
+// The fastest of the ones below this host has
+uint32_t
+stm32CRC(
+    uint32_t       crc,
+    const uint8_t* data,
+    std::size_t    length
+);
+
+// A bit at a time, as the CRC unit does it: the reference for the others
+uint32_t
+stm32CRCReference(
+    uint32_t       crc,
+    const uint8_t* data,
+    std::size_t    length
+);
+
+// Tables, 8 bytes at a time
+uint32_t
+stm32CRCSliceBy8(
+    uint32_t       crc,
+    const uint8_t* data,
+    std::size_t    length
+);
+
+// Folding with carry-less multiplications, 64 bytes at a time. Falls back
+// to stm32CRCSliceBy8 where there is no PCLMULQDQ
+uint32_t
+stm32CRCCarryless(
+    uint32_t       crc,
+    const uint8_t* data,
+    std::size_t    length
+);
+
+bool
+hasCarrylessCRC();
+
+// stm32CRC(crc, a + b) out of stm32CRC(crc, a) and stm32CRC(STM32_CRC_INITIAL, b):
+// the CRC of a whole flash out of the CRCs of its pages
+uint32_t
+stm32CRCCombine(
+    uint32_t    crcA,
+    uint32_t    crcB,
+    std::size_t lengthB
+);
+
+// core::stm32_crc::CRC::CRCBlock
+uint32_t
+stm32CRCBlock(
+    const uint32_t* words,
+    std::size_t     count
+);
+}
+}
@@ -0,0 +1,101 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <functional>
+
+#include <core/bootloader/master/Pacer.hpp>
+#include <core/bootloader/master/Transport.hpp>
+
+namespace bootloader {
+namespace master {
+// Requests to one slave and their acknowledges, paced by a Pacer
+//
+// A request that is not acknowledged in time is sent again as it is: the
+// slave resends the acknowledge if it already ran it.
+class Channel
+{
+public:
+    // Fills the next request, returns false when there are no more
+    using Producer = std::function<bool(Request& request)>;
+
+    // Gets every acknowledge, returns false to stop
+    using Consumer = std::function<bool(const Frame& acknowledge)>;
+
+    Channel(
+        ITransport&                 transport,
+        uint8_t                     masterID,
+        uint16_t                    slaveID = ANY_NODE,
+        const Pacer::Configuration& configuration = Pacer::Configuration()
+    );
+
+    // The sequence number the slave saw last, e.g. in the SELECT
+    void
+    setSequence(
+        uint8_t sequence
+    );
+
+    uint8_t
+    sequence() const;
+
+    void
+    setSlaveID(
+        uint16_t slaveID
+    );
+
+    uint16_t
+    slaveID() const;
+
+    // Sends the request on the direct topic, for shared sessions
+    void
+    setDirect(
+        bool direct
+    );
+
+    // Sends one request and waits for its acknowledge. The request gets the
+    // next sequence number if sequenced
+    AcknowledgeStatus
+    transact(
+        Request& request,
+        Frame*   acknowledge = nullptr,
+        bool     sequenced = true
+    );
+
+    // Keeps as many requests in flight as the pacer allows, stops at the
+    // first one not acknowledged with OK
+    AcknowledgeStatus
+    stream(
+        const Producer& next,
+        const Consumer& consumer = Consumer()
+    );
+
+    Pacer&
+    pacer();
+
+    void
+    setRetries(
+        unsigned retries
+    );
+
+private:
+    bool
+    send(
+        const Request& request
+    );
+
+private:
+    ITransport& _transport;
+    Pacer       _pacer;
+    uint8_t     _masterID;
+    uint16_t    _slaveID;
+    uint8_t     _sequence;
+    bool        _direct;
+    bool        _sequenced; // Acknowledges carry our sequence numbers
+    unsigned    _retries;
+};
+}
+}
@@ -0,0 +1,277 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <deque>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+#include <core/bootloader/master/Task.hpp>
+#include <core/bootloader/master/Transport.hpp>
+
+namespace bootloader {
+namespace master {
+// Runs many sessions as coroutines on the calling thread
+//
+// A coroutine that waits for an acknowledge or for some time is parked,
+// and resumed by run() when the frame arrives or the time is up: hundreds
+// of slaves share one thread and one transport. Use an Engine per thread,
+// e.g. one per bus.
+class Engine
+{
+public:
+    struct Statistics {
+        uint64_t        spawned   = 0;
+        uint64_t        finished  = 0;
+        uint64_t        resumes   = 0;
+        uint64_t        frames    = 0; // Received
+        uint64_t        unmatched = 0; // Received, but nobody was waiting for them
+        uint64_t        timeouts  = 0;
+        Clock::duration busy      = Clock::duration::zero(); // Outside of ITransport::receive
+        FrameStatistics coroutines;
+    };
+
+    // Awaits an acknowledge of request from node, true if it came
+    class AcknowledgeAwaiter
+    {
+public:
+        AcknowledgeAwaiter(
+            Engine&           engine,
+            uint16_t          node,
+            const Request&    request,
+            bool              sequenced,
+            Frame&            frame,
+            Clock::time_point deadline
+        );
+
+        bool
+        await_ready() noexcept
+        {
+            return false;
+        }
+
+        void
+        await_suspend(
+            std::coroutine_handle<> handle
+        );
+
+        bool
+        await_resume() noexcept
+        {
+            return _matched;
+        }
+
+private:
+        friend class Engine;
+
+        Engine&                 _engine;
+        uint16_t                _node;
+        const Request&          _request;
+        bool                    _sequenced;
+        Frame&                  _frame;
+        Clock::time_point       _deadline;
+        std::coroutine_handle<> _handle;
+        uint64_t                _ticket;
+        bool                    _matched;
+    };
+
+    class SleepAwaiter
+    {
+public:
+        SleepAwaiter(
+            Engine&           engine,
+            Clock::time_point until
+        );
+
+        bool
+        await_ready() noexcept
+        {
+            return _until <= Clock::now();
+        }
+
+        void
+        await_suspend(
+            std::coroutine_handle<> handle
+        );
+
+        void
+        await_resume() noexcept {}
+
+private:
+        Engine&           _engine;
+        Clock::time_point _until;
+    };
+
+    // Hands the lock over in order, to one coroutine at a time
+    class Mutex
+    {
+public:
+        struct Awaiter {
+            Mutex& mutex;
+
+            bool
+            await_ready() noexcept;
+
+            void
+            await_suspend(
+                std::coroutine_handle<> handle
+            );
+
+            void
+            await_resume() noexcept {}
+        };
+
+        Mutex(
+            Engine& engine
+        );
+
+        Awaiter
+        lock();
+
+        void
+        unlock();
+
+private:
+        Engine&                             _engine;
+        bool                                _locked;
+        std::deque<std::coroutine_handle<> > _waiting;
+    };
+
+public:
+    Engine(
+        ITransport& transport,
+        uint8_t     masterID
+    );
+
+    ~Engine();
+
+    uint8_t
+    masterID() const;
+
+    bool
+    send(
+        const Frame& frame
+    );
+
+    // Starts task at the next run()
+    void
+    spawn(
+        Task<void> task
+    );
+
+    // Until every task spawned is over
+    void
+    run();
+
+    AcknowledgeAwaiter
+    acknowledge(
+        uint16_t          node,
+        const Request&    request,
+        bool              sequenced,
+        Frame&            frame,
+        Clock::time_point deadline
+    );
+
+    SleepAwaiter
+    sleepUntil(
+        Clock::time_point until
+    );
+
+    SleepAwaiter
+    sleep(
+        Clock::duration duration
+    );
+
+    // Acknowledges from ANY_NODE cannot tell the slaves apart, one such
+    // request at a time
+    Mutex&
+    anyNode();
+
+    // Slaves without SELECT_SLAVE_SHARED act on every session message of
+    // the master, one such session at a time
+    Mutex&
+    exclusive();
+
+    // CAN ID of a slave that announced itself, if any did
+    bool
+    announced(
+        ModuleUID uid,
+        uint16_t& node
+    ) const;
+
+    // Every slave that announced itself, with its CAN ID
+    const std::unordered_map<ModuleUID, uint16_t>&
+    announced() const;
+
+    const Statistics&
+    statistics();
+
+private:
+    struct Timer {
+        Clock::time_point       deadline;
+        uint64_t                order;  // Same deadline, first come first served
+        uint64_t                ticket; // Of an AcknowledgeAwaiter, 0 for a sleep
+        std::coroutine_handle<> handle;
+
+        bool
+        operator>(
+            const Timer& other
+        ) const
+        {
+            return (deadline > other.deadline) || ((deadline == other.deadline) && (order > other.order));
+        }
+    };
+
+    Task<void>
+    root(
+        Task<void> task
+    );
+
+    void
+    schedule(
+        std::coroutine_handle<> handle
+    );
+
+    void
+    park(
+        AcknowledgeAwaiter* awaiter
+    );
+
+    void
+    unpark(
+        AcknowledgeAwaiter* awaiter
+    );
+
+    void
+    dispatch(
+        const Frame& frame
+    );
+
+    void
+    expire(
+        Clock::time_point now
+    );
+
+private:
+    ITransport&                                                     _transport;
+    uint8_t                                                         _masterID;
+    std::vector<Task<void> >                                        _tasks;
+    std::size_t                                                     _alive;
+    std::deque<std::coroutine_handle<> >                            _ready;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer> > _timers;
+    uint64_t                                                        _order;
+    uint64_t                                                        _tickets;
+    std::unordered_map<uint64_t, AcknowledgeAwaiter*>               _parked;
+    std::unordered_map<uint16_t, std::vector<AcknowledgeAwaiter*> > _byNode;
+    std::unordered_map<ModuleUID, uint16_t>                         _announced;
+    Mutex                                                           _anyNode;
+    Mutex                                                           _exclusive;
+    Statistics                                                      _statistics;
+};
+}
+}
@@ -0,0 +1,177 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <core/bootloader/master/Image.hpp>
+
+namespace bootloader {
+namespace master {
+// Where the program goes on a kind of module: PROGRAM_FLASH_FROM, the size
+// DESCRIBE reports, and the page the flash is erased by. Whole pages
+struct FlashGeometry {
+    uint32_t address;
+    uint32_t size;
+    uint32_t pageSize;
+
+    bool
+    operator==(
+        const FlashGeometry& other
+    ) const
+    {
+        return (address == other.address) && (size == other.size) && (pageSize == other.pageSize);
+    }
+};
+
+// A local, content addressed store of firmware builds
+//
+// A build is its flash, page by page: each page that is not erased is an
+// object named after its content, stored once whatever the number of builds
+// that have it. Each page has the CRC RANGE_CRC gives for it, and each build
+// the CRC the slave computes over its program flash (ProgramStorage::updateCRC),
+// made out of them. Both lookups, the build a slave has and what differs
+// from the one it should have, need nothing else than the index.
+//
+// On disk:
+//   objects/<first 2 digits>/<CRC><hash>  The pages, as they are in flash
+//   builds/<id>.build                     BuildHeader, then StorePage [pages]
+class FirmwareStore
+{
+public:
+    struct Page {
+        uint32_t address;
+        uint32_t crc;  // stm32CRC from STM32_CRC_INITIAL, as RANGE_CRC
+        uint64_t hash; // Of the content, with the CRC it names the object
+    };
+
+    struct Build {
+        std::string       id; // Its program CRC, and the hash of its pages
+        std::string       name;
+        FlashGeometry     geometry;
+        uint32_t          programCRC; // What DESCRIBE reports as flashCRC
+        std::vector<Page> pages;      // Not erased, in order
+
+        // The page at address, nullptr if it is erased
+        const Page*
+        page(
+            uint32_t address
+        ) const;
+    };
+
+    struct Statistics {
+        std::size_t builds;
+        std::size_t pages;   // In the builds
+        std::size_t objects; // Stored, once each
+        uint64_t    flashBytes;
+        uint64_t    storedBytes;
+    };
+
+public:
+    // Opens the store in directory, creating it if needed. nullptr if it
+    // cannot be read
+    static std::unique_ptr<FirmwareStore>
+    open(
+        const std::string& directory
+    );
+
+    // Stores a build, nullptr if the image does not fit the geometry. The
+    // same flash is the same build whatever its name: it is not stored again
+    const Build*
+    add(
+        const Image&         image,
+        const FlashGeometry& geometry,
+        const std::string&   name
+    );
+
+    // The builds a slave with that program CRC and flash size may have
+    std::vector<const Build*>
+    find(
+        uint32_t programCRC,
+        uint32_t flashSize
+    ) const;
+
+    const Build*
+    build(
+        const std::string& id
+    ) const;
+
+    std::vector<const Build*>
+    builds() const;
+
+    // The pages to erase and write to go from one build to the other, both
+    // of the same geometry
+    std::vector<uint32_t>
+    differingPages(
+        const Build& from,
+        const Build& to
+    ) const;
+
+    // ... from the page CRCs a slave gave, by address. The pages missing
+    // from crcs are taken as differing
+    std::vector<uint32_t>
+    differingPages(
+        const std::map<uint32_t, uint32_t>& crcs,
+        const Build&                        to
+    ) const;
+
+    // The image of a build, out of its objects
+    bool
+    load(
+        const Build& build,
+        Image&       image
+    ) const;
+
+    Statistics
+    statistics() const;
+
+private:
+    FirmwareStore(
+        const std::string& directory
+    );
+
+    bool
+    readBuild(
+        const std::string& path
+    );
+
+    std::string
+    objectPath(
+        const Page& page
+    ) const;
+
+    bool
+    writeObject(
+        const Page&    page,
+        const uint8_t* data,
+        uint32_t       pageSize
+    );
+
+    // The CRC of a page with nothing in it
+    static uint32_t
+    erasedCRC(
+        uint32_t pageSize
+    );
+
+private:
+    std::string                                       _directory;
+    std::map<std::string, std::unique_ptr<Build> >    _builds;  // By id
+    std::multimap<uint64_t, const Build*>             _byCRC;   // programCRC << 32 | flash size
+    std::map<std::pair<uint32_t, uint64_t>, uint32_t> _objects; // Their size, by CRC and hash
+};
+
+// Same as the slave computes over its program flash, out of the page CRCs
+uint32_t
+programCRC(
+    const FlashGeometry&                     geometry,
+    const std::vector<FirmwareStore::Page>& pages
+);
+}
+}
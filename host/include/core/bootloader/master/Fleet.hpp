@@ -0,0 +1,150 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <core/bootloader/master/AsyncSession.hpp>
+#include <core/bootloader/master/ImageCache.hpp>
+#include <core/bootloader/master/Plan.hpp>
+
+namespace bootloader {
+namespace master {
+// Updates the slaves of a whole machine, on all of its buses at once
+//
+// Each bus has a worker thread running an Engine, with a number of session
+// slots. Every job is queued on one of the buses the slave was heard on,
+// the one with the shortest queue. A worker whose queue is empty steals
+// the jobs it can reach from the longest queues of the others. A slave
+// that was never heard is tried on every bus, one after the other.
+class Fleet
+{
+public:
+    struct Options {
+        Master::Options      flash;
+        Pacer::Configuration pacing;
+        unsigned             sessionsPerBus;
+        Clock::duration      discovery; // Slaves announce themselves about every second
+
+        Options() :
+            sessionsPerBus(32),
+            discovery(std::chrono::seconds(3))
+        {
+            // The sessions of a bus delay each other's acknowledges, that is
+            // not the traffic of others: pace on the losses only
+            pacing.latencyTolerance = 1e6;
+        }
+    };
+
+    struct Outcome {
+        ModuleUID       uid;
+        int             bus; // Where it ran last, -1 if nowhere
+        Master::Result  result;
+        Clock::duration elapsed;
+    };
+
+    struct BusStatistics {
+        unsigned           jobs   = 0;
+        unsigned           stolen = 0; // From the queue of another bus
+        Engine::Statistics engine;
+    };
+
+    // Called from the worker threads, one at a time
+    using Report = std::function<void(const Outcome& outcome)>;
+
+public:
+    Fleet(
+        const std::vector<ITransport*>& buses,
+        uint8_t                         masterID,
+        const Options&                  options
+    );
+
+    ~Fleet();
+
+    // Listens on every bus at once, returns the buses each slave is on
+    std::map<ModuleUID, std::vector<unsigned> >
+    discover();
+
+    void
+    add(
+        ModuleUID         uid,
+        ImageCache::Entry image
+    );
+
+    void
+    add(
+        ModuleUID                   uid,
+        std::shared_ptr<const Plan> plan
+    );
+
+    // Runs every job added, until all are over
+    std::vector<Outcome>
+    run(
+        const Report& report = Report()
+    );
+
+    const std::vector<BusStatistics>&
+    statistics() const;
+
+private:
+    struct Job {
+        ModuleUID             uid;
+        ImageCache::Entry           image; // One of the two
+        std::shared_ptr<const Plan> plan;
+        std::vector<unsigned>       buses; // Where it may run
+    };
+
+    Job*
+    create(
+        ModuleUID uid
+    );
+
+    void
+    enqueue(
+        Job* job
+    );
+
+    Job*
+    take(
+        unsigned bus
+    );
+
+    void
+    finish(
+        Job*                  job,
+        unsigned              bus,
+        const Master::Result& result,
+        Clock::duration       elapsed
+    );
+
+    bool
+    idle();
+
+    Task<void>
+    slot(
+        unsigned bus
+    );
+
+private:
+    std::vector<std::unique_ptr<Engine> >       _engines;
+    Options                                     _options;
+    std::map<ModuleUID, std::vector<unsigned> > _reachable;
+    std::vector<std::unique_ptr<Job> >          _jobs;
+    std::mutex                                  _mutex;
+    std::vector<std::deque<Job*> >              _queues; // By bus
+    unsigned                                    _running;
+    std::vector<Outcome>                        _outcomes;
+    std::vector<BusStatistics>                  _statistics;
+    Report                                      _report;
+};
+}
+}
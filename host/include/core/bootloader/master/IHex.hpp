@@ -0,0 +1,161 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+// The state and the record types are the ones of kk_ihex (src/kk_ihex must be
+// on the include path): an ihex_data_read written for it works as it is
+#include <kk_ihex/kk_ihex.h>
+
+namespace bootloader {
+namespace master {
+// Intel HEX reader, for the host
+//
+// Same behaviour as ihex_read_bytes, with the same callback, but whole
+// records are decoded 16 characters at a time: the byte at a time state
+// machine only runs on the records that are split between two reads, or
+// that have something else than hex digits in them.
+class IHexReader
+{
+public:
+    // Same as ihex_data_read
+    using DataRead = std::function<ihex_bool_t(struct ihex_state* ihex, ihex_record_type_t type, ihex_bool_t checksum_mismatch)>;
+
+public:
+    IHexReader(
+        const DataRead& dataRead
+    );
+
+    // ihex_begin_read, ihex_read_at_address
+    void
+    begin(
+        ihex_address_t address = 0
+    );
+
+    // ihex_read_at_segment
+    void
+    beginAtSegment(
+        ihex_segment_t segment
+    );
+
+    // ihex_read_bytes
+    void
+    read(
+        const char* data,
+        std::size_t count
+    );
+
+    // ihex_end_read
+    void
+    end();
+
+    struct ihex_state&
+    state();
+
+    // Characters that kk_ihex would skip silently: anything else than blanks
+    // between the records, and than hex digits within them
+    std::size_t
+    stray() const;
+
+private:
+    void
+    readByte(
+        char byte
+    );
+
+    // A whole record, from its ':'. The characters read, 0 if it is not
+    // all there or not all hex digits
+    std::size_t
+    readRecord(
+        const char* data,
+        std::size_t count
+    );
+
+private:
+    DataRead          _dataRead;
+    struct ihex_state _ihex;
+    std::size_t       _stray;
+};
+
+// Intel HEX writer, for the host, as kk_ihex_write does it: linear addresses,
+// and the extended linear address records where needed
+class IHexWriter
+{
+public:
+    // Same as ihex_flush_buffer, with what is ready to go
+    using Flush = std::function<void(const char* buffer, const char* end)>;
+
+    static const unsigned DEFAULT_LINE_LENGTH = 16; // Data bytes per record
+
+public:
+    IHexWriter(
+        const Flush& flush,
+        unsigned     lineLength = DEFAULT_LINE_LENGTH
+    );
+
+    // ihex_write_at_address
+    void
+    writeAt(
+        ihex_address_t address
+    );
+
+    // ihex_write_bytes
+    void
+    write(
+        const void* data,
+        std::size_t count
+    );
+
+    // ihex_end_write: the pending data, and the end of file record
+    void
+    end();
+
+private:
+    void
+    record(
+        ihex_record_type_t type,
+        uint16_t           address,
+        const uint8_t*     data,
+        std::size_t        length
+    );
+
+    void
+    flushLine();
+
+    void
+    flush();
+
+private:
+    Flush             _flush;
+    unsigned          _lineLength;
+    ihex_address_t    _address; // Of the first byte in _line
+    ihex_address_t    _upper;   // The upper 16 bits a reader has now
+    uint8_t           _line[IHEX_LINE_MAX_LENGTH];
+    unsigned          _length;
+    std::vector<char> _buffer;
+};
+
+// The hex digits of length bytes, upper case: 2 * length characters
+void
+encodeHex(
+    char*          out,
+    const uint8_t* data,
+    std::size_t    length
+);
+
+// The bytes of 2 * length hex digits, false if any is not one
+bool
+decodeHex(
+    uint8_t*    out,
+    const char* hex,
+    std::size_t length
+);
+}
+}
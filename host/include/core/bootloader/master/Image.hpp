@@ -0,0 +1,90 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace bootloader {
+namespace master {
+// A firmware image: contiguous segments of bytes, by address
+class Image
+{
+public:
+    using Segment  = std::vector<uint8_t>;
+    using Segments = std::map<uint32_t, Segment>;
+
+    static constexpr uint8_t ERASED = 0xFF;
+
+public:
+    // Adds bytes, merging them with the segments they touch
+    void
+    add(
+        uint32_t       address,
+        const uint8_t* data,
+        std::size_t    length
+    );
+
+    // Intel HEX, false on malformed records or checksum errors, see IHexReader
+    bool
+    readIHex(
+        std::istream& stream
+    );
+
+    bool
+    loadIHex(
+        const std::string& path
+    );
+
+    bool
+    loadBinary(
+        const std::string& path,
+        uint32_t           address
+    );
+
+    // Widens every segment to multiples of alignment, padding with ERASED
+    void
+    align(
+        uint32_t alignment
+    );
+
+    bool
+    isAligned(
+        uint32_t alignment
+    ) const;
+
+    // The addresses of the pages the image touches, in order
+    std::vector<uint32_t>
+    pages(
+        uint32_t pageSize
+    ) const;
+
+    // The page at address as it will be in flash, ERASED where the image is not
+    void
+    page(
+        uint32_t address,
+        uint8_t* data,
+        uint32_t pageSize
+    ) const;
+
+    const Segments&
+    segments() const;
+
+    std::size_t
+    size() const;
+
+    bool
+    empty() const;
+
+private:
+    Segments _segments;
+};
+}
+}
@@ -0,0 +1,46 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <core/bootloader/master/Image.hpp>
+
+namespace bootloader {
+namespace master {
+// Images by path, parsed once and shared read only by every session and
+// thread
+//
+// The images are word aligned, so that neither writes nor RANGE_CRC
+// verifies need a copy.
+class ImageCache
+{
+public:
+    using Entry = std::shared_ptr<const Image>;
+
+    // Intel HEX, or raw binary at address if binary. nullptr if the file
+    // cannot be read. Threads asking for an image being parsed wait for it
+    Entry
+    load(
+        const std::string& path,
+        bool               binary = false,
+        uint32_t           address = 0
+    );
+
+    std::size_t
+    size() const;
+
+private:
+    mutable std::mutex                           _mutex;
+    std::map<std::string, std::shared_future<Entry> > _entries;
+};
+}
+}
@@ -0,0 +1,118 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+
+#include <core/bootloader/master/Session.hpp>
+
+namespace bootloader {
+namespace master {
+// Bus wide operations, and the usual flows on top of Session
+class Master
+{
+public:
+    enum class Step : uint8_t {
+        IDENTIFY,
+        OPEN,
+        ERASE,
+        WRITE,
+        VERIFY,
+        COMMIT,
+        RESET
+    };
+
+    // What went wrong, if anything
+    struct Result {
+        Step              step;
+        AcknowledgeStatus status;
+        Pacer::Metrics    metrics; // Of the session
+
+        bool
+        ok() const
+        {
+            return status == AcknowledgeStatus::OK;
+        }
+    };
+
+    struct Options {
+        bool verify = true;
+        bool reset  = true;
+    };
+
+public:
+    Master(
+        ITransport&                 transport,
+        uint8_t                     masterID,
+        const Pacer::Configuration& configuration = Pacer::Configuration()
+    );
+
+    // Slaves that announced themselves within window, by UID, with their CAN ID
+    std::map<ModuleUID, uint8_t>
+    listen(
+        Clock::duration window
+    );
+
+    // Blinks the slave, and learns its CAN ID
+    AcknowledgeStatus
+    identify(
+        ModuleUID uid,
+        uint16_t* slaveID = nullptr
+    );
+
+    std::unique_ptr<Session>
+    session(
+        ModuleUID uid,
+        uint16_t  slaveID = ANY_NODE
+    );
+
+    // identify, erase, write, verify, store the CRC and start the program
+    Result
+    flash(
+        ModuleUID                 uid,
+        const Image&              image,
+        const Options&            options,
+        const Session::Progress&  progress = Session::Progress()
+    );
+
+    // ... out of a precompiled plan
+    Result
+    flash(
+        ModuleUID                 uid,
+        const Plan&               plan,
+        const Options&            options,
+        const Session::Progress&  progress = Session::Progress()
+    );
+
+private:
+    template <typename Source>
+    Result
+    flashFrom(
+        ModuleUID                 uid,
+        const Source&             source,
+        const Options&            options,
+        const Session::Progress&  progress
+    );
+
+private:
+    ITransport&          _transport;
+    uint8_t              _masterID;
+    Pacer::Configuration _configuration;
+};
+
+const char*
+stepName(
+    Master::Step step
+);
+
+const char*
+statusName(
+    AcknowledgeStatus status
+);
+}
+}
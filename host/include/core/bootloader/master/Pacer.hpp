@@ -0,0 +1,129 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <iosfwd>
+
+#include <core/bootloader/master/Protocol.hpp>
+
+namespace bootloader {
+namespace master {
+// Paces the requests sent to one slave (AIMD)
+//
+// Acknowledges that come back close to the lowest latency seen so far widen
+// the window and shrink the gap between requests, a little at a time.
+// Losses and acknowledges delayed by the traffic of others halve the window
+// and double the gap, at most once per round trip.
+class Pacer
+{
+public:
+    using Duration = Clock::duration;
+
+    struct Configuration {
+        Duration minimumGap       = Duration::zero();
+        Duration maximumGap       = std::chrono::milliseconds(50);
+        Duration gapStep          = std::chrono::microseconds(50);  // Taken off the gap by every good acknowledge
+        unsigned maximumWindow    = 1;    // Requests in flight, more than 1 only if the slave has WINDOWING
+        double   latencyTolerance = 2.0;  // Latencies above the base one by this factor mean congestion
+        Duration latencyFloor     = std::chrono::milliseconds(1); // ... and by at least this much
+        Duration initialTimeout   = std::chrono::milliseconds(100);
+        Duration minimumTimeout   = std::chrono::milliseconds(10);
+        Duration maximumTimeout   = std::chrono::seconds(2);
+    };
+
+    enum class Decision : uint8_t {
+        NONE,
+        INCREASE,         // Good acknowledge
+        DECREASE_LATENCY, // Acknowledge late because of the traffic
+        DECREASE_LOSS     // No acknowledge
+    };
+
+    struct Metrics {
+        uint64_t sent         = 0;
+        uint64_t acknowledged = 0;
+        uint64_t lost         = 0;
+        uint64_t increases    = 0;
+        uint64_t decreases    = 0;
+        double   window       = 1.0;
+        unsigned inFlight     = 0;
+        Duration gap;
+        Duration baseLatency;
+        Duration smoothedLatency;
+        Duration latencyVariance;
+        Duration timeout;
+        Decision lastDecision = Decision::NONE;
+    };
+
+public:
+    Pacer();
+
+    Pacer(
+        const Configuration& configuration
+    );
+
+    // Limits the window, e.g. to 1 if the slave does not support WINDOWING
+    void
+    setMaximumWindow(
+        unsigned window
+    );
+
+    bool
+    canSend(
+        Clock::time_point now
+    ) const;
+
+    // When the next request may go, if the window allows it
+    Clock::time_point
+    nextSendTime() const;
+
+    void
+    onSend(
+        Clock::time_point now
+    );
+
+    // Latencies of retransmitted requests are ambiguous, they are not sampled
+    void
+    onAcknowledge(
+        Clock::time_point sentAt,
+        Clock::time_point now,
+        bool              retransmitted = false
+    );
+
+    void
+    onTimeout(
+        Clock::time_point now
+    );
+
+    // Retransmission timeout, from the latency estimate
+    Duration
+    timeout() const;
+
+    const Metrics&
+    metrics() const;
+
+private:
+    void
+    decrease(
+        Decision          why,
+        Clock::time_point now
+    );
+
+private:
+    Configuration     _configuration;
+    Metrics           _metrics;
+    Clock::time_point _lastSend;
+    Clock::time_point _holdUntil; // No further decrease before this, one per round trip
+    bool              _measured;  // At least a latency sample
+};
+
+std::ostream&
+operator<<(
+    std::ostream&           stream,
+    const Pacer::Metrics&   metrics
+);
+}
+}
@@ -0,0 +1,129 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <core/bootloader/master/Image.hpp>
+#include <core/bootloader/master/Protocol.hpp>
+
+namespace bootloader {
+namespace master {
+// A transfer plan: an image compiled offline into the write requests, ready
+// to go, for every session mode, plus the CRCs to verify it with
+//
+// Plan files are mapped, not read: sending a request is copying it out of
+// the map and setting its sequence number.
+//
+// Layout, in the byte order of the host, every table 64 bytes aligned:
+//   PlanHeader
+//   PlanTrack   [tracks]   The write requests of each session mode
+//   PlanSegment [segments] The word aligned segments of the image, for RANGE_CRC
+//   PlanPage    [pages]    The flash pages the image touches
+//   Request     [...]      The requests of each track, one after the other
+
+static const char     PLAN_MAGIC[8]    = {'B', 'L', 'P', 'L', 'A', 'N', '\r', '\n'};
+static const uint32_t PLAN_VERSION     = 1;
+static const uint32_t PLAN_TRACK_MODES = ALIGNED_LAYOUT | BINARY_WRITE; // What the requests depend on
+static const uint32_t PLAN_PAGE_SIZE   = 2048;
+
+struct PlanHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t messageLength;
+    uint32_t pageSize;
+    uint32_t imageSize;  // Bytes of the image
+    uint32_t imageCRC;   // stm32CRC of the segments, in order
+    uint32_t tracks;
+    uint32_t segments;
+    uint32_t pages;
+    uint32_t reserved;
+    uint64_t trackOffset;
+    uint64_t segmentOffset;
+    uint64_t pageOffset;
+    uint64_t fileSize;
+};
+
+struct PlanTrack {
+    uint32_t mode;  // Session mode bits, out of PLAN_TRACK_MODES
+    uint32_t count; // Requests
+    uint64_t offset;
+};
+
+struct PlanSegment {
+    uint32_t address;
+    uint32_t length;
+    uint32_t crc; // stm32CRC
+    uint32_t reserved;
+};
+
+struct PlanPage {
+    uint32_t address;
+    uint32_t crc; // stm32CRC of the whole page, erased where the image is not
+};
+
+class Plan
+{
+public:
+    ~Plan();
+
+    // Maps a plan file, nullptr if it is not a valid one
+    static std::shared_ptr<const Plan>
+    open(
+        const std::string& path
+    );
+
+    static bool
+    compile(
+        const Image&       image,
+        const std::string& path,
+        uint32_t           pageSize = PLAN_PAGE_SIZE
+    );
+
+    const PlanHeader&
+    header() const;
+
+    // The requests for a session mode, nullptr if the plan has none
+    const PlanTrack*
+    track(
+        uint32_t mode
+    ) const;
+
+    const Request*
+    requests(
+        const PlanTrack& track
+    ) const;
+
+    const PlanSegment*
+    segments() const;
+
+    const PlanPage*
+    pages() const;
+
+private:
+    Plan(
+        const uint8_t* map,
+        std::size_t    length
+    );
+
+    template <typename T>
+    const T*
+    at(
+        uint64_t offset
+    ) const
+    {
+        return reinterpret_cast<const T*>(_map + offset);
+    }
+
+private:
+    const uint8_t* _map;
+    std::size_t    _length;
+};
+}
+}
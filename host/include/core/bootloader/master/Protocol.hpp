@@ -0,0 +1,112 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+// The message definitions are shared with the firmware, without its RTOS bits
+#ifndef CORE_BOOTLOADER_HOST
+#define CORE_BOOTLOADER_HOST
+#endif
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+
+#include <core/bootloader/bootloader.hpp>
+#include <core/bootloader/bootloader_messages.hpp>
+
+namespace bootloader {
+namespace master {
+using Clock = std::chrono::steady_clock;
+
+// What goes over the bus: topic and node make the CAN ID, as rtcan does
+struct Frame {
+    uint8_t topic;
+    uint8_t node;
+    uint8_t size;
+    uint8_t data[MAXIMUM_MESSAGE_LENGTH];
+
+    template <typename MESSAGE>
+    const MESSAGE*
+    as() const
+    {
+        return (size >= sizeof(MESSAGE)) ? reinterpret_cast<const MESSAGE*>(data) : nullptr;
+    }
+}
+
+CORE_ALIGNED;
+
+static const uint16_t ANY_NODE = 0x0100; // Matches every node ID
+
+// A whole long message, whatever its type
+struct Request {
+    uint8_t data[LONG_MESSAGE_LENGTH];
+
+    Request()
+    {
+        memset(data, 0, sizeof(data));
+    }
+
+    template <typename MESSAGE>
+    Request(
+        const MESSAGE& message
+    )
+    {
+        set(message);
+    }
+
+    template <typename MESSAGE>
+    void
+    set(
+        const MESSAGE& message
+    )
+    {
+        static_assert(sizeof(MESSAGE) == LONG_MESSAGE_LENGTH, "Not a long message");
+        memcpy(data, &message, sizeof(data));
+    }
+
+    LongMessage&
+    header()
+    {
+        return *reinterpret_cast<LongMessage*>(data);
+    }
+
+    const LongMessage&
+    header() const
+    {
+        return *reinterpret_cast<const LongMessage*>(data);
+    }
+}
+
+CORE_ALIGNED;
+
+// Acknowledge of request, if frame is one. Slaves acknowledge the
+// commands outside of the sessions with their own sequence number
+inline const AcknowledgeMessage<LongMessage>*
+acknowledgeOf(
+    const Frame&   frame,
+    const Request& request,
+    bool           sequenced = true
+)
+{
+    const AcknowledgeMessage<LongMessage>* ack = reinterpret_cast<const AcknowledgeMessage<LongMessage>*>(frame.data);
+
+    if ((frame.topic != BOOTLOADER_TOPIC_ID) || (frame.size < SHORT_MESSAGE_LENGTH)) {
+        return nullptr;
+    }
+
+    if ((ack->command != MessageType::ACK) || (ack->type != request.header().command)) {
+        return nullptr;
+    }
+
+    if (sequenced && (ack->sequenceId != (uint8_t)(request.header().sequenceId + 1))) {
+        return nullptr;
+    }
+
+    return ack;
+}
+}
+}
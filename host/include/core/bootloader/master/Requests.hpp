@@ -0,0 +1,105 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <core/bootloader/master/Image.hpp>
+#include <core/bootloader/master/Protocol.hpp>
+
+namespace bootloader {
+namespace master {
+// A session request, in the legacy or in the aligned layout
+template <typename LEGACY, typename ALIGNED>
+Request
+makeRequest(
+    bool                                aligned,
+    const typename LEGACY::PayloadType& payload
+)
+{
+    if (aligned) {
+        ALIGNED m;
+        m.data = payload;
+        memset(m.padding, 0, sizeof(m.padding)); // Same payload, same request: plans are compared byte by byte
+        return Request(m);
+    } else {
+        LEGACY m;
+        m.data = payload;
+        memset(m.padding, 0, sizeof(m.padding));
+        return Request(m);
+    }
+}
+
+// The requests that write an image, in the order they must go: the
+// BINARY_WRITE chunks and the commit, or the IHEX_WRITE records between
+// BEGIN and END
+//
+// The image must be aligned to half words, and outlive this.
+class WriteRequests
+{
+public:
+    static constexpr std::size_t IHEX_RECORD_BYTES = 16;
+
+public:
+    WriteRequests(
+        const Image& image,
+        bool         aligned,
+        bool         binary
+    );
+
+    // Fills the next request, returns false when there are no more
+    bool
+    next(
+        Request& request
+    );
+
+    // Image bytes in the requests so far
+    std::size_t
+    done() const;
+
+    std::size_t
+    total() const;
+
+private:
+    enum class State : uint8_t {
+        BEGIN,
+        DATA,
+        END_OF_FILE,
+        END,
+        DONE
+    };
+
+    void
+    binaryData(
+        Request& request
+    );
+
+    void
+    ihexData(
+        Request& request
+    );
+
+private:
+    const Image&                      _image;
+    bool                              _aligned;
+    bool                              _binary;
+    State                             _state;
+    Image::Segments::const_iterator   _segment;
+    std::size_t                       _offset;
+    std::size_t                       _done;
+    uint32_t                          _base; // Upper half of the address, as the slave knows it
+};
+
+// One Intel HEX record, as IHEX_WRITE wants it
+void
+ihexRecord(
+    payload::IHex& ihex,
+    uint8_t        type,
+    uint16_t       address,
+    const uint8_t* data,
+    std::size_t    length
+);
+}
+}
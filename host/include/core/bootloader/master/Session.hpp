@@ -0,0 +1,137 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+
+#include <core/bootloader/master/Channel.hpp>
+#include <core/bootloader/master/Image.hpp>
+#include <core/bootloader/master/Plan.hpp>
+
+namespace bootloader {
+namespace master {
+// A session with one selected slave
+//
+// open() tries the aligned layout first and falls back to the legacy one
+// for slaves older than 1.2.0, the rest of the calls work with both.
+class Session
+{
+public:
+    // Bytes written so far, out of total
+    using Progress = std::function<void(std::size_t done, std::size_t total)>;
+
+    // Enabled when the slave has them
+    static const uint32_t WANTED = ALIGNED_LAYOUT | BINARY_WRITE | RANGE_CRC | ASYNC_JOBS;
+
+public:
+    Session(
+        ITransport&                 transport,
+        uint8_t                     masterID,
+        ModuleUID                   uid,
+        uint16_t                    slaveID = ANY_NODE,
+        const Pacer::Configuration& configuration = Pacer::Configuration()
+    );
+
+    ~Session();
+
+    AcknowledgeStatus
+    open(
+        bool shared = false
+    );
+
+    AcknowledgeStatus
+    close();
+
+    bool
+    isOpen() const;
+
+    // Capabilities enabled for the session
+    uint32_t
+    mode() const;
+
+    const std::string&
+    version() const;
+
+    AcknowledgeStatus
+    describe(
+        payload::DescribeV2& description
+    );
+
+    AcknowledgeStatus
+    eraseProgram();
+
+    AcknowledgeStatus
+    write(
+        const Image&    image,
+        const Progress& progress = Progress()
+    );
+
+    // Sends the requests of the plan as they are
+    AcknowledgeStatus
+    write(
+        const Plan&     plan,
+        const Progress& progress = Progress()
+    );
+
+    // Compares the flash with the image, RANGE_CRC is needed
+    AcknowledgeStatus
+    verify(
+        const Image& image
+    );
+
+    // ... with the CRCs of the plan
+    AcknowledgeStatus
+    verify(
+        const Plan& plan
+    );
+
+    AcknowledgeStatus
+    rangeCRC(
+        uint32_t  address,
+        uint32_t  length,
+        uint32_t& crc
+    );
+
+    AcknowledgeStatus
+    writeProgramCRC(
+        uint32_t crc
+    );
+
+    AcknowledgeStatus
+    reset();
+
+    Channel&
+    channel();
+
+    ModuleUID
+    uid() const;
+
+private:
+    AcknowledgeStatus
+    simple(
+        Request& request
+    );
+
+    // Polls JOB_STATUS until the job is over
+    AcknowledgeStatus
+    waitJob(
+        AcknowledgeStatus status,
+        uint32_t*         crc = nullptr
+    );
+
+private:
+    Channel     _channel;
+    uint8_t     _masterID;
+    ModuleUID   _uid;
+    bool        _open;
+    bool        _aligned;
+    uint32_t    _mode;
+    std::string _version;
+};
+}
+}
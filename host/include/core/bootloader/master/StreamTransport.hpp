@@ -0,0 +1,62 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <core/bootloader/master/Transport.hpp>
+
+namespace bootloader {
+namespace master {
+// Whole rtcan messages exchanged with a CAN gateway over a byte stream (a
+// TCP connection, a pipe or a serial line), the gateway does the
+// fragmentation. Every message is framed as
+//   CAN ID (2 bytes, big endian) | size (1 byte) | data (size bytes)
+class StreamTransport:
+    public ITransport
+{
+public:
+    // Takes ownership of the file descriptors, they can be the same
+    StreamTransport(
+        int input,
+        int output
+    );
+
+    ~StreamTransport();
+
+    // "host:port"
+    static StreamTransport*
+    connect(
+        const std::string& address
+    );
+
+    bool
+    send(
+        const Frame& frame
+    );
+
+    bool
+    receive(
+        Frame&          frame,
+        Clock::duration timeout
+    );
+
+private:
+    // A whole message out of what was read so far
+    bool
+    extract(
+        Frame& frame
+    );
+
+private:
+    int                  _input;
+    int                  _output;
+    std::vector<uint8_t> _buffer;
+};
+}
+}
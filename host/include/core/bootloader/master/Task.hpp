@@ -0,0 +1,266 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+// Coroutines need C++20, the rest of the host library builds with C++17
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <utility>
+
+namespace bootloader {
+namespace master {
+// Coroutine frames allocated by the calling thread
+struct FrameStatistics {
+    std::size_t frames    = 0; // Alive
+    std::size_t bytes     = 0; // Alive
+    std::size_t peakBytes = 0;
+    std::size_t allocated = 0; // From the heap, the others were recycled
+};
+
+const FrameStatistics&
+frameStatistics();
+
+// Frames are recycled by size class, a session allocates the same few
+// frames over and over
+void*
+allocateFrame(
+    std::size_t size
+);
+
+void
+freeFrame(
+    void*       frame,
+    std::size_t size
+);
+
+template <typename T>
+class Task;
+
+namespace detail {
+struct PromiseBase {
+    std::coroutine_handle<> continuation;
+
+    struct FinalAwaiter {
+        bool
+        await_ready() noexcept
+        {
+            return false;
+        }
+
+        // Straight back to whoever awaited the task, without growing the stack
+        template <typename PROMISE>
+        std::coroutine_handle<>
+        await_suspend(
+            std::coroutine_handle<PROMISE> handle
+        ) noexcept
+        {
+            std::coroutine_handle<> next = handle.promise().continuation;
+
+            return next ? next : std::noop_coroutine();
+        }
+
+        void
+        await_resume() noexcept {}
+    };
+
+    std::suspend_always
+    initial_suspend() noexcept
+    {
+        return {};
+    }
+
+    FinalAwaiter
+    final_suspend() noexcept
+    {
+        return {};
+    }
+
+    // Nothing in here throws
+    void
+    unhandled_exception() noexcept
+    {
+        std::terminate();
+    }
+
+    static void*
+    operator new(
+        std::size_t size
+    )
+    {
+        return allocateFrame(size);
+    }
+
+    static void
+    operator delete(
+        void*       frame,
+        std::size_t size
+    )
+    {
+        freeFrame(frame, size);
+    }
+};
+
+template <typename T>
+struct Promise:
+    public PromiseBase {
+    T value = T();
+
+    Task<T>
+    get_return_object();
+
+    void
+    return_value(
+        T v
+    )
+    {
+        value = std::move(v);
+    }
+
+    T
+    result()
+    {
+        return std::move(value);
+    }
+};
+
+template <>
+struct Promise<void>:
+    public PromiseBase {
+    Task<void>
+    get_return_object();
+
+    void
+    return_void() {}
+
+    void
+    result() {}
+};
+}
+
+// A lazy coroutine: it starts when awaited, and resumes its awaiter when over
+template <typename T = void>
+class Task
+{
+public:
+    using promise_type = detail::Promise<T>;
+    using Handle       = std::coroutine_handle<promise_type>;
+
+public:
+    Task() : _handle(nullptr) {}
+
+    explicit
+    Task(
+        Handle handle
+    ) : _handle(handle) {}
+
+    Task(
+        Task&& other
+    ) noexcept : _handle(std::exchange(other._handle, nullptr)) {}
+
+    Task&
+    operator=(
+        Task&& other
+    ) noexcept
+    {
+        if (this != &other) {
+            destroy();
+            _handle = std::exchange(other._handle, nullptr);
+        }
+
+        return *this;
+    }
+
+    Task(
+        const Task&
+    ) = delete;
+
+    Task&
+    operator=(
+        const Task&
+    ) = delete;
+
+    ~Task()
+    {
+        destroy();
+    }
+
+    bool
+    done() const
+    {
+        return !_handle || _handle.done();
+    }
+
+    Handle
+    handle() const
+    {
+        return _handle;
+    }
+
+    auto operator co_await() && noexcept
+    {
+        struct Awaiter {
+            Handle handle;
+
+            bool
+            await_ready() noexcept
+            {
+                return !handle || handle.done();
+            }
+
+            std::coroutine_handle<>
+            await_suspend(
+                std::coroutine_handle<> awaiting
+            ) noexcept
+            {
+                handle.promise().continuation = awaiting;
+                return handle;
+            }
+
+            T
+            await_resume()
+            {
+                return handle.promise().result();
+            }
+        };
+
+        return Awaiter {
+                   _handle
+        };
+    }
+
+private:
+    void
+    destroy()
+    {
+        if (_handle) {
+            _handle.destroy();
+            _handle = nullptr;
+        }
+    }
+
+private:
+    Handle _handle;
+};
+
+namespace detail {
+template <typename T>
+inline Task<T>
+Promise<T>::get_return_object()
+{
+    return Task<T>(std::coroutine_handle<Promise<T> >::from_promise(*this));
+}
+
+inline Task<void>
+Promise<void>::get_return_object()
+{
+    return Task<void>(std::coroutine_handle<Promise<void> >::from_promise(*this));
+}
+}
+}
+}
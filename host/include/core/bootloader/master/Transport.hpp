@@ -0,0 +1,34 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <core/bootloader/master/Protocol.hpp>
+
+namespace bootloader {
+namespace master {
+// What the master needs from the bus: whole messages, the fragmentation is
+// up to the implementation
+class ITransport
+{
+public:
+    virtual
+    ~ITransport() {}
+
+    virtual bool
+    send(
+        const Frame& frame
+    ) = 0;
+
+    // Returns false if nothing arrived within timeout
+    virtual bool
+    receive(
+        Frame&          frame,
+        Clock::duration timeout
+    ) = 0;
+};
+}
+}
@@ -0,0 +1,132 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace bootloader {
+namespace port {
+// The flash of an STM32, for the host build of the bootloader
+//
+// The firmware reads the flash at its addresses, so the emulated one is
+// mapped where the real one is, read only: only program() and erasePage()
+// change it, as only the flash interface does. Both take the time the part
+// would take, added to statistics().busy instead of spent: the caller decides
+// what that time means (a stalled CPU, in the bus simulator).
+//
+// As the part does, programming fails if the location is not erased: the
+// STM32F0, F1 and F3 allow zeros over anything, the parts with ECC do not.
+// And the flash interface is locked out of reset: programming and erasing
+// fail until unlock(), and again after lock().
+// There is one in each process, at most.
+class EmulatedFlash
+{
+public:
+    using Duration = std::chrono::nanoseconds;
+
+    // Defaults of an STM32F091: 256 KiB, 2 KiB pages, half words
+    struct Configuration {
+        uint32_t address       = 0x08000000;
+        uint32_t size          = 256 * 1024;
+        uint32_t pageSize      = 2048; // Must be HW_FLASH_PAGE_SIZE of the firmware
+        uint32_t programUnit   = 2;    // Bytes programmed at once: 2, 4 or 8
+        Duration programTime   = std::chrono::nanoseconds(53500); // Of a unit
+        Duration eraseTime     = std::chrono::milliseconds(30);   // Of a page
+        bool     zeroOverwrite = true; // Zeros can be programmed over anything
+    };
+
+    struct Statistics {
+        uint64_t programmed = 0; // Units
+        uint64_t erased     = 0; // Pages
+        uint64_t refused    = 0; // Programs of locations not erased
+        uint64_t locked     = 0; // Programs and erases while locked
+        Duration busy       = Duration::zero();
+    };
+
+public:
+    // Maps the flash, erased, or with the content of the file at path if
+    // there is one: the flash is kept there, across resets and runs.
+    // nullptr if the address is taken, or there is already one
+    static std::unique_ptr<EmulatedFlash>
+    create(
+        const Configuration& configuration,
+        const std::string&   path = std::string()
+    );
+
+    ~EmulatedFlash();
+
+    // The one of this process, nullptr if there is none
+    static EmulatedFlash*
+    instance();
+
+    const Configuration&
+    configuration() const;
+
+    bool
+    contains(
+        uint32_t    address,
+        std::size_t length = 1
+    ) const;
+
+    const uint8_t*
+    data(
+        uint32_t address
+    ) const;
+
+    bool
+    isErased(
+        uint32_t    address,
+        std::size_t length
+    ) const;
+
+    // length and address in whole units
+    bool
+    program(
+        uint32_t    address,
+        const void* data,
+        std::size_t length
+    );
+
+    bool
+    erasePage(
+        uint32_t address
+    );
+
+    void
+    unlock();
+
+    void
+    lock();
+
+    bool
+    isLocked() const;
+
+    const Statistics&
+    statistics() const;
+
+    void
+    resetStatistics();
+
+private:
+    EmulatedFlash(
+        const Configuration& configuration
+    );
+
+private:
+    Configuration _configuration;
+    Statistics    _statistics;
+    int           _file;
+    uint8_t*      _flash;  // At the address, read only
+    uint8_t*      _writer; // The same, writable
+    bool          _locked;
+};
+}
+}
@@ -0,0 +1,204 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <hal.h>
+#include <core/bootloader/hw/hw_utils.hpp>
+
+#include <cstdint>
+
+namespace bootloader {
+namespace port {
+// Virtual time, from the beginning of the simulation [ns]
+using Time = uint64_t;
+
+static const Time NEVER = UINT64_MAX;
+
+// What the CAN controller sends and receives: an extended frame
+struct CanFrame {
+    uint32_t id; // 29 bits
+    uint8_t  length;
+    uint8_t  data[8];
+};
+
+// The simulator drives a node one event at a time, over a SOCK_SEQPACKET
+// socket. The node answers with the actions it takes, the last one WAIT
+// (it has nothing to do until the next event) or one that ends it: RESET,
+// BOOT or HALT.
+struct NodeEvent {
+    enum Type : uint8_t {
+        FRAME, // Received
+        SENT,  // The frame of the last TRANSMIT made it
+        LOST,  // The frame of the last TRANSMIT was still there at its deadline
+        TIMER  // The WAIT timed out
+    };
+
+    Type     type;
+    Time     time;
+    CanFrame frame;
+};
+
+struct NodeAction {
+    enum Type : uint8_t {
+        WAIT,
+        TRANSMIT,
+        WATCHDOG, // The watchdog was enabled
+        NVR,
+        RESET,
+        BOOT, // hw::jumptoapp(), the application is not simulated
+        HALT
+    };
+
+    Type     type;
+    Time     time;     // Of the node, when it did it
+    Time     until;    // WAIT: wakes up then, TRANSMIT: deadline, WATCHDOG: bites then
+    Time     watchdog; // WAIT: the watchdog bites then, if not reloaded before
+    uint32_t value;    // NVR: the new value, RESET: the hw::ResetSource
+    CanFrame frame;    // TRANSMIT
+};
+
+// A slave, for the host build of the bootloader: what the kernel, rtcan and
+// hw do on the part they do here, on a socket to the bus simulator.
+//
+// A node is a process: the firmware has its statics, its flash at a fixed
+// address, and a reset is the end of the process. The flash must have been
+// created (EmulatedFlash::create) before run().
+//
+// The node time advances with the events, and with the time the flash
+// operations take: the CPU is stalled meanwhile, as on the part. A loop that
+// never waits, as the while (1) {} that waits for the watchdog, is caught
+// on the CPU time of the process: the watchdog bites, if it is enabled.
+class Node
+{
+public:
+    struct Configuration {
+        int             socket;
+        hw::UID         uid;
+        hw::ResetSource resetSource;
+        uint32_t        nvr;
+        Time            time; // Of the reset
+    };
+
+public:
+    // Runs the bootloader thread, until the node resets, boots or halts
+    [[noreturn]] static void
+    run(
+        const Configuration& configuration
+    );
+
+    static Node&
+    instance();
+
+    const Configuration&
+    configuration() const;
+
+    Time
+    now();
+
+    // Serves the events until resume(reference) or until, MSG_TIMEOUT then.
+    // The events before now are served anyway: the interrupts run.
+    msg_t
+    suspend(
+        thread_reference_t* reference,
+        Time                until
+    );
+
+    void
+    resume(
+        thread_reference_t* reference,
+        msg_t               message
+    );
+
+    // The CAN controller sends frame, unless deadline passes first
+    void
+    transmit(
+        const CanFrame& frame,
+        Time            deadline
+    );
+
+    uint32_t
+    nvr() const;
+
+    void
+    setNVR(
+        uint32_t value
+    );
+
+    void
+    enableWatchdog(
+        Time period
+    );
+
+    void
+    reloadWatchdog();
+
+    [[noreturn]] void
+    reset(
+        hw::ResetSource source
+    );
+
+    [[noreturn]] void
+    boot();
+
+    [[noreturn]] void
+    halt(
+        const char* reason
+    );
+
+private:
+    Node(
+        const Configuration& configuration
+    );
+
+    void
+    send(
+        const NodeAction& action
+    );
+
+    [[noreturn]] void
+    end(
+        const NodeAction& action
+    );
+
+    void
+    checkWatchdog();
+
+    static void
+    thread();
+
+    static void
+    watch(
+        int signal
+    );
+
+private:
+    Configuration _configuration;
+    Time          _now;
+    Time          _busy; // Of the flash, already in _now
+    Time          _watchdogPeriod;
+    Time          _watchdog;
+    bool          _resumed;
+    msg_t         _message;
+
+    volatile uint64_t _sent; // Actions
+    uint64_t          _watched;
+
+    static Node* _instance;
+};
+
+// The interrupts of the CAN controller, in the host rtcan
+void
+canReceived(
+    const CanFrame& frame
+);
+
+void
+canSent(
+    bool success
+);
+}
+}
@@ -0,0 +1,43 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+// Host build: the CRC unit, with bootloader::master::stm32CRC
+
+#include <stdint.h>
+#include <cstddef>
+
+namespace core {
+namespace stm32_crc {
+class CRC
+{
+public:
+    // Only POLY_32, the default of the unit, is emulated
+    enum class PolynomialSize {
+        POLY_7, POLY_8, POLY_16, POLY_32
+    };
+
+    static void
+    init();
+
+    static void
+    setPolynomialSize(
+        PolynomialSize size
+    );
+
+    static void
+    reset();
+
+    // After a reset
+    static uint32_t
+    CRCBlock(
+        const uint32_t* data,
+        std::size_t     words
+    );
+};
+}
+}
@@ -0,0 +1,154 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <core/stm32_flash/FlashSegment.hpp>
+
+namespace core {
+namespace stm32_flash {
+// Two banks of the same size: the configuration is in one of them, changes
+// go to the other one
+class Storage
+{
+public:
+    Storage(
+        FlashSegment& bank1,
+        FlashSegment& bank2
+    );
+
+    FlashSegment&
+    bank(
+        std::size_t index
+    );
+
+    uint32_t
+    bankSize() const;
+
+private:
+    FlashSegment& _bank1;
+    FlashSegment& _bank2;
+};
+
+struct ModuleConfiguration {
+    uint32_t imageCRC;
+    uint8_t  canID;
+    char     name[16];
+};
+
+// The module configuration, followed by the user configuration, in the
+// bank that has the last valid header
+//
+// Changing the module configuration writes it, and the user configuration,
+// to the other bank. The user configuration is written where it is, after
+// eraseUserConfiguration(); its addresses are offsets in it.
+class ConfigurationStorage
+{
+public:
+    // What a module without configuration has
+    static const ModuleConfiguration DEFAULT;
+
+public:
+    ConfigurationStorage(
+        Storage& storage
+    );
+
+    bool
+    isValid() const;
+
+    bool
+    isUserAddressValid(
+        uint32_t address
+    ) const;
+
+    uint32_t
+    userDataSize() const;
+
+    const ModuleConfiguration*
+    getModuleConfiguration() const;
+
+    const void*
+    getUserConfiguration() const;
+
+    bool
+    unlock();
+
+    // Both banks
+    bool
+    erase();
+
+    bool
+    eraseUserConfiguration();
+
+    bool
+    writeProgramCRC(
+        uint32_t crc
+    );
+
+    bool
+    writeModuleName(
+        const char* name
+    );
+
+    bool
+    writeCanID(
+        uint8_t id
+    );
+
+    // A write of the user configuration is in progress
+    bool
+    isReady() const;
+
+    bool
+    beginWrite();
+
+    bool
+    writeUserData16(
+        uint32_t address,
+        uint16_t data
+    );
+
+    bool
+    endWrite();
+
+private:
+    struct Header {
+        uint32_t            magic;
+        uint32_t            sequence; // The highest one is the current bank
+        ModuleConfiguration module;
+        uint32_t            crc;      // Of the above
+    };
+
+    static const uint32_t MAGIC       = 0xC0F16B00;
+    static const uint32_t USER_OFFSET = 64; // After the header
+
+    // The bank with the configuration, nullptr if there is none
+    FlashSegment*
+    current() const;
+
+    const Header*
+    header(
+        FlashSegment& bank
+    ) const;
+
+    bool
+    isValid(
+        const Header* header
+    ) const;
+
+    // Writes module to the other bank, with the user configuration if keepUser
+    bool
+    rewrite(
+        const ModuleConfiguration& module,
+        bool                       keepUser
+    );
+
+private:
+    Storage& _storage;
+    bool     _writing;
+};
+}
+}
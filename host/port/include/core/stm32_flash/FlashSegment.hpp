@@ -0,0 +1,81 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+// Host build: the flash of the STM32F091 the firmware runs on, over
+// bootloader::port::EmulatedFlash
+
+#include <stdint.h>
+#include <cstddef>
+
+namespace core {
+namespace stm32_flash {
+static const uint32_t FLASH_FROM = 0x08000000;
+static const uint32_t FLASH_TO   = 0x08040000;
+
+static const uint32_t TAGS_FLASH_FROM = 0x08003F00; // At the end of the bootloader
+static const uint32_t TAGS_FLASH_SIZE = 0x100;
+
+static const uint32_t PROGRAM_FLASH_FROM = 0x08004000;
+static const uint32_t PROGRAM_FLASH_TO   = 0x0803E000;
+static const uint32_t PROGRAM_JUMP       = PROGRAM_FLASH_FROM;
+
+static const uint32_t CONFIGURATION1_FLASH_FROM = 0x0803E000;
+static const uint32_t CONFIGURATION1_FLASH_TO   = 0x0803F000;
+static const uint32_t CONFIGURATION2_FLASH_FROM = 0x0803F000;
+static const uint32_t CONFIGURATION2_FLASH_TO   = 0x08040000;
+
+// A range of whole pages
+class FlashSegment
+{
+public:
+    FlashSegment(
+        uint32_t from,
+        uint32_t to
+    );
+
+    uint32_t
+    from() const;
+
+    uint32_t
+    to() const;
+
+    uint32_t
+    size() const;
+
+    bool
+    isAddressValid(
+        uint32_t address
+    ) const;
+
+    bool
+    isErased() const;
+
+    // Erases the pages that are not erased already
+    bool
+    erase();
+
+    bool
+    write16(
+        uint32_t address,
+        uint16_t data
+    );
+
+    // In the program units of the part
+    bool
+    write(
+        uint32_t    address,
+        const void* data,
+        std::size_t length
+    );
+
+private:
+    uint32_t _from;
+    uint32_t _to;
+};
+}
+}
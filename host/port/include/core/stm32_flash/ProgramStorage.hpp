@@ -0,0 +1,61 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <core/stm32_flash/FlashSegment.hpp>
+
+namespace core {
+namespace stm32_flash {
+// The program flash, written between beginWrite() and endWrite()
+class ProgramStorage
+{
+public:
+    ProgramStorage(
+        FlashSegment& segment
+    );
+
+    bool
+    isAddressValid(
+        uint32_t address
+    ) const;
+
+    bool
+    unlock();
+
+    bool
+    erase();
+
+    // A write is in progress
+    bool
+    isReady() const;
+
+    bool
+    beginWrite();
+
+    bool
+    write16(
+        uint32_t address,
+        uint16_t data
+    );
+
+    bool
+    endWrite();
+
+    // The CRC of the whole segment, as the CRC unit computes it
+    uint32_t
+    updateCRC();
+
+    uint32_t
+    size() const;
+
+private:
+    FlashSegment& _segment;
+    bool          _writing;
+    uint32_t      _crc;
+};
+}
+}
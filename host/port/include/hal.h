@@ -0,0 +1,22 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+// Host build: the HAL of a board with an STM32F091, the part the emulated
+// flash has the geometry of. The LED is not there.
+
+#if !defined(STM32F091xC) && !defined(STM32F072xB) && !defined(STM32F303xC) && !defined(STM32F303x8)
+#define STM32F091xC
+#endif
+
+#include <osal.h>
+
+#define LED_GPIO 0
+#define LED_PIN  0
+
+#define palSetPad(port, pad)   ((void)(port), (void)(pad))
+#define palClearPad(port, pad) ((void)(port), (void)(pad))
@@ -0,0 +1,72 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+// Host build: the part of the ChibiOS/NIL API the bootloader uses. There is
+// one thread, the bootloader one, and the time is the one of the simulated
+// bus: see bootloader::port::Node.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CH_CFG_ST_FREQUENCY 10000
+
+typedef uint32_t systime_t;
+typedef int32_t  msg_t;
+typedef void*    thread_reference_t;
+typedef uint64_t stkalign_t;
+
+#define MSG_OK      ((msg_t)0)
+#define MSG_TIMEOUT ((msg_t)-1)
+#define MSG_RESET   ((msg_t)-2)
+
+#define TIME_IMMEDIATE ((systime_t)0)
+#define TIME_INFINITE  ((systime_t)-1)
+
+#define S2ST(sec)   ((systime_t)((uint32_t)(sec) * (uint32_t)CH_CFG_ST_FREQUENCY))
+#define MS2ST(msec) ((systime_t)(((uint32_t)(msec) * (uint32_t)CH_CFG_ST_FREQUENCY + 999UL) / 1000UL))
+#define US2ST(usec) ((systime_t)(((uint32_t)(usec) * (uint32_t)CH_CFG_ST_FREQUENCY + 999999UL) / 1000000UL))
+
+#define THD_WORKING_AREA_SIZE(n)  ((((n) + sizeof(stkalign_t) - 1) / sizeof(stkalign_t)) * sizeof(stkalign_t))
+#define THD_WORKING_AREA(s, n)    stkalign_t s[THD_WORKING_AREA_SIZE(n) / sizeof(stkalign_t)]
+#define THD_FUNCTION(tname, arg)  void tname(void* arg)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void
+chSysLock(
+    void
+);
+
+void
+chSysUnlock(
+    void
+);
+
+void
+chSysHalt(
+    const char* reason
+);
+
+systime_t
+chVTGetSystemTimeX(
+    void
+);
+
+void
+chThdSleep(
+    systime_t time
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define chThdSleepMilliseconds(msec) chThdSleep(MS2ST(msec))
+#define chThdSleepMicroseconds(usec) chThdSleep(US2ST(usec))
@@ -0,0 +1,56 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+// Host build: the OSAL of the HAL, on the host NIL
+
+#include <nil.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void
+osalSysLock(
+    void
+);
+
+void
+osalSysUnlock(
+    void
+);
+
+void
+osalSysHalt(
+    const char* reason
+);
+
+// The caller goes to sleep until osalThreadResumeI(trp) or the timeout, MSG_TIMEOUT then
+msg_t
+osalThreadSuspendTimeoutS(
+    thread_reference_t* trp,
+    systime_t           timeout
+);
+
+// Wakes the thread suspended on trp, if there is one
+void
+osalThreadResumeI(
+    thread_reference_t* trp,
+    msg_t               msg
+);
+
+void
+osalThreadSleep(
+    systime_t time
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define osalThreadSleepMilliseconds(msec) osalThreadSleep(MS2ST(msec))
+#define osalThreadSleepMicroseconds(usec) osalThreadSleep(US2ST(usec))
@@ -0,0 +1,111 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+// Host build: rtcan, on the simulated bus of bootloader::port::Node
+//
+// As rtcan does, a message goes in 8 byte frames, identified by the
+// message ID and a fragment counter that goes down to 0 on the last one:
+// (id << 7) | fragment. Messages are sent one at a time, in deadline order.
+
+#include <nil.h>
+
+typedef uint16_t rtcan_id_t;
+
+typedef enum {
+    RTCAN_MSG_UNINIT,
+    RTCAN_MSG_READY,
+    RTCAN_MSG_BUSY,
+    RTCAN_MSG_QUEUED,
+    RTCAN_MSG_ONAIR,
+    RTCAN_MSG_TIMEOUT,
+    RTCAN_MSG_ERROR
+} rtcan_msgstatus_t;
+
+typedef void (* rtcan_msgcallback_t)(
+    void* msg
+);
+
+typedef struct rtcan_msg_t {
+    struct rtcan_msg_t* next;
+    rtcan_msgcallback_t callback; // Called with the message, once sent or received
+    void*               params;
+    rtcan_msgstatus_t   status;
+    rtcan_id_t          id;
+    uint16_t            size;
+    uint8_t*            data;
+    const uint8_t*      ptr;      // Next byte to send
+    uint8_t             fragment; // Of the next frame
+    void*               rx_isr;
+} rtcan_msg_t;
+
+typedef struct {
+    uint32_t baudrate; // [bit/s]
+    uint32_t clock;    // Of the time slots [Hz]
+    uint32_t slots;
+} RTCANConfig;
+
+typedef enum {
+    RTCAN_UNINIT,
+    RTCAN_STOP,
+    RTCAN_READY,
+    RTCAN_ERROR
+} rtcanstate_t;
+
+typedef struct {
+    rtcanstate_t       state;
+    const RTCANConfig* config;
+} RTCANDriver;
+
+extern RTCANDriver RTCAND1;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void
+rtcanInit(
+    void
+);
+
+void
+rtcanStart(
+    RTCANDriver*       rtcanp,
+    const RTCANConfig* config
+);
+
+void
+rtcanStop(
+    RTCANDriver* rtcanp
+);
+
+// Queues msg, that must be sent within timeout
+void
+rtcanTransmit(
+    RTCANDriver* rtcanp,
+    rtcan_msg_t* msg,
+    systime_t    timeout
+);
+
+// msg gets the messages with its ID, at most its size long
+void
+rtcanReceive(
+    RTCANDriver* rtcanp,
+    rtcan_msg_t* msg
+);
+
+// msg gets the messages whose ID matches its one under mask
+void
+rtcanReceiveMask(
+    RTCANDriver* rtcanp,
+    rtcan_msg_t* msg,
+    uint32_t     mask
+);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,13 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+// Host build: there is no CAN peripheral, rtcanStop() does it all
+
+#include <rtcan.h>
+
+#define rtcan_lld_can_force_stop(rtcanp) rtcanStop(rtcanp)
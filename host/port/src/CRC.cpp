@@ -0,0 +1,37 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#include <core/stm32_crc/CRC.hpp>
+#include <core/bootloader/master/CRC.hpp>
+
+namespace core {
+namespace stm32_crc {
+void
+CRC::init()
+{}
+
+void
+CRC::setPolynomialSize(
+    PolynomialSize size
+)
+{
+    (void)size;
+}
+
+void
+CRC::reset()
+{}
+
+uint32_t
+CRC::CRCBlock(
+    const uint32_t* data,
+    std::size_t     words
+)
+{
+    return bootloader::master::stm32CRCBlock(data, words);
+}
+}
+}
@@ -0,0 +1,304 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#include <core/stm32_flash/ConfigurationStorage.hpp>
+#include <core/bootloader/master/CRC.hpp>
+#include <core/bootloader/port/EmulatedFlash.hpp>
+
+#include <cstddef>
+#include <cstring>
+
+using bootloader::port::EmulatedFlash;
+
+namespace core {
+namespace stm32_flash {
+Storage::Storage(
+    FlashSegment& bank1,
+    FlashSegment& bank2
+) :
+    _bank1(bank1),
+    _bank2(bank2)
+{}
+
+FlashSegment&
+Storage::bank(
+    std::size_t index
+)
+{
+    return (index == 0) ? _bank1 : _bank2;
+}
+
+uint32_t
+Storage::bankSize() const
+{
+    return _bank1.size();
+}
+
+const ModuleConfiguration ConfigurationStorage::DEFAULT = {
+    0xFFFFFFFF, 0xFF, "*"
+};
+
+ConfigurationStorage::ConfigurationStorage(
+    Storage& storage
+) :
+    _storage(storage),
+    _writing(false)
+{}
+
+const ConfigurationStorage::Header*
+ConfigurationStorage::header(
+    FlashSegment& bank
+) const
+{
+    return reinterpret_cast<const Header*>(static_cast<uintptr_t>(bank.from()));
+}
+
+bool
+ConfigurationStorage::isValid(
+    const Header* header
+) const
+{
+    if (header->magic != MAGIC) {
+        return false;
+    }
+
+    return bootloader::master::stm32CRC(bootloader::master::STM32_CRC_INITIAL, reinterpret_cast<const uint8_t*>(header), offsetof(Header, crc)) == header->crc;
+}
+
+FlashSegment*
+ConfigurationStorage::current() const
+{
+    FlashSegment* bank1 = &_storage.bank(0);
+    FlashSegment* bank2 = &_storage.bank(1);
+    bool          valid1 = isValid(header(*bank1));
+    bool          valid2 = isValid(header(*bank2));
+
+    if (valid1 && valid2) {
+        return (header(*bank2)->sequence > header(*bank1)->sequence) ? bank2 : bank1;
+    }
+
+    return valid1 ? bank1 : (valid2 ? bank2 : nullptr);
+}
+
+bool
+ConfigurationStorage::isValid() const
+{
+    return current() != nullptr;
+}
+
+bool
+ConfigurationStorage::isUserAddressValid(
+    uint32_t address
+) const
+{
+    return address < userDataSize();
+}
+
+uint32_t
+ConfigurationStorage::userDataSize() const
+{
+    return _storage.bankSize() - USER_OFFSET;
+}
+
+const ModuleConfiguration*
+ConfigurationStorage::getModuleConfiguration() const
+{
+    FlashSegment* bank = current();
+
+    return (bank != nullptr) ? &header(*bank)->module : &DEFAULT;
+}
+
+const void*
+ConfigurationStorage::getUserConfiguration() const
+{
+    FlashSegment* bank = current();
+
+    if (bank == nullptr) {
+        bank = &_storage.bank(0);
+    }
+
+    return reinterpret_cast<const void*>(static_cast<uintptr_t>(bank->from() + USER_OFFSET));
+}
+
+bool
+ConfigurationStorage::unlock()
+{
+    EmulatedFlash* flash = EmulatedFlash::instance();
+
+    if (flash == nullptr) {
+        return false;
+    }
+
+    flash->unlock();
+
+    return true;
+}
+
+bool
+ConfigurationStorage::erase()
+{
+    bool success = true;
+
+    success &= _storage.bank(0).erase();
+    success &= _storage.bank(1).erase();
+
+    return success;
+}
+
+bool
+ConfigurationStorage::rewrite(
+    const ModuleConfiguration& module,
+    bool                       keepUser
+)
+{
+    EmulatedFlash* flash = EmulatedFlash::instance();
+    FlashSegment*  from  = current();
+    FlashSegment&  to    = (from == &_storage.bank(0)) ? _storage.bank(1) : _storage.bank(0);
+
+    if (flash == nullptr) {
+        return false;
+    }
+
+    // A whole rewrite unlocks the flash itself, and leaves it as it was
+    bool locked = flash->isLocked();
+
+    flash->unlock();
+
+    if (!to.erase()) {
+        if (locked) {
+            flash->lock();
+        }
+
+        return false;
+    }
+
+    const uint32_t unit    = flash->configuration().programUnit;
+    bool           success = true;
+
+    if (keepUser && (from != nullptr)) {
+        // What is still erased needs no programming
+        for (uint32_t offset = USER_OFFSET; offset < to.size(); offset += unit) {
+            if (!flash->isErased(from->from() + offset, unit)) {
+                success &= to.write(to.from() + offset, flash->data(from->from() + offset), unit);
+            }
+        }
+    }
+
+    // The header goes last: until it is there, the configuration is the previous one
+    uint8_t buffer[(sizeof(Header) + 7) & ~7];
+    Header  h;
+
+    memset(&h, 0, sizeof(h));
+    h.magic    = MAGIC;
+    h.sequence = (from != nullptr) ? header(*from)->sequence + 1 : 1;
+    h.module   = module;
+    h.crc      = bootloader::master::stm32CRC(bootloader::master::STM32_CRC_INITIAL, reinterpret_cast<const uint8_t*>(&h), offsetof(Header, crc));
+
+    memset(buffer, 0xFF, sizeof(buffer));
+    memcpy(buffer, &h, sizeof(h));
+
+    success &= to.write(to.from(), buffer, (sizeof(Header) + unit - 1) / unit * unit);
+
+    if (locked) {
+        flash->lock();
+    }
+
+    return success;
+} // ConfigurationStorage::rewrite
+
+bool
+ConfigurationStorage::eraseUserConfiguration()
+{
+    return rewrite(*getModuleConfiguration(), false);
+}
+
+bool
+ConfigurationStorage::writeProgramCRC(
+    uint32_t crc
+)
+{
+    ModuleConfiguration module = *getModuleConfiguration();
+
+    module.imageCRC = crc;
+
+    return rewrite(module, true);
+}
+
+bool
+ConfigurationStorage::writeModuleName(
+    const char* name
+)
+{
+    ModuleConfiguration module = *getModuleConfiguration();
+
+    memset(module.name, 0, sizeof(module.name));
+    memcpy(module.name, name, strnlen(name, sizeof(module.name)));
+
+    return rewrite(module, true);
+}
+
+bool
+ConfigurationStorage::writeCanID(
+    uint8_t id
+)
+{
+    ModuleConfiguration module = *getModuleConfiguration();
+
+    module.canID = id;
+
+    return rewrite(module, true);
+}
+
+bool
+ConfigurationStorage::isReady() const
+{
+    return _writing;
+}
+
+bool
+ConfigurationStorage::beginWrite()
+{
+    _writing = true;
+
+    return true;
+}
+
+bool
+ConfigurationStorage::writeUserData16(
+    uint32_t address,
+    uint16_t data
+)
+{
+    if (!_writing || !isUserAddressValid(address)) {
+        return false;
+    }
+
+    if ((current() == nullptr) && !rewrite(DEFAULT, false)) {
+        return false;
+    }
+
+    FlashSegment* bank = current();
+
+    return bank->write16(bank->from() + USER_OFFSET + address, data);
+}
+
+bool
+ConfigurationStorage::endWrite()
+{
+    EmulatedFlash* flash      = EmulatedFlash::instance();
+    bool           wasWriting = _writing;
+
+    // As the library does, the flash is locked again
+    if (flash != nullptr) {
+        flash->lock();
+    }
+
+    _writing = false;
+
+    return wasWriting;
+}
+}
+}
@@ -0,0 +1,270 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#include <core/bootloader/port/EmulatedFlash.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+namespace bootloader {
+namespace port {
+static EmulatedFlash* _instance = nullptr;
+
+static bool
+isPowerOfTwo(
+    uint32_t x
+)
+{
+    return (x != 0) && ((x & (x - 1)) == 0);
+}
+
+EmulatedFlash::EmulatedFlash(
+    const Configuration& configuration
+) :
+    _configuration(configuration),
+    _file(-1),
+    _flash(nullptr),
+    _writer(nullptr),
+    _locked(true)
+{}
+
+EmulatedFlash::~EmulatedFlash()
+{
+    if (_flash != nullptr) {
+        munmap(_flash, _configuration.size);
+    }
+
+    if (_writer != nullptr) {
+        munmap(_writer, _configuration.size);
+    }
+
+    if (_file >= 0) {
+        close(_file);
+    }
+
+    if (_instance == this) {
+        _instance = nullptr;
+    }
+}
+
+std::unique_ptr<EmulatedFlash>
+EmulatedFlash::create(
+    const Configuration& configuration,
+    const std::string&   path
+)
+{
+    const Configuration& c = configuration;
+
+    if ((_instance != nullptr) || !isPowerOfTwo(c.pageSize) || ((c.programUnit != 2) && (c.programUnit != 4) && (c.programUnit != 8))) {
+        return nullptr;
+    }
+
+    if ((c.size == 0) || ((c.address % c.pageSize) != 0) || ((c.size % c.pageSize) != 0) || ((c.size % static_cast<uint32_t>(sysconf(_SC_PAGESIZE))) != 0)) {
+        return nullptr;
+    }
+
+    std::unique_ptr<EmulatedFlash> flash(new EmulatedFlash(configuration));
+    off_t existing = 0;
+
+    if (path.empty()) {
+        flash->_file = memfd_create("flash", 0);
+    } else {
+        struct stat s;
+
+        flash->_file = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        existing     = ((flash->_file >= 0) && (fstat(flash->_file, &s) == 0)) ? s.st_size : 0;
+    }
+
+    if ((flash->_file < 0) || (ftruncate(flash->_file, std::max<off_t>(existing, c.size)) != 0)) {
+        return nullptr;
+    }
+
+    void* writer = mmap(nullptr, c.size, PROT_READ | PROT_WRITE, MAP_SHARED, flash->_file, 0);
+
+    if (writer == MAP_FAILED) {
+        return nullptr;
+    }
+
+    flash->_writer = static_cast<uint8_t*>(writer);
+
+    // What was not there before is erased
+    if (existing < c.size) {
+        memset(flash->_writer + existing, 0xFF, c.size - existing);
+    }
+
+    void* requested = reinterpret_cast<void*>(static_cast<uintptr_t>(c.address));
+    void* map       = mmap(requested, c.size, PROT_READ, MAP_SHARED | MAP_FIXED_NOREPLACE, flash->_file, 0);
+
+    if (map == MAP_FAILED) {
+        return nullptr;
+    }
+
+    if (map != requested) {
+        // The kernel took it as a hint: something else is there
+        munmap(map, c.size);
+        return nullptr;
+    }
+
+    flash->_flash = static_cast<uint8_t*>(map);
+    _instance     = flash.get();
+
+    return flash;
+} // EmulatedFlash::create
+
+EmulatedFlash*
+EmulatedFlash::instance()
+{
+    return _instance;
+}
+
+const EmulatedFlash::Configuration&
+EmulatedFlash::configuration() const
+{
+    return _configuration;
+}
+
+bool
+EmulatedFlash::contains(
+    uint32_t    address,
+    std::size_t length
+) const
+{
+    return (address >= _configuration.address) && (length <= _configuration.size)
+           && (address - _configuration.address <= _configuration.size - length);
+}
+
+const uint8_t*
+EmulatedFlash::data(
+    uint32_t address
+) const
+{
+    return contains(address) ? _flash + (address - _configuration.address) : nullptr;
+}
+
+bool
+EmulatedFlash::isErased(
+    uint32_t    address,
+    std::size_t length
+) const
+{
+    if (!contains(address, length)) {
+        return false;
+    }
+
+    const uint8_t* p = _flash + (address - _configuration.address);
+
+    for (std::size_t i = 0; i < length; i++) {
+        if (p[i] != 0xFF) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool
+EmulatedFlash::program(
+    uint32_t    address,
+    const void* data,
+    std::size_t length
+)
+{
+    const uint32_t unit = _configuration.programUnit;
+    const uint8_t* from = static_cast<const uint8_t*>(data);
+
+    if (((address % unit) != 0) || ((length % unit) != 0) || !contains(address, length)) {
+        return false;
+    }
+
+    if (_locked) {
+        _statistics.locked++;
+        return false;
+    }
+
+    for (std::size_t i = 0; i < length; i += unit) {
+        uint8_t* to   = _writer + (address - _configuration.address) + i;
+        bool     zero = true;
+
+        for (uint32_t j = 0; j < unit; j++) {
+            zero &= (from[i + j] == 0x00);
+        }
+
+        // The part stops at the first unit it refuses, the ones before stay programmed
+        if (!isErased(address + i, unit) && !(zero && _configuration.zeroOverwrite)) {
+            _statistics.refused++;
+            return false;
+        }
+
+        memcpy(to, from + i, unit);
+
+        _statistics.programmed++;
+        _statistics.busy += _configuration.programTime;
+    }
+
+    return true;
+} // EmulatedFlash::program
+
+bool
+EmulatedFlash::erasePage(
+    uint32_t address
+)
+{
+    if (((address % _configuration.pageSize) != 0) || !contains(address, _configuration.pageSize)) {
+        return false;
+    }
+
+    if (_locked) {
+        _statistics.locked++;
+        return false;
+    }
+
+    memset(_writer + (address - _configuration.address), 0xFF, _configuration.pageSize);
+
+    _statistics.erased++;
+    _statistics.busy += _configuration.eraseTime;
+
+    return true;
+}
+
+void
+EmulatedFlash::unlock()
+{
+    _locked = false;
+}
+
+void
+EmulatedFlash::lock()
+{
+    _locked = true;
+}
+
+bool
+EmulatedFlash::isLocked() const
+{
+    return _locked;
+}
+
+const EmulatedFlash::Statistics&
+EmulatedFlash::statistics() const
+{
+    return _statistics;
+}
+
+void
+EmulatedFlash::resetStatistics()
+{
+    _statistics = Statistics();
+}
+}
+}
@@ -0,0 +1,102 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#include <core/stm32_flash/FlashSegment.hpp>
+#include <core/bootloader/port/EmulatedFlash.hpp>
+
+using bootloader::port::EmulatedFlash;
+
+namespace core {
+namespace stm32_flash {
+FlashSegment::FlashSegment(
+    uint32_t from,
+    uint32_t to
+) :
+    _from(from),
+    _to(to)
+{}
+
+uint32_t
+FlashSegment::from() const
+{
+    return _from;
+}
+
+uint32_t
+FlashSegment::to() const
+{
+    return _to;
+}
+
+uint32_t
+FlashSegment::size() const
+{
+    return _to - _from;
+}
+
+bool
+FlashSegment::isAddressValid(
+    uint32_t address
+) const
+{
+    return (address >= _from) && (address < _to);
+}
+
+bool
+FlashSegment::isErased() const
+{
+    EmulatedFlash* flash = EmulatedFlash::instance();
+
+    return (flash != nullptr) && flash->isErased(_from, size());
+}
+
+bool
+FlashSegment::erase()
+{
+    EmulatedFlash* flash = EmulatedFlash::instance();
+
+    if (flash == nullptr) {
+        return false;
+    }
+
+    const uint32_t pageSize = flash->configuration().pageSize;
+    bool           success  = true;
+
+    for (uint32_t page = _from; page < _to; page += pageSize) {
+        if (!flash->isErased(page, pageSize)) {
+            success &= flash->erasePage(page);
+        }
+    }
+
+    return success;
+}
+
+bool
+FlashSegment::write16(
+    uint32_t address,
+    uint16_t data
+)
+{
+    return write(address, &data, sizeof(data));
+}
+
+bool
+FlashSegment::write(
+    uint32_t    address,
+    const void* data,
+    std::size_t length
+)
+{
+    EmulatedFlash* flash = EmulatedFlash::instance();
+
+    if ((flash == nullptr) || !isAddressValid(address) || (length > _to - address)) {
+        return false;
+    }
+
+    return flash->program(address, data, length);
+}
+}
+}
@@ -0,0 +1,438 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#include <nil.h>
+#include <osal.h>
+
+#include <core/bootloader/bootloader.hpp>
+#include <core/bootloader/port/EmulatedFlash.hpp>
+#include <core/bootloader/port/Node.hpp>
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace bootloader {
+namespace port {
+static const Time TICK = 1000000000ULL / CH_CFG_ST_FREQUENCY;
+
+// Of CPU time, twice without an action and the node is spinning
+static const long WATCH_PERIOD = 50000; // [us]
+
+// The thread runs on a stack of its own, zeroed as the working area on the
+// part: what the firmware leaves uninitialized and sends is always the same.
+// It is larger than the working area, the host code is not the one of the part
+static const std::size_t STACK_SIZE = 256 * 1024;
+
+static ucontext_t _thread;
+static uint64_t   _stack[STACK_SIZE / sizeof(uint64_t)];
+
+Node* Node::_instance = nullptr;
+
+Node::Node(
+    const Configuration& configuration
+) :
+    _configuration(configuration),
+    _now(configuration.time),
+    _busy(0),
+    _watchdogPeriod(NEVER),
+    _watchdog(NEVER),
+    _resumed(false),
+    _message(MSG_OK),
+    _sent(0),
+    _watched(0)
+{
+    EmulatedFlash* flash = EmulatedFlash::instance();
+
+    if (flash != nullptr) {
+        _busy = flash->statistics().busy.count();
+    }
+}
+
+void
+Node::run(
+    const Configuration& configuration
+)
+{
+    static Node node(configuration);
+
+    _instance = &node;
+
+    struct sigaction action;
+    struct itimerval timer;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = watch;
+    action.sa_flags   = SA_RESTART;
+
+    timer.it_interval.tv_sec  = 0;
+    timer.it_interval.tv_usec = WATCH_PERIOD;
+    timer.it_value            = timer.it_interval;
+
+    sigaction(SIGVTALRM, &action, nullptr);
+    setitimer(ITIMER_VIRTUAL, &timer, nullptr);
+
+    getcontext(&_thread);
+    _thread.uc_stack.ss_sp   = _stack;
+    _thread.uc_stack.ss_size = sizeof(_stack);
+    _thread.uc_link          = nullptr;
+    makecontext(&_thread, thread, 0);
+    setcontext(&_thread);
+
+    node.halt("the bootloader thread did not start");
+} // Node::run
+
+void
+Node::thread()
+{
+    bootloaderThread(nullptr);
+
+    _instance->halt("the bootloader thread returned");
+}
+
+Node&
+Node::instance()
+{
+    return *_instance;
+}
+
+const Node::Configuration&
+Node::configuration() const
+{
+    return _configuration;
+}
+
+Time
+Node::now()
+{
+    EmulatedFlash* flash = EmulatedFlash::instance();
+
+    // The CPU was stalled while the flash was busy
+    if (flash != nullptr) {
+        Time busy = flash->statistics().busy.count();
+
+        _now += busy - _busy;
+        _busy = busy;
+    }
+
+    return _now;
+}
+
+msg_t
+Node::suspend(
+    thread_reference_t* reference,
+    Time                until
+)
+{
+    bool timeout = false;
+
+    _resumed = false;
+
+    if (reference != nullptr) {
+        *reference = this;
+    }
+
+    // At least once: what happened while the thread was running is served now
+    do {
+        checkWatchdog();
+
+        NodeAction action = {NodeAction::WAIT, now(), until, _watchdog, 0, {}};
+        NodeEvent  event;
+
+        send(action);
+
+        if (recv(_configuration.socket, &event, sizeof(event), 0) != sizeof(event)) {
+            // The simulator is gone
+            _exit(0);
+        }
+
+        _now = std::max(_now, event.time);
+
+        switch (event.type) {
+          case NodeEvent::FRAME:
+              canReceived(event.frame);
+              break;
+          case NodeEvent::SENT:
+              canSent(true);
+              break;
+          case NodeEvent::LOST:
+              canSent(false);
+              break;
+          case NodeEvent::TIMER:
+              timeout = true;
+              break;
+        }
+    } while (!_resumed && !timeout);
+
+    if (!_resumed) {
+        if (reference != nullptr) {
+            *reference = nullptr;
+        }
+
+        return MSG_TIMEOUT;
+    }
+
+    return _message;
+} // Node::suspend
+
+void
+Node::resume(
+    thread_reference_t* reference,
+    msg_t               message
+)
+{
+    if ((reference != nullptr) && (*reference != nullptr)) {
+        *reference = nullptr;
+        _resumed   = true;
+        _message   = message;
+    }
+}
+
+void
+Node::transmit(
+    const CanFrame& frame,
+    Time            deadline
+)
+{
+    NodeAction action = {NodeAction::TRANSMIT, now(), deadline, NEVER, 0, frame};
+
+    send(action);
+}
+
+uint32_t
+Node::nvr() const
+{
+    return _configuration.nvr;
+}
+
+void
+Node::setNVR(
+    uint32_t value
+)
+{
+    NodeAction action = {NodeAction::NVR, now(), NEVER, NEVER, value, {}};
+
+    _configuration.nvr = value;
+    send(action);
+}
+
+void
+Node::enableWatchdog(
+    Time period
+)
+{
+    _watchdogPeriod = period;
+    reloadWatchdog();
+
+    // It may not wait again before it bites
+    NodeAction action = {NodeAction::WATCHDOG, now(), _watchdog, _watchdog, 0, {}};
+
+    send(action);
+}
+
+void
+Node::reloadWatchdog()
+{
+    checkWatchdog();
+
+    if (_watchdogPeriod != NEVER) {
+        _watchdog = now() + _watchdogPeriod;
+    }
+}
+
+void
+Node::checkWatchdog()
+{
+    if (now() >= _watchdog) {
+        NodeAction action = {NodeAction::RESET, _watchdog, NEVER, NEVER, hw::ResetSource::WATCHDOG, {}};
+
+        end(action);
+    }
+}
+
+void
+Node::reset(
+    hw::ResetSource source
+)
+{
+    NodeAction action = {NodeAction::RESET, now(), NEVER, NEVER, static_cast<uint32_t>(source), {}};
+
+    end(action);
+}
+
+void
+Node::boot()
+{
+    NodeAction action = {NodeAction::BOOT, now(), NEVER, NEVER, 0, {}};
+
+    end(action);
+}
+
+void
+Node::halt(
+    const char* reason
+)
+{
+    NodeAction action = {NodeAction::HALT, now(), NEVER, NEVER, 0, {}};
+
+    (void)reason;
+    end(action);
+}
+
+void
+Node::watch(
+    int signal
+)
+{
+    Node* node = _instance;
+
+    (void)signal;
+
+    if (node->_sent != node->_watched) {
+        node->_watched = node->_sent;
+        return;
+    }
+
+    // send() and _exit() only, this is a signal handler
+    NodeAction action = {NodeAction::HALT, node->_now, NEVER, NEVER, 0, {}};
+
+    if (node->_watchdog != NEVER) {
+        action.type  = NodeAction::RESET;
+        action.time  = std::max(node->_now, node->_watchdog);
+        action.value = hw::ResetSource::WATCHDOG;
+    }
+
+    ::send(node->_configuration.socket, &action, sizeof(action), MSG_NOSIGNAL);
+    _exit(0);
+} // Node::watch
+
+void
+Node::send(
+    const NodeAction& action
+)
+{
+    _sent = _sent + 1;
+
+    if (::send(_configuration.socket, &action, sizeof(action), MSG_NOSIGNAL) != sizeof(action)) {
+        _exit(0);
+    }
+}
+
+void
+Node::end(
+    const NodeAction& action
+)
+{
+    send(action);
+    _exit(0);
+}
+}
+}
+
+using bootloader::port::Node;
+using bootloader::port::TICK;
+
+static bootloader::port::Time
+deadline(
+    systime_t time
+)
+{
+    return (time == TIME_INFINITE) ? bootloader::port::NEVER : Node::instance().now() + time * TICK;
+}
+
+// The bootloader is the only thread: the interrupts run while it waits
+void
+chSysLock(
+    void
+)
+{}
+
+void
+chSysUnlock(
+    void
+)
+{}
+
+void
+chSysHalt(
+    const char* reason
+)
+{
+    Node::instance().halt(reason);
+}
+
+systime_t
+chVTGetSystemTimeX(
+    void
+)
+{
+    return static_cast<systime_t>(Node::instance().now() / TICK);
+}
+
+void
+chThdSleep(
+    systime_t time
+)
+{
+    Node::instance().suspend(nullptr, deadline(time));
+}
+
+void
+osalSysLock(
+    void
+)
+{}
+
+void
+osalSysUnlock(
+    void
+)
+{}
+
+void
+osalSysHalt(
+    const char* reason
+)
+{
+    Node::instance().halt(reason);
+}
+
+msg_t
+osalThreadSuspendTimeoutS(
+    thread_reference_t* trp,
+    systime_t           timeout
+)
+{
+    if (timeout == TIME_IMMEDIATE) {
+        // As on the part, the thread does not sleep and *trp stays empty: a resume meanwhile is lost
+        Node::instance().suspend(nullptr, Node::instance().now());
+        return MSG_TIMEOUT;
+    }
+
+    return Node::instance().suspend(trp, deadline(timeout));
+}
+
+void
+osalThreadResumeI(
+    thread_reference_t* trp,
+    msg_t               msg
+)
+{
+    Node::instance().resume(trp, msg);
+}
+
+void
+osalThreadSleep(
+    systime_t time
+)
+{
+    Node::instance().suspend(nullptr, deadline(time));
+}
@@ -0,0 +1,106 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#include <core/stm32_flash/ProgramStorage.hpp>
+#include <core/bootloader/master/CRC.hpp>
+#include <core/bootloader/port/EmulatedFlash.hpp>
+
+using bootloader::port::EmulatedFlash;
+
+namespace core {
+namespace stm32_flash {
+ProgramStorage::ProgramStorage(
+    FlashSegment& segment
+) :
+    _segment(segment),
+    _writing(false),
+    _crc(0)
+{}
+
+bool
+ProgramStorage::isAddressValid(
+    uint32_t address
+) const
+{
+    return _segment.isAddressValid(address);
+}
+
+bool
+ProgramStorage::unlock()
+{
+    EmulatedFlash* flash = EmulatedFlash::instance();
+
+    if (flash == nullptr) {
+        return false;
+    }
+
+    flash->unlock();
+
+    return true;
+}
+
+bool
+ProgramStorage::erase()
+{
+    return _segment.erase();
+}
+
+bool
+ProgramStorage::isReady() const
+{
+    return _writing;
+}
+
+bool
+ProgramStorage::beginWrite()
+{
+    _writing = true;
+
+    return true;
+}
+
+bool
+ProgramStorage::write16(
+    uint32_t address,
+    uint16_t data
+)
+{
+    return _writing && _segment.write16(address, data);
+}
+
+bool
+ProgramStorage::endWrite()
+{
+    EmulatedFlash* flash      = EmulatedFlash::instance();
+    bool           wasWriting = _writing;
+
+    // As the library does, the flash is locked again
+    if (flash != nullptr) {
+        flash->lock();
+    }
+
+    _writing = false;
+
+    return wasWriting;
+}
+
+uint32_t
+ProgramStorage::updateCRC()
+{
+    const uint8_t* flash = reinterpret_cast<const uint8_t*>(static_cast<uintptr_t>(_segment.from()));
+
+    _crc = bootloader::master::stm32CRC(bootloader::master::STM32_CRC_INITIAL, flash, _segment.size());
+
+    return _crc;
+}
+
+uint32_t
+ProgramStorage::size() const
+{
+    return _segment.size();
+}
+}
+}
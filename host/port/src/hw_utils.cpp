@@ -0,0 +1,157 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+// Host build of src/hw/hw_utils.cpp: what the part does, the node does
+
+// First: the part, and so the flash page size, is there
+#include <hal.h>
+
+#include <core/bootloader/hw/hw_utils.hpp>
+#include <core/bootloader/master/CRC.hpp>
+#include <core/bootloader/port/EmulatedFlash.hpp>
+#include <core/bootloader/port/Node.hpp>
+
+using bootloader::port::Node;
+
+namespace hw {
+const UID&
+getUID()
+{
+    return Node::instance().configuration().uid;
+}
+
+ResetSource
+getResetSource()
+{
+    return Node::instance().configuration().resetSource;
+}
+
+void
+reset()
+{
+    osalThreadSleepMilliseconds(100);
+
+    Node::instance().reset(ResetSource::SOFTWARE);
+}
+
+uint32_t
+getNVR()
+{
+    return Node::instance().nvr();
+}
+
+void
+setNVR(
+    uint32_t value
+)
+{
+    Node::instance().setNVR(value);
+}
+
+void
+Watchdog::freezeOnDebug()
+{}
+
+void
+Watchdog::enable(
+    Period period
+)
+{
+#ifndef OVERRIDE_WATCHDOG
+    // The reload values of the part, with the 40 kHz LSI
+    switch (period) {
+      case Period::_0_ms:
+          Node::instance().enableWatchdog(200000ULL);
+          break;
+      case Period::_800_ms:
+          Node::instance().enableWatchdog(819200000ULL);
+          break;
+      case Period::_1600_ms:
+          Node::instance().enableWatchdog(1638400000ULL);
+          break;
+      case Period::_3200_ms:
+          Node::instance().enableWatchdog(3276800000ULL);
+          break;
+      default:
+          Node::instance().enableWatchdog(6553600000ULL);
+          break;
+    } // switch
+#endif // ifndef OVERRIDE_WATCHDOG
+} // Watchdog::enable
+
+void
+Watchdog::reload()
+{
+#ifndef OVERRIDE_WATCHDOG
+    Node::instance().reloadWatchdog();
+#endif
+}
+
+void
+Stack::paint(
+    void*       base,
+    std::size_t size
+)
+{
+    // The thread does not run on its working area here: it is all unused
+    uint32_t* from = reinterpret_cast<uint32_t*>(base);
+    uint32_t* to   = from + size / sizeof(uint32_t);
+
+    while (from < to) {
+        *(from++) = FILL;
+    }
+}
+
+std::size_t
+Stack::unused(
+    const void* base,
+    std::size_t size
+)
+{
+    const uint32_t* from = reinterpret_cast<const uint32_t*>(base);
+    const uint32_t* to   = from + size / sizeof(uint32_t);
+    const uint32_t* p    = from;
+
+    while ((p < to) && (*p == FILL)) {
+        p++;
+    }
+
+    return (p - from) * sizeof(uint32_t);
+}
+
+bool
+Flash::erasePage(
+    uint32_t address
+)
+{
+    bootloader::port::EmulatedFlash* flash = bootloader::port::EmulatedFlash::instance();
+
+    // The page of the firmware and the one of the flash must be the same
+    return (flash != nullptr) && (flash->configuration().pageSize == PAGE_SIZE) && flash->erasePage(address);
+}
+
+uint32_t
+CRCUnit::update(
+    uint32_t        crc,
+    const uint32_t* data,
+    std::size_t     words
+)
+{
+    // The host is little endian, as the part: the words are in memory as the unit takes them
+    return bootloader::master::stm32CRC(crc, reinterpret_cast<const uint8_t*>(data), words * sizeof(uint32_t));
+}
+
+int32_t
+jumptoapp(
+    uint32_t addr
+)
+{
+    // The application is not simulated: the node leaves the bus
+    (void)addr;
+
+    Node::instance().boot();
+}
+}
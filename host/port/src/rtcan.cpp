@@ -0,0 +1,291 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+// Host build of rtcan, on the CAN controller of bootloader::port::Node
+
+#include <rtcan.h>
+#include <core/bootloader/port/Node.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <vector>
+
+RTCANDriver RTCAND1 = {
+    RTCAN_UNINIT, nullptr
+};
+
+namespace bootloader {
+namespace port {
+static const std::size_t FRAME_LENGTH = 8;
+static const std::size_t MAXIMUM_SIZE = 128 * FRAME_LENGTH;
+
+static const Time TICK = 1000000000ULL / CH_CFG_ST_FREQUENCY;
+
+struct Receiver {
+    rtcan_msg_t* message;
+    rtcan_id_t   id;   // The one it was registered with, message->id gets the received one
+    rtcan_id_t   mask;
+    uint16_t     size; // The longest message it takes
+};
+
+struct Transmission {
+    rtcan_msg_t* message;
+    Time         deadline;
+};
+
+// A message whose fragments are arriving
+struct Reassembly {
+    std::size_t receiver; // In _receivers
+    uint8_t     fragment; // Expected next
+    uint16_t    size;
+    uint8_t     data[MAXIMUM_SIZE];
+};
+
+static std::vector<Receiver>             _receivers;
+static std::vector<Transmission>         _queue; // By deadline, the first one is on the controller
+static bool                              _sending = false;
+static std::map<rtcan_id_t, Reassembly> _reassemblies;
+
+static void
+transmitNext()
+{
+    while (!_sending && !_queue.empty()) {
+        rtcan_msg_t* m = _queue.front().message;
+        CanFrame     frame;
+        std::size_t  sent = m->ptr - m->data;
+
+        frame.id     = (static_cast<uint32_t>(m->id) << 7) | m->fragment;
+        frame.length = static_cast<uint8_t>(std::min(FRAME_LENGTH, m->size - sent));
+        memcpy(frame.data, m->ptr, frame.length);
+
+        m->status = RTCAN_MSG_ONAIR;
+        _sending  = true;
+
+        Node::instance().transmit(frame, _queue.front().deadline);
+    }
+}
+
+void
+canSent(
+    bool success
+)
+{
+    if (!_sending) {
+        // Stopped meanwhile
+        return;
+    }
+
+    rtcan_msg_t* m = _queue.front().message;
+
+    _sending = false;
+
+    if (!success) {
+        m->status = RTCAN_MSG_TIMEOUT;
+        _queue.erase(_queue.begin());
+    } else if (m->fragment == 0) {
+        m->status = RTCAN_MSG_READY;
+        _queue.erase(_queue.begin());
+
+        if (m->callback != nullptr) {
+            m->callback(m);
+        }
+    } else {
+        m->ptr += FRAME_LENGTH;
+        m->fragment--;
+    }
+
+    transmitNext();
+} // canSent
+
+static const std::size_t NONE = SIZE_MAX;
+
+static std::size_t
+receiver(
+    rtcan_id_t id,
+    uint16_t   size
+)
+{
+    // An exact match first, as the filters of the controller do
+    for (std::size_t i = 0; i < _receivers.size(); i++) {
+        const Receiver& r = _receivers[i];
+
+        if ((r.mask == 0xFFFF) && (r.id == id) && (size <= r.size)) {
+            return i;
+        }
+    }
+
+    for (std::size_t i = 0; i < _receivers.size(); i++) {
+        const Receiver& r = _receivers[i];
+
+        if ((r.mask != 0xFFFF) && ((r.id & r.mask) == (id & r.mask)) && (size <= r.size)) {
+            return i;
+        }
+    }
+
+    return NONE;
+}
+
+void
+canReceived(
+    const CanFrame& frame
+)
+{
+    rtcan_id_t id       = static_cast<rtcan_id_t>(frame.id >> 7);
+    uint8_t    fragment = frame.id & 0x7F;
+    auto       i        = _reassemblies.find(id);
+
+    if ((i != _reassemblies.end()) && (i->second.fragment != fragment)) {
+        // A fragment went missing: the message is lost
+        _reassemblies.erase(i);
+        i = _reassemblies.end();
+    }
+
+    if (i == _reassemblies.end()) {
+        std::size_t r = receiver(id, (fragment + 1) * FRAME_LENGTH);
+
+        if (r == NONE) {
+            return;
+        }
+
+        i = _reassemblies.emplace(id, Reassembly()).first;
+        i->second.receiver = r;
+        i->second.size     = 0;
+    }
+
+    Reassembly& a = i->second;
+
+    memcpy(a.data + a.size, frame.data, frame.length);
+    a.size    += frame.length;
+    a.fragment = fragment - 1;
+
+    if (fragment != 0) {
+        return;
+    }
+
+    rtcan_msg_t* m = _receivers[a.receiver].message;
+
+    // The one before was not released yet: this is dropped
+    if (m->status == RTCAN_MSG_READY) {
+        memcpy(m->data, a.data, a.size);
+        m->id     = id;
+        m->size   = a.size;
+        m->status = RTCAN_MSG_BUSY;
+
+        if (m->callback != nullptr) {
+            m->callback(m);
+        }
+    }
+
+    _reassemblies.erase(id);
+} // canReceived
+
+static void
+receive(
+    rtcan_msg_t* msg,
+    rtcan_id_t   mask
+)
+{
+    Receiver r = {
+        msg, msg->id, mask, msg->size
+    };
+
+    for (Receiver& registered : _receivers) {
+        if (registered.message == msg) {
+            registered = r;
+            return;
+        }
+    }
+
+    _receivers.push_back(r);
+}
+}
+}
+
+using namespace bootloader::port;
+
+void
+rtcanInit(
+    void
+)
+{
+    RTCAND1.state = RTCAN_STOP;
+}
+
+void
+rtcanStart(
+    RTCANDriver*       rtcanp,
+    const RTCANConfig* config
+)
+{
+    rtcanp->config = config;
+    rtcanp->state  = RTCAN_READY;
+}
+
+void
+rtcanStop(
+    RTCANDriver* rtcanp
+)
+{
+    rtcanp->state = RTCAN_STOP;
+
+    _receivers.clear();
+    _reassemblies.clear();
+    _queue.clear();
+    _sending = false;
+}
+
+void
+rtcanTransmit(
+    RTCANDriver* rtcanp,
+    rtcan_msg_t* msg,
+    systime_t    timeout
+)
+{
+    if ((rtcanp->state != RTCAN_READY) || (msg->size == 0) || (msg->size > MAXIMUM_SIZE)) {
+        msg->status = RTCAN_MSG_ERROR;
+        return;
+    }
+
+    Transmission t = {
+        msg, Node::instance().now() + timeout * TICK
+    };
+
+    msg->ptr      = msg->data;
+    msg->fragment = static_cast<uint8_t>((msg->size - 1) / FRAME_LENGTH);
+    msg->status   = RTCAN_MSG_QUEUED;
+
+    // The one on the controller stays there
+    auto position = std::upper_bound(_queue.begin() + (_sending ? 1 : 0), _queue.end(), t, [](const Transmission& a, const Transmission& b) {
+        return a.deadline < b.deadline;
+    });
+
+    _queue.insert(position, t);
+
+    transmitNext();
+}
+
+void
+rtcanReceive(
+    RTCANDriver* rtcanp,
+    rtcan_msg_t* msg
+)
+{
+    (void)rtcanp;
+    receive(msg, 0xFFFF);
+}
+
+void
+rtcanReceiveMask(
+    RTCANDriver* rtcanp,
+    rtcan_msg_t* msg,
+    uint32_t     mask
+)
+{
+    (void)rtcanp;
+    receive(msg, static_cast<rtcan_id_t>(mask));
+}
@@ -0,0 +1,164 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#include <core/bootloader/master/AsyncChannel.hpp>
+
+namespace bootloader {
+namespace master {
+AsyncChannel::AsyncChannel(
+    Engine&                     engine,
+    uint16_t                    slaveID,
+    const Pacer::Configuration& configuration
+) :
+    _engine(engine),
+    _pacer(configuration),
+    _slaveID(slaveID),
+    _sequence(0),
+    _direct(false),
+    _retries(5)
+{}
+
+void
+AsyncChannel::setSequence(
+    uint8_t sequence
+)
+{
+    _sequence = sequence;
+}
+
+uint8_t
+AsyncChannel::sequence() const
+{
+    return _sequence;
+}
+
+void
+AsyncChannel::setSlaveID(
+    uint16_t slaveID
+)
+{
+    _slaveID = slaveID;
+}
+
+uint16_t
+AsyncChannel::slaveID() const
+{
+    return _slaveID;
+}
+
+void
+AsyncChannel::setDirect(
+    bool direct
+)
+{
+    _direct = direct;
+}
+
+void
+AsyncChannel::setRetries(
+    unsigned retries
+)
+{
+    _retries = retries;
+}
+
+Pacer&
+AsyncChannel::pacer()
+{
+    return _pacer;
+}
+
+Engine&
+AsyncChannel::engine()
+{
+    return _engine;
+}
+
+bool
+AsyncChannel::send(
+    const Request& request
+)
+{
+    Frame frame;
+
+    if (_direct && (_slaveID != ANY_NODE)) {
+        frame.topic = BOOTLOADER_DIRECT_TOPIC_ID;
+        frame.node  = (uint8_t)_slaveID;
+    } else {
+        frame.topic = BOOTLOADER_TOPIC_ID;
+        frame.node  = _engine.masterID();
+    }
+
+    frame.size = LongMessage::MESSAGE_LENGTH;
+    memcpy(frame.data, request.data, LongMessage::MESSAGE_LENGTH);
+
+    return _engine.send(frame);
+}
+
+Task<AcknowledgeStatus>
+AsyncChannel::transact(
+    Request& request,
+    Frame*   acknowledge,
+    bool     sequenced
+)
+{
+    if (sequenced) {
+        _sequence += 2;
+        request.header().sequenceId = _sequence;
+    }
+
+    if (_slaveID != ANY_NODE) {
+        co_return co_await exchange(request, acknowledge, sequenced);
+    }
+
+    co_await _engine.anyNode().lock();
+
+    AcknowledgeStatus status = co_await exchange(request, acknowledge, sequenced);
+
+    _engine.anyNode().unlock();
+
+    co_return status;
+}
+
+Task<AcknowledgeStatus>
+AsyncChannel::exchange(
+    const Request& request,
+    Frame*         acknowledge,
+    bool           sequenced
+)
+{
+    Frame frame;
+
+    for (unsigned attempt = 0; attempt <= _retries; attempt++) {
+        if (!_pacer.canSend(Clock::now())) {
+            co_await _engine.sleepUntil(_pacer.nextSendTime());
+        }
+
+        Clock::time_point sentAt = Clock::now();
+
+        if (!send(request)) {
+            co_return AcknowledgeStatus::BROKEN;
+        }
+
+        _pacer.onSend(sentAt);
+
+        if (co_await _engine.acknowledge(_slaveID, request, sequenced, frame, sentAt + _pacer.timeout())) {
+            _pacer.onAcknowledge(sentAt, Clock::now(), attempt > 0);
+
+            if (acknowledge != nullptr) {
+                *acknowledge = frame;
+            }
+
+            co_return acknowledgeOf(frame, request, sequenced)->status;
+        }
+
+        _pacer.onTimeout(Clock::now());
+    }
+
+    co_return AcknowledgeStatus::NONE; // No acknowledge
+} // AsyncChannel::exchange
+}
+}
@@ -0,0 +1,559 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#include <core/bootloader/master/AsyncSession.hpp>
+#include <core/bootloader/master/CRC.hpp>
+#include <core/bootloader/master/Requests.hpp>
+
+#include <cstdio>
+
+namespace bootloader {
+namespace master {
+// As Session: between two erase steps, when the slave listens
+static const Clock::duration JOB_POLL_INTERVAL = std::chrono::milliseconds(50);
+static const unsigned        PROBE_RETRIES     = 2; // Legacy slaves do not answer SELECT_SLAVE_ALIGNED
+
+AsyncSession::AsyncSession(
+    Engine&                     engine,
+    ModuleUID                   uid,
+    uint16_t                    slaveID,
+    const Pacer::Configuration& configuration
+) :
+    _channel(engine, slaveID, configuration),
+    _uid(uid),
+    _open(false),
+    _aligned(false),
+    _mode(0)
+{}
+
+Task<AcknowledgeStatus>
+AsyncSession::simple(
+    Request request
+)
+{
+    co_return co_await _channel.transact(request);
+}
+
+Task<AcknowledgeStatus>
+AsyncSession::open(
+    bool shared
+)
+{
+    payload::UIDAndMaster select;
+
+    select.uid      = _uid;
+    select.masterID = _channel.engine().masterID();
+
+    AcknowledgeStatus status;
+    Request           request;
+
+    // The slave takes the sequence number of the SELECT
+    if (shared) {
+        messages::aligned::SelectShared m;
+        m.data = select;
+        request.set(m);
+    } else {
+        messages::aligned::SelectSlave m;
+        m.data = select;
+        request.set(m);
+    }
+
+    request.header().sequenceId = 0;
+
+    _channel.setRetries(PROBE_RETRIES);
+    status = co_await _channel.transact(request, nullptr, false);
+    _channel.setRetries(5);
+
+    _aligned = (status == AcknowledgeStatus::OK);
+
+    if ((status == AcknowledgeStatus::NONE) && !shared) {
+        messages::SelectSlave m;
+        m.data = select;
+        request.set(m);
+        request.header().sequenceId = 0;
+
+        status = co_await _channel.transact(request, nullptr, false);
+    }
+
+    if (status != AcknowledgeStatus::OK) {
+        co_return status;
+    }
+
+    _open = true;
+    _mode = _aligned ? (uint32_t)ALIGNED_LAYOUT : 0;
+    _channel.setSequence(0);
+    _channel.setDirect(shared);
+
+    // What the slave can do
+    Frame        ack;
+    payload::UID uid;
+
+    uid.uid = _uid;
+    request = makeRequest<messages::ProtocolVersion, messages::aligned::ProtocolVersion>(_aligned, uid);
+    status  = co_await _channel.transact(request, &ack);
+
+    if (status != AcknowledgeStatus::OK) {
+        co_return status;
+    }
+
+    const AcknowledgeProtocolVersion* version = ack.as<AcknowledgeProtocolVersion>();
+
+    _version.assign(version->data.version, strnlen(version->data.version, sizeof(version->data.version)));
+
+    unsigned major = 0;
+    unsigned minor = 0;
+
+    if ((sscanf(_version.c_str(), "%u.%u", &major, &minor) != 2) || ((major == 1) && (minor < 2))) {
+        // Capabilities came with 1.2.0
+        co_return AcknowledgeStatus::OK;
+    }
+
+    payload::UIDAndMode mode;
+
+    mode.uid          = _uid;
+    mode.capabilities = (version->data.capabilities & Session::WANTED) | _mode;
+
+    request = makeRequest<messages::SetSessionMode, messages::aligned::SetSessionMode>(_aligned, mode);
+    status  = co_await _channel.transact(request, &ack);
+
+    if (status == AcknowledgeStatus::OK) {
+        _mode = ack.as<AcknowledgeMode>()->data.capabilities;
+    }
+
+    co_return status;
+} // AsyncSession::open
+
+Task<AcknowledgeStatus>
+AsyncSession::close()
+{
+    payload::UID uid;
+
+    uid.uid = _uid;
+    _open   = false;
+
+    co_return co_await simple(makeRequest<messages::DeselectSlave, messages::aligned::DeselectSlave>(_aligned, uid));
+}
+
+bool
+AsyncSession::isOpen() const
+{
+    return _open;
+}
+
+uint32_t
+AsyncSession::mode() const
+{
+    return _mode;
+}
+
+const std::string&
+AsyncSession::version() const
+{
+    return _version;
+}
+
+Task<AcknowledgeStatus>
+AsyncSession::describe(
+    payload::DescribeV2& description
+)
+{
+    payload::UID uid;
+    Frame        ack;
+
+    uid.uid = _uid;
+
+    Request           request = makeRequest<messages::DescribeV2, messages::aligned::DescribeV2>(_aligned, uid);
+    AcknowledgeStatus status  = co_await _channel.transact(request, &ack);
+
+    if (status == AcknowledgeStatus::OK) {
+        description = ack.as<AcknowledgeDescribeV2>()->data;
+    }
+
+    co_return status;
+}
+
+Task<AcknowledgeStatus>
+AsyncSession::waitJob(
+    AcknowledgeStatus status,
+    uint32_t*         crc
+)
+{
+    payload::UID uid;
+    Frame        ack;
+
+    uid.uid = _uid;
+
+    while (status == AcknowledgeStatus::IN_PROGRESS) {
+        co_await _channel.engine().sleep(JOB_POLL_INTERVAL);
+
+        Request request = makeRequest<messages::JobStatus, messages::aligned::JobStatus>(_aligned, uid);
+
+        status = co_await _channel.transact(request, &ack);
+
+        if ((status == AcknowledgeStatus::OK) && (crc != nullptr)) {
+            *crc = ack.as<AcknowledgeJobStatus>()->data.crc;
+        }
+    }
+
+    co_return status;
+}
+
+Task<AcknowledgeStatus>
+AsyncSession::eraseProgram()
+{
+    payload::UID uid;
+
+    uid.uid = _uid;
+
+    AcknowledgeStatus status = co_await simple(makeRequest<messages::EraseProgram, messages::aligned::EraseProgram>(_aligned, uid));
+
+    co_return co_await waitJob(status);
+}
+
+Task<AcknowledgeStatus>
+AsyncSession::write(
+    const Image&             image,
+    const Session::Progress& progress
+)
+{
+    // Flash is written by half words. Many sessions usually share an image
+    // that is aligned already, no need for a copy each
+    const Image* source = &image;
+    Image        aligned;
+
+    if (!image.isAligned(sizeof(uint16_t))) {
+        aligned = image;
+        aligned.align(sizeof(uint16_t));
+        source = &aligned;
+    }
+
+    WriteRequests     requests(*source, _aligned, (_mode & BINARY_WRITE) != 0);
+    Request           request;
+    AcknowledgeStatus status = AcknowledgeStatus::OK;
+
+    while ((status == AcknowledgeStatus::OK) && requests.next(request)) {
+        if (progress) {
+            progress(requests.done(), requests.total());
+        }
+
+        status = co_await _channel.transact(request);
+    }
+
+    co_return status;
+}
+
+Task<AcknowledgeStatus>
+AsyncSession::write(
+    const Plan&              plan,
+    const Session::Progress& progress
+)
+{
+    const PlanTrack* track = plan.track(_mode);
+
+    if (track == nullptr) {
+        co_return AcknowledgeStatus::NOT_IMPLEMENTED;
+    }
+
+    const Request*    requests = plan.requests(*track);
+    std::size_t       total    = plan.header().imageSize;
+    AcknowledgeStatus status   = AcknowledgeStatus::OK;
+
+    for (uint32_t i = 0; (status == AcknowledgeStatus::OK) && (i < track->count); i++) {
+        Request request = requests[i];
+
+        if (progress) {
+            progress((uint64_t)total * (i + 1) / track->count, total);
+        }
+
+        status = co_await _channel.transact(request);
+    }
+
+    co_return status;
+}
+
+Task<AcknowledgeStatus>
+AsyncSession::rangeCRC(
+    uint32_t  address,
+    uint32_t  length,
+    uint32_t& crc
+)
+{
+    payload::UIDAndRange range;
+    Frame                ack;
+
+    range.uid     = _uid;
+    range.address = address;
+    range.length  = length;
+
+    Request           request = makeRequest<messages::RangeCRC, messages::aligned::RangeCRC>(_aligned, range);
+    AcknowledgeStatus status  = co_await _channel.transact(request, &ack);
+
+    if (status == AcknowledgeStatus::OK) {
+        crc = ack.as<AcknowledgeCRC>()->data.crc;
+    }
+
+    co_return co_await waitJob(status, &crc);
+}
+
+Task<AcknowledgeStatus>
+AsyncSession::verify(
+    const Image& image
+)
+{
+    if (!(_mode & RANGE_CRC)) {
+        co_return AcknowledgeStatus::NOT_IMPLEMENTED;
+    }
+
+    // RANGE_CRC works on words
+    const Image* source = &image;
+    Image        aligned;
+
+    if (!image.isAligned(sizeof(uint32_t))) {
+        aligned = image;
+        aligned.align(sizeof(uint32_t));
+        source = &aligned;
+    }
+
+    for (const auto& segment : source->segments()) {
+        uint32_t crc      = 0;
+        uint32_t expected = stm32CRC(STM32_CRC_INITIAL, segment.second.data(), segment.second.size());
+
+        AcknowledgeStatus status = co_await rangeCRC(segment.first, segment.second.size(), crc);
+
+        if (status != AcknowledgeStatus::OK) {
+            co_return status;
+        }
+
+        if (crc != expected) {
+            co_return AcknowledgeStatus::ERROR;
+        }
+    }
+
+    co_return AcknowledgeStatus::OK;
+} // AsyncSession::verify
+
+Task<AcknowledgeStatus>
+AsyncSession::verify(
+    const Plan& plan
+)
+{
+    if (!(_mode & RANGE_CRC)) {
+        co_return AcknowledgeStatus::NOT_IMPLEMENTED;
+    }
+
+    for (uint32_t i = 0; i < plan.header().segments; i++) {
+        const PlanSegment& segment = plan.segments()[i];
+        uint32_t           crc     = 0;
+        AcknowledgeStatus  status  = co_await rangeCRC(segment.address, segment.length, crc);
+
+        if (status != AcknowledgeStatus::OK) {
+            co_return status;
+        }
+
+        if (crc != segment.crc) {
+            co_return AcknowledgeStatus::ERROR;
+        }
+    }
+
+    co_return AcknowledgeStatus::OK;
+}
+
+Task<AcknowledgeStatus>
+AsyncSession::writeProgramCRC(
+    uint32_t crc
+)
+{
+    payload::UIDAndCRC data;
+
+    data.uid = _uid;
+    data.crc = crc;
+
+    co_return co_await simple(makeRequest<messages::WriteProgramCrc, messages::aligned::WriteProgramCrc>(_aligned, data));
+}
+
+Task<AcknowledgeStatus>
+AsyncSession::reset()
+{
+    payload::UID uid;
+
+    uid.uid = _uid;
+
+    AcknowledgeStatus status = co_await simple(makeRequest<messages::Reset, messages::aligned::Reset>(_aligned, uid));
+
+    if (status == AcknowledgeStatus::OK) {
+        // The slave is gone
+        _open = false;
+    }
+
+    co_return status;
+}
+
+AsyncChannel&
+AsyncSession::channel()
+{
+    return _channel;
+}
+
+ModuleUID
+AsyncSession::uid() const
+{
+    return _uid;
+}
+
+Task<AcknowledgeStatus>
+identify(
+    Engine&                     engine,
+    ModuleUID                   uid,
+    uint16_t*                   slaveID,
+    const Pacer::Configuration& configuration
+)
+{
+    AsyncChannel            channel(engine, ANY_NODE, configuration);
+    messages::IdentifySlave m; // Outside of the sessions, always in the legacy layout
+    Frame                   ack;
+
+    m.data.uid = uid;
+
+    Request           request(m);
+    AcknowledgeStatus status = co_await channel.transact(request, &ack, false);
+
+    if ((status == AcknowledgeStatus::OK) && (slaveID != nullptr)) {
+        *slaveID = ack.node;
+    }
+
+    co_return status;
+}
+
+// The flow, once the session is open
+template <typename Source>
+static Task<Master::Result>
+flashOpen(
+    AsyncSession&            s,
+    const Source&            source,
+    const Master::Options&   options,
+    const Session::Progress& progress
+)
+{
+    AcknowledgeStatus status;
+
+    auto result = [&](Master::Step step, AcknowledgeStatus status) {
+                      return Master::Result {step, status, s.channel().pacer().metrics()};
+                  };
+
+    if ((status = co_await s.eraseProgram()) != AcknowledgeStatus::OK) {
+        co_return result(Master::Step::ERASE, status);
+    }
+
+    if ((status = co_await s.write(source, progress)) != AcknowledgeStatus::OK) {
+        co_return result(Master::Step::WRITE, status);
+    }
+
+    if (options.verify && (s.mode() & RANGE_CRC)) {
+        if ((status = co_await s.verify(source)) != AcknowledgeStatus::OK) {
+            co_return result(Master::Step::VERIFY, status);
+        }
+    }
+
+    // The CRC the slave computes over the program flash is the one it will
+    // check at boot
+    payload::DescribeV2 description;
+
+    if ((status = co_await s.describe(description)) != AcknowledgeStatus::OK) {
+        co_return result(Master::Step::COMMIT, status);
+    }
+
+    if ((status = co_await s.writeProgramCRC(description.flashCRC)) != AcknowledgeStatus::OK) {
+        co_return result(Master::Step::COMMIT, status);
+    }
+
+    if (options.reset) {
+        if ((status = co_await s.reset()) != AcknowledgeStatus::OK) {
+            co_return result(Master::Step::RESET, status);
+        }
+    } else {
+        co_await s.close();
+    }
+
+    co_return result(Master::Step::RESET, AcknowledgeStatus::OK);
+} // flashOpen
+
+template <typename Source>
+static Task<Master::Result>
+flashFrom(
+    Engine&                     engine,
+    ModuleUID                   uid,
+    const Source&               source,
+    const Master::Options&      options,
+    const Pacer::Configuration& configuration,
+    Session::Progress           progress
+)
+{
+    uint16_t          slaveID = ANY_NODE;
+    AcknowledgeStatus status  = AcknowledgeStatus::OK;
+
+    if (!engine.announced(uid, slaveID)) {
+        status = co_await identify(engine, uid, &slaveID, configuration);
+
+        if (status != AcknowledgeStatus::OK) {
+            co_return Master::Result {Master::Step::IDENTIFY, status, Pacer::Metrics()};
+        }
+    }
+
+    AsyncSession s(engine, uid, slaveID, configuration);
+
+    // Other sessions run at the same time, the slave must only act on the
+    // messages sent to its CAN ID
+    bool exclusive = false;
+
+    status = co_await s.open(true);
+
+    if (status == AcknowledgeStatus::NONE) {
+        co_await engine.exclusive().lock();
+
+        exclusive = true;
+        status    = co_await s.open(false);
+    }
+
+    Master::Result result {Master::Step::OPEN, status, s.channel().pacer().metrics()};
+
+    if (status == AcknowledgeStatus::OK) {
+        result = co_await flashOpen(s, source, options, progress);
+    }
+
+    if (exclusive) {
+        engine.exclusive().unlock();
+    }
+
+    co_return result;
+} // flashFrom
+
+Task<Master::Result>
+flash(
+    Engine&                     engine,
+    ModuleUID                   uid,
+    const Image&                image,
+    const Master::Options&      options,
+    const Pacer::Configuration& configuration,
+    Session::Progress           progress
+)
+{
+    co_return co_await flashFrom(engine, uid, image, options, configuration, std::move(progress));
+}
+
+Task<Master::Result>
+flash(
+    Engine&                     engine,
+    ModuleUID                   uid,
+    const Plan&                 plan,
+    const Master::Options&      options,
+    const Pacer::Configuration& configuration,
+    Session::Progress           progress
+)
+{
+    co_return co_await flashFrom(engine, uid, plan, options, configuration, std::move(progress));
+}
+}
+}
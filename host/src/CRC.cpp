@@ -0,0 +1,313 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#include <core/bootloader/master/CRC.hpp>
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CRC_CARRYLESS
+#include <immintrin.h>
+#endif
+
+namespace bootloader {
+namespace master {
+// Each word goes most significant bit first: in bytes, the fourth one of
+// each word comes first. The tables work on the words as they are, xored
+// into the CRC, which spares the byte swaps
+static inline uint32_t
+word(
+    const uint8_t* p
+)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// x^n mod P
+static uint32_t
+power(
+    unsigned n
+)
+{
+    uint64_t r = 1;
+
+    for (unsigned i = 0; i < n; i++) {
+        r <<= 1;
+
+        if (r & 0x100000000ULL) {
+            r ^= 0x100000000ULL | STM32_CRC_POLYNOMIAL;
+        }
+    }
+
+    return r;
+}
+
+// table[k][b]: byte b, followed by k zero bytes
+struct Tables {
+    uint32_t table[8][256];
+
+    Tables()
+    {
+        for (uint32_t b = 0; b < 256; b++) {
+            uint32_t crc = b << 24;
+
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 0x80000000) ? ((crc << 1) ^ STM32_CRC_POLYNOMIAL) : (crc << 1);
+            }
+
+            table[0][b] = crc;
+        }
+
+        for (int k = 1; k < 8; k++) {
+            for (uint32_t b = 0; b < 256; b++) {
+                uint32_t previous = table[k - 1][b];
+
+                table[k][b] = (previous << 8) ^ table[0][previous >> 24];
+            }
+        }
+    }
+};
+
+static const Tables TABLES;
+
+uint32_t
+stm32CRCReference(
+    uint32_t       crc,
+    const uint8_t* data,
+    std::size_t    length
+)
+{
+    for (std::size_t i = 0; i + 4 <= length; i += 4) {
+        crc ^= word(data + i);
+
+        for (int bit = 0; bit < 32; bit++) {
+            crc = (crc & 0x80000000) ? ((crc << 1) ^ STM32_CRC_POLYNOMIAL) : (crc << 1);
+        }
+    }
+
+    return crc;
+}
+
+uint32_t
+stm32CRCSliceBy8(
+    uint32_t       crc,
+    const uint8_t* data,
+    std::size_t    length
+)
+{
+    const uint32_t(&t)[8][256] = TABLES.table;
+    std::size_t i = 0;
+
+    for (; i + 8 <= length; i += 8) {
+        uint32_t first  = crc ^ word(data + i);
+        uint32_t second = word(data + i + 4);
+
+        crc = t[7][first >> 24] ^ t[6][(first >> 16) & 0xFF] ^ t[5][(first >> 8) & 0xFF] ^ t[4][first & 0xFF]
+              ^ t[3][second >> 24] ^ t[2][(second >> 16) & 0xFF] ^ t[1][(second >> 8) & 0xFF] ^ t[0][second & 0xFF];
+    }
+
+    if (i + 4 <= length) {
+        uint32_t last = crc ^ word(data + i);
+
+        crc = t[3][last >> 24] ^ t[2][(last >> 16) & 0xFF] ^ t[1][(last >> 8) & 0xFF] ^ t[0][last & 0xFF];
+    }
+
+    return crc;
+} // stm32CRCSliceBy8
+
+#if defined(CRC_CARRYLESS)
+// The data as one long polynomial, 128 bits at a time, first bit highest
+// is the same as its words in reverse order
+struct Folding {
+    uint64_t by512[2]; // x^512 mod P, x^576 mod P: for the low and high halves
+    uint64_t by384[2];
+    uint64_t by256[2];
+    uint64_t by128[2];
+
+    Folding() :
+        by512 {power(512), power(576)},
+        by384 {power(384), power(448)},
+        by256 {power(256), power(320)},
+        by128 {power(128), power(192)}
+    {}
+};
+
+static const Folding FOLDING;
+
+__attribute__((target("sse2,pclmul"))) static inline __m128i
+load(
+    const uint8_t* p
+)
+{
+    return _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), 0x1B);
+}
+
+// x times x^n, n being what k is for
+__attribute__((target("sse2,pclmul"))) static inline __m128i
+fold(
+    __m128i         x,
+    const uint64_t* k
+)
+{
+    __m128i constants = _mm_loadu_si128(reinterpret_cast<const __m128i*>(k));
+
+    return _mm_xor_si128(_mm_clmulepi64_si128(x, constants, 0x00), _mm_clmulepi64_si128(x, constants, 0x11));
+}
+
+__attribute__((target("sse2,pclmul"))) static uint32_t
+carryless(
+    uint32_t       crc,
+    const uint8_t* data,
+    std::size_t    length
+)
+{
+    // The CRC so far goes into the first bits, as the CRC unit does it
+    __m128i     x = _mm_xor_si128(load(data), _mm_set_epi32(crc, 0, 0, 0));
+    std::size_t i = 16;
+
+    if (length >= 64) {
+        __m128i x1 = load(data + 16);
+        __m128i x2 = load(data + 32);
+        __m128i x3 = load(data + 48);
+
+        for (i = 64; i + 64 <= length; i += 64) {
+            x  = _mm_xor_si128(fold(x, FOLDING.by512), load(data + i));
+            x1 = _mm_xor_si128(fold(x1, FOLDING.by512), load(data + i + 16));
+            x2 = _mm_xor_si128(fold(x2, FOLDING.by512), load(data + i + 32));
+            x3 = _mm_xor_si128(fold(x3, FOLDING.by512), load(data + i + 48));
+        }
+
+        x = _mm_xor_si128(_mm_xor_si128(fold(x, FOLDING.by384), fold(x1, FOLDING.by256)), _mm_xor_si128(fold(x2, FOLDING.by128), x3));
+    }
+
+    for (; i + 16 <= length; i += 16) {
+        x = _mm_xor_si128(fold(x, FOLDING.by128), load(data + i));
+    }
+
+    // What is left has the CRC of the whole, from zero
+    uint8_t rest[16];
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(rest), _mm_shuffle_epi32(x, 0x1B));
+
+    crc = stm32CRCSliceBy8(0, rest, sizeof(rest));
+
+    return stm32CRCSliceBy8(crc, data + i, length - i);
+} // carryless
+#endif // if defined(CRC_CARRYLESS)
+
+bool
+hasCarrylessCRC()
+{
+#if defined(CRC_CARRYLESS)
+    static const bool has = __builtin_cpu_supports("pclmul");
+
+    return has;
+
+#else
+    return false;
+#endif
+}
+
+uint32_t
+stm32CRCCarryless(
+    uint32_t       crc,
+    const uint8_t* data,
+    std::size_t    length
+)
+{
+#if defined(CRC_CARRYLESS)
+    if (hasCarrylessCRC() && (length >= 16)) {
+        return carryless(crc, data, length);
+    }
+#endif
+
+    return stm32CRCSliceBy8(crc, data, length);
+}
+
+uint32_t
+stm32CRC(
+    uint32_t       crc,
+    const uint8_t* data,
+    std::size_t    length
+)
+{
+    return stm32CRCCarryless(crc, data, length);
+}
+
+// a * b mod P
+static uint32_t
+multiply(
+    uint32_t a,
+    uint32_t b
+)
+{
+    uint32_t product = 0;
+
+    for (int bit = 31; bit >= 0; bit--) {
+        product = (product & 0x80000000) ? ((product << 1) ^ STM32_CRC_POLYNOMIAL) : (product << 1);
+
+        if (b & (1u << bit)) {
+            product ^= a;
+        }
+    }
+
+    return product;
+}
+
+uint32_t
+stm32CRCCombine(
+    uint32_t    crcA,
+    uint32_t    crcB,
+    std::size_t lengthB
+)
+{
+    // The CRC is linear: what b does from crcA is what it does from zero,
+    // plus crcA pushed through its length. crcB started from
+    // STM32_CRC_INITIAL instead of zero, pushed the same way
+    uint32_t    shift = 1; // x^(8 lengthB) mod P
+    uint32_t    x8    = power(8);
+    std::size_t n     = lengthB - (lengthB % 4);
+
+    while (n > 0) {
+        if (n & 1) {
+            shift = multiply(shift, x8);
+        }
+
+        x8  = multiply(x8, x8);
+        n >>= 1;
+    }
+
+    return multiply(crcA ^ STM32_CRC_INITIAL, shift) ^ crcB;
+} // stm32CRCCombine
+
+uint32_t
+stm32CRCBlock(
+    const uint32_t* words,
+    std::size_t     count
+)
+{
+    uint8_t     bytes[64];
+    uint32_t    crc = STM32_CRC_INITIAL;
+    std::size_t i   = 0;
+
+    // The words are in host order, the CRC unit takes them as numbers
+    while (i < count) {
+        std::size_t n = 0;
+
+        for (; (n < sizeof(bytes)) && (i < count); n += 4, i++) {
+            bytes[n]     = words[i];
+            bytes[n + 1] = words[i] >> 8;
+            bytes[n + 2] = words[i] >> 16;
+            bytes[n + 3] = words[i] >> 24;
+        }
+
+        crc = stm32CRC(crc, bytes, n);
+    }
+
+    return crc;
+} // stm32CRCBlock
+}
+}
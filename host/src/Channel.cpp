@@ -0,0 +1,261 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#include <core/bootloader/master/Channel.hpp>
+
+#include <algorithm>
+#include <deque>
+
+namespace bootloader {
+namespace master {
+Channel::Channel(
+    ITransport&                 transport,
+    uint8_t                     masterID,
+    uint16_t                    slaveID,
+    const Pacer::Configuration& configuration
+) :
+    _transport(transport),
+    _pacer(configuration),
+    _masterID(masterID),
+    _slaveID(slaveID),
+    _sequence(0),
+    _direct(false),
+    _sequenced(true),
+    _retries(5)
+{}
+
+void
+Channel::setSequence(
+    uint8_t sequence
+)
+{
+    _sequence = sequence;
+}
+
+uint8_t
+Channel::sequence() const
+{
+    return _sequence;
+}
+
+void
+Channel::setSlaveID(
+    uint16_t slaveID
+)
+{
+    _slaveID = slaveID;
+}
+
+uint16_t
+Channel::slaveID() const
+{
+    return _slaveID;
+}
+
+void
+Channel::setDirect(
+    bool direct
+)
+{
+    _direct = direct;
+}
+
+Pacer&
+Channel::pacer()
+{
+    return _pacer;
+}
+
+void
+Channel::setRetries(
+    unsigned retries
+)
+{
+    _retries = retries;
+}
+
+bool
+Channel::send(
+    const Request& request
+)
+{
+    Frame frame;
+
+    if (_direct && (_slaveID != ANY_NODE)) {
+        frame.topic = BOOTLOADER_DIRECT_TOPIC_ID;
+        frame.node  = (uint8_t)_slaveID;
+    } else {
+        frame.topic = BOOTLOADER_TOPIC_ID;
+        frame.node  = _masterID;
+    }
+
+    frame.size = LongMessage::MESSAGE_LENGTH;
+    memcpy(frame.data, request.data, LongMessage::MESSAGE_LENGTH);
+
+    return _transport.send(frame);
+}
+
+AcknowledgeStatus
+Channel::transact(
+    Request& request,
+    Frame*   acknowledge,
+    bool     sequenced
+)
+{
+    bool              sent   = false;
+    AcknowledgeStatus status = AcknowledgeStatus::NONE;
+
+    uint8_t sequence = _sequence;
+
+    if (!sequenced) {
+        // Keep the sequence number of the caller
+        _sequence  = request.header().sequenceId - 2;
+        _sequenced = false;
+    }
+
+    status = stream([&](Request& next) {
+                        if (sent) {
+                            return false;
+                        }
+
+                        next = request;
+                        sent = true;
+                        return true;
+                    }, [&](const Frame& frame) {
+                        if (acknowledge != nullptr) {
+                            *acknowledge = frame;
+                        }
+
+                        return true;
+                    });
+
+    if (!sequenced) {
+        _sequence  = sequence;
+        _sequenced = true;
+    } else {
+        request.header().sequenceId = _sequence;
+    }
+
+    return status;
+} // Channel::transact
+
+AcknowledgeStatus
+Channel::stream(
+    const Producer& next,
+    const Consumer& consumer
+)
+{
+    struct InFlight {
+        Request           request;
+        Clock::time_point sentAt;
+        Clock::time_point deadline;
+        unsigned          retries;
+        bool              retransmitted;
+    };
+
+    std::deque<InFlight> inFlight;
+    bool                 more = true;
+
+    while (more || !inFlight.empty()) {
+        Clock::time_point now = Clock::now();
+
+        // As many as the window allows
+        while (more && _pacer.canSend(now)) {
+            InFlight f;
+
+            if (!next(f.request)) {
+                more = false;
+                break;
+            }
+
+            _sequence += 2;
+            f.request.header().sequenceId = _sequence;
+
+            if (!send(f.request)) {
+                return AcknowledgeStatus::BROKEN;
+            }
+
+            _pacer.onSend(now);
+
+            f.sentAt        = now;
+            f.deadline      = now + _pacer.timeout();
+            f.retries       = _retries;
+            f.retransmitted = false;
+            inFlight.push_back(f);
+        }
+
+        if (!more && inFlight.empty()) {
+            break;
+        }
+
+        // Wait for an acknowledge, a timeout or the pacer
+        Clock::time_point wake = more ? _pacer.nextSendTime() : Clock::time_point::max();
+
+        for (const InFlight& f : inFlight) {
+            wake = std::min(wake, f.deadline);
+        }
+
+        Frame frame;
+
+        if (_transport.receive(frame, std::max(wake - now, Clock::duration::zero()))) {
+            now = Clock::now();
+
+            if ((_slaveID == ANY_NODE) || (frame.node == _slaveID)) {
+                for (auto f = inFlight.begin(); f != inFlight.end(); f++) {
+                    const AcknowledgeMessage<LongMessage>* ack = acknowledgeOf(frame, f->request, _sequenced);
+
+                    if (ack == nullptr) {
+                        continue;
+                    }
+
+                    _pacer.onAcknowledge(f->sentAt, now, f->retransmitted);
+                    inFlight.erase(f);
+
+                    if (consumer && !consumer(frame)) {
+                        return ack->status;
+                    }
+
+                    if (ack->status != AcknowledgeStatus::OK) {
+                        // What is still in flight will be refused
+                        return ack->status;
+                    }
+
+                    break;
+                }
+            }
+        }
+
+        // Send again what was not acknowledged in time
+        now = Clock::now();
+
+        for (InFlight& f : inFlight) {
+            if (f.deadline > now) {
+                continue;
+            }
+
+            _pacer.onTimeout(now);
+
+            if (f.retries == 0) {
+                return AcknowledgeStatus::NONE; // No acknowledge
+            }
+
+            if (!send(f.request)) {
+                return AcknowledgeStatus::BROKEN;
+            }
+
+            _pacer.onSend(now);
+
+            f.retries--;
+            f.retransmitted = true;
+            f.sentAt        = now;
+            f.deadline      = now + _pacer.timeout();
+        }
+    }
+
+    return AcknowledgeStatus::OK;
+} // Channel::stream
+}
+}
@@ -0,0 +1,447 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#include <core/bootloader/master/Engine.hpp>
+
+#include <algorithm>
+#include <new>
+
+namespace bootloader {
+namespace master {
+// --- Coroutine frames --------------------------------------------------------
+
+static const std::size_t FRAME_CLASS   = 64;
+static const std::size_t FRAME_CLASSES = 32; // Larger frames are not recycled
+
+struct FreeFrame {
+    FreeFrame* next;
+};
+
+static thread_local FrameStatistics frames_;
+static thread_local FreeFrame*      free_[FRAME_CLASSES];
+
+const FrameStatistics&
+frameStatistics()
+{
+    return frames_;
+}
+
+void*
+allocateFrame(
+    std::size_t size
+)
+{
+    std::size_t c     = (size + FRAME_CLASS - 1) / FRAME_CLASS;
+    void*       frame = nullptr;
+
+    if ((c < FRAME_CLASSES) && (free_[c] != nullptr)) {
+        frame    = free_[c];
+        free_[c] = free_[c]->next;
+    } else {
+        frame = ::operator new((c < FRAME_CLASSES) ? c * FRAME_CLASS : size);
+        frames_.allocated++;
+    }
+
+    frames_.frames++;
+    frames_.bytes    += size;
+    frames_.peakBytes = std::max(frames_.peakBytes, frames_.bytes);
+
+    return frame;
+}
+
+void
+freeFrame(
+    void*       frame,
+    std::size_t size
+)
+{
+    std::size_t c = (size + FRAME_CLASS - 1) / FRAME_CLASS;
+
+    frames_.frames--;
+    frames_.bytes -= size;
+
+    if (c < FRAME_CLASSES) {
+        FreeFrame* f = static_cast<FreeFrame*>(frame);
+
+        f->next  = free_[c];
+        free_[c] = f;
+    } else {
+        ::operator delete(frame);
+    }
+}
+
+// --- Awaiters ----------------------------------------------------------------
+
+Engine::AcknowledgeAwaiter::AcknowledgeAwaiter(
+    Engine&           engine,
+    uint16_t          node,
+    const Request&    request,
+    bool              sequenced,
+    Frame&            frame,
+    Clock::time_point deadline
+) :
+    _engine(engine),
+    _node(node),
+    _request(request),
+    _sequenced(sequenced),
+    _frame(frame),
+    _deadline(deadline),
+    _ticket(0),
+    _matched(false)
+{}
+
+void
+Engine::AcknowledgeAwaiter::await_suspend(
+    std::coroutine_handle<> handle
+)
+{
+    _handle = handle;
+    _engine.park(this);
+}
+
+Engine::SleepAwaiter::SleepAwaiter(
+    Engine&           engine,
+    Clock::time_point until
+) :
+    _engine(engine),
+    _until(until)
+{}
+
+void
+Engine::SleepAwaiter::await_suspend(
+    std::coroutine_handle<> handle
+)
+{
+    _engine._timers.push(Timer {_until, _engine._order++, 0, handle});
+}
+
+Engine::Mutex::Mutex(
+    Engine& engine
+) :
+    _engine(engine),
+    _locked(false)
+{}
+
+bool
+Engine::Mutex::Awaiter::await_ready() noexcept
+{
+    if (!mutex._locked) {
+        mutex._locked = true;
+        return true;
+    }
+
+    return false;
+}
+
+void
+Engine::Mutex::Awaiter::await_suspend(
+    std::coroutine_handle<> handle
+)
+{
+    mutex._waiting.push_back(handle);
+}
+
+Engine::Mutex::Awaiter
+Engine::Mutex::lock()
+{
+    return Awaiter {
+               *this
+    };
+}
+
+void
+Engine::Mutex::unlock()
+{
+    if (_waiting.empty()) {
+        _locked = false;
+        return;
+    }
+
+    // Still locked, by the next one
+    _engine.schedule(_waiting.front());
+    _waiting.pop_front();
+}
+
+// --- Engine ------------------------------------------------------------------
+
+Engine::Engine(
+    ITransport& transport,
+    uint8_t     masterID
+) :
+    _transport(transport),
+    _masterID(masterID),
+    _alive(0),
+    _order(0),
+    _tickets(0),
+    _anyNode(*this),
+    _exclusive(*this)
+{}
+
+Engine::~Engine()
+{
+    // Tasks still parked are destroyed with their frames
+    _tasks.clear();
+}
+
+uint8_t
+Engine::masterID() const
+{
+    return _masterID;
+}
+
+bool
+Engine::send(
+    const Frame& frame
+)
+{
+    return _transport.send(frame);
+}
+
+Task<void>
+Engine::root(
+    Task<void> task
+)
+{
+    co_await std::move(task);
+
+    _alive--;
+    _statistics.finished++;
+}
+
+void
+Engine::spawn(
+    Task<void> task
+)
+{
+    Task<void> r = root(std::move(task));
+
+    schedule(r.handle());
+    _tasks.push_back(std::move(r));
+    _alive++;
+    _statistics.spawned++;
+}
+
+void
+Engine::schedule(
+    std::coroutine_handle<> handle
+)
+{
+    _ready.push_back(handle);
+}
+
+Engine::AcknowledgeAwaiter
+Engine::acknowledge(
+    uint16_t          node,
+    const Request&    request,
+    bool              sequenced,
+    Frame&            frame,
+    Clock::time_point deadline
+)
+{
+    return AcknowledgeAwaiter(*this, node, request, sequenced, frame, deadline);
+}
+
+Engine::SleepAwaiter
+Engine::sleepUntil(
+    Clock::time_point until
+)
+{
+    return SleepAwaiter(*this, until);
+}
+
+Engine::SleepAwaiter
+Engine::sleep(
+    Clock::duration duration
+)
+{
+    return SleepAwaiter(*this, Clock::now() + duration);
+}
+
+Engine::Mutex&
+Engine::anyNode()
+{
+    return _anyNode;
+}
+
+Engine::Mutex&
+Engine::exclusive()
+{
+    return _exclusive;
+}
+
+bool
+Engine::announced(
+    ModuleUID uid,
+    uint16_t& node
+) const
+{
+    auto i = _announced.find(uid);
+
+    if (i == _announced.end()) {
+        return false;
+    }
+
+    node = i->second;
+    return true;
+}
+
+const std::unordered_map<ModuleUID, uint16_t>&
+Engine::announced() const
+{
+    return _announced;
+}
+
+const Engine::Statistics&
+Engine::statistics()
+{
+    _statistics.coroutines = frameStatistics();
+
+    return _statistics;
+}
+
+void
+Engine::park(
+    AcknowledgeAwaiter* awaiter
+)
+{
+    awaiter->_ticket = ++_tickets;
+
+    _parked.emplace(awaiter->_ticket, awaiter);
+    _byNode[awaiter->_node].push_back(awaiter);
+    _timers.push(Timer {awaiter->_deadline, _order++, awaiter->_ticket, nullptr});
+}
+
+void
+Engine::unpark(
+    AcknowledgeAwaiter* awaiter
+)
+{
+    std::vector<AcknowledgeAwaiter*>& waiting = _byNode[awaiter->_node];
+
+    auto i = std::find(waiting.begin(), waiting.end(), awaiter);
+
+    *i = waiting.back();
+    waiting.pop_back();
+
+    _parked.erase(awaiter->_ticket);
+    schedule(awaiter->_handle);
+}
+
+void
+Engine::dispatch(
+    const Frame& frame
+)
+{
+    _statistics.frames++;
+
+    if (frame.topic == BOOTLOADER_MASTER_TOPIC_ID) {
+        const messages::Announce* announce = frame.as<messages::Announce>();
+
+        if ((announce != nullptr) && (announce->command == MessageType::REQUEST)) {
+            _announced[announce->data.uid] = frame.node;
+            return;
+        }
+    }
+
+    const uint16_t nodes[] = {
+        frame.node, ANY_NODE
+    };
+
+    for (uint16_t node : nodes) {
+        auto waiting = _byNode.find(node);
+
+        if (waiting == _byNode.end()) {
+            continue;
+        }
+
+        for (AcknowledgeAwaiter* awaiter : waiting->second) {
+            if (acknowledgeOf(frame, awaiter->_request, awaiter->_sequenced) != nullptr) {
+                awaiter->_frame   = frame;
+                awaiter->_matched = true;
+                unpark(awaiter);
+                return;
+            }
+        }
+    }
+
+    _statistics.unmatched++;
+} // Engine::dispatch
+
+void
+Engine::expire(
+    Clock::time_point now
+)
+{
+    while (!_timers.empty() && (_timers.top().deadline <= now)) {
+        Timer timer = _timers.top();
+
+        _timers.pop();
+
+        if (timer.ticket == 0) {
+            schedule(timer.handle);
+            continue;
+        }
+
+        // The acknowledge may have come already
+        auto parked = _parked.find(timer.ticket);
+
+        if (parked != _parked.end()) {
+            _statistics.timeouts++;
+            unpark(parked->second);
+        }
+    }
+}
+
+void
+Engine::run()
+{
+    Frame frame;
+
+    while (_alive > 0) {
+        Clock::time_point start = Clock::now();
+
+        while (!_ready.empty()) {
+            std::coroutine_handle<> handle = _ready.front();
+
+            _ready.pop_front();
+            handle.resume();
+            _statistics.resumes++;
+        }
+
+        Clock::time_point now = Clock::now();
+
+        expire(now);
+
+        _statistics.busy += now - start;
+
+        if ((_alive == 0) || !_ready.empty()) {
+            continue;
+        }
+
+        // Nothing to do until a frame arrives or the next timer is up
+        Clock::duration timeout = _timers.empty() ? Clock::duration(std::chrono::seconds(1)) : _timers.top().deadline - now;
+
+        if (_transport.receive(frame, std::max(timeout, Clock::duration::zero()))) {
+            start = Clock::now();
+
+            dispatch(frame);
+
+            // Whatever else is already there
+            while (_transport.receive(frame, Clock::duration::zero())) {
+                dispatch(frame);
+            }
+
+            _statistics.busy += Clock::now() - start;
+        }
+
+        expire(Clock::now());
+    }
+
+    // The roots are over, their frames can go
+    _tasks.clear();
+} // Engine::run
+}
+}
@@ -0,0 +1,510 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#include <core/bootloader/master/FirmwareStore.hpp>
+#include <core/bootloader/master/CRC.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace bootloader {
+namespace master {
+static const char     BUILD_MAGIC[8] = {'B', 'L', 'B', 'U', 'I', 'L', 'D', '\n'};
+static const uint32_t BUILD_VERSION  = 1;
+
+struct BuildHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t address;
+    uint32_t size;
+    uint32_t pageSize;
+    uint32_t programCRC;
+    uint32_t pages;
+    char     name[64];
+};
+
+struct StorePage {
+    uint32_t address;
+    uint32_t crc;
+    uint64_t hash;
+};
+
+static_assert(sizeof(StorePage) == sizeof(FirmwareStore::Page), "Pages are stored as they are");
+
+// FNV-1a
+static uint64_t
+contentHash(
+    const uint8_t* data,
+    std::size_t    length
+)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (std::size_t i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+static bool
+makeDirectory(
+    const std::string& path
+)
+{
+    return (mkdir(path.c_str(), 0755) == 0) || (errno == EEXIST);
+}
+
+// Replaced as a whole, or not at all
+static bool
+writeFile(
+    const std::string& path,
+    const void*        data,
+    std::size_t        length
+)
+{
+    std::string temporary = path + ".tmp";
+    FILE*       f         = fopen(temporary.c_str(), "wb");
+
+    if (f == nullptr) {
+        return false;
+    }
+
+    bool success = (fwrite(data, 1, length, f) == length);
+
+    success = (fclose(f) == 0) && success;
+
+    if (!success || (rename(temporary.c_str(), path.c_str()) != 0)) {
+        unlink(temporary.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+uint32_t
+programCRC(
+    const FlashGeometry&                    geometry,
+    const std::vector<FirmwareStore::Page>& pages
+)
+{
+    std::vector<uint8_t> erased(geometry.pageSize, Image::ERASED);
+    uint32_t             erasedCRC = stm32CRC(STM32_CRC_INITIAL, erased.data(), erased.size());
+    uint32_t             crc       = STM32_CRC_INITIAL;
+    auto                 page      = pages.begin();
+
+    for (uint32_t address = geometry.address; address < geometry.address + geometry.size; address += geometry.pageSize) {
+        uint32_t pageCRC = erasedCRC;
+
+        if ((page != pages.end()) && (page->address == address)) {
+            pageCRC = (page++)->crc;
+        }
+
+        crc = stm32CRCCombine(crc, pageCRC, geometry.pageSize);
+    }
+
+    return crc;
+} // programCRC
+
+const FirmwareStore::Page*
+FirmwareStore::Build::page(
+    uint32_t address
+) const
+{
+    auto i = std::lower_bound(pages.begin(), pages.end(), address, [](const Page& p, uint32_t a) {
+                                  return p.address < a;
+                              });
+
+    return ((i != pages.end()) && (i->address == address)) ? &*i : nullptr;
+}
+
+FirmwareStore::FirmwareStore(
+    const std::string& directory
+) :
+    _directory(directory)
+{}
+
+std::unique_ptr<FirmwareStore>
+FirmwareStore::open(
+    const std::string& directory
+)
+{
+    if (!makeDirectory(directory) || !makeDirectory(directory + "/objects") || !makeDirectory(directory + "/builds")) {
+        return nullptr;
+    }
+
+    std::unique_ptr<FirmwareStore> store(new FirmwareStore(directory));
+
+    // The objects, for the statistics and to know what to write
+    DIR* objects = opendir((directory + "/objects").c_str());
+
+    if (objects == nullptr) {
+        return nullptr;
+    }
+
+    for (struct dirent* fan = readdir(objects); fan != nullptr; fan = readdir(objects)) {
+        if (fan->d_name[0] == '.') {
+            continue;
+        }
+
+        std::string path = directory + "/objects/" + fan->d_name;
+        DIR*        d    = opendir(path.c_str());
+
+        for (struct dirent* e = d ? readdir(d) : nullptr; e != nullptr; e = readdir(d)) {
+            unsigned           crc;
+            unsigned long long hash;
+            struct stat        s;
+            char               end;
+
+            if ((sscanf(e->d_name, "%8x%16llx%c", &crc, &hash, &end) == 2) && (stat((path + "/" + e->d_name).c_str(), &s) == 0)) {
+                store->_objects[std::make_pair((uint32_t)crc, (uint64_t)hash)] = s.st_size;
+            }
+        }
+
+        if (d != nullptr) {
+            closedir(d);
+        }
+    }
+
+    closedir(objects);
+
+    // The index
+    DIR* builds = opendir((directory + "/builds").c_str());
+
+    if (builds == nullptr) {
+        return nullptr;
+    }
+
+    for (struct dirent* e = readdir(builds); e != nullptr; e = readdir(builds)) {
+        std::string name = e->d_name;
+
+        if ((name.size() > 6) && (name.compare(name.size() - 6, 6, ".build") == 0)) {
+            store->readBuild(directory + "/builds/" + name);
+        }
+    }
+
+    closedir(builds);
+
+    return store;
+} // FirmwareStore::open
+
+bool
+FirmwareStore::readBuild(
+    const std::string& path
+)
+{
+    std::ifstream stream(path, std::ios::binary);
+    BuildHeader   header;
+
+    if (!stream.read(reinterpret_cast<char*>(&header), sizeof(header))
+        || (memcmp(header.magic, BUILD_MAGIC, sizeof(BUILD_MAGIC)) != 0)
+        || (header.version != BUILD_VERSION)
+        || (header.pageSize == 0)
+        || (header.pages > header.size / header.pageSize + 1)) {
+        return false;
+    }
+
+    std::unique_ptr<Build> build(new Build());
+
+    build->name       = std::string(header.name, strnlen(header.name, sizeof(header.name)));
+    build->geometry   = FlashGeometry {header.address, header.size, header.pageSize};
+    build->programCRC = header.programCRC;
+    build->pages.resize(header.pages);
+
+    if (!stream.read(reinterpret_cast<char*>(build->pages.data()), header.pages * sizeof(StorePage))) {
+        return false;
+    }
+
+    std::size_t slash = path.find_last_of('/');
+
+    build->id = path.substr(slash + 1, path.size() - slash - 1 - 6);
+
+    _byCRC.emplace(((uint64_t)build->programCRC << 32) | build->geometry.size, build.get());
+    _builds[build->id] = std::move(build);
+
+    return true;
+} // FirmwareStore::readBuild
+
+std::string
+FirmwareStore::objectPath(
+    const Page& page
+) const
+{
+    char name[32];
+
+    snprintf(name, sizeof(name), "%08x%016llx", page.crc, (unsigned long long)page.hash);
+
+    return _directory + "/objects/" + std::string(name, 2) + "/" + name;
+}
+
+bool
+FirmwareStore::writeObject(
+    const Page&    page,
+    const uint8_t* data,
+    uint32_t       pageSize
+)
+{
+    auto key = std::make_pair(page.crc, page.hash);
+
+    if (_objects.count(key) != 0) {
+        return true; // Deduplicated
+    }
+
+    std::string path = objectPath(page);
+
+    if (!makeDirectory(path.substr(0, path.find_last_of('/'))) || !writeFile(path, data, pageSize)) {
+        return false;
+    }
+
+    _objects[key] = pageSize;
+
+    return true;
+}
+
+uint32_t
+FirmwareStore::erasedCRC(
+    uint32_t pageSize
+)
+{
+    std::vector<uint8_t> erased(pageSize, Image::ERASED);
+
+    return stm32CRC(STM32_CRC_INITIAL, erased.data(), erased.size());
+}
+
+const FirmwareStore::Build*
+FirmwareStore::add(
+    const Image&         image,
+    const FlashGeometry& geometry,
+    const std::string&   name
+)
+{
+    if (image.empty() || (geometry.pageSize == 0) || ((geometry.pageSize % sizeof(uint32_t)) != 0)
+        || ((geometry.address % geometry.pageSize) != 0) || ((geometry.size % geometry.pageSize) != 0)) {
+        return nullptr;
+    }
+
+    const Image::Segments& segments = image.segments();
+    auto                   last     = std::prev(segments.end());
+
+    if ((segments.begin()->first < geometry.address)
+        || ((uint64_t)last->first + last->second.size() > (uint64_t)geometry.address + geometry.size)) {
+        return nullptr;
+    }
+
+    std::unique_ptr<Build> build(new Build());
+    std::vector<uint8_t>   data(geometry.pageSize);
+    uint32_t               erased = erasedCRC(geometry.pageSize);
+
+    build->name     = name.substr(0, sizeof(BuildHeader::name));
+    build->geometry = geometry;
+
+    for (uint32_t address : image.pages(geometry.pageSize)) {
+        Page page;
+
+        image.page(address, data.data(), geometry.pageSize);
+
+        page.address = address;
+        page.crc     = stm32CRC(STM32_CRC_INITIAL, data.data(), data.size());
+        page.hash    = contentHash(data.data(), data.size());
+
+        if ((page.crc == erased) && std::all_of(data.begin(), data.end(), [](uint8_t b) {
+                                                    return b == Image::ERASED;
+                                                })) {
+            continue; // Nothing to store, as if it was not there
+        }
+
+        if (!writeObject(page, data.data(), geometry.pageSize)) {
+            return nullptr;
+        }
+
+        build->pages.push_back(page);
+    }
+
+    build->programCRC = programCRC(geometry, build->pages);
+
+    // Named after what it is: same flash, same id, whatever the name
+    char     id[32];
+    uint64_t hash = contentHash(reinterpret_cast<const uint8_t*>(&geometry), sizeof(geometry));
+
+    hash ^= contentHash(reinterpret_cast<const uint8_t*>(build->pages.data()), build->pages.size() * sizeof(Page));
+    snprintf(id, sizeof(id), "%08x-%016llx", build->programCRC, (unsigned long long)hash);
+    build->id = id;
+
+    auto existing = _builds.find(build->id);
+
+    if (existing != _builds.end()) {
+        return existing->second.get();
+    }
+
+    BuildHeader header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BUILD_MAGIC, sizeof(BUILD_MAGIC));
+    header.version    = BUILD_VERSION;
+    header.address    = geometry.address;
+    header.size       = geometry.size;
+    header.pageSize   = geometry.pageSize;
+    header.programCRC = build->programCRC;
+    header.pages      = build->pages.size();
+    memcpy(header.name, build->name.data(), build->name.size());
+
+    std::vector<uint8_t> file(sizeof(header) + build->pages.size() * sizeof(StorePage));
+
+    memcpy(file.data(), &header, sizeof(header));
+    memcpy(file.data() + sizeof(header), build->pages.data(), build->pages.size() * sizeof(StorePage));
+
+    if (!writeFile(_directory + "/builds/" + build->id + ".build", file.data(), file.size())) {
+        return nullptr;
+    }
+
+    const Build* added = build.get();
+
+    _byCRC.emplace(((uint64_t)build->programCRC << 32) | geometry.size, added);
+    _builds[build->id] = std::move(build);
+
+    return added;
+} // FirmwareStore::add
+
+std::vector<const FirmwareStore::Build*>
+FirmwareStore::find(
+    uint32_t programCRC,
+    uint32_t flashSize
+) const
+{
+    std::vector<const Build*> found;
+    auto                      range = _byCRC.equal_range(((uint64_t)programCRC << 32) | flashSize);
+
+    for (auto i = range.first; i != range.second; i++) {
+        found.push_back(i->second);
+    }
+
+    return found;
+}
+
+const FirmwareStore::Build*
+FirmwareStore::build(
+    const std::string& id
+) const
+{
+    auto i = _builds.find(id);
+
+    return (i != _builds.end()) ? i->second.get() : nullptr;
+}
+
+std::vector<const FirmwareStore::Build*>
+FirmwareStore::builds() const
+{
+    std::vector<const Build*> builds;
+
+    for (const auto& b : _builds) {
+        builds.push_back(b.second.get());
+    }
+
+    return builds;
+}
+
+std::vector<uint32_t>
+FirmwareStore::differingPages(
+    const Build& from,
+    const Build& to
+) const
+{
+    std::vector<uint32_t> pages;
+
+    if (!(from.geometry == to.geometry)) {
+        return pages;
+    }
+
+    // Both lists are in order, a page missing from one is erased there
+    auto f = from.pages.begin();
+    auto t = to.pages.begin();
+
+    while ((f != from.pages.end()) || (t != to.pages.end())) {
+        if ((t == to.pages.end()) || ((f != from.pages.end()) && (f->address < t->address))) {
+            pages.push_back((f++)->address);
+        } else if ((f == from.pages.end()) || (t->address < f->address)) {
+            pages.push_back((t++)->address);
+        } else {
+            if ((f->crc != t->crc) || (f->hash != t->hash)) {
+                pages.push_back(t->address);
+            }
+
+            f++;
+            t++;
+        }
+    }
+
+    return pages;
+} // FirmwareStore::differingPages
+
+std::vector<uint32_t>
+FirmwareStore::differingPages(
+    const std::map<uint32_t, uint32_t>& crcs,
+    const Build&                        to
+) const
+{
+    std::vector<uint32_t> pages;
+    const FlashGeometry&  g      = to.geometry;
+    uint32_t              erased = erasedCRC(g.pageSize);
+
+    for (uint32_t address = g.address; address < g.address + g.size; address += g.pageSize) {
+        const Page* page     = to.page(address);
+        uint32_t    expected = page ? page->crc : erased;
+        auto        crc      = crcs.find(address);
+
+        if ((crc == crcs.end()) || (crc->second != expected)) {
+            pages.push_back(address);
+        }
+    }
+
+    return pages;
+}
+
+bool
+FirmwareStore::load(
+    const Build& build,
+    Image&       image
+) const
+{
+    std::vector<uint8_t> data(build.geometry.pageSize);
+
+    for (const Page& page : build.pages) {
+        std::ifstream stream(objectPath(page), std::ios::binary);
+
+        if (!stream.read(reinterpret_cast<char*>(data.data()), data.size())) {
+            return false;
+        }
+
+        image.add(page.address, data.data(), data.size());
+    }
+
+    return true;
+}
+
+FirmwareStore::Statistics
+FirmwareStore::statistics() const
+{
+    Statistics s {_builds.size(), 0, _objects.size(), 0, 0};
+
+    for (const auto& b : _builds) {
+        s.pages      += b.second->pages.size();
+        s.flashBytes += (uint64_t)b.second->pages.size() * b.second->geometry.pageSize;
+    }
+
+    for (const auto& o : _objects) {
+        s.storedBytes += o.second;
+    }
+
+    return s;
+}
+}
+}
@@ -0,0 +1,322 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#include <core/bootloader/master/Fleet.hpp>
+
+#include <algorithm>
+#include <thread>
+
+namespace bootloader {
+namespace master {
+static const Clock::duration IDLE_POLL = std::chrono::milliseconds(20);
+
+Fleet::Fleet(
+    const std::vector<ITransport*>& buses,
+    uint8_t                         masterID,
+    const Options&                  options
+) :
+    _options(options),
+    _queues(buses.size()),
+    _running(0),
+    _statistics(buses.size())
+{
+    for (ITransport* bus : buses) {
+        _engines.emplace_back(new Engine(*bus, masterID));
+    }
+}
+
+Fleet::~Fleet() {}
+
+static Task<void>
+listen(
+    Engine&         engine,
+    Clock::duration window
+)
+{
+    // The engine notes the announces while this waits
+    co_await engine.sleep(window);
+}
+
+std::map<ModuleUID, std::vector<unsigned> >
+Fleet::discover()
+{
+    std::vector<std::thread> workers;
+
+    for (auto& engine : _engines) {
+        Engine* e = engine.get();
+
+        workers.emplace_back([this, e]() {
+                                 e->spawn(listen(*e, _options.discovery));
+                                 e->run();
+                             });
+    }
+
+    for (std::thread& w : workers) {
+        w.join();
+    }
+
+    _reachable.clear();
+
+    for (unsigned bus = 0; bus < _engines.size(); bus++) {
+        for (const auto& slave : _engines[bus]->announced()) {
+            _reachable[slave.first].push_back(bus);
+        }
+    }
+
+    return _reachable;
+} // Fleet::discover
+
+void
+Fleet::add(
+    ModuleUID         uid,
+    ImageCache::Entry image
+)
+{
+    create(uid)->image = image;
+}
+
+void
+Fleet::add(
+    ModuleUID                   uid,
+    std::shared_ptr<const Plan> plan
+)
+{
+    create(uid)->plan = plan;
+}
+
+Fleet::Job*
+Fleet::create(
+    ModuleUID uid
+)
+{
+    std::unique_ptr<Job> job(new Job());
+
+    job->uid = uid;
+
+    auto reachable = _reachable.find(uid);
+
+    if (reachable != _reachable.end()) {
+        job->buses = reachable->second;
+    } else {
+        // Not heard, maybe it just did not announce itself: try everywhere
+        for (unsigned bus = 0; bus < _engines.size(); bus++) {
+            job->buses.push_back(bus);
+        }
+    }
+
+    _jobs.push_back(std::move(job));
+
+    return _jobs.back().get();
+} // Fleet::create
+
+void
+Fleet::enqueue(
+    Job* job
+)
+{
+    unsigned home = job->buses.front();
+
+    for (unsigned bus : job->buses) {
+        if (_queues[bus].size() < _queues[home].size()) {
+            home = bus;
+        }
+    }
+
+    _queues[home].push_back(job);
+}
+
+Fleet::Job*
+Fleet::take(
+    unsigned bus
+)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    Job* job = nullptr;
+
+    if (!_queues[bus].empty()) {
+        job = _queues[bus].front();
+        _queues[bus].pop_front();
+    } else {
+        // Steal from the longest queue that has something for this bus,
+        // from the back, where the owner would get last
+        std::size_t longest = 0;
+
+        for (unsigned other = 0; other < _queues.size(); other++) {
+            std::deque<Job*>& queue = _queues[other];
+
+            if (queue.size() <= longest) {
+                continue;
+            }
+
+            for (auto i = queue.rbegin(); i != queue.rend(); i++) {
+                if (std::find((*i)->buses.begin(), (*i)->buses.end(), bus) != (*i)->buses.end()) {
+                    job     = *i;
+                    longest = queue.size();
+                    break;
+                }
+            }
+        }
+
+        if (job != nullptr) {
+            for (std::deque<Job*>& queue : _queues) {
+                auto i = std::find(queue.begin(), queue.end(), job);
+
+                if (i != queue.end()) {
+                    queue.erase(i);
+                    break;
+                }
+            }
+
+            _statistics[bus].stolen++;
+        }
+    }
+
+    if (job != nullptr) {
+        _running++;
+        _statistics[bus].jobs++;
+    }
+
+    return job;
+} // Fleet::take
+
+void
+Fleet::finish(
+    Job*                  job,
+    unsigned              bus,
+    const Master::Result& result,
+    Clock::duration       elapsed
+)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _running--;
+
+    if ((result.step == Master::Step::IDENTIFY) && (result.status == AcknowledgeStatus::NONE)) {
+        // Not on this bus, maybe on another
+        job->buses.erase(std::find(job->buses.begin(), job->buses.end(), bus));
+
+        if (!job->buses.empty()) {
+            enqueue(job);
+            return;
+        }
+    }
+
+    Outcome outcome {job->uid, (int)bus, result, elapsed};
+
+    _outcomes.push_back(outcome);
+
+    if (_report) {
+        _report(outcome);
+    }
+} // Fleet::finish
+
+bool
+Fleet::idle()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (_running > 0) {
+        return false;
+    }
+
+    for (const std::deque<Job*>& queue : _queues) {
+        if (!queue.empty()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+Task<void>
+Fleet::slot(
+    unsigned bus
+)
+{
+    Engine& engine = *_engines[bus];
+
+    for (;;) {
+        Job* job = take(bus);
+
+        if (job == nullptr) {
+            if (idle()) {
+                co_return;
+            }
+
+            // What is left is for the other buses, or may come back from them
+            co_await engine.sleep(IDLE_POLL);
+            continue;
+        }
+
+        Clock::time_point start  = Clock::now();
+        Master::Result    result;
+
+        if (job->plan) {
+            result = co_await flash(engine, job->uid, *job->plan, _options.flash, _options.pacing);
+        } else {
+            result = co_await flash(engine, job->uid, *job->image, _options.flash, _options.pacing);
+        }
+
+        finish(job, bus, result, Clock::now() - start);
+    }
+}
+
+std::vector<Fleet::Outcome>
+Fleet::run(
+    const Report& report
+)
+{
+    _report = report;
+    _outcomes.clear();
+
+    for (auto& job : _jobs) {
+        if (job->buses.empty() || (!job->image && !job->plan)) {
+            Outcome outcome {job->uid, -1, Master::Result {Master::Step::IDENTIFY, AcknowledgeStatus::NONE, Pacer::Metrics()}, Clock::duration::zero()};
+
+            _outcomes.push_back(outcome);
+
+            if (_report) {
+                _report(outcome);
+            }
+        } else {
+            enqueue(job.get());
+        }
+    }
+
+    std::vector<std::thread> workers;
+
+    for (unsigned bus = 0; bus < _engines.size(); bus++) {
+        workers.emplace_back([this, bus]() {
+                                 Engine& engine = *_engines[bus];
+
+                                 for (unsigned i = 0; i < _options.sessionsPerBus; i++) {
+                                     engine.spawn(slot(bus));
+                                 }
+
+                                 engine.run();
+
+                                 _statistics[bus].engine = engine.statistics();
+                             });
+    }
+
+    for (std::thread& w : workers) {
+        w.join();
+    }
+
+    _jobs.clear();
+    _report = Report();
+
+    return _outcomes;
+} // Fleet::run
+
+const std::vector<Fleet::BusStatistics>&
+Fleet::statistics() const
+{
+    return _statistics;
+}
+}
+}
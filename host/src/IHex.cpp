@@ -0,0 +1,501 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#include <core/bootloader/master/IHex.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace bootloader {
+namespace master {
+// The state machine of kk_ihex_read.c, same encoding in ihex_state::flags
+enum ReadState : uint8_t {
+    READ_WAIT_FOR_START = 0,
+    READ_COUNT_HIGH     = 1,
+    READ_COUNT_LOW,
+    READ_ADDRESS_MSB_HIGH,
+    READ_ADDRESS_MSB_LOW,
+    READ_ADDRESS_LSB_HIGH,
+    READ_ADDRESS_LSB_LOW,
+    READ_RECORD_TYPE_HIGH,
+    READ_RECORD_TYPE_LOW,
+    READ_DATA_HIGH,
+    READ_DATA_LOW
+};
+
+static const uint8_t        RECORD_TYPE_MASK   = 0x07;
+static const uint8_t        STATE_MASK         = 0x78;
+static const uint8_t        STATE_OFFSET       = 3;
+static const ihex_address_t ADDRESS_HIGH_MASK  = 0xFFFF0000;
+static const std::size_t    WRITE_BUFFER_BYTES = 64 * 1024;
+
+static const char HEX_DIGITS[] = "0123456789ABCDEF";
+
+// 0-15 for the hex digits, 0xFF for the rest
+struct HexTable {
+    uint8_t value[256];
+
+    HexTable()
+    {
+        memset(value, 0xFF, sizeof(value));
+
+        for (int i = 0; i < 16; i++) {
+            value[(uint8_t)HEX_DIGITS[i]] = i;
+            value[(uint8_t)"0123456789abcdef"[i]] = i;
+        }
+    }
+};
+
+static const HexTable HEX;
+
+static inline bool
+isBlank(
+    char c
+)
+{
+    return (c == '\n') || (c == '\r') || (c == ' ') || (c == '\t');
+}
+
+void
+encodeHex(
+    char*          out,
+    const uint8_t* data,
+    std::size_t    length
+)
+{
+    std::size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i low  = _mm_set1_epi8(0x0F);
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i gap  = _mm_set1_epi8('A' - '0' - 10);
+
+    for (; i + 16 <= length; i += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i high  = _mm_and_si128(_mm_srli_epi16(bytes, 4), low);
+        __m128i lows  = _mm_and_si128(bytes, low);
+
+        // High nibble first, as they are written
+        __m128i first  = _mm_unpacklo_epi8(high, lows);
+        __m128i second = _mm_unpackhi_epi8(high, lows);
+
+        first  = _mm_add_epi8(_mm_add_epi8(first, zero), _mm_and_si128(_mm_cmpgt_epi8(first, nine), gap));
+        second = _mm_add_epi8(_mm_add_epi8(second, zero), _mm_and_si128(_mm_cmpgt_epi8(second, nine), gap));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i), first);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i + 16), second);
+    }
+#endif
+
+    for (; i < length; i++) {
+        out[2 * i]     = HEX_DIGITS[data[i] >> 4];
+        out[2 * i + 1] = HEX_DIGITS[data[i] & 0x0F];
+    }
+} // encodeHex
+
+bool
+decodeHex(
+    uint8_t*    out,
+    const char* hex,
+    std::size_t length
+)
+{
+    std::size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i digit = _mm_set1_epi8('0');
+    const __m128i alpha = _mm_set1_epi8('a');
+    const __m128i lower = _mm_set1_epi8(0x20);
+    const __m128i nine  = _mm_set1_epi8(9);
+    const __m128i five  = _mm_set1_epi8(5);
+    const __m128i ten   = _mm_set1_epi8(10);
+    const __m128i byte  = _mm_set1_epi16(0x00FF);
+
+    for (; i + 8 <= length; i += 8) {
+        __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hex + 2 * i));
+
+        // '0'-'9' as they are, 'A'-'F' and 'a'-'f' once in lower case:
+        // the unsigned distance from the first one tells
+        __m128i d       = _mm_sub_epi8(chars, digit);
+        __m128i a       = _mm_sub_epi8(_mm_or_si128(chars, lower), alpha);
+        __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(d, nine), d);
+        __m128i isAlpha = _mm_cmpeq_epi8(_mm_min_epu8(a, five), a);
+
+        if (_mm_movemask_epi8(_mm_or_si128(isDigit, isAlpha)) != 0xFFFF) {
+            return false;
+        }
+
+        __m128i nibbles = _mm_or_si128(_mm_and_si128(d, isDigit), _mm_and_si128(_mm_add_epi8(a, ten), isAlpha));
+
+        // Each 16 bit lane has the high nibble in its low byte
+        __m128i bytes = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(nibbles, byte), 4), _mm_srli_epi16(nibbles, 8));
+
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(bytes, bytes));
+    }
+#endif
+
+    for (; i < length; i++) {
+        uint8_t h = HEX.value[(uint8_t)hex[2 * i]];
+        uint8_t l = HEX.value[(uint8_t)hex[2 * i + 1]];
+
+        if ((h | l) & 0xF0) {
+            return false;
+        }
+
+        out[i] = (h << 4) | l;
+    }
+
+    return true;
+} // decodeHex
+
+IHexReader::IHexReader(
+    const DataRead& dataRead
+) :
+    _dataRead(dataRead),
+    _stray(0)
+{
+    begin();
+}
+
+void
+IHexReader::begin(
+    ihex_address_t address
+)
+{
+    _ihex.address     = address;
+    _ihex.segment     = 0;
+    _ihex.flags       = 0;
+    _ihex.line_length = 0;
+    _ihex.length      = 0;
+    _stray            = 0;
+}
+
+void
+IHexReader::beginAtSegment(
+    ihex_segment_t segment
+)
+{
+    begin();
+    _ihex.segment = segment;
+}
+
+void
+IHexReader::end()
+{
+    uint8_t type = _ihex.flags & RECORD_TYPE_MASK;
+    uint8_t sum  = _ihex.length;
+
+    if ((sum == 0) && (type == IHEX_DATA_RECORD)) {
+        return;
+    }
+
+    // The received checksum is the byte after the data
+    sum += type + (_ihex.address & 0xFF) + ((_ihex.address >> 8) & 0xFF);
+
+    for (uint8_t i = 0; i < _ihex.length; i++) {
+        sum += _ihex.data[i];
+    }
+
+    sum = (uint8_t)(~sum + 1) ^ _ihex.data[_ihex.length];
+
+    if (_dataRead(&_ihex, type, sum)) {
+        if (type == IHEX_EXTENDED_LINEAR_ADDRESS_RECORD) {
+            _ihex.address &= 0xFFFF;
+            _ihex.address |= ((ihex_address_t)_ihex.data[0] << 24) | ((ihex_address_t)_ihex.data[1] << 16);
+        } else if (type == IHEX_EXTENDED_SEGMENT_ADDRESS_RECORD) {
+            _ihex.segment = (ihex_segment_t)((_ihex.data[0] << 8) | _ihex.data[1]);
+        }
+    }
+
+    _ihex.length = 0;
+    _ihex.flags  = 0;
+} // IHexReader::end
+
+// ihex_read_byte, as it is, but for the stray characters count
+void
+IHexReader::readByte(
+    char byte
+)
+{
+    uint8_t b     = (uint8_t)byte;
+    uint8_t len   = _ihex.length;
+    uint8_t state = _ihex.flags & STATE_MASK;
+
+    _ihex.flags ^= state;
+    state      >>= STATE_OFFSET;
+
+    if ((b >= '0') && (b <= '9')) {
+        b -= '0';
+    } else if ((b >= 'A') && (b <= 'F')) {
+        b -= 'A' - 10;
+    } else if ((b >= 'a') && (b <= 'f')) {
+        b -= 'a' - 10;
+    } else if (b == ':') {
+        // Sync to a new record at any state
+        end();
+        _ihex.flags |= READ_COUNT_HIGH << STATE_OFFSET;
+        return;
+    } else {
+        if ((state != READ_WAIT_FOR_START) || !isBlank(byte)) {
+            _stray++;
+        }
+
+        _ihex.flags |= state << STATE_OFFSET;
+        return;
+    }
+
+    if (!(++state & 1)) {
+        // High nibble, kept at the end of the data
+        _ihex.data[len] = b << 4;
+    } else {
+        b = (_ihex.data[len] |= b);
+
+        switch (state >> 1) {
+          default:
+              // Still waiting for a ':'
+              _stray++;
+              return;
+          case (READ_COUNT_LOW >> 1):
+              _ihex.line_length = b;
+              break;
+          case (READ_ADDRESS_MSB_LOW >> 1):
+              _ihex.address &= ADDRESS_HIGH_MASK;
+              _ihex.address |= (ihex_address_t)b << 8;
+              break;
+          case (READ_ADDRESS_LSB_LOW >> 1):
+              _ihex.address |= (ihex_address_t)b;
+              break;
+          case (READ_RECORD_TYPE_LOW >> 1):
+              if (b & ~RECORD_TYPE_MASK) {
+                  // Unknown record types are skipped
+                  return;
+              }
+
+              _ihex.flags = (_ihex.flags & ~RECORD_TYPE_MASK) | b;
+              break;
+          case (READ_DATA_LOW >> 1):
+              if (len < _ihex.line_length) {
+                  _ihex.length = len + 1;
+                  state        = READ_DATA_HIGH;
+                  break;
+              }
+
+              // The last one is the checksum
+              end();
+              return;
+        } // switch
+    }
+
+    _ihex.flags |= state << STATE_OFFSET;
+} // IHexReader::readByte
+
+std::size_t
+IHexReader::readRecord(
+    const char* data,
+    std::size_t count
+)
+{
+    // :LLAAAATT, the data, the checksum
+    uint8_t header[4];
+
+    if ((count < 11) || !decodeHex(header, data + 1, sizeof(header))) {
+        return 0;
+    }
+
+    uint8_t     length = header[0];
+    uint8_t     type   = header[3];
+    std::size_t size   = 1 + 2 * (sizeof(header) + length + 1);
+
+    if ((type & ~RECORD_TYPE_MASK) || (count < size) || !decodeHex(_ihex.data, data + 9, length + 1)) {
+        return 0;
+    }
+
+    _ihex.line_length = length;
+    _ihex.address     = (_ihex.address & ADDRESS_HIGH_MASK) | ((ihex_address_t)header[1] << 8) | header[2];
+    _ihex.flags       = type;
+    _ihex.length      = length;
+
+    end();
+
+    return size;
+} // IHexReader::readRecord
+
+void
+IHexReader::read(
+    const char* data,
+    std::size_t count
+)
+{
+    const char* last = data + count;
+
+    while (data < last) {
+        if (((_ihex.flags & STATE_MASK) != (READ_WAIT_FOR_START << STATE_OFFSET)) || (_ihex.length != 0)) {
+            readByte(*data++);
+            continue;
+        }
+
+        // Between the records
+        if (*data != ':') {
+            if (!isBlank(*data)) {
+                _stray++;
+            }
+
+            data++;
+            continue;
+        }
+
+        std::size_t used = ((_ihex.flags & RECORD_TYPE_MASK) == IHEX_DATA_RECORD) ? readRecord(data, last - data) : 0;
+
+        if (used != 0) {
+            data += used;
+        } else {
+            readByte(*data++);
+        }
+    }
+} // IHexReader::read
+
+struct ihex_state&
+IHexReader::state()
+{
+    return _ihex;
+}
+
+std::size_t
+IHexReader::stray() const
+{
+    return _stray;
+}
+
+IHexWriter::IHexWriter(
+    const Flush& flush,
+    unsigned     lineLength
+) :
+    _flush(flush),
+    _lineLength(std::max(1u, std::min(lineLength, (unsigned)IHEX_LINE_MAX_LENGTH))),
+    _address(0),
+    _upper(0),
+    _length(0)
+{
+    _buffer.reserve(WRITE_BUFFER_BYTES + 1024);
+}
+
+void
+IHexWriter::writeAt(
+    ihex_address_t address
+)
+{
+    flushLine();
+    _address = address;
+}
+
+void
+IHexWriter::write(
+    const void* data,
+    std::size_t count
+)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+    while (count > 0) {
+        // Records do not cross 64 KiB boundaries
+        ihex_address_t address = _address + _length;
+        std::size_t    room    = std::min<std::size_t>(_lineLength - _length, 0x10000 - (address & 0xFFFF));
+        std::size_t    n       = std::min(count, room);
+
+
+        memcpy(_line + _length, bytes, n);
+        _length += n;
+        bytes   += n;
+        count   -= n;
+
+        if (n == room) {
+            flushLine();
+        }
+    }
+}
+
+void
+IHexWriter::end()
+{
+    flushLine();
+    record(IHEX_END_OF_FILE_RECORD, 0, nullptr, 0);
+    flush();
+}
+
+void
+IHexWriter::record(
+    ihex_record_type_t type,
+    uint16_t           address,
+    const uint8_t*     data,
+    std::size_t        length
+)
+{
+    uint8_t header[4] = {(uint8_t)length, (uint8_t)(address >> 8), (uint8_t)address, type};
+    uint8_t sum       = 0;
+
+    for (uint8_t b : header) {
+        sum += b;
+    }
+
+    for (std::size_t i = 0; i < length; i++) {
+        sum += data[i];
+    }
+
+    sum = ~sum + 1;
+
+    std::size_t at = _buffer.size();
+
+    _buffer.resize(at + 1 + 2 * (sizeof(header) + length + 1) + sizeof(IHEX_NEWLINE_STRING) - 1);
+
+    char* w = _buffer.data() + at;
+
+    *w++ = ':';
+    encodeHex(w, header, sizeof(header));
+    encodeHex(w + 2 * sizeof(header), data, length);
+    w += 2 * (sizeof(header) + length);
+    encodeHex(w, &sum, 1);
+    memcpy(w + 2, IHEX_NEWLINE_STRING, sizeof(IHEX_NEWLINE_STRING) - 1);
+
+    if (_buffer.size() >= WRITE_BUFFER_BYTES) {
+        flush();
+    }
+} // IHexWriter::record
+
+void
+IHexWriter::flushLine()
+{
+    if (_length == 0) {
+        return;
+    }
+
+    if ((_address & ADDRESS_HIGH_MASK) != _upper) {
+        uint8_t upper[2] = {(uint8_t)(_address >> 24), (uint8_t)(_address >> 16)};
+
+        record(IHEX_EXTENDED_LINEAR_ADDRESS_RECORD, 0, upper, sizeof(upper));
+        _upper = _address & ADDRESS_HIGH_MASK;
+    }
+
+    record(IHEX_DATA_RECORD, _address & 0xFFFF, _line, _length);
+
+    _address += _length;
+    _length   = 0;
+}
+
+void
+IHexWriter::flush()
+{
+    if (!_buffer.empty()) {
+        _flush(_buffer.data(), _buffer.data() + _buffer.size());
+        _buffer.clear();
+    }
+}
+}
+}
@@ -0,0 +1,240 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#include <core/bootloader/master/Image.hpp>
+#include <core/bootloader/master/IHex.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+namespace bootloader {
+namespace master {
+static const std::size_t READ_BUFFER_BYTES = 64 * 1024;
+
+void
+Image::add(
+    uint32_t       address,
+    const uint8_t* data,
+    std::size_t    length
+)
+{
+    if (length == 0) {
+        return;
+    }
+
+    uint32_t from = address;
+    uint32_t to   = address + length;
+
+    // The first segment that ends at or after from
+    auto first = _segments.upper_bound(from);
+
+    if ((first != _segments.begin()) && (std::prev(first)->first + std::prev(first)->second.size() >= from)) {
+        first = std::prev(first);
+    }
+
+    // Merge everything in [first, last) into one segment
+    auto last = first;
+
+    while ((last != _segments.end()) && (last->first <= to)) {
+        from = std::min(from, last->first);
+        to   = std::max(to, (uint32_t)(last->first + last->second.size()));
+        last++;
+    }
+
+    Segment merged(to - from, ERASED);
+
+    for (auto i = first; i != last; i++) {
+        std::copy(i->second.begin(), i->second.end(), merged.begin() + (i->first - from));
+    }
+
+    std::copy(data, data + length, merged.begin() + (address - from));
+
+    _segments.erase(first, last);
+    _segments.emplace(from, std::move(merged));
+} // Image::add
+
+bool
+Image::readIHex(
+    std::istream& stream
+)
+{
+    bool ended  = false;
+    bool failed = false;
+
+    IHexReader reader([&](struct ihex_state* ihex, ihex_record_type_t type, ihex_bool_t checksumMismatch) -> ihex_bool_t {
+                          if (checksumMismatch || (ihex->length < ihex->line_length)) {
+                              failed = true;
+                              return false;
+                          }
+
+                          if (ended) {
+                              return true;
+                          }
+
+                          if (type == IHEX_DATA_RECORD) {
+                              add(IHEX_LINEAR_ADDRESS(ihex), ihex->data, ihex->length);
+                          } else if (type == IHEX_END_OF_FILE_RECORD) {
+                              ended = true;
+                          }
+
+                          return true; // Start addresses do not matter here
+                      });
+
+    char buffer[READ_BUFFER_BYTES];
+
+    while (!failed && stream) {
+        stream.read(buffer, sizeof(buffer));
+        reader.read(buffer, stream.gcount());
+    }
+
+    reader.end();
+
+    return !failed && (reader.stray() == 0);
+} // Image::readIHex
+
+bool
+Image::loadIHex(
+    const std::string& path
+)
+{
+    std::ifstream stream(path, std::ios::binary);
+
+    return stream && readIHex(stream);
+}
+
+bool
+Image::loadBinary(
+    const std::string& path,
+    uint32_t           address
+)
+{
+    std::ifstream stream(path, std::ios::binary);
+
+    if (!stream) {
+        return false;
+    }
+
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+
+    add(address, data.data(), data.size());
+
+    return true;
+}
+
+void
+Image::align(
+    uint32_t alignment
+)
+{
+    Segments segments;
+
+    segments.swap(_segments);
+
+    for (const auto& s : segments) {
+        uint32_t from = s.first - (s.first % alignment);
+        uint32_t to   = s.first + s.second.size();
+
+        to += (alignment - (to % alignment)) % alignment;
+
+        auto last = _segments.empty() ? _segments.end() : std::prev(_segments.end());
+
+        if ((last != _segments.end()) && (last->first + last->second.size() >= from)) {
+            // The padding reaches the previous segment: extend that one
+            last->second.resize(to - last->first, ERASED);
+        } else {
+            last = _segments.emplace(from, Segment(to - from, ERASED)).first;
+        }
+
+        std::copy(s.second.begin(), s.second.end(), last->second.begin() + (s.first - last->first));
+    }
+}
+
+bool
+Image::isAligned(
+    uint32_t alignment
+) const
+{
+    for (const auto& s : _segments) {
+        if (((s.first % alignment) != 0) || ((s.second.size() % alignment) != 0)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+std::vector<uint32_t>
+Image::pages(
+    uint32_t pageSize
+) const
+{
+    std::vector<uint32_t> pages;
+
+    for (const auto& s : _segments) {
+        uint64_t to = (uint64_t)s.first + s.second.size();
+
+        for (uint64_t address = s.first - (s.first % pageSize); address < to; address += pageSize) {
+            if (pages.empty() || (pages.back() != address)) {
+                pages.push_back(address);
+            }
+        }
+    }
+
+    return pages;
+}
+
+void
+Image::page(
+    uint32_t address,
+    uint8_t* data,
+    uint32_t pageSize
+) const
+{
+    std::fill(data, data + pageSize, ERASED);
+
+    // From the last segment that starts before the page
+    auto i = _segments.upper_bound(address);
+
+    if (i != _segments.begin()) {
+        i--;
+    }
+
+    for (; (i != _segments.end()) && (i->first < (uint64_t)address + pageSize); i++) {
+        uint64_t from = std::max<uint64_t>(address, i->first);
+        uint64_t to   = std::min<uint64_t>((uint64_t)address + pageSize, (uint64_t)i->first + i->second.size());
+
+        if (from < to) {
+            std::copy(i->second.begin() + (from - i->first), i->second.begin() + (to - i->first), data + (from - address));
+        }
+    }
+} // Image::page
+
+const Image::Segments&
+Image::segments() const
+{
+    return _segments;
+}
+
+std::size_t
+Image::size() const
+{
+    std::size_t size = 0;
+
+    for (const auto& s : _segments) {
+        size += s.second.size();
+    }
+
+    return size;
+}
+
+bool
+Image::empty() const
+{
+    return _segments.empty();
+}
+}
+}
@@ -0,0 +1,59 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#include <core/bootloader/master/ImageCache.hpp>
+
+namespace bootloader {
+namespace master {
+ImageCache::Entry
+ImageCache::load(
+    const std::string& path,
+    bool               binary,
+    uint32_t           address
+)
+{
+    std::promise<Entry>       parsed;
+    std::shared_future<Entry> entry;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto i = _entries.find(path);
+
+        if (i != _entries.end()) {
+            entry = i->second;
+        } else {
+            _entries.emplace(path, parsed.get_future().share());
+        }
+    }
+
+    if (entry.valid()) {
+        return entry.get();
+    }
+
+    // First to ask: parse it, out of the lock
+    std::shared_ptr<Image> image(new Image());
+    bool                   success = binary ? image->loadBinary(path, address) : image->loadIHex(path);
+
+    if (success && !image->empty()) {
+        image->align(sizeof(uint32_t));
+        parsed.set_value(image);
+        return image;
+    }
+
+    parsed.set_value(nullptr);
+    return nullptr;
+} // ImageCache::load
+
+std::size_t
+ImageCache::size() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    return _entries.size();
+}
+}
+}
@@ -0,0 +1,218 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#include <core/bootloader/master/Master.hpp>
+
+namespace bootloader {
+namespace master {
+Master::Master(
+    ITransport&                 transport,
+    uint8_t                     masterID,
+    const Pacer::Configuration& configuration
+) :
+    _transport(transport),
+    _masterID(masterID),
+    _configuration(configuration)
+{}
+
+std::map<ModuleUID, uint8_t>
+Master::listen(
+    Clock::duration window
+)
+{
+    std::map<ModuleUID, uint8_t> slaves;
+    Clock::time_point            until = Clock::now() + window;
+    Frame                        frame;
+
+    for (Clock::time_point now = Clock::now(); now < until; now = Clock::now()) {
+        if (!_transport.receive(frame, until - now)) {
+            continue;
+        }
+
+        const messages::Announce* announce = frame.as<messages::Announce>();
+
+        if ((frame.topic == BOOTLOADER_MASTER_TOPIC_ID) && (announce != nullptr) && (announce->command == MessageType::REQUEST)) {
+            slaves[announce->data.uid] = frame.node;
+        }
+    }
+
+    return slaves;
+}
+
+AcknowledgeStatus
+Master::identify(
+    ModuleUID uid,
+    uint16_t* slaveID
+)
+{
+    Channel                 channel(_transport, _masterID, ANY_NODE, _configuration);
+    messages::IdentifySlave m; // Outside of the sessions, always in the legacy layout
+    Frame                   ack;
+
+    m.data.uid = uid;
+
+    Request           request(m);
+    AcknowledgeStatus status = channel.transact(request, &ack, false);
+
+    if ((status == AcknowledgeStatus::OK) && (slaveID != nullptr)) {
+        *slaveID = ack.node;
+    }
+
+    return status;
+}
+
+std::unique_ptr<Session>
+Master::session(
+    ModuleUID uid,
+    uint16_t  slaveID
+)
+{
+    return std::unique_ptr<Session>(new Session(_transport, _masterID, uid, slaveID, _configuration));
+}
+
+template <typename Source>
+Master::Result
+Master::flashFrom(
+    ModuleUID                uid,
+    const Source&            source,
+    const Options&           options,
+    const Session::Progress& progress
+)
+{
+    uint16_t                 slaveID = ANY_NODE;
+    AcknowledgeStatus        status  = identify(uid, &slaveID);
+    std::unique_ptr<Session> s;
+
+    auto result = [&](Step step, AcknowledgeStatus status) {
+                      return Result {step, status, s ? s->channel().pacer().metrics() : Pacer::Metrics()};
+                  };
+
+    if (status != AcknowledgeStatus::OK) {
+        return result(Step::IDENTIFY, status);
+    }
+
+    s = session(uid, slaveID);
+
+    if ((status = s->open()) != AcknowledgeStatus::OK) {
+        return result(Step::OPEN, status);
+    }
+
+    if ((status = s->eraseProgram()) != AcknowledgeStatus::OK) {
+        return result(Step::ERASE, status);
+    }
+
+    if ((status = s->write(source, progress)) != AcknowledgeStatus::OK) {
+        return result(Step::WRITE, status);
+    }
+
+    if (options.verify && (s->mode() & RANGE_CRC)) {
+        if ((status = s->verify(source)) != AcknowledgeStatus::OK) {
+            return result(Step::VERIFY, status);
+        }
+    }
+
+    // The image is in flash: the CRC the slave computes over the program
+    // flash is the one it will check at boot
+    payload::DescribeV2 description;
+
+    if ((status = s->describe(description)) != AcknowledgeStatus::OK) {
+        return result(Step::COMMIT, status);
+    }
+
+    if ((status = s->writeProgramCRC(description.flashCRC)) != AcknowledgeStatus::OK) {
+        return result(Step::COMMIT, status);
+    }
+
+    if (options.reset) {
+        if ((status = s->reset()) != AcknowledgeStatus::OK) {
+            return result(Step::RESET, status);
+        }
+    } else {
+        s->close();
+    }
+
+    return result(Step::RESET, AcknowledgeStatus::OK);
+} // Master::flashFrom
+
+Master::Result
+Master::flash(
+    ModuleUID                uid,
+    const Image&             image,
+    const Options&           options,
+    const Session::Progress& progress
+)
+{
+    return flashFrom(uid, image, options, progress);
+}
+
+Master::Result
+Master::flash(
+    ModuleUID                uid,
+    const Plan&              plan,
+    const Options&           options,
+    const Session::Progress& progress
+)
+{
+    return flashFrom(uid, plan, options, progress);
+}
+
+const char*
+stepName(
+    Master::Step step
+)
+{
+    switch (step) {
+      case Master::Step::IDENTIFY:
+          return "identify";
+      case Master::Step::OPEN:
+          return "open";
+      case Master::Step::ERASE:
+          return "erase";
+      case Master::Step::WRITE:
+          return "write";
+      case Master::Step::VERIFY:
+          return "verify";
+      case Master::Step::COMMIT:
+          return "commit";
+      case Master::Step::RESET:
+          return "reset";
+    }
+
+    return "?";
+}
+
+const char*
+statusName(
+    AcknowledgeStatus status
+)
+{
+    switch (status) {
+      case AcknowledgeStatus::NONE:
+          return "no acknowledge";
+      case AcknowledgeStatus::OK:
+          return "ok";
+      case AcknowledgeStatus::WRONG_UID:
+          return "wrong UID";
+      case AcknowledgeStatus::WRONG_SEQUENCE:
+          return "wrong sequence";
+      case AcknowledgeStatus::DISCARD:
+          return "discarded";
+      case AcknowledgeStatus::NOT_SELECTED:
+          return "not selected";
+      case AcknowledgeStatus::NOT_IMPLEMENTED:
+          return "not implemented";
+      case AcknowledgeStatus::BROKEN:
+          return "broken";
+      case AcknowledgeStatus::ERROR:
+          return "error";
+      case AcknowledgeStatus::IN_PROGRESS:
+          return "in progress";
+      default:
+          return "?";
+    }
+}
+}
+}
@@ -0,0 +1,203 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#include <core/bootloader/master/Pacer.hpp>
+
+#include <algorithm>
+#include <ostream>
+
+namespace bootloader {
+namespace master {
+Pacer::Pacer() : Pacer(Configuration()) {}
+
+Pacer::Pacer(
+    const Configuration& configuration
+) :
+    _configuration(configuration),
+    _lastSend(),
+    _holdUntil(),
+    _measured(false)
+{
+    _metrics.gap             = _configuration.minimumGap;
+    _metrics.baseLatency     = Duration::max();
+    _metrics.smoothedLatency = Duration::zero();
+    _metrics.latencyVariance = Duration::zero();
+    _metrics.timeout         = _configuration.initialTimeout;
+}
+
+void
+Pacer::setMaximumWindow(
+    unsigned window
+)
+{
+    _configuration.maximumWindow = std::max(window, 1u);
+    _metrics.window = std::min(_metrics.window, (double)_configuration.maximumWindow);
+}
+
+bool
+Pacer::canSend(
+    Clock::time_point now
+) const
+{
+    return (_metrics.inFlight < (unsigned)_metrics.window) && (now >= nextSendTime());
+}
+
+Clock::time_point
+Pacer::nextSendTime() const
+{
+    return _lastSend + _metrics.gap;
+}
+
+void
+Pacer::onSend(
+    Clock::time_point now
+)
+{
+    _lastSend = now;
+    _metrics.sent++;
+    _metrics.inFlight++;
+}
+
+void
+Pacer::onAcknowledge(
+    Clock::time_point sentAt,
+    Clock::time_point now,
+    bool              retransmitted
+)
+{
+    Duration latency = now - sentAt;
+
+    _metrics.acknowledged++;
+
+    if (_metrics.inFlight > 0) {
+        _metrics.inFlight--;
+    }
+
+    if (retransmitted) {
+        return;
+    }
+
+    // RFC 6298 estimator
+    if (!_measured) {
+        _metrics.smoothedLatency = latency;
+        _metrics.latencyVariance = latency / 2;
+        _measured = true;
+    } else {
+        Duration error = (latency > _metrics.smoothedLatency) ? (latency - _metrics.smoothedLatency) : (_metrics.smoothedLatency - latency);
+        _metrics.latencyVariance = (3 * _metrics.latencyVariance + error) / 4;
+        _metrics.smoothedLatency = (7 * _metrics.smoothedLatency + latency) / 8;
+    }
+
+    _metrics.timeout     = std::min(std::max(_metrics.smoothedLatency + 4 * _metrics.latencyVariance, _configuration.minimumTimeout), _configuration.maximumTimeout);
+    _metrics.baseLatency = std::min(_metrics.baseLatency, latency);
+
+    Duration threshold = std::max(std::chrono::duration_cast<Duration>(_metrics.baseLatency * _configuration.latencyTolerance),
+                                  _metrics.baseLatency + _configuration.latencyFloor);
+
+    if (latency > threshold) {
+        decrease(Decision::DECREASE_LATENCY, now);
+        return;
+    }
+
+    // Additive increase: a whole message per window worth of acknowledges
+    _metrics.window = std::min(_metrics.window + 1.0 / _metrics.window, (double)_configuration.maximumWindow);
+    _metrics.gap    = std::max(_metrics.gap - _configuration.gapStep, _configuration.minimumGap);
+
+    _metrics.increases++;
+    _metrics.lastDecision = Decision::INCREASE;
+} // Pacer::onAcknowledge
+
+void
+Pacer::onTimeout(
+    Clock::time_point now
+)
+{
+    _metrics.lost++;
+
+    if (_metrics.inFlight > 0) {
+        _metrics.inFlight--;
+    }
+
+    // Back off until an acknowledge comes back
+    _metrics.timeout = std::min(_metrics.timeout * 2, _configuration.maximumTimeout);
+
+    decrease(Decision::DECREASE_LOSS, now);
+}
+
+Pacer::Duration
+Pacer::timeout() const
+{
+    return _metrics.timeout;
+}
+
+const Pacer::Metrics&
+Pacer::metrics() const
+{
+    return _metrics;
+}
+
+void
+Pacer::decrease(
+    Decision          why,
+    Clock::time_point now
+)
+{
+    if (now < _holdUntil) {
+        // Same congestion event
+        return;
+    }
+
+    _metrics.window = std::max(_metrics.window / 2, 1.0);
+    _metrics.gap    = std::min(std::max(_metrics.gap * 2, _configuration.gapStep), _configuration.maximumGap);
+
+    _holdUntil = now + std::max(_metrics.smoothedLatency, _configuration.minimumTimeout);
+
+    _metrics.decreases++;
+    _metrics.lastDecision = why;
+}
+
+static const char*
+decisionName(
+    Pacer::Decision decision
+)
+{
+    switch (decision) {
+      case Pacer::Decision::INCREASE:
+          return "increase";
+      case Pacer::Decision::DECREASE_LATENCY:
+          return "decrease(latency)";
+      case Pacer::Decision::DECREASE_LOSS:
+          return "decrease(loss)";
+      default:
+          return "none";
+    }
+}
+
+std::ostream&
+operator<<(
+    std::ostream&         stream,
+    const Pacer::Metrics& metrics
+)
+{
+    using std::chrono::microseconds;
+    using std::chrono::duration_cast;
+
+    stream << "sent="       << metrics.sent
+           << " acked="     << metrics.acknowledged
+           << " lost="      << metrics.lost
+           << " window="    << metrics.window
+           << " gap="       << duration_cast<microseconds>(metrics.gap).count() << "us"
+           << " latency="   << duration_cast<microseconds>(metrics.smoothedLatency).count() << "us"
+           << " base="      << ((metrics.baseLatency == Pacer::Duration::max()) ? -1 : duration_cast<microseconds>(metrics.baseLatency).count()) << "us"
+           << " timeout="   << duration_cast<microseconds>(metrics.timeout).count() << "us"
+           << " increases=" << metrics.increases
+           << " decreases=" << metrics.decreases
+           << " last="      << decisionName(metrics.lastDecision);
+
+    return stream;
+}
+}
+}
@@ -0,0 +1,268 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#include <core/bootloader/master/Plan.hpp>
+#include <core/bootloader/master/CRC.hpp>
+#include <core/bootloader/master/Requests.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace bootloader {
+namespace master {
+static const std::size_t TABLE_ALIGNMENT = 64;
+
+static_assert(sizeof(Request) == LONG_MESSAGE_LENGTH, "Requests are stored as they are");
+
+Plan::Plan(
+    const uint8_t* map,
+    std::size_t    length
+) :
+    _map(map),
+    _length(length)
+{}
+
+Plan::~Plan()
+{
+    munmap(const_cast<uint8_t*>(_map), _length);
+}
+
+const PlanHeader&
+Plan::header() const
+{
+    return *at<PlanHeader>(0);
+}
+
+const PlanTrack*
+Plan::track(
+    uint32_t mode
+) const
+{
+    const PlanTrack* tracks = at<PlanTrack>(header().trackOffset);
+
+    for (uint32_t i = 0; i < header().tracks; i++) {
+        if (tracks[i].mode == (mode & PLAN_TRACK_MODES)) {
+            return &tracks[i];
+        }
+    }
+
+    return nullptr;
+}
+
+const Request*
+Plan::requests(
+    const PlanTrack& track
+) const
+{
+    return at<Request>(track.offset);
+}
+
+const PlanSegment*
+Plan::segments() const
+{
+    return at<PlanSegment>(header().segmentOffset);
+}
+
+const PlanPage*
+Plan::pages() const
+{
+    return at<PlanPage>(header().pageOffset);
+}
+
+// Every table must be within the file
+static bool
+fits(
+    uint64_t    offset,
+    uint64_t    count,
+    std::size_t size,
+    std::size_t length
+)
+{
+    return ((offset % TABLE_ALIGNMENT) == 0) && (offset <= length) && (count <= (length - offset) / size);
+}
+
+std::shared_ptr<const Plan>
+Plan::open(
+    const std::string& path
+)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    struct stat s;
+
+    if ((fstat(fd, &s) != 0) || ((std::size_t)s.st_size < sizeof(PlanHeader))) {
+        close(fd);
+        return nullptr;
+    }
+
+    std::size_t length = s.st_size;
+    void*       map    = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        return nullptr;
+    }
+
+    std::shared_ptr<const Plan> plan(new Plan(static_cast<const uint8_t*>(map), length));
+    const PlanHeader&           h = plan->header();
+
+    bool valid = (memcmp(h.magic, PLAN_MAGIC, sizeof(PLAN_MAGIC)) == 0)
+                 && (h.version == PLAN_VERSION)
+                 && (h.headerSize == sizeof(PlanHeader))
+                 && (h.messageLength == LONG_MESSAGE_LENGTH)
+                 && (h.fileSize == length)
+                 && fits(h.trackOffset, h.tracks, sizeof(PlanTrack), length)
+                 && fits(h.segmentOffset, h.segments, sizeof(PlanSegment), length)
+                 && fits(h.pageOffset, h.pages, sizeof(PlanPage), length);
+
+    for (uint32_t i = 0; valid && (i < h.tracks); i++) {
+        const PlanTrack& t = plan->at<PlanTrack>(h.trackOffset)[i];
+
+        valid = fits(t.offset, t.count, sizeof(Request), length);
+    }
+
+    return valid ? plan : nullptr;
+} // Plan::open
+
+// Appends a table, aligned
+template <typename T>
+static uint64_t
+append(
+    std::vector<uint8_t>& file,
+    const T*              table,
+    std::size_t           count
+)
+{
+    file.resize((file.size() + TABLE_ALIGNMENT - 1) & ~(TABLE_ALIGNMENT - 1), 0);
+
+    uint64_t offset = file.size();
+
+    file.insert(file.end(), reinterpret_cast<const uint8_t*>(table), reinterpret_cast<const uint8_t*>(table + count));
+
+    return offset;
+}
+
+bool
+Plan::compile(
+    const Image&       image,
+    const std::string& path,
+    uint32_t           pageSize
+)
+{
+    if (image.empty() || (pageSize == 0) || ((pageSize % sizeof(uint32_t)) != 0)) {
+        return false;
+    }
+
+    // Flash is written by half words, RANGE_CRC works on words
+    Image written = image;
+    Image checked = image;
+
+    written.align(sizeof(uint16_t));
+    checked.align(sizeof(uint32_t));
+
+    PlanHeader header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PLAN_MAGIC, sizeof(PLAN_MAGIC));
+    header.version       = PLAN_VERSION;
+    header.headerSize    = sizeof(PlanHeader);
+    header.messageLength = LONG_MESSAGE_LENGTH;
+    header.pageSize      = pageSize;
+    header.imageSize     = written.size();
+    header.imageCRC      = STM32_CRC_INITIAL;
+
+    std::vector<PlanSegment> segments;
+
+    for (const auto& s : checked.segments()) {
+        PlanSegment segment;
+
+        segment.address  = s.first;
+        segment.length   = s.second.size();
+        segment.crc      = stm32CRC(STM32_CRC_INITIAL, s.second.data(), s.second.size());
+        segment.reserved = 0;
+        segments.push_back(segment);
+
+        header.imageCRC = stm32CRC(header.imageCRC, s.second.data(), s.second.size());
+    }
+
+    // The pages the image touches, as they will be in flash
+    std::vector<PlanPage> pages;
+    std::vector<uint8_t>  page(pageSize);
+
+    for (uint32_t address : checked.pages(pageSize)) {
+        checked.page(address, page.data(), pageSize);
+        pages.push_back(PlanPage {address, stm32CRC(STM32_CRC_INITIAL, page.data(), page.size())});
+    }
+
+    // The requests, in every layout and write mode
+    std::vector<PlanTrack>            tracks;
+    std::vector<std::vector<Request> > requests;
+
+    for (uint32_t mode : {0u, (uint32_t)ALIGNED_LAYOUT, (uint32_t)(ALIGNED_LAYOUT | BINARY_WRITE), (uint32_t)BINARY_WRITE}) {
+        WriteRequests        w(written, (mode & ALIGNED_LAYOUT) != 0, (mode & BINARY_WRITE) != 0);
+        std::vector<Request> r;
+        Request              request;
+
+        while (w.next(request)) {
+            r.push_back(request);
+        }
+
+        tracks.push_back(PlanTrack {mode, (uint32_t)r.size(), 0});
+        requests.push_back(std::move(r));
+    }
+
+    header.tracks   = tracks.size();
+    header.segments = segments.size();
+    header.pages    = pages.size();
+
+    std::vector<uint8_t> file;
+
+    append(file, &header, 1);
+    header.trackOffset   = append(file, tracks.data(), tracks.size());
+    header.segmentOffset = append(file, segments.data(), segments.size());
+    header.pageOffset    = append(file, pages.data(), pages.size());
+
+    for (std::size_t i = 0; i < tracks.size(); i++) {
+        tracks[i].offset = append(file, requests[i].data(), requests[i].size());
+    }
+
+    header.fileSize = file.size();
+
+    // Now that the offsets are known
+    memcpy(file.data(), &header, sizeof(header));
+    memcpy(file.data() + header.trackOffset, tracks.data(), tracks.size() * sizeof(PlanTrack));
+
+    // Replaced as a whole, masters may have the old one mapped
+    std::string temporary = path + ".tmp";
+    FILE*       f         = fopen(temporary.c_str(), "wb");
+
+    if (f == nullptr) {
+        return false;
+    }
+
+    bool success = (fwrite(file.data(), 1, file.size(), f) == file.size());
+
+    success = (fclose(f) == 0) && success;
+
+    if (!success || (rename(temporary.c_str(), path.c_str()) != 0)) {
+        unlink(temporary.c_str());
+        return false;
+    }
+
+    return true;
+} // Plan::compile
+}
+}
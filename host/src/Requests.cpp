@@ -0,0 +1,179 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#include <core/bootloader/master/Requests.hpp>
+
+#include <algorithm>
+#include <cstdio>
+
+namespace bootloader {
+namespace master {
+WriteRequests::WriteRequests(
+    const Image& image,
+    bool         aligned,
+    bool         binary
+) :
+    _image(image),
+    _aligned(aligned),
+    _binary(binary),
+    _state(binary ? State::DATA : State::BEGIN),
+    _segment(image.segments().begin()),
+    _offset(0),
+    _done(0),
+    _base(0xFFFFFFFF)
+{}
+
+std::size_t
+WriteRequests::done() const
+{
+    return _done;
+}
+
+std::size_t
+WriteRequests::total() const
+{
+    return _image.size();
+}
+
+bool
+WriteRequests::next(
+    Request& request
+)
+{
+    payload::IHex ihex;
+
+    memset(&ihex, 0, sizeof(ihex));
+
+    switch (_state) {
+      case State::BEGIN:
+          ihex.type = payload::IHex::BEGIN;
+          _state    = State::DATA;
+          break;
+      case State::DATA:
+
+          if (_segment != _image.segments().end()) {
+              if (_binary) {
+                  binaryData(request);
+              } else {
+                  ihexData(request);
+              }
+
+              return true;
+          }
+
+          if (_binary) {
+              // A zero length chunk commits the write
+              payload::BinaryData end;
+
+              memset(&end, 0, sizeof(end));
+              request = makeRequest<messages::BinaryData, messages::aligned::BinaryData>(_aligned, end);
+              _state  = State::DONE;
+              return true;
+          }
+
+          ihex.type = payload::IHex::DATA;
+          ihexRecord(ihex, 0x01, 0, nullptr, 0);
+          _state = State::END;
+          break;
+      case State::END:
+          ihex.type = payload::IHex::END;
+          _state    = State::DONE;
+          break;
+      default:
+          return false;
+    } // switch
+
+    request = makeRequest<messages::IHexData, messages::aligned::IHexData>(_aligned, ihex);
+
+    return true;
+} // WriteRequests::next
+
+void
+WriteRequests::binaryData(
+    Request& request
+)
+{
+    const Image::Segment& segment = _segment->second;
+    payload::BinaryData   data;
+    std::size_t           length = std::min(segment.size() - _offset, sizeof(data.data));
+
+    data.address  = _segment->first + _offset;
+    data.length   = length;
+    data.reserved = 0;
+    memset(data.data, Image::ERASED, sizeof(data.data));
+    memcpy(data.data, segment.data() + _offset, length);
+
+    request = makeRequest<messages::BinaryData, messages::aligned::BinaryData>(_aligned, data);
+
+    _offset += length;
+    _done   += length;
+
+    if (_offset == segment.size()) {
+        _segment++;
+        _offset = 0;
+    }
+}
+
+void
+WriteRequests::ihexData(
+    Request& request
+)
+{
+    const Image::Segment& segment = _segment->second;
+    uint32_t              address = _segment->first + _offset;
+    payload::IHex         ihex;
+
+    memset(&ihex, 0, sizeof(ihex));
+    ihex.type = payload::IHex::DATA;
+
+    if ((address >> 16) != _base) {
+        uint8_t upper[2] = {
+            (uint8_t)(address >> 24), (uint8_t)(address >> 16)
+        };
+
+        _base = address >> 16;
+        ihexRecord(ihex, 0x04, 0, upper, sizeof(upper));
+    } else {
+        // Records do not cross 64 KiB boundaries
+        std::size_t length = std::min(std::min(segment.size() - _offset, IHEX_RECORD_BYTES), (std::size_t)(0x10000 - (address & 0xFFFF)));
+
+        ihexRecord(ihex, 0x00, address & 0xFFFF, segment.data() + _offset, length);
+
+        _offset += length;
+        _done   += length;
+
+        if (_offset == segment.size()) {
+            _segment++;
+            _offset = 0;
+        }
+    }
+
+    request = makeRequest<messages::IHexData, messages::aligned::IHexData>(_aligned, ihex);
+} // WriteRequests::ihexData
+
+void
+ihexRecord(
+    payload::IHex& ihex,
+    uint8_t        type,
+    uint16_t       address,
+    const uint8_t* data,
+    std::size_t    length
+)
+{
+    uint8_t checksum = length + (address >> 8) + (address & 0xFF) + type;
+    char*   s        = ihex.string;
+
+    s += sprintf(s, ":%02X%04X%02X", (unsigned)length, address, type);
+
+    for (std::size_t i = 0; i < length; i++) {
+        s        += sprintf(s, "%02X", data[i]);
+        checksum += data[i];
+    }
+
+    sprintf(s, "%02X", (uint8_t)(0x100 - checksum));
+}
+}
+}
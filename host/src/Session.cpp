@@ -0,0 +1,414 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#include <core/bootloader/master/Session.hpp>
+#include <core/bootloader/master/CRC.hpp>
+#include <core/bootloader/master/Requests.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+
+namespace bootloader {
+namespace master {
+// After an acknowledge the slave erases a page, 30 ms it cannot hear, then listens for 80 ms
+static const Clock::duration JOB_POLL_INTERVAL = std::chrono::milliseconds(50);
+static const unsigned        PROBE_RETRIES     = 2; // Legacy slaves do not answer SELECT_SLAVE_ALIGNED
+
+Session::Session(
+    ITransport&                 transport,
+    uint8_t                     masterID,
+    ModuleUID                   uid,
+    uint16_t                    slaveID,
+    const Pacer::Configuration& configuration
+) :
+    _channel(transport, masterID, slaveID, configuration),
+    _masterID(masterID),
+    _uid(uid),
+    _open(false),
+    _aligned(false),
+    _mode(0)
+{}
+
+Session::~Session()
+{
+    if (_open) {
+        close();
+    }
+}
+
+AcknowledgeStatus
+Session::simple(
+    Request& request
+)
+{
+    return _channel.transact(request);
+}
+
+AcknowledgeStatus
+Session::open(
+    bool shared
+)
+{
+    payload::UIDAndMaster select;
+
+    select.uid      = _uid;
+    select.masterID = _masterID;
+
+    AcknowledgeStatus status;
+    Request           request;
+
+    // The slave takes the sequence number of the SELECT
+    if (shared) {
+        messages::aligned::SelectShared m;
+        m.data = select;
+        request.set(m);
+    } else {
+        messages::aligned::SelectSlave m;
+        m.data = select;
+        request.set(m);
+    }
+
+    request.header().sequenceId = 0;
+
+    _channel.setRetries(PROBE_RETRIES);
+    status = _channel.transact(request, nullptr, false);
+    _channel.setRetries(5);
+
+    _aligned = (status == AcknowledgeStatus::OK);
+
+    if ((status == AcknowledgeStatus::NONE) && !shared) {
+        messages::SelectSlave m;
+        m.data = select;
+        request.set(m);
+        request.header().sequenceId = 0;
+
+        status = _channel.transact(request, nullptr, false);
+    }
+
+    if (status != AcknowledgeStatus::OK) {
+        return status;
+    }
+
+    _open = true;
+    _mode = _aligned ? (uint32_t)ALIGNED_LAYOUT : 0;
+    _channel.setSequence(0);
+    _channel.setDirect(shared);
+
+    // What the slave can do
+    Frame        ack;
+    payload::UID uid;
+
+    uid.uid = _uid;
+    request = makeRequest<messages::ProtocolVersion, messages::aligned::ProtocolVersion>(_aligned, uid);
+    status  = _channel.transact(request, &ack);
+
+    if (status != AcknowledgeStatus::OK) {
+        return status;
+    }
+
+    const AcknowledgeProtocolVersion* version = ack.as<AcknowledgeProtocolVersion>();
+
+    _version.assign(version->data.version, strnlen(version->data.version, sizeof(version->data.version)));
+
+    unsigned major = 0;
+    unsigned minor = 0;
+
+    if ((sscanf(_version.c_str(), "%u.%u", &major, &minor) != 2) || ((major == 1) && (minor < 2))) {
+        // Capabilities came with 1.2.0
+        return AcknowledgeStatus::OK;
+    }
+
+    payload::UIDAndMode mode;
+
+    mode.uid          = _uid;
+    mode.capabilities = (version->data.capabilities & WANTED) | _mode;
+
+    request = makeRequest<messages::SetSessionMode, messages::aligned::SetSessionMode>(_aligned, mode);
+    status  = _channel.transact(request, &ack);
+
+    if (status == AcknowledgeStatus::OK) {
+        _mode = ack.as<AcknowledgeMode>()->data.capabilities;
+    }
+
+    return status;
+} // Session::open
+
+AcknowledgeStatus
+Session::close()
+{
+    payload::UID uid;
+
+    uid.uid = _uid;
+
+    Request request = makeRequest<messages::DeselectSlave, messages::aligned::DeselectSlave>(_aligned, uid);
+
+    _open = false;
+
+    return simple(request);
+}
+
+bool
+Session::isOpen() const
+{
+    return _open;
+}
+
+uint32_t
+Session::mode() const
+{
+    return _mode;
+}
+
+const std::string&
+Session::version() const
+{
+    return _version;
+}
+
+AcknowledgeStatus
+Session::describe(
+    payload::DescribeV2& description
+)
+{
+    payload::UID uid;
+    Frame        ack;
+
+    uid.uid = _uid;
+
+    Request           request = makeRequest<messages::DescribeV2, messages::aligned::DescribeV2>(_aligned, uid);
+    AcknowledgeStatus status  = _channel.transact(request, &ack);
+
+    if (status == AcknowledgeStatus::OK) {
+        description = ack.as<AcknowledgeDescribeV2>()->data;
+    }
+
+    return status;
+}
+
+AcknowledgeStatus
+Session::waitJob(
+    AcknowledgeStatus status,
+    uint32_t*         crc
+)
+{
+    payload::UID uid;
+    Frame        ack;
+
+    uid.uid = _uid;
+
+    while (status == AcknowledgeStatus::IN_PROGRESS) {
+        std::this_thread::sleep_for(JOB_POLL_INTERVAL);
+
+        Request request = makeRequest<messages::JobStatus, messages::aligned::JobStatus>(_aligned, uid);
+
+        status = _channel.transact(request, &ack);
+
+        if ((status == AcknowledgeStatus::OK) && (crc != nullptr)) {
+            *crc = ack.as<AcknowledgeJobStatus>()->data.crc;
+        }
+    }
+
+    return status;
+}
+
+AcknowledgeStatus
+Session::eraseProgram()
+{
+    payload::UID uid;
+
+    uid.uid = _uid;
+
+    Request request = makeRequest<messages::EraseProgram, messages::aligned::EraseProgram>(_aligned, uid);
+
+    return waitJob(simple(request));
+}
+
+AcknowledgeStatus
+Session::write(
+    const Image&    image,
+    const Progress& progress
+)
+{
+    Image aligned = image;
+
+    // Flash is written by half words
+    aligned.align(sizeof(uint16_t));
+
+    WriteRequests requests(aligned, _aligned, (_mode & BINARY_WRITE) != 0);
+
+    return _channel.stream([&](Request& request) {
+                               if (!requests.next(request)) {
+                                   return false;
+                               }
+
+                               if (progress) {
+                                   progress(requests.done(), requests.total());
+                               }
+
+                               return true;
+                           });
+}
+
+AcknowledgeStatus
+Session::write(
+    const Plan&     plan,
+    const Progress& progress
+)
+{
+    const PlanTrack* track = plan.track(_mode);
+
+    if (track == nullptr) {
+        return AcknowledgeStatus::NOT_IMPLEMENTED;
+    }
+
+    const Request* requests = plan.requests(*track);
+    const Request* end      = requests + track->count;
+    std::size_t    total    = plan.header().imageSize;
+
+    return _channel.stream([&](Request& request) {
+                               if (requests == end) {
+                                   return false;
+                               }
+
+                               request = *requests++;
+
+                               if (progress) {
+                                   progress(total - (uint64_t)total * (end - requests) / track->count, total);
+                               }
+
+                               return true;
+                           });
+} // Session::write
+
+AcknowledgeStatus
+Session::rangeCRC(
+    uint32_t  address,
+    uint32_t  length,
+    uint32_t& crc
+)
+{
+    payload::UIDAndRange range;
+    Frame                ack;
+
+    range.uid     = _uid;
+    range.address = address;
+    range.length  = length;
+
+    Request           request = makeRequest<messages::RangeCRC, messages::aligned::RangeCRC>(_aligned, range);
+    AcknowledgeStatus status  = _channel.transact(request, &ack);
+
+    if (status == AcknowledgeStatus::OK) {
+        crc = ack.as<AcknowledgeCRC>()->data.crc;
+    }
+
+    return waitJob(status, &crc);
+}
+
+AcknowledgeStatus
+Session::verify(
+    const Image& image
+)
+{
+    if (!(_mode & RANGE_CRC)) {
+        return AcknowledgeStatus::NOT_IMPLEMENTED;
+    }
+
+    Image aligned = image;
+
+    // RANGE_CRC works on words
+    aligned.align(sizeof(uint32_t));
+
+    for (const auto& segment : aligned.segments()) {
+        uint32_t crc      = 0;
+        uint32_t expected = stm32CRC(STM32_CRC_INITIAL, segment.second.data(), segment.second.size());
+
+        AcknowledgeStatus status = rangeCRC(segment.first, segment.second.size(), crc);
+
+        if (status != AcknowledgeStatus::OK) {
+            return status;
+        }
+
+        if (crc != expected) {
+            return AcknowledgeStatus::ERROR;
+        }
+    }
+
+    return AcknowledgeStatus::OK;
+} // Session::verify
+
+AcknowledgeStatus
+Session::verify(
+    const Plan& plan
+)
+{
+    if (!(_mode & RANGE_CRC)) {
+        return AcknowledgeStatus::NOT_IMPLEMENTED;
+    }
+
+    for (uint32_t i = 0; i < plan.header().segments; i++) {
+        const PlanSegment& segment = plan.segments()[i];
+        uint32_t           crc     = 0;
+        AcknowledgeStatus  status  = rangeCRC(segment.address, segment.length, crc);
+
+        if (status != AcknowledgeStatus::OK) {
+            return status;
+        }
+
+        if (crc != segment.crc) {
+            return AcknowledgeStatus::ERROR;
+        }
+    }
+
+    return AcknowledgeStatus::OK;
+}
+
+AcknowledgeStatus
+Session::writeProgramCRC(
+    uint32_t crc
+)
+{
+    payload::UIDAndCRC data;
+
+    data.uid = _uid;
+    data.crc = crc;
+
+    Request request = makeRequest<messages::WriteProgramCrc, messages::aligned::WriteProgramCrc>(_aligned, data);
+
+    return simple(request);
+}
+
+AcknowledgeStatus
+Session::reset()
+{
+    payload::UID uid;
+
+    uid.uid = _uid;
+
+    Request           request = makeRequest<messages::Reset, messages::aligned::Reset>(_aligned, uid);
+    AcknowledgeStatus status  = simple(request);
+
+    if (status == AcknowledgeStatus::OK) {
+        // The slave is gone
+        _open = false;
+    }
+
+    return status;
+}
+
+Channel&
+Session::channel()
+{
+    return _channel;
+}
+
+ModuleUID
+Session::uid() const
+{
+    return _uid;
+}
+}
+}
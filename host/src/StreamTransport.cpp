@@ -0,0 +1,164 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#include <core/bootloader/master/StreamTransport.hpp>
+
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace bootloader {
+namespace master {
+static const std::size_t HEADER_LENGTH = 3;
+
+StreamTransport::StreamTransport(
+    int input,
+    int output
+) :
+    _input(input),
+    _output(output)
+{}
+
+StreamTransport::~StreamTransport()
+{
+    close(_input);
+
+    if (_output != _input) {
+        close(_output);
+    }
+}
+
+StreamTransport*
+StreamTransport::connect(
+    const std::string& address
+)
+{
+    std::string::size_type colon = address.rfind(':');
+
+    if (colon == std::string::npos) {
+        return nullptr;
+    }
+
+    std::string host = address.substr(0, colon);
+    std::string port = address.substr(colon + 1);
+
+    struct addrinfo  hints;
+    struct addrinfo* result = nullptr;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0) {
+        return nullptr;
+    }
+
+    int fd = -1;
+
+    for (struct addrinfo* i = result; (i != nullptr) && (fd < 0); i = i->ai_next) {
+        fd = socket(i->ai_family, i->ai_socktype, i->ai_protocol);
+
+        if ((fd >= 0) && (::connect(fd, i->ai_addr, i->ai_addrlen) != 0)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    freeaddrinfo(result);
+
+    return (fd >= 0) ? new StreamTransport(fd, fd) : nullptr;
+} // StreamTransport::connect
+
+bool
+StreamTransport::send(
+    const Frame& frame
+)
+{
+    uint8_t     buffer[HEADER_LENGTH + MAXIMUM_MESSAGE_LENGTH];
+    std::size_t length = HEADER_LENGTH + frame.size;
+
+    buffer[0] = frame.topic;
+    buffer[1] = frame.node;
+    buffer[2] = frame.size;
+    memcpy(buffer + HEADER_LENGTH, frame.data, frame.size);
+
+    for (std::size_t sent = 0; sent < length;) {
+        ssize_t n = write(_output, buffer + sent, length - sent);
+
+        if (n <= 0) {
+            return false;
+        }
+
+        sent += n;
+    }
+
+    return true;
+}
+
+bool
+StreamTransport::extract(
+    Frame& frame
+)
+{
+    if (_buffer.size() < HEADER_LENGTH) {
+        return false;
+    }
+
+    std::size_t size = std::min<std::size_t>(_buffer[2], MAXIMUM_MESSAGE_LENGTH);
+
+    if (_buffer.size() < HEADER_LENGTH + _buffer[2]) {
+        return false;
+    }
+
+    frame.topic = _buffer[0];
+    frame.node  = _buffer[1];
+    frame.size  = size;
+    memcpy(frame.data, _buffer.data() + HEADER_LENGTH, size);
+
+    _buffer.erase(_buffer.begin(), _buffer.begin() + HEADER_LENGTH + _buffer[2]);
+
+    return true;
+}
+
+bool
+StreamTransport::receive(
+    Frame&          frame,
+    Clock::duration timeout
+)
+{
+    Clock::time_point until = Clock::now() + timeout;
+
+    while (!extract(frame)) {
+        Clock::duration left = until - Clock::now();
+
+        if (left < Clock::duration::zero()) {
+            return false;
+        }
+
+        struct pollfd p;
+
+        p.fd     = _input;
+        p.events = POLLIN;
+
+        if (poll(&p, 1, std::chrono::duration_cast<std::chrono::milliseconds>(left).count()) <= 0) {
+            return false;
+        }
+
+        uint8_t chunk[256];
+        ssize_t n = read(_input, chunk, sizeof(chunk));
+
+        if (n <= 0) {
+            return false;
+        }
+
+        _buffer.insert(_buffer.end(), chunk, chunk + n);
+    }
+
+    return true;
+} // StreamTransport::receive
+}
+}
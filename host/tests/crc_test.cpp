@@ -0,0 +1,155 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+// The host CRCs against the bit at a time reference
+//
+//   crc_test
+//
+// Built with host/src/CRC.cpp. As a CMake test:
+//   add_test(NAME crc_test COMMAND crc_test)
+//
+// Every length up to 1 KiB at every start within 16 bytes, odd lengths too
+// (the bytes past the last word do not count), then random ones, from the
+// initial value and from random ones. Then stm32CRCCombine, and the known
+// answers of the CRC unit. Exits with 1 if a case fails.
+
+#include <core/bootloader/master/CRC.hpp>
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace bootloader::master;
+
+using Function = uint32_t (*)(uint32_t crc, const uint8_t* data, std::size_t length);
+
+struct Method {
+    const char* name;
+    Function    function;
+};
+
+static const Method METHODS[] = {
+    {"slice-by-8", stm32CRCSliceBy8},
+    {"carryless", stm32CRCCarryless},
+    {"stm32CRC", stm32CRC}
+};
+
+static const std::size_t EVERY_LENGTH = 1024;
+static const std::size_t STARTS       = 16;
+static const unsigned    RANDOM       = 2000;
+static const std::size_t LONGEST      = 8192;
+
+static unsigned failed = 0;
+
+static void
+check(
+    bool        ok,
+    const char* format,
+    ...
+) __attribute__((format(printf, 2, 3)));
+
+static void
+check(
+    bool        ok,
+    const char* format,
+    ...
+)
+{
+    if (!ok) {
+        va_list arguments;
+
+        printf("FAIL ");
+        va_start(arguments, format);
+        vprintf(format, arguments);
+        va_end(arguments);
+        printf("\n");
+        failed++;
+    }
+}
+
+static void
+compare(
+    const uint8_t* data,
+    std::size_t    start,
+    std::size_t    length,
+    uint32_t       crc
+)
+{
+    uint32_t reference = stm32CRCReference(crc, data + start, length);
+
+    for (const Method& m : METHODS) {
+        check(m.function(crc, data + start, length) == reference, "%s, %zu bytes at +%zu from %08X", m.name, length, start, crc);
+    }
+}
+
+int
+main()
+{
+    std::mt19937         random(1);
+    std::vector<uint8_t> data(LONGEST + STARTS);
+
+    for (uint8_t& b : data) {
+        b = random();
+    }
+
+    for (std::size_t length = 0; length <= EVERY_LENGTH; length++) {
+        for (std::size_t start = 0; start < STARTS; start++) {
+            compare(data.data(), start, length, STM32_CRC_INITIAL);
+            compare(data.data(), start, length, random());
+        }
+    }
+
+    for (unsigned n = 0; n < RANDOM; n++) {
+        std::size_t length = random() % (LONGEST + 1);
+        std::size_t start  = random() % STARTS;
+
+        compare(data.data(), start, length, (n & 1) ? random() : STM32_CRC_INITIAL);
+    }
+
+    // A whole out of its parts: the first one in words, the second one any
+    for (unsigned n = 0; n < RANDOM; n++) {
+        std::size_t lengthA = 4 * (random() % (LONGEST / 8 + 1));
+        std::size_t lengthB = (n < 16) ? n : random() % (LONGEST / 2 + 1);
+        uint32_t    crcA    = stm32CRC(STM32_CRC_INITIAL, data.data(), lengthA);
+        uint32_t    crcB    = stm32CRC(STM32_CRC_INITIAL, data.data() + lengthA, lengthB);
+        uint32_t    whole   = stm32CRCReference(STM32_CRC_INITIAL, data.data(), lengthA + lengthB - (lengthB % 4));
+
+        check(stm32CRCCombine(crcA, crcB, lengthB) == whole, "stm32CRCCombine, %zu then %zu bytes", lengthA, lengthB);
+    }
+
+    // What a slave computes: the CRC unit over the words, from the reset
+    // value. 0xC704DD7B is the CRC of a single zero word
+    uint32_t words[LONGEST / 4];
+    uint32_t zero = 0;
+
+    memcpy(words, data.data(), sizeof(words));
+
+    check(stm32CRCBlock(&zero, 1) == 0xC704DD7B, "stm32CRCBlock, a zero word");
+    check(stm32CRCBlock(&zero, 0) == STM32_CRC_INITIAL, "stm32CRCBlock, no words");
+
+    for (std::size_t count = 0; count <= 64; count++) {
+        uint32_t bytes[64];
+
+        // The words as numbers, in little endian bytes
+        for (std::size_t i = 0; i < count; i++) {
+            uint8_t* b = reinterpret_cast<uint8_t*>(&bytes[i]);
+
+            b[0] = words[i];
+            b[1] = words[i] >> 8;
+            b[2] = words[i] >> 16;
+            b[3] = words[i] >> 24;
+        }
+
+        check(stm32CRCBlock(words, count) == stm32CRCReference(STM32_CRC_INITIAL, reinterpret_cast<const uint8_t*>(bytes), 4 * count),
+              "stm32CRCBlock, %zu words", count);
+    }
+
+    printf("%s, %s\n", (failed == 0) ? "ok" : "FAILED", hasCarrylessCRC() ? "with PCLMULQDQ" : "no PCLMULQDQ");
+
+    return (failed == 0) ? 0 : 1;
+} // main
@@ -0,0 +1,337 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+// The host Intel HEX against kk_ihex, byte at a time
+//
+//   ihex_test
+//
+// Built with host/src/IHex.cpp and src/kk_ihex/kk_ihex_read.c. As a CMake test:
+//   add_test(NAME ihex_test COMMAND ihex_test)
+//
+// encodeHex and decodeHex against a byte at a time reference, at every
+// length up to 48 and every start within 16 bytes: the vector loops and the
+// tails around them. Then IHexReader against ihex_read_bytes on what
+// IHexWriter writes, lengths, addresses and records that do not fall on a
+// boundary, read in chunks that split the records anywhere, and on broken
+// text. Both must see the same records, and the records the data written.
+// Exits with 1 if a case fails.
+
+#include <core/bootloader/master/IHex.hpp>
+
+#include <kk_ihex/kk_ihex_read.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace bootloader::master;
+
+static const std::size_t MAXIMUM_LENGTH = 48;
+static const std::size_t STARTS         = 16;
+
+// What a reader saw, record by record
+struct Transcript {
+    std::string          records;
+    std::vector<uint8_t> data;              // Of the data records, in order
+    uint32_t             address    = 0;    // Of the first data record
+    bool                 contiguous = true;
+    unsigned             errors     = 0;
+
+    void
+    add(
+        struct ihex_state* ihex,
+        ihex_record_type_t type,
+        ihex_bool_t        error
+    )
+    {
+        char header[32];
+
+        snprintf(header, sizeof(header), "%u %08X %u %u:", type, (unsigned)IHEX_LINEAR_ADDRESS(ihex), ihex->length, error != 0);
+        records.append(header);
+        records.append(reinterpret_cast<const char*>(ihex->data), ihex->length);
+        errors += (error != 0);
+
+        if (type == IHEX_DATA_RECORD) {
+            if (data.empty()) {
+                address = IHEX_LINEAR_ADDRESS(ihex);
+            } else if (IHEX_LINEAR_ADDRESS(ihex) != address + data.size()) {
+                contiguous = false;
+            }
+
+            data.insert(data.end(), ihex->data, ihex->data + ihex->length);
+        }
+    }
+};
+
+static Transcript kk;
+
+extern "C" ihex_bool_t
+ihex_data_read(
+    struct ihex_state* ihex,
+    ihex_record_type_t type,
+    ihex_bool_t        checksum_mismatch
+)
+{
+    kk.add(ihex, type, checksum_mismatch);
+    return true;
+}
+
+static unsigned failed = 0;
+
+static void
+check(
+    const std::string& name,
+    bool               ok
+)
+{
+    if (!ok) {
+        printf("FAIL %s\n", name.c_str());
+        failed++;
+    }
+}
+
+static std::vector<uint8_t>
+randomBytes(
+    std::size_t   length,
+    std::mt19937& random
+)
+{
+    std::vector<uint8_t> data(length);
+
+    for (uint8_t& b : data) {
+        b = random();
+    }
+
+    return data;
+}
+
+static void
+checkEncode(
+    std::mt19937& random
+)
+{
+    std::vector<uint8_t> data = randomBytes(MAXIMUM_LENGTH + STARTS, random);
+
+    for (std::size_t length = 0; length <= MAXIMUM_LENGTH; length++) {
+        for (std::size_t start = 0; start < STARTS; start++) {
+            char expected[2 * (MAXIMUM_LENGTH + STARTS) + 1];
+            char out[2 * (MAXIMUM_LENGTH + STARTS) + 1];
+
+            for (std::size_t i = 0; i < length; i++) {
+                snprintf(expected + 2 * i, 3, "%02X", data[start + i]);
+            }
+
+            // Nothing is written past the digits
+            memset(out, '#', sizeof(out));
+            encodeHex(out + start, data.data() + start, length);
+
+            check("encodeHex length " + std::to_string(length) + " start " + std::to_string(start),
+                  (memcmp(out + start, expected, 2 * length) == 0) && (out[start + 2 * length] == '#') && ((start == 0) || (out[start - 1] == '#')));
+        }
+    }
+} // checkEncode
+
+static void
+checkDecode(
+    std::mt19937& random
+)
+{
+    static const char NOT_HEX[] = {' ', '/', ':', '@', 'G', '`', 'g', '\0', '\x80', '\xFF'};
+
+    std::vector<uint8_t> data = randomBytes(MAXIMUM_LENGTH, random);
+
+    for (std::size_t length = 0; length <= MAXIMUM_LENGTH; length++) {
+        for (std::size_t start = 0; start < STARTS; start++) {
+            std::string name = "decodeHex length " + std::to_string(length) + " start " + std::to_string(start);
+            char        hex[2 * (MAXIMUM_LENGTH + STARTS)];
+            uint8_t     out[MAXIMUM_LENGTH + 1];
+
+            for (std::size_t i = 0; i < length; i++) {
+                snprintf(hex + start + 2 * i, 3, "%02X", data[i]);
+            }
+
+            memset(out, 0xA5, sizeof(out));
+            check(name, decodeHex(out, hex + start, length) && (memcmp(out, data.data(), length) == 0) && (out[length] == 0xA5));
+
+            // kk_ihex takes lower case too
+            for (std::size_t i = 0; i < 2 * length; i++) {
+                hex[start + i] = tolower(hex[start + i]);
+            }
+
+            check(name + " lower case", decodeHex(out, hex + start, length) && (memcmp(out, data.data(), length) == 0));
+
+            // A character that is not a digit, anywhere
+            for (std::size_t i = 0; i < 2 * length; i++) {
+                char digit = hex[start + i];
+
+                hex[start + i] = NOT_HEX[(length + start + i) % sizeof(NOT_HEX)];
+                check(name + " not hex at " + std::to_string(i), !decodeHex(out, hex + start, length));
+                hex[start + i] = digit;
+            }
+        }
+    }
+} // checkDecode
+
+// Both readers, chunk characters at a time
+static void
+compare(
+    const std::string& name,
+    const std::string& text,
+    std::size_t        chunk,
+    Transcript&        fast
+)
+{
+    IHexReader        reader([&](struct ihex_state* ihex, ihex_record_type_t type, ihex_bool_t error) -> ihex_bool_t {
+                                 fast.add(ihex, type, error);
+                                 return true;
+                             });
+    struct ihex_state ihex;
+
+    kk   = Transcript();
+    fast = Transcript();
+
+    ihex_begin_read(&ihex);
+    reader.begin();
+
+    for (std::size_t i = 0; i < text.size(); i += chunk) {
+        ihex_read_bytes(&ihex, text.data() + i, std::min(chunk, text.size() - i));
+        reader.read(text.data() + i, std::min(chunk, text.size() - i));
+    }
+
+    ihex_end_read(&ihex);
+    reader.end();
+
+    check(name + " chunk " + std::to_string(chunk), (fast.records == kk.records) && (fast.errors == kk.errors));
+}
+
+static void
+checkReader(
+    std::mt19937& random
+)
+{
+    static const std::size_t LENGTHS[]      = {0, 1, 7, 8, 9, 15, 16, 17, 255, 256, 257, 4099};
+    static const uint32_t    ADDRESSES[]    = {0x08000000, 0x08000001, 0x08004007, 0x0800FFF9};
+    static const unsigned    LINE_LENGTHS[] = {1, 7, 8, 9, 16, 32, IHEX_LINE_MAX_LENGTH};
+    static const std::size_t CHUNKS[]       = {1, 2, 7, 11, 43, 4096};
+
+    for (std::size_t length : LENGTHS) {
+        std::vector<uint8_t> data = randomBytes(length, random);
+
+        for (uint32_t address : ADDRESSES) {
+            for (unsigned lineLength : LINE_LENGTHS) {
+                std::string text;
+                IHexWriter  writer([&](const char* buffer, const char* end) {
+                                       text.append(buffer, end);
+                                   }, lineLength);
+
+                writer.writeAt(address);
+                writer.write(data.data(), data.size());
+                writer.end();
+
+                char name[96];
+
+                snprintf(name, sizeof(name), "IHexReader length %zu address %08X line %u", length, address, lineLength);
+
+                for (std::size_t chunk : CHUNKS) {
+                    Transcript fast;
+
+                    compare(name, text, chunk, fast);
+                    check(std::string(name) + " data", (fast.data == data) && fast.contiguous && ((length == 0) || (fast.address == address)) && (fast.errors == 0));
+                }
+            }
+        }
+    }
+} // checkReader
+
+// What a file can have in it besides clean records
+static void
+checkBroken(
+    std::mt19937& random
+)
+{
+    std::vector<uint8_t> data = randomBytes(301, random);
+    std::string          text;
+    IHexWriter           writer([&](const char* buffer, const char* end) {
+                                    text.append(buffer, end);
+                                }, 16);
+
+    writer.writeAt(0x0800FF03);
+    writer.write(data.data(), data.size());
+    writer.end();
+
+    std::string lower = text;
+    std::string crlf;
+
+    for (char& c : lower) {
+        c = tolower(c);
+    }
+
+    for (char c : text) {
+        crlf += (c == '\n') ? std::string("\r\n") : std::string(1, c);
+    }
+
+    struct Case {
+        const char* name;
+        std::string text;
+    };
+
+    std::vector<Case> cases = {
+        {"lower case", lower},
+        {"CRLF", crlf},
+        {"blanks and junk between the records", "  \t" + text.substr(0, 45) + "junk\n" + text.substr(45)},
+        {"truncated", text.substr(0, text.size() / 2 + 5)},
+        {"no end of file record", text.substr(0, text.rfind(':'))}
+    };
+
+    // A wrong checksum, a digit that is not one, a record cut short, in the
+    // first, a middle and the last data record
+    for (std::size_t record : {std::size_t(0), std::size_t(9), std::size_t(18)}) {
+        std::size_t at = 0;
+
+        for (std::size_t i = 0; i <= record; i++) {
+            at = text.find(':', at + 1);
+        }
+
+        std::string checksum = text;
+        std::string digit    = text;
+        std::string cut      = text;
+
+        checksum[at + 20] = (checksum[at + 20] == '0') ? '1' : '0';
+        digit[at + 13]    = 'x';
+        cut.erase(at + 15, 8);
+
+        cases.push_back({"checksum", checksum});
+        cases.push_back({"not a digit", digit});
+        cases.push_back({"cut short", cut});
+    }
+
+    for (const Case& c : cases) {
+        for (std::size_t chunk : {std::size_t(1), std::size_t(5), std::size_t(64), c.text.size() + 1}) {
+            Transcript fast;
+
+            compare(std::string("IHexReader ") + c.name, c.text, chunk, fast);
+        }
+    }
+} // checkBroken
+
+int
+main()
+{
+    std::mt19937 random(1);
+
+    checkEncode(random);
+    checkDecode(random);
+    checkReader(random);
+    checkBroken(random);
+
+    printf("%s\n", (failed == 0) ? "ok" : "FAILED");
+
+    return (failed == 0) ? 0 : 1;
+}
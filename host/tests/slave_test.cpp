@@ -0,0 +1,901 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+// The master library against the bootloader of src/, through the host port
+//
+//   slave_test
+//
+// Built as the simulator is, with this file instead of the tool: src/
+// bootloader.cpp and blinker.cpp for the host, host/port/src, host/src and
+// kk_ihex. As a CMake test:
+//   add_test(NAME slave_test COMMAND slave_test)
+//
+// One slave, a process as in the simulator, on a bus of its own. The master
+// library keeps its timeouts on the clock, so the slave runs in real time,
+// driven by a thread: a frame takes FRAME_TIME, the flash the time of the
+// part. Exits with 1 if a case fails.
+
+#include <core/bootloader/master/CRC.hpp>
+#include <core/bootloader/master/Image.hpp>
+#include <core/bootloader/master/Master.hpp>
+#include <core/bootloader/master/Requests.hpp>
+#include <core/bootloader/port/EmulatedFlash.hpp>
+#include <core/bootloader/port/Node.hpp>
+#include <core/stm32_flash/ConfigurationStorage.hpp>
+
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace bootloader;
+using namespace bootloader::port;
+using namespace bootloader::master;
+using namespace core::stm32_flash;
+
+static const Time    FRAME_TIME = 130000;    // [ns] An extended frame of 8 bytes at 1 Mbit/s, stuff bits included
+static const Time    RESTART    = 1000000;   // [ns] From a reset to the bootloader running
+static const int     HANG_POLL  = 10000;     // [ms] A node that does not answer
+static const uint8_t MASTER_ID  = 1;
+static const uint8_t SLAVE_ID   = 10;
+
+// The controllers of the slave, as in the simulator
+static FlashSegment         configurationBank1(CONFIGURATION1_FLASH_FROM, CONFIGURATION1_FLASH_TO);
+static FlashSegment         configurationBank2(CONFIGURATION2_FLASH_FROM, CONFIGURATION2_FLASH_TO);
+static Storage              userStorage(configurationBank1, configurationBank2);
+static ConfigurationStorage configurationStorage(userStorage);
+
+using MasterAdvertise = Message_<ShortMessage, MessageType::MASTER_ADVERTISE, payload::UID>;
+
+// A slave started as a master asked it to bootload, with its CAN ID set
+class PortBus:
+    public ITransport
+{
+public:
+    PortBus(
+        const std::string& flashPath
+    );
+
+    ~PortBus();
+
+    bool
+    send(
+        const Frame& frame
+    ) override;
+
+    bool
+    receive(
+        Frame&          frame,
+        Clock::duration timeout
+    ) override;
+
+    ModuleUID
+    uid() const;
+
+    // The acknowledge of command after skip others does not reach the master
+    void
+    loseAcknowledge(
+        MessageType command,
+        unsigned    skip
+    );
+
+    // Acknowledges that did not reach the master
+    unsigned
+    lost();
+
+    // Nothing goes through, either way
+    void
+    cut(
+        bool cut
+    );
+
+    // Until the slave starts the program, false if it halts or timeout passes
+    bool
+    waitBoot(
+        Clock::duration timeout
+    );
+
+    // The program asks for the bootloader, as after BOOTLOAD
+    void
+    bootload();
+
+    // The master tells the slave to ignore it: it follows no master
+    void
+    release();
+
+    // What the slave has in flash
+    std::vector<uint8_t>
+    read(
+        uint32_t    address,
+        std::size_t length
+    );
+
+private:
+    enum State {
+        RUNNING,
+        RESTARTING,
+        BOOTED,
+        HALTED
+    };
+
+    // As rtcan does it: a missing fragment loses the message
+    struct Reassembly {
+        uint8_t              fragment; // Expected next
+        std::vector<uint8_t> data;
+    };
+
+    Time
+    now() const;
+
+    // The slave follows the first master it hears
+    void
+    advertise();
+
+    void
+    spawn(
+        Time now
+    );
+
+    void
+    collect(
+        Time now
+    );
+
+    void
+    deliver(
+        const NodeEvent& event,
+        Time             now
+    );
+
+    void
+    terminate();
+
+    // From the slave to the master
+    void
+    received(
+        const CanFrame& frame
+    );
+
+    // Does what is due, false and the time of the next thing if nothing is
+    bool
+    service(
+        Time  now,
+        Time& next
+    );
+
+    void
+    drive();
+
+private:
+    std::string       _flashPath;
+    hw::UID           _uid;
+    ModuleUID         _moduleUID;
+    Clock::time_point _epoch;
+
+    std::mutex              _mutex;
+    std::condition_variable _changed;
+    std::thread             _driver;
+    bool                    _stop;
+
+    State           _state;
+    pid_t           _pid;
+    int             _socket;
+    bool            _first;
+    hw::ResetSource _resetSource;
+    uint32_t        _nvr;
+    Time            _restart;
+    Time            _idle;
+    Time            _until;
+    Time            _watchdog;
+
+    std::multimap<Time, CanFrame> _arrivals; // Frames on the bus, by the time they end
+    std::deque<NodeEvent>         _inbox;    // Waiting for the node to be idle
+    Time                          _free;     // The bus
+
+    bool     _transmitting;
+    CanFrame _frame;
+    Time     _transmitted; // The frame ends then...
+    Time     _deadline;    // ... unless this comes first
+
+    std::map<uint32_t, Reassembly> _reassemblies;
+    std::deque<Frame>              _received;
+
+    bool        _cut;
+    bool        _losing;
+    MessageType _loseCommand;
+    unsigned    _loseSkip;
+    unsigned    _lost;
+};
+
+PortBus::PortBus(
+    const std::string& flashPath
+) :
+    _flashPath(flashPath),
+    _epoch(Clock::now()),
+    _stop(false),
+    _state(HALTED),
+    _pid(-1),
+    _socket(-1),
+    _first(true),
+    _resetSource(hw::ResetSource::WATCHDOG),
+    _nvr(hw::Watchdog::Reason::USER_REQUEST),
+    _restart(NEVER),
+    _idle(0),
+    _until(NEVER),
+    _watchdog(NEVER),
+    _free(0),
+    _transmitting(false),
+    _transmitted(NEVER),
+    _deadline(NEVER),
+    _cut(false),
+    _losing(false),
+    _loseCommand(MessageType::NONE),
+    _loseSkip(0),
+    _lost(0)
+{
+    for (std::size_t i = 0; i < _uid.size(); i++) {
+        _uid[i] = 0x5A ^ (i * 37);
+    }
+
+    _moduleUID = stm32CRC(STM32_CRC_INITIAL, _uid.data(), _uid.size());
+
+    spawn(0);
+    _driver = std::thread(&PortBus::drive, this);
+    advertise();
+}
+
+PortBus::~PortBus()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        _stop = true;
+    }
+
+    _changed.notify_all();
+    _driver.join();
+    terminate();
+}
+
+bool
+PortBus::send(
+    const Frame& frame
+)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (_cut) {
+        return true; // On the bus, but nobody gets it
+    }
+
+    uint16_t id       = (frame.topic << 8) | frame.node;
+    uint8_t  fragment = (frame.size - 1) / 8;
+    Time     now      = this->now();
+
+    for (std::size_t offset = 0; offset < frame.size; offset += 8, fragment--) {
+        CanFrame f;
+
+        f.id     = (static_cast<uint32_t>(id) << 7) | fragment;
+        f.length = std::min<std::size_t>(8, frame.size - offset);
+        memcpy(f.data, frame.data + offset, f.length);
+
+        _free = std::max(now, _free) + FRAME_TIME;
+        _arrivals.emplace(_free, f);
+    }
+
+    _changed.notify_all();
+    return true;
+} // PortBus::send
+
+bool
+PortBus::receive(
+    Frame&          frame,
+    Clock::duration timeout
+)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (!_changed.wait_for(lock, timeout, [this] {
+        return !_received.empty();
+    })) {
+        return false;
+    }
+
+    frame = _received.front();
+    _received.pop_front();
+    return true;
+}
+
+ModuleUID
+PortBus::uid() const
+{
+    return _moduleUID;
+}
+
+void
+PortBus::loseAcknowledge(
+    MessageType command,
+    unsigned    skip
+)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _losing      = true;
+    _loseCommand = command;
+    _loseSkip    = skip;
+}
+
+unsigned
+PortBus::lost()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    return _lost;
+}
+
+void
+PortBus::cut(
+    bool cut
+)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _cut = cut;
+}
+
+bool
+PortBus::waitBoot(
+    Clock::duration timeout
+)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    _changed.wait_for(lock, timeout, [this] {
+        return (_state == BOOTED) || (_state == HALTED);
+    });
+
+    return _state == BOOTED;
+}
+
+void
+PortBus::bootload()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        _resetSource = hw::ResetSource::WATCHDOG;
+        _nvr         = hw::Watchdog::Reason::USER_REQUEST;
+        _restart     = now() + RESTART;
+        _state       = RESTARTING;
+    }
+
+    _changed.notify_all();
+    advertise();
+}
+
+void
+PortBus::release()
+{
+    messages::MasterIgnore m;
+    Frame                  frame;
+
+    m.data.uid = uid();
+    memset(m.padding, 0, sizeof(m.padding));
+
+    frame.topic = BOOTLOADER_MASTER_TOPIC_ID;
+    frame.node  = MASTER_ID;
+    frame.size  = ShortMessage::MESSAGE_LENGTH;
+    memcpy(frame.data, &m, frame.size);
+    send(frame);
+}
+
+std::vector<uint8_t>
+PortBus::read(
+    uint32_t    address,
+    std::size_t length
+)
+{
+    std::vector<uint8_t> data(length);
+    std::ifstream        file(_flashPath, std::ios::binary);
+
+    file.seekg(address - EmulatedFlash::Configuration().address);
+    file.read(reinterpret_cast<char*>(data.data()), length);
+
+    if (!file) {
+        data.clear();
+    }
+
+    return data;
+}
+
+Time
+PortBus::now() const
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - _epoch).count();
+}
+
+void
+PortBus::advertise()
+{
+    MasterAdvertise m;
+    Frame           frame;
+
+    m.data.uid = ANY_MODULE_UID;
+    memset(m.padding, 0, sizeof(m.padding));
+
+    frame.topic = BOOTLOADER_MASTER_TOPIC_ID;
+    frame.node  = MASTER_ID;
+    frame.size  = ShortMessage::MESSAGE_LENGTH;
+    memcpy(frame.data, &m, frame.size);
+    send(frame);
+}
+
+void
+PortBus::spawn(
+    Time now
+)
+{
+    int sockets[2];
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockets) != 0) {
+        perror("socketpair");
+        exit(1);
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+
+    if (pid == 0) {
+        close(sockets[0]);
+
+        std::unique_ptr<EmulatedFlash> f = EmulatedFlash::create(EmulatedFlash::Configuration(), _flashPath);
+
+        if (!f) {
+            _exit(1);
+        }
+
+        if (_first) {
+            configurationStorage.writeCanID(SLAVE_ID);
+        }
+
+        Node::Configuration configuration = {
+            sockets[1], _uid, _resetSource, _nvr, now
+        };
+
+        Node::run(configuration);
+    }
+
+    close(sockets[1]);
+
+    _pid      = pid;
+    _socket   = sockets[0];
+    _state    = RUNNING;
+    _first    = false;
+    _idle     = now;
+    _until    = NEVER;
+    _watchdog = NEVER;
+
+    collect(now);
+} // PortBus::spawn
+
+// What the node does, up to its next WAIT
+void
+PortBus::collect(
+    Time now
+)
+{
+    for (;;) {
+        struct pollfd p = {
+            _socket, POLLIN, 0
+        };
+
+        NodeAction action;
+
+        if ((poll(&p, 1, HANG_POLL) != 1) || (recv(_socket, &action, sizeof(action), 0) != sizeof(action))) {
+            fprintf(stderr, "slave: stopped answering at %.6f ms\n", now / 1e6);
+            terminate();
+            _state = HALTED;
+            return;
+        }
+
+        switch (action.type) {
+          case NodeAction::WAIT:
+              _idle     = action.time;
+              _until    = action.until;
+              _watchdog = action.watchdog;
+              return;
+          case NodeAction::TRANSMIT:
+              _transmitting = true;
+              _frame        = action.frame;
+              _transmitted  = std::max(std::max(now, action.time), _free) + FRAME_TIME;
+              _deadline     = action.until;
+              _free         = std::min(_transmitted, _deadline);
+              break;
+          case NodeAction::WATCHDOG:
+              _watchdog = action.until;
+              break;
+          case NodeAction::NVR:
+              _nvr = action.value;
+              break;
+          case NodeAction::RESET:
+              terminate();
+              _resetSource = static_cast<hw::ResetSource>(action.value);
+              _restart     = std::max(now, action.time) + RESTART;
+              _state       = RESTARTING;
+              return;
+          case NodeAction::BOOT:
+              terminate();
+              _state = BOOTED;
+              return;
+          case NodeAction::HALT:
+              terminate();
+              _state = HALTED;
+              return;
+        } // switch
+    }
+} // PortBus::collect
+
+void
+PortBus::deliver(
+    const NodeEvent& event,
+    Time             now
+)
+{
+    if (::send(_socket, &event, sizeof(event), MSG_NOSIGNAL) != sizeof(event)) {
+        terminate();
+        _state = HALTED;
+        return;
+    }
+
+    collect(now);
+}
+
+void
+PortBus::terminate()
+{
+    if (_pid > 0) {
+        kill(_pid, SIGKILL);
+        waitpid(_pid, nullptr, 0);
+        close(_socket);
+    }
+
+    // The controller is reset too
+    _pid          = -1;
+    _socket       = -1;
+    _transmitting = false;
+    _watchdog     = NEVER;
+    _inbox.clear();
+}
+
+void
+PortBus::received(
+    const CanFrame& frame
+)
+{
+    uint32_t id       = frame.id >> 7;
+    uint8_t  fragment = frame.id & 0x7F;
+    auto     i        = _reassemblies.find(id);
+
+    if ((i != _reassemblies.end()) && (i->second.fragment != fragment)) {
+        _reassemblies.erase(i);
+        i = _reassemblies.end();
+    }
+
+    if (i == _reassemblies.end()) {
+        i = _reassemblies.emplace(id, Reassembly()).first;
+    }
+
+    std::vector<uint8_t>& m = i->second.data;
+
+    m.insert(m.end(), frame.data, frame.data + frame.length);
+    i->second.fragment = fragment - 1;
+
+    if (fragment != 0) {
+        return;
+    }
+
+    std::vector<uint8_t> message = std::move(m);
+
+    _reassemblies.erase(i);
+
+    if (_cut || (message.size() > MAXIMUM_MESSAGE_LENGTH)) {
+        return;
+    }
+
+    // An acknowledge: command, sequence, status, the command acknowledged
+    if (_losing && (message.size() >= 4) && (message[0] == static_cast<uint8_t>(MessageType::ACK))
+        && (message[3] == static_cast<uint8_t>(_loseCommand))) {
+        if (_loseSkip == 0) {
+            _losing = false;
+            _lost++;
+            return;
+        }
+
+        _loseSkip--;
+    }
+
+    Frame f;
+
+    f.topic = id >> 8;
+    f.node  = id & 0xFF;
+    f.size  = message.size();
+    memcpy(f.data, message.data(), message.size());
+
+    _received.push_back(f);
+} // PortBus::received
+
+bool
+PortBus::service(
+    Time  now,
+    Time& next
+)
+{
+    next = NEVER;
+
+    if (_state == RESTARTING) {
+        if (now < _restart) {
+            next = _restart;
+            return false;
+        }
+
+        spawn(now);
+        return true;
+    }
+
+    if (_state != RUNNING) {
+        _arrivals.clear();
+        return false;
+    }
+
+    if (now >= _watchdog) {
+        terminate();
+        _resetSource = hw::ResetSource::WATCHDOG;
+        _restart     = now + RESTART;
+        _state       = RESTARTING;
+        return true;
+    }
+
+    // Into the receive FIFO
+    while (!_arrivals.empty() && (_arrivals.begin()->first <= now)) {
+        NodeEvent event = {NodeEvent::FRAME, now, _arrivals.begin()->second};
+
+        _inbox.push_back(event);
+        _arrivals.erase(_arrivals.begin());
+    }
+
+    if (_transmitting && (now >= std::min(_transmitted, _deadline))) {
+        NodeEvent event = {(_transmitted <= _deadline) ? NodeEvent::SENT : NodeEvent::LOST, now, {}};
+
+        if (event.type == NodeEvent::SENT) {
+            received(_frame);
+        }
+
+        _transmitting = false;
+        _inbox.push_back(event);
+    }
+
+    if (now >= _idle) {
+        if (!_inbox.empty()) {
+            NodeEvent event = _inbox.front();
+
+            _inbox.pop_front();
+            event.time = now;
+            deliver(event, now);
+            return true;
+        }
+
+        if (now >= _until) {
+            NodeEvent event = {NodeEvent::TIMER, now, {}};
+
+            deliver(event, now);
+            return true;
+        }
+    }
+
+    next = std::min(_watchdog, _inbox.empty() ? std::max(_until, _idle) : _idle);
+
+    if (!_arrivals.empty()) {
+        next = std::min(next, _arrivals.begin()->first);
+    }
+
+    if (_transmitting) {
+        next = std::min(next, std::min(_transmitted, _deadline));
+    }
+
+    return false;
+} // PortBus::service
+
+void
+PortBus::drive()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (!_stop) {
+        Time next;
+
+        if (service(now(), next)) {
+            _changed.notify_all();
+        } else if (next == NEVER) {
+            _changed.wait(lock);
+        } else {
+            _changed.wait_until(lock, _epoch + std::chrono::nanoseconds(next));
+        }
+    }
+}
+
+static Image
+madeUp(
+    std::size_t length,
+    unsigned    seed
+)
+{
+    std::mt19937         random(seed);
+    std::vector<uint8_t> data(length);
+    Image                image;
+
+    for (uint8_t& b : data) {
+        b = random();
+    }
+
+    image.add(PROGRAM_FLASH_FROM, data.data(), data.size());
+    return image;
+}
+
+static bool
+programmed(
+    PortBus&     bus,
+    const Image& image
+)
+{
+    const Image::Segment& segment = image.segments().begin()->second;
+
+    return bus.read(image.segments().begin()->first, segment.size()) == segment;
+}
+
+static unsigned failed = 0;
+
+static void
+check(
+    const char* name,
+    bool        ok
+)
+{
+    printf("%s %s\n", ok ? "ok  " : "FAIL", name);
+
+    if (!ok) {
+        failed++;
+    }
+}
+
+int
+main()
+{
+    char pattern[] = "/tmp/slave_test.XXXXXX";
+
+    if (mkdtemp(pattern) == nullptr) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    std::string directory = pattern;
+    std::string flashPath = directory + "/slave.flash";
+
+    {
+        PortBus        bus(flashPath);
+        Master         master(bus, MASTER_ID);
+        Image          image  = madeUp(8 * 1024, 1);
+        Master::Result result = {};
+
+        // Identify, select, erase, write, verify, commit, reset: one write goes twice
+        bus.loseAcknowledge(MessageType::BINARY_WRITE, 2);
+        result = master.flash(bus.uid(), image, Master::Options());
+
+        if (!result.ok()) {
+            printf("     %s: %s\n", stepName(result.step), statusName(result.status));
+        }
+
+        check("flash", result.ok());
+        check("write sent again after a lost acknowledge", (bus.lost() == 1) && (result.metrics.lost >= 1));
+        check("boot", bus.waitBoot(std::chrono::seconds(4)));
+        check("program in flash", programmed(bus, image));
+
+        // Back in the bootloader, a master goes away in the middle of a write,
+        // half a page staged
+        Image                    abandoned = madeUp(8 * 1024, 2);
+        uint16_t                 slaveID   = ANY_NODE;
+        std::unique_ptr<Session> session;
+
+        image = madeUp(6 * 1024, 3);
+        bus.bootload();
+        check("identify", (master.identify(bus.uid(), &slaveID) == AcknowledgeStatus::OK) && (slaveID == SLAVE_ID));
+
+        session = master.session(bus.uid(), slaveID);
+        check("abandoned write", (session->open() == AcknowledgeStatus::OK) && (session->eraseProgram() == AcknowledgeStatus::OK));
+
+        session->write(abandoned, [&](std::size_t done, std::size_t) {
+            if (done >= 3 * 1024) {
+                session->channel().setRetries(0);
+                bus.cut(true);
+            }
+        });
+
+        session.reset();
+        bus.cut(false);
+
+        // The slave is still selected, it does not answer IDENTIFY_SLAVE: the
+        // master opens a session with the CAN ID it knows. Nothing of the
+        // abandoned write must end up in flash
+        payload::DescribeV2 description;
+        AcknowledgeStatus   status;
+
+        session = master.session(bus.uid(), slaveID);
+        status  = session->open();
+        status  = (status == AcknowledgeStatus::OK) ? session->eraseProgram() : status;
+        status  = (status == AcknowledgeStatus::OK) ? session->write(image) : status;
+        status  = (status == AcknowledgeStatus::OK) ? session->verify(image) : status;
+        status  = (status == AcknowledgeStatus::OK) ? session->describe(description) : status;
+        status  = (status == AcknowledgeStatus::OK) ? session->writeProgramCRC(description.flashCRC) : status;
+        status  = (status == AcknowledgeStatus::OK) ? session->reset() : status;
+
+        check("write after an abandoned one", status == AcknowledgeStatus::OK);
+        check("boot", bus.waitBoot(std::chrono::seconds(4)));
+        check("program in flash", programmed(bus, image));
+
+        // Back in the bootloader, nobody selected it: a TAGS_READ is rejected
+        // before it reads anything, the acknowledge has no tags in it
+        payload::UIDAndAddress tags;
+        Request                request;
+        Frame                  ack = {};
+
+        bus.bootload();
+        tags.uid     = bus.uid();
+        tags.address = PROGRAM_FLASH_FROM;
+        request      = makeRequest<messages::TagsRead, messages::aligned::TagsRead>(false, tags);
+        session      = master.session(bus.uid(), slaveID);
+        status       = master.identify(bus.uid(), &slaveID);
+        status       = (status == AcknowledgeStatus::OK) ? session->channel().transact(request, &ack, false) : status;
+
+        const AcknowledgeTags* rejected = ack.as<AcknowledgeTags>();
+        static const char      NO_TAGS[sizeof(rejected->data)] = {0};
+
+        check("tags read when not selected", (status == AcknowledgeStatus::NOT_SELECTED) && (rejected != nullptr) && (memcmp(rejected->data, NO_TAGS, sizeof(NO_TAGS)) == 0));
+
+        // In a shared session the requests come on the direct topic, with the
+        // CAN ID of the slave only: once its master let it go, the slave does
+        // not take them, not even to refuse them
+        session = master.session(bus.uid(), slaveID);
+        check("shared session", session->open(true) == AcknowledgeStatus::OK);
+
+        bus.release();
+        check("no direct requests after a release", session->channel().transact(request, &ack, false) == AcknowledgeStatus::NONE);
+    }
+
+    unlink(flashPath.c_str());
+    rmdir(directory.c_str());
+
+    return (failed == 0) ? 0 : 1;
+} // main
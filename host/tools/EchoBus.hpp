@@ -0,0 +1,181 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+// Simulated slaves for the benchmarks: they acknowledge everything with OK,
+// after the latency, as 1.2.0 slaves with ALIGNED_LAYOUT and BINARY_WRITE
+
+#include <core/bootloader/master/Transport.hpp>
+
+#include <algorithm>
+#include <map>
+#include <thread>
+#include <vector>
+
+namespace bootloader {
+namespace master {
+class EchoBus:
+    public ITransport
+{
+public:
+    // The slaves get the CAN IDs 1 to n, in order. Each message keeps the
+    // bus busy for frameTime, one after the other
+    EchoBus(
+        const std::vector<ModuleUID>& slaves,
+        Clock::duration               latency,
+        Clock::duration               frameTime = Clock::duration::zero()
+    ) :
+        _latency(latency),
+        _frameTime(frameTime),
+        _free(Clock::now()),
+        _head(0)
+    {
+        for (std::size_t i = 0; i < slaves.size(); i++) {
+            messages::Announce m;
+            Frame              frame;
+
+            _nodes[slaves[i]] = i + 1;
+            _uids.push_back(slaves[i]);
+
+            // Everybody announces itself first
+            m.data.uid  = slaves[i];
+            frame.topic = BOOTLOADER_MASTER_TOPIC_ID;
+            frame.node  = i + 1;
+            frame.size  = sizeof(m);
+            memcpy(frame.data, &m, sizeof(m));
+            _queue.push_back(Pending {Clock::now(), frame});
+        }
+    }
+
+    bool
+    send(
+        const Frame& frame
+    ) override
+    {
+        const LongMessage* m    = reinterpret_cast<const LongMessage*>(frame.data);
+        ModuleUID          uid  = 0;
+        uint8_t            node = 0;
+
+        if (frame.topic == BOOTLOADER_DIRECT_TOPIC_ID) {
+            node = frame.node;
+        } else {
+            if (m->command == MessageType::IDENTIFY_SLAVE) {
+                uid = reinterpret_cast<const messages::IdentifySlave*>(frame.data)->data.uid;
+            } else {
+                // SELECT_SLAVE_SHARED, the rest of the session goes direct
+                uid = reinterpret_cast<const messages::aligned::SelectShared*>(frame.data)->data.uid;
+            }
+
+            auto i = _nodes.find(uid);
+
+            node = (i != _nodes.end()) ? i->second : 0;
+        }
+
+        // The request takes the bus, even if nobody answers
+        Clock::time_point start = std::max(Clock::now(), _free);
+
+        _free = start + _frameTime;
+
+        if ((node == 0) || (node > _uids.size())) {
+            return true;
+        }
+
+        uid = _uids[node - 1];
+
+        Frame ack;
+
+        ack.topic = BOOTLOADER_TOPIC_ID;
+        ack.node  = node;
+        ack.size  = LongMessage::MESSAGE_LENGTH;
+
+        switch (m->command) {
+          case MessageType::PROTOCOL_VERSION:
+          {
+              AcknowledgeProtocolVersion a(m->sequenceId, m, AcknowledgeStatus::OK, "1.2.0", ALIGNED_LAYOUT | BINARY_WRITE);
+              memcpy(ack.data, &a, sizeof(a));
+          }
+          break;
+          case MessageType::SET_SESSION_MODE:
+          {
+              const messages::aligned::SetSessionMode* r = reinterpret_cast<const messages::aligned::SetSessionMode*>(m);
+              AcknowledgeMode a(m->sequenceId, m, AcknowledgeStatus::OK, uid, r->data.capabilities);
+              memcpy(ack.data, &a, sizeof(a));
+          }
+          break;
+          case MessageType::DESCRIBE_V2:
+          {
+              static const char     NAME[16] = "echo";
+              AcknowledgeDescribeV2 a(m->sequenceId, m, AcknowledgeStatus::OK, node, NAME, NAME, 0, 0, 0, 0);
+              memcpy(ack.data, &a, sizeof(a));
+          }
+          break;
+          default:
+          {
+              AcknowledgeMessage_<LongMessage, payload::UID> a(m->sequenceId, m, AcknowledgeStatus::OK);
+              a.data.uid = uid;
+              memcpy(ack.data, &a, sizeof(a));
+          }
+        } // switch
+
+        // The acknowledge is ready after the latency, it takes the bus when
+        // it is received
+        _queue.push_back(Pending {_free + _latency, ack});
+
+        return true;
+    } // send
+
+    bool
+    receive(
+        Frame&          frame,
+        Clock::duration timeout
+    ) override
+    {
+        if (_head == _queue.size()) {
+            std::this_thread::sleep_for(timeout);
+            return false;
+        }
+
+        Clock::time_point now  = Clock::now();
+        const Pending&    next = _queue[_head];
+        Clock::time_point at   = std::max(next.at, _free) + _frameTime;
+
+        if (at > now) {
+            if (at - now > timeout) {
+                std::this_thread::sleep_for(timeout);
+                return false;
+            }
+
+            std::this_thread::sleep_until(at);
+        }
+
+        frame = next.frame;
+        _free = std::max(_free, at);
+
+        if (++_head == _queue.size()) {
+            _queue.clear();
+            _head = 0;
+        }
+
+        return true;
+    } // receive
+
+private:
+    struct Pending {
+        Clock::time_point at; // Ready to go
+        Frame             frame;
+    };
+
+    Clock::duration                _latency;
+    Clock::duration                _frameTime;
+    Clock::time_point              _free; // When the bus is free again
+    std::map<ModuleUID, uint8_t>   _nodes;
+    std::vector<ModuleUID>         _uids;
+    std::vector<Pending>           _queue;
+    std::size_t                    _head;
+};
+}
+}
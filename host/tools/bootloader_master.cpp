@@ -0,0 +1,345 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+// Command line master
+//
+//   bootloader_master [options] list
+//   bootloader_master [options] identify <uid>
+//   bootloader_master [options] flash <uid> <image.hex>
+//   bootloader_master [options] verify <uid> <image.hex>
+//   bootloader_master [options] reset <uid>
+//   bootloader_master [options] update <plan>
+//
+// A plan has a line per slave, "<uid> <image.hex>". update flashes them all,
+// on every gateway given at once, see Fleet.
+//
+// An image ending in .blp is a transfer plan made by bootloader_plan: it is
+// mapped and sent as it is, --binary does not apply.
+//
+// Options:
+//   --gateway <host:port>  CAN gateway, see StreamTransport (default localhost:11898),
+//                          once per bus
+//   --sessions <n>         Slaves flashed at the same time on each bus by update (default 32)
+//   --master <id>          CAN ID of the master (default 0xF0)
+//   --binary <address>     The image is a raw binary to be written at address
+//   --no-verify            Do not compare the flash with the image
+//   --no-reset             Leave the slave in the bootloader
+//   --verbose              Print the pacing metrics
+
+#include <core/bootloader/master/Fleet.hpp>
+#include <core/bootloader/master/Master.hpp>
+#include <core/bootloader/master/StreamTransport.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace bootloader;
+using namespace bootloader::master;
+
+static int
+usage()
+{
+    std::cerr << "usage: bootloader_master [--gateway host:port]... [--master id] [--binary address] [--sessions n]" << std::endl
+              << "                         [--no-verify] [--no-reset] [--verbose] <command> [arguments]" << std::endl
+              << "commands: list | identify <uid> | flash <uid> <image> | verify <uid> <image> | reset <uid> | update <plan>" << std::endl;
+    return 2;
+}
+
+static bool
+loadImage(
+    Image&             image,
+    const std::string& path,
+    bool               binary,
+    uint32_t           address
+)
+{
+    bool success = binary ? image.loadBinary(path, address) : image.loadIHex(path);
+
+    if (!success || image.empty()) {
+        std::cerr << path << ": cannot read the image" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+static bool
+isTransferPlan(
+    const std::string& path
+)
+{
+    static const std::string EXTENSION = ".blp";
+
+    return (path.size() > EXTENSION.size()) && (path.compare(path.size() - EXTENSION.size(), EXTENSION.size(), EXTENSION) == 0);
+}
+
+static std::shared_ptr<const Plan>
+loadPlan(
+    const std::string& path
+)
+{
+    std::shared_ptr<const Plan> plan = Plan::open(path);
+
+    if (!plan) {
+        std::cerr << path << ": not a valid transfer plan" << std::endl;
+    }
+
+    return plan;
+}
+
+static int
+report(
+    const char*       what,
+    AcknowledgeStatus status
+)
+{
+    if (status != AcknowledgeStatus::OK) {
+        std::cerr << what << ": " << statusName(status) << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+// Every slave of the plan, on every bus at once
+static int
+update(
+    const std::vector<std::string>& gateways,
+    uint8_t                         masterID,
+    const std::string&              plan,
+    const Fleet::Options&           options,
+    bool                            binary,
+    uint32_t                        address,
+    bool                            verbose
+)
+{
+    std::vector<std::unique_ptr<StreamTransport> > transports;
+    std::vector<ITransport*>                       buses;
+
+    for (const std::string& gateway : gateways) {
+        transports.emplace_back(StreamTransport::connect(gateway));
+
+        if (!transports.back()) {
+            std::cerr << gateway << ": cannot connect to the gateway" << std::endl;
+            return 1;
+        }
+
+        buses.push_back(transports.back().get());
+    }
+
+    std::ifstream stream(plan);
+
+    if (!stream) {
+        std::cerr << plan << ": cannot read the plan" << std::endl;
+        return 1;
+    }
+
+    Fleet      fleet(buses, masterID, options);
+    ImageCache images;
+
+    std::map<std::string, std::shared_ptr<const Plan> > plans;
+
+    fleet.discover();
+
+    std::string uid;
+    std::string path;
+
+    while (stream >> uid >> path) {
+        if (isTransferPlan(path)) {
+            std::shared_ptr<const Plan>& plan = plans[path];
+
+            if (!plan && !(plan = loadPlan(path))) {
+                return 1;
+            }
+
+            fleet.add(strtoul(uid.c_str(), nullptr, 16), plan);
+            continue;
+        }
+
+        ImageCache::Entry image = images.load(path, binary, address);
+
+        if (!image) {
+            std::cerr << path << ": cannot read the image" << std::endl;
+            return 1;
+        }
+
+        fleet.add(strtoul(uid.c_str(), nullptr, 16), image);
+    }
+
+    int failed = 0;
+
+    fleet.run([&](const Fleet::Outcome& o) {
+                  if (o.result.ok()) {
+                      printf("%08X  bus %d  done in %.1f s\n", o.uid, o.bus, std::chrono::duration<double>(o.elapsed).count());
+                  } else {
+                      printf("%08X  bus %d  %s: %s\n", o.uid, o.bus, stepName(o.result.step), statusName(o.result.status));
+                      failed++;
+                  }
+
+                  if (verbose) {
+                      std::cerr << o.result.metrics << std::endl;
+                  }
+              });
+
+    return (failed == 0) ? 0 : 1;
+} // update
+
+int
+main(
+    int   argc,
+    char* argv[]
+)
+{
+    std::vector<std::string> gateways;
+    Fleet::Options           fleet;
+    uint8_t                  masterID = 0xF0;
+    bool                     binary   = false;
+    uint32_t                 address  = 0;
+    bool                     verbose  = false;
+    Master::Options          options;
+    std::vector<std::string> arguments;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+
+        if ((a == "--gateway") && (i + 1 < argc)) {
+            gateways.push_back(argv[++i]);
+        } else if ((a == "--sessions") && (i + 1 < argc)) {
+            fleet.sessionsPerBus = strtoul(argv[++i], nullptr, 0);
+        } else if ((a == "--master") && (i + 1 < argc)) {
+            masterID = strtoul(argv[++i], nullptr, 0);
+        } else if ((a == "--binary") && (i + 1 < argc)) {
+            binary  = true;
+            address = strtoul(argv[++i], nullptr, 0);
+        } else if (a == "--no-verify") {
+            options.verify = false;
+        } else if (a == "--no-reset") {
+            options.reset = false;
+        } else if (a == "--verbose") {
+            verbose = true;
+        } else if (a.compare(0, 2, "--") == 0) {
+            return usage();
+        } else {
+            arguments.push_back(a);
+        }
+    }
+
+    if (arguments.empty()) {
+        return usage();
+    }
+
+    if (gateways.empty()) {
+        gateways.push_back("localhost:11898");
+    }
+
+    if ((arguments[0] == "update") && (arguments.size() == 2)) {
+        fleet.flash = options;
+        return update(gateways, masterID, arguments[1], fleet, binary, address, verbose);
+    }
+
+    std::unique_ptr<StreamTransport> transport(StreamTransport::connect(gateways.front()));
+
+    if (!transport) {
+        std::cerr << gateways.front() << ": cannot connect to the gateway" << std::endl;
+        return 1;
+    }
+
+    Master            master(*transport, masterID);
+    const std::string command = arguments[0];
+    ModuleUID         uid     = (arguments.size() > 1) ? strtoul(arguments[1].c_str(), nullptr, 16) : 0;
+
+    if (command == "list") {
+        // Slaves announce themselves about every second
+        for (const auto& slave : master.listen(std::chrono::seconds(3))) {
+            printf("%08X  CAN ID 0x%02X\n", slave.first, slave.second);
+        }
+
+        return 0;
+    } else if ((command == "identify") && (arguments.size() == 2)) {
+        uint16_t slaveID = ANY_NODE;
+        int      result  = report("identify", master.identify(uid, &slaveID));
+
+        if (result == 0) {
+            printf("%08X  CAN ID 0x%02X\n", uid, slaveID);
+        }
+
+        return result;
+    } else if ((command == "flash") && (arguments.size() == 3)) {
+        Image                       image;
+        std::shared_ptr<const Plan> plan;
+
+        auto progress = [](std::size_t done, std::size_t total) {
+                            fprintf(stderr, "\r%zu/%zu bytes", done, total);
+                        };
+
+        if (isTransferPlan(arguments[2]) ? !(plan = loadPlan(arguments[2])) : !loadImage(image, arguments[2], binary, address)) {
+            return 1;
+        }
+
+        Master::Result result = plan ? master.flash(uid, *plan, options, progress) : master.flash(uid, image, options, progress);
+
+        fprintf(stderr, "\n");
+
+        if (verbose) {
+            std::cerr << result.metrics << std::endl;
+        }
+
+        if (!result.ok()) {
+            std::cerr << stepName(result.step) << ": " << statusName(result.status) << std::endl;
+            return 1;
+        }
+
+        return 0;
+    } else if ((command == "verify") && (arguments.size() == 3)) {
+        Image                       image;
+        std::shared_ptr<const Plan> plan;
+        uint16_t                    slaveID = ANY_NODE;
+
+        if (isTransferPlan(arguments[2]) ? !(plan = loadPlan(arguments[2])) : !loadImage(image, arguments[2], binary, address)) {
+            return 1;
+        }
+
+        if (report("identify", master.identify(uid, &slaveID))) {
+            return 1;
+        }
+
+        std::unique_ptr<Session> session = master.session(uid, slaveID);
+
+        if (report("open", session->open())) {
+            return 1;
+        }
+
+        int result = report("verify", plan ? session->verify(*plan) : session->verify(image));
+
+        if (verbose) {
+            std::cerr << session->channel().pacer().metrics() << std::endl;
+        }
+
+        return result;
+    } else if ((command == "reset") && (arguments.size() == 2)) {
+        uint16_t slaveID = ANY_NODE;
+
+        if (report("identify", master.identify(uid, &slaveID))) {
+            return 1;
+        }
+
+        std::unique_ptr<Session> session = master.session(uid, slaveID);
+
+        if (report("open", session->open())) {
+            return 1;
+        }
+
+        return report("reset", session->reset());
+    }
+
+    return usage();
+} // main
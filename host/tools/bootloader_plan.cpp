@@ -0,0 +1,120 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+// Transfer plan compiler
+//
+//   bootloader_plan [--binary address] [--page-size bytes] <image.hex> <plan.blp>
+//   bootloader_plan --show <plan.blp>
+//
+// Compiles the image into the write requests of every session mode, once,
+// so that bootloader_master only has to map the plan and send them, see Plan.
+
+#include <core/bootloader/master/Plan.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace bootloader;
+using namespace bootloader::master;
+
+static int
+usage()
+{
+    std::cerr << "usage: bootloader_plan [--binary address] [--page-size bytes] <image> <plan>" << std::endl
+              << "       bootloader_plan --show <plan>" << std::endl;
+    return 2;
+}
+
+static int
+show(
+    const std::string& path
+)
+{
+    std::shared_ptr<const Plan> plan = Plan::open(path);
+
+    if (!plan) {
+        std::cerr << path << ": not a valid transfer plan" << std::endl;
+        return 1;
+    }
+
+    const PlanHeader& h = plan->header();
+
+    printf("image     %u bytes, CRC %08X\n", h.imageSize, h.imageCRC);
+    printf("file      %llu bytes\n", (unsigned long long)h.fileSize);
+
+    for (uint32_t mode : {0u, (uint32_t)ALIGNED_LAYOUT, (uint32_t)(ALIGNED_LAYOUT | BINARY_WRITE), (uint32_t)BINARY_WRITE}) {
+        const PlanTrack* track = plan->track(mode);
+
+        if (track != nullptr) {
+            printf("track     %-7s %-6s %u requests\n", (mode & ALIGNED_LAYOUT) ? "aligned" : "legacy", (mode & BINARY_WRITE) ? "binary" : "ihex", track->count);
+        }
+    }
+
+    for (uint32_t i = 0; i < h.segments; i++) {
+        const PlanSegment& s = plan->segments()[i];
+
+        printf("segment   %08X  %u bytes, CRC %08X\n", s.address, s.length, s.crc);
+    }
+
+    for (uint32_t i = 0; i < h.pages; i++) {
+        const PlanPage& p = plan->pages()[i];
+
+        printf("page      %08X  CRC %08X\n", p.address, p.crc);
+    }
+
+    return 0;
+} // show
+
+int
+main(
+    int   argc,
+    char* argv[]
+)
+{
+    bool                     binary   = false;
+    uint32_t                 address  = 0;
+    uint32_t                 pageSize = PLAN_PAGE_SIZE;
+    std::vector<std::string> arguments;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+
+        if ((a == "--binary") && (i + 1 < argc)) {
+            binary  = true;
+            address = strtoul(argv[++i], nullptr, 0);
+        } else if ((a == "--page-size") && (i + 1 < argc)) {
+            pageSize = strtoul(argv[++i], nullptr, 0);
+        } else if ((a == "--show") && (i + 1 < argc)) {
+            return show(argv[++i]);
+        } else if (a.compare(0, 2, "--") == 0) {
+            return usage();
+        } else {
+            arguments.push_back(a);
+        }
+    }
+
+    if (arguments.size() != 2) {
+        return usage();
+    }
+
+    Image image;
+    bool  success = binary ? image.loadBinary(arguments[0], address) : image.loadIHex(arguments[0]);
+
+    if (!success || image.empty()) {
+        std::cerr << arguments[0] << ": cannot read the image" << std::endl;
+        return 1;
+    }
+
+    if (!Plan::compile(image, arguments[1], pageSize)) {
+        std::cerr << arguments[1] << ": cannot write the plan" << std::endl;
+        return 1;
+    }
+
+    return show(arguments[1]);
+} // main
@@ -0,0 +1,2363 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+// Tens of slaves on one CAN bus, in virtual time
+//
+//   bootloader_simulator [--trace] <scenario>
+//
+// The slaves run the bootloader of src/, built for the host with host/port:
+// each is a process of its own, with its statics and its flash, driven one
+// event at a time (bootloader::port::Node). The bus is simulated here: frames
+// are arbitrated by identifier, take the time of their bits at the bitrate
+// of rtcan_config, stuff bits included, and frames with the same identifier
+// but different data collide, with error frames and the error counters of
+// the controllers. The masters are scripted.
+//
+// The result depends on the scenario only: the same scenario, the same run.
+// The firmware sends some bytes it did not initialize, stack addresses among
+// them: the simulator runs without address space randomization for that.
+//
+// A scenario has one statement per line, # begins a comment. Times are
+// numbers with ns, us, ms or s.
+//
+//   bitrate <bit/s>         Default: the one of rtcan_config
+//   duration <time>         Default: 10 s
+//   fifo <frames>           Receive FIFO of the slaves, default 3
+//   restart <time>          From a reset to the bootloader running, default 1 ms
+//   slaves <n> [power-on | bootload] [canid <first>] [image <ihex file>]
+//                           n more slaves. power-on (the default) starts them
+//                           after a power on reset, bootload as a master asked
+//                           them to. Without canid they pick a random one.
+//   master <id>             A master, with that CAN ID
+//   at <time> [every <period>] <master> <command> [arguments]
+//   faults [drop <p>] [duplicate <p>] [reorder <p>] [delay <p> <time>]
+//                           A noisy bus: each node misses a frame with
+//                           probability p, gets it twice, gets a fragment
+//                           after the next one, and a master gets an
+//                           acknowledge late. rtcan loses a message whose
+//                           fragments do not arrive in order
+//   seed <n>                Of the faults, default 1
+//   timeout <time>          Of the transfers, before a request goes again, default
+//                           100 ms, then twice as long each time up to 2 s, as
+//                           the masters back off. Without async, the slave
+//                           acknowledges ERASE_PROGRAM after the whole erase:
+//                           that takes seconds
+//   retries <n>             Of a request, default 5
+//
+// The slaves are numbered from 0 in the order they are declared. Commands:
+//
+//   advertise               MASTER_ADVERTISE
+//   ignore <slave | all>    MASTER_IGNORE
+//   force <slave | all>     MASTER_FORCE
+//   bootload                BOOTLOAD, to the slaves that follow the master
+//   identify <slave>        IDENTIFY_SLAVE
+//   enumerate <bits> <us>   ENUMERATE, 2^bits slots of us each
+//   describe-all <first> <last> <us>  DESCRIBE_ALL, CAN IDs from first to last, slots of us each
+//   select <slave>          SELECT_SLAVE
+//   describe <slave>        DESCRIBE_V3, in the session
+//   deselect <slave>        DESELECT_SLAVE
+//   reset <slave>           RESET
+//   reset-all               RESET_ALL
+//   program <slave> <ihex file | bytes> [mode]
+//                           Writes an image, or made up bytes, as the masters
+//                           do: select, SET_SESSION_MODE, erase, write, commit
+//                           the CRC, deselect. Stop and wait: one request in
+//                           flight, the same one again after timeout. mode is
+//                           legacy, or the capabilities joined by +: aligned,
+//                           binary, windowing, compression, range-crc,
+//                           compact-ack, async, resume. Default aligned+binary+async
+//
+// For each node, the report has its CAN ID, what became of it, its messages
+// with the time from the first frame queued to the last one sent, the
+// arbitrations it lost, its collisions and bus offs, and the frames it lost
+// because its FIFO was full. For the slaves, the time from the end of a
+// request to the end of their acknowledge, as the master that sent it saw it.
+// For each transfer, what it achieved: the bytes of the image over the time
+// from the first request to the last acknowledge, over the time of the writes
+// alone, and the requests sent again. The exit status is 1 if a transfer did
+// not complete: a scenario is also a test.
+// --trace prints every message on the bus.
+
+#include <core/bootloader/master/CRC.hpp>
+#include <core/bootloader/master/Image.hpp>
+#include <core/bootloader/master/Protocol.hpp>
+#include <core/bootloader/master/Requests.hpp>
+#include <core/bootloader/port/EmulatedFlash.hpp>
+#include <core/bootloader/port/Node.hpp>
+#include <core/stm32_flash/ConfigurationStorage.hpp>
+#include <core/stm32_flash/ProgramStorage.hpp>
+
+#include <rtcan.h>
+
+#include <signal.h>
+#include <poll.h>
+#include <sys/personality.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace bootloader;
+using namespace bootloader::port;
+using bootloader::master::Image;
+using bootloader::master::Request;
+using namespace core::stm32_flash;
+
+extern RTCANConfig rtcan_config;
+
+static const Time SECOND      = 1000000000ULL;
+static const int  HANG_POLL   = 10000;         // [ms] A node that does not answer, not even for its CPU timer
+static const Time ERROR_FRAME = 20;            // [bits] Error flag, its echo and the delimiter
+static const Time JOB_POLL    = SECOND / 20;   // Between JOB_STATUS, as the masters do
+static const Time BACKOFF     = 2 * SECOND;    // The masters double the timeout up to this
+
+static const uint32_t DEFAULT_MODE = ALIGNED_LAYOUT | BINARY_WRITE | ASYNC_JOBS;
+
+// The controllers of the slaves, and the flash: those of the part
+static FlashSegment         programFlash(PROGRAM_FLASH_FROM, PROGRAM_FLASH_TO);
+static ProgramStorage       programStorage(programFlash);
+static FlashSegment         configurationBank1(CONFIGURATION1_FLASH_FROM, CONFIGURATION1_FLASH_TO);
+static FlashSegment         configurationBank2(CONFIGURATION2_FLASH_FROM, CONFIGURATION2_FLASH_TO);
+static Storage              userStorage(configurationBank1, configurationBank2);
+static ConfigurationStorage configurationStorage(userStorage);
+
+using MasterAdvertise = Message_<ShortMessage, MessageType::MASTER_ADVERTISE, payload::UID>;
+
+// Not random, but not regular either: the UIDs of the slaves, the faults
+static uint64_t
+mix(
+    uint64_t x
+)
+{
+    x += 0x9E3779B97F4A7C15ULL;
+    x  = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x  = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+
+    return x ^ (x >> 31);
+}
+
+//--- BIT TIMING --------------------------------------------------------------
+
+// Bits of an extended data frame on the wire, stuff bits and interframe space included
+static unsigned
+frameBits(
+    const CanFrame& frame
+)
+{
+    std::vector<uint8_t> bits;
+
+    auto put = [&bits](uint32_t value, unsigned count) {
+                   while (count-- > 0) {
+                       bits.push_back((value >> count) & 1);
+                   }
+               };
+
+    put(0, 1);                 // SOF
+    put(frame.id >> 18, 11);   // Base identifier
+    put(3, 2);                 // SRR, IDE
+    put(frame.id, 18);         // Extended identifier
+    put(0, 3);                 // RTR, r1, r0
+    put(frame.length, 4);
+
+    for (uint8_t i = 0; i < frame.length; i++) {
+        put(frame.data[i], 8);
+    }
+
+    uint16_t crc = 0;
+
+    for (uint8_t b : bits) {
+        bool next = ((crc >> 14) ^ b) & 1;
+
+        crc = (crc << 1) & 0x7FFF;
+
+        if (next) {
+            crc ^= 0x4599;
+        }
+    }
+
+    put(crc, 15);
+
+    // After five equal bits, one of the other value, which counts for the next five
+    unsigned stuffed = 0;
+    unsigned run     = 0;
+    uint8_t  last    = 2;
+
+    for (uint8_t b : bits) {
+        run  = (b == last) ? run + 1 : 1;
+        last = b;
+
+        if (run == 5) {
+            stuffed++;
+            last = !b;
+            run  = 1;
+        }
+    }
+
+    // CRC delimiter, ACK, ACK delimiter, EOF, intermission
+    return bits.size() + stuffed + 1 + 2 + 7 + 3;
+} // frameBits
+
+// Bits on the bus until two frames with the same identifier collide, and the error frame
+static unsigned
+collisionBits(
+    const CanFrame& a,
+    const CanFrame& b
+)
+{
+    unsigned header = 39; // Up to the DLC, stuff bits aside
+    unsigned at     = 0;
+
+    if (a.length == b.length) {
+        while ((at < a.length) && (a.data[at] == b.data[at])) {
+            at++;
+        }
+
+        at = (at + 1) * 8;
+    }
+
+    return header + at + ERROR_FRAME + 3;
+}
+
+//--- NODES -------------------------------------------------------------------
+
+struct Summary {
+    uint64_t count   = 0;
+    Time     total   = 0;
+    Time     maximum = 0;
+
+    void
+    add(
+        Time t
+    )
+    {
+        count++;
+        total  += t;
+        maximum = std::max(maximum, t);
+    }
+
+    double
+    mean() const // [us]
+    {
+        return (count > 0) ? total / 1e3 / count : 0.0;
+    }
+};
+
+// Something with a CAN controller on the bus
+struct Station {
+    std::string name;
+
+    // The frame on the controller
+    bool     pending = false;
+    CanFrame frame;
+    Time     queued   = 0;
+    Time     deadline = NEVER;
+    uint64_t serial   = 0;
+
+    // The error confinement of the controller
+    unsigned tec         = 0;
+    Time     busOffUntil = 0;
+
+    // The message being sent, for the report and the trace
+    Time                 messageStart = NEVER;
+    std::vector<uint8_t> message;
+    uint8_t              canID = 0xFF;
+
+    // A frame received, held back until the next one: they arrive swapped
+    bool     held = false;
+    CanFrame heldFrame;
+    unsigned heldFrom = 0;
+
+    uint64_t frames          = 0;
+    uint64_t arbitrationLost = 0;
+    uint64_t collisions      = 0;
+    uint64_t busOffs         = 0;
+    uint64_t expired         = 0; // Frames still there at their deadline
+    uint64_t overruns        = 0;
+    Summary  messages;  // From the first frame queued to the last one sent
+    Summary  responses; // From the end of a request to the end of its acknowledge
+
+    virtual ~Station() {}
+};
+
+struct Slave:
+    public Station {
+    enum State {
+        RUNNING, APPLICATION, HALTED
+    };
+
+    hw::UID     uid;
+    ModuleUID   moduleUID;
+    std::string flashPath;
+    uint8_t     presetID = 0xFF;
+    Image*      image    = nullptr;
+    bool        first    = true;
+
+    hw::ResetSource resetSource = hw::ResetSource::HARDWARE;
+    uint32_t        nvr         = 0;
+
+    State state  = RUNNING;
+    pid_t pid    = -1;
+    int   socket = -1;
+
+    // Of the node: busy until idle, then waiting until until
+    Time     idle       = 0;
+    Time     until      = NEVER;
+    Time     watchdog   = NEVER;
+    uint64_t generation = 0;
+
+    std::deque<NodeEvent> inbox;
+    unsigned              inboxFrames = 0;
+
+    uint64_t resets         = 0;
+    uint64_t watchdogResets = 0;
+};
+
+// A firmware transfer to a slave, stop and wait: one request in flight, sent
+// again if its acknowledge is not there after the timeout
+struct Transfer {
+    enum Step {
+        SELECT, MODE, ERASE, JOB, WRITE, DESCRIBE, COMMIT, DESELECT, DONE, FAILED
+    };
+
+    unsigned    slave;
+    std::string source;
+    uint32_t    mode;    // Asked for
+    uint32_t    granted; // By the slave, what the requests follow
+    Image       image;   // Half word aligned
+
+    std::unique_ptr<master::WriteRequests> writes;
+
+    Step              step     = SELECT;
+    Step              failedAt = SELECT;
+    AcknowledgeStatus status   = AcknowledgeStatus::NONE;
+    Request           request;         // In flight, or the next JOB_STATUS
+    bool              inFlight = false;
+    uint8_t           sequence = 0;
+    unsigned          retries  = 0;    // Left for the request in flight
+    uint64_t          timer    = 0;    // Serial of the timer that counts
+    uint32_t          crc      = 0;    // Of the program flash, as the slave computed it
+
+    Time start      = 0;
+    Time end        = NEVER;
+    Time writeStart = NEVER; // The first write request
+    Time writeEnd   = NEVER; // The acknowledge of the last one
+
+    uint64_t requests      = 0;
+    uint64_t transmissions = 0;
+    uint64_t timeouts      = 0;
+    uint64_t stale         = 0; // Acknowledges of a request no longer in flight
+};
+
+struct Master:
+    public Station {
+    struct Outgoing {
+        CanFrame    frame;
+        MessageType type;
+    };
+
+    // As rtcan does it: a missing fragment loses the message
+    struct Reassembly {
+        uint8_t              fragment; // Expected next
+        std::vector<uint8_t> data;
+    };
+
+    uint8_t              id;
+    std::deque<Outgoing> queue;
+    MessageType          sending = MessageType::NONE;
+    uint8_t              sequence = 0;
+    std::map<unsigned, uint8_t> sessions; // Sequence of the session with a slave
+
+    // The last request sent, the acknowledges of its type are its responses
+    MessageType lastType = MessageType::NONE;
+    Time        lastSent = NEVER;
+
+    std::map<uint32_t, Reassembly> reassemblies;
+
+    Transfer* transfer = nullptr; // The one going on
+};
+
+struct Command {
+    Time                     at;
+    Time                     every;
+    uint8_t                  master;
+    std::vector<std::string> words;
+};
+
+//--- SIMULATOR ---------------------------------------------------------------
+
+class Simulator
+{
+public:
+    Time     duration = 10 * SECOND;
+    unsigned fifo     = 3;
+    Time     restart  = SECOND / 1000;
+    bool     trace    = false;
+
+    // Of the frames each node receives
+    struct Faults {
+        double drop      = 0.0;
+        double duplicate = 0.0;
+        double reorder   = 0.0;
+        double delay     = 0.0; // Of the acknowledges to the masters
+        Time   delayTime = 0;
+    };
+
+    Faults   faults;
+    uint64_t seed    = 1;
+    Time     timeout = SECOND / 10;
+    unsigned retries = 5;
+
+    std::vector<std::unique_ptr<Slave> >  slaves;
+    std::vector<std::unique_ptr<Master> > masters;
+    std::vector<Command>                  commands;
+    std::vector<std::unique_ptr<Image> >  images;
+
+    std::map<std::string, Image>             programs; // Of the program commands, by source
+    std::vector<std::unique_ptr<Transfer> > transfers;
+
+    EmulatedFlash::Configuration flash;
+
+    uint64_t busFrames  = 0;
+    uint64_t busErrors  = 0;
+    Time     busTime    = 0;
+    uint64_t dropped    = 0;
+    uint64_t duplicated = 0;
+    uint64_t reordered  = 0;
+    uint64_t delayed    = 0;
+
+    std::string directory;
+
+public:
+    bool
+    run();
+
+    void
+    report();
+
+    // All the transfers of the scenario completed
+    bool
+    transferred() const;
+
+    void
+    cleanup();
+
+private:
+    enum class EventType {
+        SPAWN, SERVICE, WATCHDOG, ARBITRATE, FRAME_END, DEADLINE, COMMAND, TRANSFER, ACKNOWLEDGE
+    };
+
+    struct Event {
+        Time      time;
+        uint64_t  order;
+        EventType type;
+        unsigned  target;
+        uint64_t  tag;
+
+        bool
+        operator>(
+            const Event& other
+        ) const
+        {
+            return (time != other.time) ? (time > other.time) : (order > other.order);
+        }
+    };
+
+    void
+    schedule(
+        Time      time,
+        EventType type,
+        unsigned  target = 0,
+        uint64_t  tag = 0
+    )
+    {
+        _events.push(Event {time, _order++, type, target, tag});
+    }
+
+    Time
+    bits(
+        unsigned count
+    ) const
+    {
+        return count * SECOND / rtcan_config.baudrate;
+    }
+
+    // Bus
+    void
+    kick(
+        Time time
+    );
+
+    void
+    arbitrate(
+        Time now
+    );
+
+    void
+    frameEnd(
+        Time now
+    );
+
+    void
+    expire(
+        unsigned station,
+        uint64_t serial,
+        Time     now
+    );
+
+    void
+    sent(
+        Station& station,
+        Time     now
+    );
+
+    // With the faults, ...
+    void
+    received(
+        unsigned        station,
+        unsigned        from,
+        const CanFrame& frame,
+        Time            now
+    );
+
+    // ... and what is left
+    void
+    accept(
+        unsigned        station,
+        unsigned        from,
+        const CanFrame& frame,
+        Time            now
+    );
+
+    bool
+    chance(
+        double probability
+    );
+
+    void
+    traceMessage(
+        const Station& from,
+        uint32_t       id,
+        Time           now
+    );
+
+    // Slaves
+    void
+    spawn(
+        Slave& slave,
+        Time   now
+    );
+
+    void
+    service(
+        Slave&   slave,
+        uint64_t generation,
+        Time     now
+    );
+
+    void
+    deliver(
+        Slave&           slave,
+        const NodeEvent& event,
+        Time             now
+    );
+
+    void
+    collect(
+        Slave& slave,
+        Time   now
+    );
+
+    void
+    post(
+        Slave&           slave,
+        const NodeEvent& event,
+        Time             now
+    );
+
+    void
+    terminate(
+        Slave& slave
+    );
+
+    void
+    watchdog(
+        Slave& slave,
+        Time   now
+    );
+
+    // Masters
+    void
+    execute(
+        const Command& command,
+        Time           now
+    );
+
+    template <typename MESSAGE>
+    void
+    send(
+        Master&        master,
+        const MESSAGE& message,
+        uint8_t        topic,
+        Time           now
+    );
+
+    void
+    next(
+        Master& master,
+        Time    now
+    );
+
+    void
+    queue(
+        Master&        master,
+        const uint8_t* data,
+        std::size_t    size,
+        uint8_t        topic,
+        Time           now
+    );
+
+    void
+    masterReceived(
+        Master&         master,
+        unsigned        from,
+        const CanFrame& frame,
+        Time            now
+    );
+
+    void
+    masterMessage(
+        Master&                     master,
+        unsigned                    from,
+        const std::vector<uint8_t>& data,
+        Time                        now
+    );
+
+    // Transfers
+    void
+    begin(
+        Master&            master,
+        unsigned           slave,
+        const std::string& source,
+        uint32_t           mode,
+        Time               now
+    );
+
+    void
+    issue(
+        Master&        master,
+        Transfer&      transfer,
+        const Request& request,
+        Time           now
+    );
+
+    void
+    transmit(
+        Master&   master,
+        Transfer& transfer,
+        Time      now
+    );
+
+    void
+    acknowledged(
+        Master&                     master,
+        Transfer&                   transfer,
+        const std::vector<uint8_t>& data,
+        Time                        now
+    );
+
+    void
+    expireTransfer(
+        Master&  master,
+        uint64_t timer,
+        Time     now
+    );
+
+    void
+    finish(
+        Master&           master,
+        Transfer&         transfer,
+        Transfer::Step    step,
+        AcknowledgeStatus status,
+        Time              now
+    );
+
+    Station&
+    station(
+        unsigned index
+    )
+    {
+        return (index < slaves.size()) ? static_cast<Station&>(*slaves[index]) : static_cast<Station&>(*masters[index - slaves.size()]);
+    }
+
+    unsigned
+    stations() const
+    {
+        return slaves.size() + masters.size();
+    }
+
+    unsigned
+    indexOf(
+        const Station& s
+    ) const
+    {
+        for (unsigned i = 0; i < slaves.size(); i++) {
+            if (slaves[i].get() == &s) {
+                return i;
+            }
+        }
+
+        for (unsigned i = 0; i < masters.size(); i++) {
+            if (masters[i].get() == &s) {
+                return slaves.size() + i;
+            }
+        }
+
+        return 0;
+    }
+
+private:
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event> > _events;
+    uint64_t _order = 0;
+
+    bool                  _busy        = false;
+    bool                  _arbitrating = false;
+    bool                  _collision   = false;
+    std::vector<unsigned> _onAir;
+
+    // Acknowledges on their way to a master, late
+    struct Delayed {
+        unsigned             master;
+        unsigned             from;
+        std::vector<uint8_t> data;
+    };
+
+    uint64_t                    _draws  = 0;
+    uint64_t                    _delays = 0;
+    std::map<uint64_t, Delayed> _delayed;
+};
+
+void
+Simulator::kick(
+    Time time
+)
+{
+    if (!_busy && !_arbitrating) {
+        _arbitrating = true;
+        schedule(time, EventType::ARBITRATE);
+    }
+}
+
+void
+Simulator::arbitrate(
+    Time now
+)
+{
+    _arbitrating = false;
+
+    if (_busy) {
+        return;
+    }
+
+    std::vector<unsigned> contenders;
+    Time                  later = NEVER;
+
+    for (unsigned i = 0; i < stations(); i++) {
+        Station& s = station(i);
+
+        if (!s.pending) {
+            continue;
+        }
+
+        Time ready = std::max(s.queued, s.busOffUntil);
+
+        if (ready > now) {
+            later = std::min(later, ready);
+        } else {
+            contenders.push_back(i);
+        }
+    }
+
+    if (contenders.empty()) {
+        if (later != NEVER) {
+            kick(later);
+        }
+
+        return;
+    }
+
+    // The dominant bits win: the lowest identifier
+    uint32_t winner = station(contenders[0]).frame.id;
+
+    for (unsigned i : contenders) {
+        winner = std::min(winner, station(i).frame.id);
+    }
+
+    const CanFrame* first    = nullptr;
+    unsigned        duration = 0;
+
+    _onAir.clear();
+    _collision = false;
+
+    for (unsigned i : contenders) {
+        Station& s = station(i);
+
+        if (s.frame.id != winner) {
+            s.arbitrationLost++;
+            continue;
+        }
+
+        _onAir.push_back(i);
+
+        // The same frame from several nodes is one frame on the wire
+        if (first == nullptr) {
+            first    = &s.frame;
+            duration = frameBits(s.frame);
+        } else if ((s.frame.length != first->length) || (memcmp(s.frame.data, first->data, first->length) != 0)) {
+            _collision = true;
+            duration   = std::min(duration, collisionBits(*first, s.frame));
+        }
+    }
+
+    _busy    = true;
+    busTime += bits(duration);
+
+    schedule(now + bits(duration), EventType::FRAME_END);
+} // Simulator::arbitrate
+
+void
+Simulator::frameEnd(
+    Time now
+)
+{
+    _busy = false;
+
+    if (_collision) {
+        busErrors++;
+
+        for (unsigned i : _onAir) {
+            Station& s = station(i);
+
+            s.collisions++;
+            s.tec += 8;
+
+            if (s.tec > 255) {
+                // Back after 128 times 11 recessive bits
+                s.busOffs++;
+                s.tec         = 0;
+                s.busOffUntil = now + bits(128 * 11);
+            }
+
+            // Its deadline passed on the wire: the controller gives up now
+            if (s.deadline <= now) {
+                expire(i, s.serial, now);
+            }
+        }
+    } else {
+        CanFrame frame = station(_onAir[0]).frame;
+
+        busFrames++;
+
+        for (unsigned i : _onAir) {
+            Station& s = station(i);
+
+            s.pending = false;
+            s.frames++;
+            s.tec = (s.tec > 0) ? s.tec - 1 : 0;
+
+            // The bytes of the message, to see where it ends
+            s.message.insert(s.message.end(), frame.data, frame.data + frame.length);
+
+            if ((frame.id & 0x7F) == 0) {
+                if (s.messageStart != NEVER) {
+                    s.messages.add(now - s.messageStart);
+                }
+
+                s.messageStart = NEVER;
+                s.canID        = (frame.id >> 7) & 0xFF;
+
+                if (trace) {
+                    traceMessage(s, frame.id >> 7, now);
+                }
+
+                s.message.clear();
+            }
+
+            sent(s, now);
+        }
+
+        for (unsigned i = 0; i < stations(); i++) {
+            if (std::find(_onAir.begin(), _onAir.end(), i) == _onAir.end()) {
+                received(i, _onAir[0], frame, now);
+            }
+        }
+    }
+
+    kick(now);
+} // Simulator::frameEnd
+
+void
+Simulator::expire(
+    unsigned station,
+    uint64_t serial,
+    Time     now
+)
+{
+    Station& s = this->station(station);
+
+    if (!s.pending || (s.serial != serial)) {
+        return;
+    }
+
+    // It cannot be taken off the wire, it is given up at the end of it
+    if (_busy && (std::find(_onAir.begin(), _onAir.end(), station) != _onAir.end())) {
+        return;
+    }
+
+    s.pending      = false;
+    s.messageStart = NEVER;
+    s.expired++;
+    s.message.clear();
+
+    if (station < slaves.size()) {
+        NodeEvent event = {NodeEvent::LOST, now, {}};
+
+        post(*slaves[station], event, now);
+    }
+}
+
+void
+Simulator::sent(
+    Station& s,
+    Time     now
+)
+{
+    unsigned i = indexOf(s);
+
+    if (i < slaves.size()) {
+        NodeEvent event = {NodeEvent::SENT, now, {}};
+
+        post(*slaves[i], event, now);
+    } else {
+        Master& m = *masters[i - slaves.size()];
+
+        m.queue.pop_front();
+
+        if ((m.frame.id & 0x7F) == 0) {
+            m.lastType = m.sending;
+            m.lastSent = now;
+        }
+
+        next(m, now);
+    }
+}
+
+bool
+Simulator::chance(
+    double probability
+)
+{
+    if (probability <= 0.0) {
+        return false;
+    }
+
+    // Drawn in the order of the events: the same scenario, the same faults
+    return (mix(seed ^ mix(_draws++)) >> 11) * (1.0 / (1ULL << 53)) < probability;
+}
+
+void
+Simulator::received(
+    unsigned        station,
+    unsigned        from,
+    const CanFrame& frame,
+    Time            now
+)
+{
+    Station& s = this->station(station);
+
+    if (chance(faults.drop)) {
+        dropped++;
+        return;
+    }
+
+    // Between the fragments of a message: the last one has none after it
+    if (!s.held && ((frame.id & 0x7F) != 0) && chance(faults.reorder)) {
+        reordered++;
+        s.held      = true;
+        s.heldFrame = frame;
+        s.heldFrom  = from;
+        return;
+    }
+
+    accept(station, from, frame, now);
+
+    if (chance(faults.duplicate)) {
+        duplicated++;
+        accept(station, from, frame, now);
+    }
+
+    if (s.held) {
+        s.held = false;
+        accept(station, s.heldFrom, s.heldFrame, now);
+    }
+} // Simulator::received
+
+void
+Simulator::accept(
+    unsigned        station,
+    unsigned        from,
+    const CanFrame& frame,
+    Time            now
+)
+{
+    if (station >= slaves.size()) {
+        masterReceived(*masters[station - slaves.size()], from, frame, now);
+        return;
+    }
+
+    Slave& s = *slaves[station];
+
+    if (s.state != Slave::RUNNING) {
+        return;
+    }
+
+    if (s.inboxFrames >= fifo) {
+        s.overruns++;
+        return;
+    }
+
+    NodeEvent event = {NodeEvent::FRAME, now, frame};
+
+    post(s, event, now);
+}
+
+void
+Simulator::traceMessage(
+    const Station& from,
+    uint32_t       id,
+    Time           now
+)
+{
+    printf("%12.6f ms  %-10s %04X  %2zu B ", now / 1e6, from.name.c_str(), id, from.message.size());
+
+    for (uint8_t b : from.message) {
+        printf(" %02X", b);
+    }
+
+    printf("\n");
+}
+
+void
+Simulator::spawn(
+    Slave& slave,
+    Time   now
+)
+{
+    int sockets[2];
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockets) != 0) {
+        perror("socketpair");
+        exit(1);
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+
+    if (pid == 0) {
+        close(sockets[0]);
+
+        for (auto& s : slaves) {
+            if (s->socket >= 0) {
+                close(s->socket);
+            }
+        }
+
+        std::unique_ptr<EmulatedFlash> f = EmulatedFlash::create(flash, slave.flashPath);
+
+        if (!f) {
+            _exit(1);
+        }
+
+        if (slave.first) {
+            // What the slave had before the scenario
+            if (slave.image != nullptr) {
+                std::vector<uint8_t> page(flash.pageSize);
+
+                programStorage.unlock();
+                programStorage.beginWrite();
+
+                for (uint32_t address : slave.image->pages(flash.pageSize)) {
+                    slave.image->page(address, page.data(), page.size());
+                    programFlash.write(address, page.data(), page.size());
+                }
+
+                programStorage.endWrite();
+                configurationStorage.writeProgramCRC(programStorage.updateCRC());
+            }
+
+            if (slave.presetID != 0xFF) {
+                configurationStorage.writeCanID(slave.presetID);
+            }
+        }
+
+        Node::Configuration configuration = {
+            sockets[1], slave.uid, slave.resetSource, slave.nvr, now
+        };
+
+        Node::run(configuration);
+    }
+
+    close(sockets[1]);
+
+    slave.pid    = pid;
+    slave.socket = sockets[0];
+    slave.state  = Slave::RUNNING;
+    slave.first  = false;
+    slave.idle   = now;
+    slave.generation++;
+
+    collect(slave, now);
+} // Simulator::spawn
+
+// Something for the node, that it gets as soon as it is not busy
+void
+Simulator::post(
+    Slave&           slave,
+    const NodeEvent& event,
+    Time             now
+)
+{
+    if (slave.state != Slave::RUNNING) {
+        return;
+    }
+
+    slave.inbox.push_back(event);
+
+    if (event.type == NodeEvent::FRAME) {
+        slave.inboxFrames++;
+    }
+
+    schedule(std::max(now, slave.idle), EventType::SERVICE, indexOf(slave), slave.generation);
+}
+
+void
+Simulator::service(
+    Slave&   slave,
+    uint64_t generation,
+    Time     now
+)
+{
+    if ((slave.state != Slave::RUNNING) || (generation != slave.generation) || (now < slave.idle)) {
+        return;
+    }
+
+    if (!slave.inbox.empty()) {
+        NodeEvent event = slave.inbox.front();
+
+        slave.inbox.pop_front();
+
+        if (event.type == NodeEvent::FRAME) {
+            slave.inboxFrames--;
+        }
+
+        event.time = now;
+        deliver(slave, event, now);
+    } else if (now >= slave.until) {
+        NodeEvent event = {NodeEvent::TIMER, now, {}};
+
+        deliver(slave, event, now);
+    }
+}
+
+void
+Simulator::deliver(
+    Slave&           slave,
+    const NodeEvent& event,
+    Time             now
+)
+{
+    if (::send(slave.socket, &event, sizeof(event), MSG_NOSIGNAL) != sizeof(event)) {
+        terminate(slave);
+        slave.state = Slave::HALTED;
+        return;
+    }
+
+    collect(slave, now);
+}
+
+// What the node does, up to its next WAIT
+void
+Simulator::collect(
+    Slave& slave,
+    Time   now
+)
+{
+    unsigned index = indexOf(slave);
+
+    for (;;) {
+        struct pollfd p = {
+            slave.socket, POLLIN, 0
+        };
+
+        NodeAction action;
+
+        if ((poll(&p, 1, HANG_POLL) != 1) || (recv(slave.socket, &action, sizeof(action), 0) != sizeof(action))) {
+            fprintf(stderr, "%s: stopped answering at %.6f ms\n", slave.name.c_str(), now / 1e6);
+            terminate(slave);
+            slave.state = Slave::HALTED;
+            return;
+        }
+
+        switch (action.type) {
+          case NodeAction::WAIT:
+              slave.idle     = action.time;
+              slave.until    = action.until;
+              slave.watchdog = action.watchdog;
+              slave.generation++;
+
+              if (!slave.inbox.empty()) {
+                  schedule(std::max(now, slave.idle), EventType::SERVICE, index, slave.generation);
+              } else if (slave.until != NEVER) {
+                  schedule(std::max(slave.until, slave.idle), EventType::SERVICE, index, slave.generation);
+              }
+
+              if (slave.watchdog != NEVER) {
+                  schedule(slave.watchdog, EventType::WATCHDOG, index);
+              }
+
+              return;
+          case NodeAction::TRANSMIT:
+              slave.pending  = true;
+              slave.frame    = action.frame;
+              slave.queued   = action.time;
+              slave.deadline = action.until;
+              slave.serial++;
+
+              if (slave.messageStart == NEVER) {
+                  slave.messageStart = action.time;
+              }
+
+              if (slave.deadline != NEVER) {
+                  schedule(slave.deadline, EventType::DEADLINE, index, slave.serial);
+              }
+
+              kick(std::max(now, action.time));
+              break;
+          case NodeAction::WATCHDOG:
+              slave.watchdog = action.until;
+              schedule(slave.watchdog, EventType::WATCHDOG, index);
+              break;
+          case NodeAction::NVR:
+              slave.nvr = action.value;
+              break;
+          case NodeAction::RESET:
+              terminate(slave);
+              slave.resets++;
+              slave.resetSource = static_cast<hw::ResetSource>(action.value);
+
+              if (slave.resetSource == hw::ResetSource::WATCHDOG) {
+                  slave.watchdogResets++;
+              }
+
+              schedule(std::max(now, action.time) + restart, EventType::SPAWN, index);
+              return;
+          case NodeAction::BOOT:
+              terminate(slave);
+              slave.state = Slave::APPLICATION;
+              return;
+          case NodeAction::HALT:
+              terminate(slave);
+              slave.state = Slave::HALTED;
+              return;
+        } // switch
+    }
+} // Simulator::collect
+
+void
+Simulator::terminate(
+    Slave& slave
+)
+{
+    if (slave.pid > 0) {
+        kill(slave.pid, SIGKILL);
+        waitpid(slave.pid, nullptr, 0);
+        close(slave.socket);
+    }
+
+    // The controller is reset too
+    slave.pid          = -1;
+    slave.socket       = -1;
+    slave.pending      = false;
+    slave.messageStart = NEVER;
+    slave.tec          = 0;
+    slave.busOffUntil  = 0;
+    slave.watchdog     = NEVER;
+    slave.inboxFrames  = 0;
+    slave.held         = false;
+    slave.message.clear();
+    slave.inbox.clear();
+    slave.generation++;
+    slave.state = Slave::HALTED; // Until it is spawned again
+}
+
+void
+Simulator::watchdog(
+    Slave& slave,
+    Time   now
+)
+{
+    if ((slave.state != Slave::RUNNING) || (slave.watchdog > now)) {
+        return;
+    }
+
+    terminate(slave);
+    slave.resets++;
+    slave.watchdogResets++;
+    slave.resetSource = hw::ResetSource::WATCHDOG;
+
+    schedule(now + restart, EventType::SPAWN, indexOf(slave));
+}
+
+template <typename MESSAGE>
+void
+Simulator::send(
+    Master&        master,
+    const MESSAGE& message,
+    uint8_t        topic,
+    Time           now
+)
+{
+    MESSAGE blank = message;
+
+    // Not what happened to be on the stack: the run depends on the scenario only
+    memset(blank.padding, 0, sizeof(blank.padding));
+
+    queue(master, reinterpret_cast<const uint8_t*>(&blank), MESSAGE::ContainerType::MESSAGE_LENGTH, topic, now);
+}
+
+void
+Simulator::queue(
+    Master&        master,
+    const uint8_t* data,
+    std::size_t    size,
+    uint8_t        topic,
+    Time           now
+)
+{
+    uint16_t id       = (topic << 8) | master.id;
+    uint8_t  fragment = (size - 1) / 8;
+
+    for (std::size_t offset = 0; offset < size; offset += 8, fragment--) {
+        Master::Outgoing o;
+
+        o.type         = static_cast<MessageType>(data[0]);
+        o.frame.id     = (static_cast<uint32_t>(id) << 7) | fragment;
+        o.frame.length = std::min<std::size_t>(8, size - offset);
+        memcpy(o.frame.data, data + offset, o.frame.length);
+
+        master.queue.push_back(o);
+    }
+
+    next(master, now);
+} // Simulator::queue
+
+void
+Simulator::next(
+    Master& master,
+    Time    now
+)
+{
+    if (master.pending || master.queue.empty()) {
+        return;
+    }
+
+    master.pending = true;
+    master.frame   = master.queue.front().frame;
+    master.sending = master.queue.front().type;
+    master.queued  = now;
+    master.serial++;
+
+    if (master.messageStart == NEVER) {
+        master.messageStart = now;
+    }
+
+    kick(now);
+}
+
+void
+Simulator::masterReceived(
+    Master&         master,
+    unsigned        from,
+    const CanFrame& frame,
+    Time            now
+)
+{
+    uint32_t id       = frame.id >> 7;
+    uint8_t  fragment = frame.id & 0x7F;
+    auto     i        = master.reassemblies.find(id);
+
+    if ((i != master.reassemblies.end()) && (i->second.fragment != fragment)) {
+        master.reassemblies.erase(i);
+        i = master.reassemblies.end();
+    }
+
+    if (i == master.reassemblies.end()) {
+        i = master.reassemblies.emplace(id, Master::Reassembly()).first;
+    }
+
+    std::vector<uint8_t>& m = i->second.data;
+
+    m.insert(m.end(), frame.data, frame.data + frame.length);
+    i->second.fragment = fragment - 1;
+
+    if (fragment != 0) {
+        return;
+    }
+
+    std::vector<uint8_t> message = std::move(m);
+
+    master.reassemblies.erase(i);
+
+    if ((from < slaves.size()) && (message[0] == static_cast<uint8_t>(MessageType::ACK)) && chance(faults.delay)) {
+        delayed++;
+        _delayed[_delays] = Delayed {indexOf(master), from, std::move(message)};
+        schedule(now + faults.delayTime, EventType::ACKNOWLEDGE, 0, _delays++);
+        return;
+    }
+
+    masterMessage(master, from, message, now);
+} // Simulator::masterReceived
+
+void
+Simulator::masterMessage(
+    Master&                     master,
+    unsigned                    from,
+    const std::vector<uint8_t>& data,
+    Time                        now
+)
+{
+    if ((from >= slaves.size()) || (data.size() < 4) || (data[0] != static_cast<uint8_t>(MessageType::ACK))) {
+        return;
+    }
+
+    // An acknowledge of the last request
+    if ((data[3] == static_cast<uint8_t>(master.lastType)) && (master.lastSent != NEVER)) {
+        slaves[from]->responses.add(now - master.lastSent);
+    }
+
+    Transfer* t = master.transfer;
+
+    if ((t == nullptr) || (from != t->slave)) {
+        return;
+    }
+
+    const LongMessage& request = t->request.header();
+
+    if (t->inFlight && (data[3] == static_cast<uint8_t>(request.command)) && (data[1] == static_cast<uint8_t>(request.sequenceId + 1))) {
+        acknowledged(master, *t, data, now);
+    } else {
+        t->stale++;
+    }
+} // Simulator::masterMessage
+
+//--- TRANSFERS ---------------------------------------------------------------
+
+void
+Simulator::begin(
+    Master&            master,
+    unsigned           slave,
+    const std::string& source,
+    uint32_t           mode,
+    Time               now
+)
+{
+    std::unique_ptr<Transfer> t(new Transfer());
+    payload::UIDAndMaster     select;
+
+    t->slave   = slave;
+    t->source  = source;
+    t->mode    = mode;
+    t->granted = mode & ALIGNED_LAYOUT;
+    t->image   = programs[source];
+    t->start   = now;
+
+    // Flash is written by half words
+    t->image.align(sizeof(uint16_t));
+
+    select.uid      = slaves[slave]->moduleUID;
+    select.masterID = master.id;
+
+    master.transfer = t.get();
+    transfers.push_back(std::move(t));
+
+    // The slave takes the sequence number of the SELECT
+    issue(master, *master.transfer, master::makeRequest<messages::SelectSlave, messages::aligned::SelectSlave>(mode & ALIGNED_LAYOUT, select), now);
+} // Simulator::begin
+
+void
+Simulator::issue(
+    Master&        master,
+    Transfer&      transfer,
+    const Request& request,
+    Time           now
+)
+{
+    if (transfer.step != Transfer::SELECT) {
+        transfer.sequence += 2;
+    }
+
+    transfer.request = request;
+    transfer.request.header().sequenceId = transfer.sequence;
+    transfer.retries = retries;
+    transfer.requests++;
+
+    transmit(master, transfer, now);
+}
+
+void
+Simulator::transmit(
+    Master&   master,
+    Transfer& transfer,
+    Time      now
+)
+{
+    Time wait = std::max(timeout, std::min(timeout << std::min(retries - transfer.retries, 16u), BACKOFF));
+
+    queue(master, transfer.request.data, sizeof(transfer.request.data), BOOTLOADER_TOPIC_ID, now);
+
+    transfer.inFlight = true;
+    transfer.transmissions++;
+    schedule(now + wait, EventType::TRANSFER, indexOf(master), ++transfer.timer);
+}
+
+void
+Simulator::acknowledged(
+    Master&                     master,
+    Transfer&                   transfer,
+    const std::vector<uint8_t>& data,
+    Time                        now
+)
+{
+    Request ack; // Word aligned, for the payloads
+    auto    status = static_cast<AcknowledgeStatus>(data[2]);
+    bool    aligned;
+
+    memcpy(ack.data, data.data(), std::min(data.size(), sizeof(ack.data)));
+
+    transfer.inFlight = false;
+    transfer.timer++;
+
+    if ((status == AcknowledgeStatus::IN_PROGRESS) && ((transfer.step == Transfer::ERASE) || (transfer.step == Transfer::JOB))) {
+        // Asked again in a while
+        transfer.step = Transfer::JOB;
+        schedule(now + JOB_POLL, EventType::TRANSFER, indexOf(master), transfer.timer);
+        return;
+    }
+
+    if (status != AcknowledgeStatus::OK) {
+        finish(master, transfer, transfer.step, status, now);
+        return;
+    }
+
+    if (transfer.step == Transfer::MODE) {
+        transfer.granted = reinterpret_cast<const AcknowledgeMode*>(ack.data)->data.capabilities;
+    } else if (transfer.step == Transfer::DESCRIBE) {
+        transfer.crc = reinterpret_cast<const AcknowledgeDescribeV2*>(ack.data)->data.flashCRC;
+    }
+
+    aligned = (transfer.granted & ALIGNED_LAYOUT) != 0;
+
+    payload::UID uid;
+    Request      request;
+
+    uid.uid = slaves[transfer.slave]->moduleUID;
+
+    switch (transfer.step) {
+      case Transfer::SELECT:
+
+          // The rest of the mode, if there is more than the layout
+          if ((transfer.mode & ~ALIGNED_LAYOUT) != 0) {
+              payload::UIDAndMode mode;
+
+              mode.uid          = uid.uid;
+              mode.capabilities = transfer.mode;
+              transfer.step     = Transfer::MODE;
+              issue(master, transfer, master::makeRequest<messages::SetSessionMode, messages::aligned::SetSessionMode>(aligned, mode), now);
+              break;
+          }
+
+      // Falls through
+      case Transfer::MODE:
+          transfer.step = Transfer::ERASE;
+          issue(master, transfer, master::makeRequest<messages::EraseProgram, messages::aligned::EraseProgram>(aligned, uid), now);
+          break;
+      case Transfer::ERASE:
+      case Transfer::JOB:
+          transfer.step       = Transfer::WRITE;
+          transfer.writeStart = now;
+          transfer.writes.reset(new master::WriteRequests(transfer.image, aligned, (transfer.granted & BINARY_WRITE) != 0));
+
+      // Falls through
+      case Transfer::WRITE:
+
+          if (transfer.writes->next(request)) {
+              issue(master, transfer, request, now);
+              break;
+          }
+
+          transfer.step     = Transfer::DESCRIBE;
+          transfer.writeEnd = now;
+          issue(master, transfer, master::makeRequest<messages::DescribeV2, messages::aligned::DescribeV2>(aligned, uid), now);
+          break;
+      case Transfer::DESCRIBE: {
+          // The CRC the slave computes over the program flash is the one it will check at boot
+          payload::UIDAndCRC crc;
+
+          crc.uid       = uid.uid;
+          crc.crc       = transfer.crc;
+          transfer.step = Transfer::COMMIT;
+          issue(master, transfer, master::makeRequest<messages::WriteProgramCrc, messages::aligned::WriteProgramCrc>(aligned, crc), now);
+          break;
+      }
+      case Transfer::COMMIT:
+          transfer.step = Transfer::DESELECT;
+          issue(master, transfer, master::makeRequest<messages::DeselectSlave, messages::aligned::DeselectSlave>(aligned, uid), now);
+          break;
+      case Transfer::DESELECT:
+          finish(master, transfer, Transfer::DONE, status, now);
+          break;
+      default:
+          break;
+    } // switch
+} // Simulator::acknowledged
+
+void
+Simulator::expireTransfer(
+    Master&  master,
+    uint64_t timer,
+    Time     now
+)
+{
+    Transfer* t = master.transfer;
+
+    if ((t == nullptr) || (t->timer != timer)) {
+        return;
+    }
+
+    if (!t->inFlight) {
+        // Time to ask how the job is going
+        payload::UID uid;
+
+        uid.uid = slaves[t->slave]->moduleUID;
+        issue(master, *t, master::makeRequest<messages::JobStatus, messages::aligned::JobStatus>((t->granted & ALIGNED_LAYOUT) != 0, uid), now);
+        return;
+    }
+
+    t->timeouts++;
+
+    if (t->retries == 0) {
+        finish(master, *t, t->step, AcknowledgeStatus::NONE, now);
+        return;
+    }
+
+    t->retries--;
+    transmit(master, *t, now);
+} // Simulator::expireTransfer
+
+void
+Simulator::finish(
+    Master&           master,
+    Transfer&         transfer,
+    Transfer::Step    step,
+    AcknowledgeStatus status,
+    Time              now
+)
+{
+    transfer.failedAt = transfer.step;
+    transfer.step     = (step == Transfer::DONE) ? Transfer::DONE : Transfer::FAILED;
+    transfer.status   = status;
+    transfer.end      = now;
+    transfer.inFlight = false;
+    transfer.timer++;
+
+    master.transfer = nullptr;
+}
+
+static bool
+parseTime(
+    const std::string& s,
+    Time&              time
+)
+{
+    char*  end;
+    double value = strtod(s.c_str(), &end);
+
+    std::string unit = end;
+
+    if (end == s.c_str()) {
+        return false;
+    }
+
+    if (unit == "ns") {
+        time = value;
+    } else if (unit == "us") {
+        time = value * 1e3;
+    } else if (unit == "ms") {
+        time = value * 1e6;
+    } else if (unit == "s") {
+        time = value * 1e9;
+    } else {
+        return false;
+    }
+
+    return true;
+} // parseTime
+
+// legacy, a number, or capabilities joined by +
+static bool
+parseMode(
+    const std::string& s,
+    uint32_t&          mode
+)
+{
+    static const struct {
+        const char* name;
+        uint32_t    capability;
+    } NAMES[] = {
+        {"aligned", ALIGNED_LAYOUT}, {"binary", BINARY_WRITE}, {"windowing", WINDOWING}, {"compression", COMPRESSION},
+        {"range-crc", RANGE_CRC}, {"compact-ack", COMPACT_ACK}, {"async", ASYNC_JOBS}, {"resume", RESUME}
+    };
+
+    char* end;
+
+    mode = strtoul(s.c_str(), &end, 0);
+
+    if ((end != s.c_str()) && (*end == '\0')) {
+        return true;
+    }
+
+    mode = 0;
+
+    if (s == "legacy") {
+        return true;
+    }
+
+    std::istringstream stream(s);
+    std::string        name;
+
+    while (std::getline(stream, name, '+')) {
+        std::size_t i = 0;
+
+        while ((i < sizeof(NAMES) / sizeof(NAMES[0])) && (name != NAMES[i].name)) {
+            i++;
+        }
+
+        if (i == sizeof(NAMES) / sizeof(NAMES[0])) {
+            return false;
+        }
+
+        mode |= NAMES[i].capability;
+    }
+
+    return mode != 0;
+} // parseMode
+
+// An Intel HEX file, or that many made up bytes (k: KiB) at the beginning of the program flash
+static bool
+loadProgram(
+    const std::string& source,
+    Image&             image
+)
+{
+    char*         end;
+    unsigned long size = strtoul(source.c_str(), &end, 0);
+
+    if ((end == source.c_str()) || ((*end != '\0') && (strcmp(end, "k") != 0))) {
+        return image.loadIHex(source) && !image.empty();
+    }
+
+    if (*end == 'k') {
+        size *= 1024;
+    }
+
+    if ((size == 0) || (size > PROGRAM_FLASH_TO - PROGRAM_FLASH_FROM)) {
+        return false;
+    }
+
+    std::vector<uint8_t> bytes(size);
+
+    for (std::size_t i = 0; i < size; i++) {
+        bytes[i] = static_cast<uint8_t>(mix(i));
+    }
+
+    image.add(PROGRAM_FLASH_FROM, bytes.data(), size);
+
+    return true;
+} // loadProgram
+
+void
+Simulator::execute(
+    const Command& command,
+    Time           now
+)
+{
+    Master* master = nullptr;
+
+    for (auto& m : masters) {
+        if (m->id == command.master) {
+            master = m.get();
+        }
+    }
+
+    const std::string& verb   = command.words[0];
+    unsigned           target = (command.words.size() > 1) ? strtoul(command.words[1].c_str(), nullptr, 0) : 0;
+    ModuleUID          uid    = ANY_MODULE_UID;
+
+    if ((command.words.size() > 1) && (command.words[1] != "all") && (target < slaves.size())) {
+        uid = slaves[target]->moduleUID;
+    }
+
+    if (verb == "advertise") {
+        MasterAdvertise m;
+        m.data.uid = ANY_MODULE_UID;
+        send(*master, m, BOOTLOADER_MASTER_TOPIC_ID, now);
+    } else if (verb == "ignore") {
+        messages::MasterIgnore m;
+        m.data.uid = uid;
+        send(*master, m, BOOTLOADER_MASTER_TOPIC_ID, now);
+    } else if (verb == "force") {
+        messages::MasterForce m;
+        m.data.uid = uid;
+        send(*master, m, BOOTLOADER_MASTER_TOPIC_ID, now);
+    } else if (verb == "bootload") {
+        messages::Bootload m;
+        m.sequenceId = master->sequence += 2;
+        send(*master, m, BOOTLOADER_TOPIC_ID, now);
+    } else if (verb == "identify") {
+        messages::IdentifySlave m;
+        m.sequenceId = master->sequence += 2;
+        m.data.uid   = uid;
+        send(*master, m, BOOTLOADER_TOPIC_ID, now);
+    } else if (verb == "enumerate") {
+        messages::Enumerate m;
+        m.sequenceId        = master->sequence += 2;
+        m.data.prefix       = 0;
+        m.data.prefixLength = 0;
+        m.data.slotBits     = target;
+        m.data.slotTime     = strtoul(command.words[2].c_str(), nullptr, 0);
+        send(*master, m, BOOTLOADER_TOPIC_ID, now);
+    } else if (verb == "describe-all") {
+        messages::DescribeAll m;
+        m.sequenceId    = master->sequence += 2;
+        m.data.firstID  = target;
+        m.data.lastID   = strtoul(command.words[2].c_str(), nullptr, 0);
+        m.data.slotTime = strtoul(command.words[3].c_str(), nullptr, 0);
+        send(*master, m, BOOTLOADER_TOPIC_ID, now);
+    } else if (verb == "select") {
+        messages::SelectSlave m;
+        m.sequenceId    = master->sessions[target] = master->sequence += 2;
+        m.data.uid      = uid;
+        m.data.masterID = master->id;
+        send(*master, m, BOOTLOADER_TOPIC_ID, now);
+    } else if (verb == "describe") {
+        messages::DescribeV3 m;
+        m.sequenceId = master->sessions[target] += 2;
+        m.data.uid   = uid;
+        send(*master, m, BOOTLOADER_TOPIC_ID, now);
+    } else if (verb == "deselect") {
+        messages::DeselectSlave m;
+        m.sequenceId = master->sessions[target] += 2;
+        m.data.uid   = uid;
+        send(*master, m, BOOTLOADER_TOPIC_ID, now);
+    } else if (verb == "reset") {
+        messages::Reset m;
+        m.sequenceId = master->sessions[target] += 2;
+        m.data.uid   = uid;
+        send(*master, m, BOOTLOADER_TOPIC_ID, now);
+    } else if (verb == "reset-all") {
+        messages::ResetAll m;
+        m.sequenceId = master->sequence += 2;
+        send(*master, m, BOOTLOADER_TOPIC_ID, now);
+    } else if (verb == "program") {
+        uint32_t mode = DEFAULT_MODE;
+
+        if (command.words.size() > 3) {
+            parseMode(command.words[3], mode);
+        }
+
+        if (master->transfer != nullptr) {
+            fprintf(stderr, "%s: busy with a transfer at %.6f ms, program %s ignored\n", master->name.c_str(), now / 1e6, command.words[1].c_str());
+            return;
+        }
+
+        begin(*master, target, command.words[2], mode, now);
+    }
+} // Simulator::execute
+
+bool
+Simulator::run()
+{
+    char pattern[] = "/tmp/bootloader_simulator.XXXXXX";
+
+    if (mkdtemp(pattern) == nullptr) {
+        perror("mkdtemp");
+        return false;
+    }
+
+    directory = pattern;
+
+    for (unsigned i = 0; i < slaves.size(); i++) {
+        slaves[i]->flashPath = directory + "/" + std::to_string(i) + ".flash";
+        schedule(0, EventType::SPAWN, i);
+    }
+
+    for (unsigned i = 0; i < commands.size(); i++) {
+        schedule(commands[i].at, EventType::COMMAND, i);
+    }
+
+    while (!_events.empty() && (_events.top().time <= duration)) {
+        Event e = _events.top();
+
+        _events.pop();
+
+        switch (e.type) {
+          case EventType::SPAWN:
+              spawn(*slaves[e.target], e.time);
+              break;
+          case EventType::SERVICE:
+              service(*slaves[e.target], e.tag, e.time);
+              break;
+          case EventType::WATCHDOG:
+              watchdog(*slaves[e.target], e.time);
+              break;
+          case EventType::ARBITRATE:
+              arbitrate(e.time);
+              break;
+          case EventType::FRAME_END:
+              frameEnd(e.time);
+              break;
+          case EventType::DEADLINE:
+              expire(e.target, e.tag, e.time);
+              break;
+          case EventType::TRANSFER:
+              expireTransfer(*masters[e.target - slaves.size()], e.tag, e.time);
+              break;
+          case EventType::ACKNOWLEDGE: {
+              Delayed d = std::move(_delayed[e.tag]);
+
+              _delayed.erase(e.tag);
+              masterMessage(*masters[d.master - slaves.size()], d.from, d.data, e.time);
+              break;
+          }
+          case EventType::COMMAND:
+              execute(commands[e.target], e.time);
+
+              if (commands[e.target].every > 0) {
+                  schedule(e.time + commands[e.target].every, EventType::COMMAND, e.target);
+              }
+
+              break;
+        } // switch
+    }
+
+    return true;
+} // Simulator::run
+
+void
+Simulator::cleanup()
+{
+    for (auto& s : slaves) {
+        Slave::State state = s->state;
+
+        terminate(*s);
+        s->state = state;
+
+        if (!s->flashPath.empty()) {
+            unlink(s->flashPath.c_str());
+        }
+    }
+
+    if (!directory.empty()) {
+        rmdir(directory.c_str());
+    }
+}
+
+void
+Simulator::report()
+{
+    static const char* STATES[] = {
+        "bootloader", "application", "halted"
+    };
+
+    printf("%zu slaves, %zu masters, %u bit/s, %.3f s\n\n", slaves.size(), masters.size(), rtcan_config.baudrate, duration / 1e9);
+    printf("%-10s %-8s %-6s %-11s %6s %6s %8s %8s %8s %6s %5s %6s %8s %6s %9s %9s %6s %9s %9s\n", "node", "uid", "can id", "state", "resets", "wdog",
+           "frames", "lost arb", "collide", "busoff", "late", "overrun", "messages", "", "mean [us]", "max [us]", "acks", "mean [us]", "max [us]");
+
+    for (unsigned i = 0; i < stations(); i++) {
+        Station&    s     = station(i);
+        Slave*      slave = (i < slaves.size()) ? slaves[i].get() : nullptr;
+        char        uid[16];
+        char        id[8];
+        const char* state = "-";
+
+        snprintf(uid, sizeof(uid), "%08X", (slave != nullptr) ? slave->moduleUID : 0);
+        snprintf(id, sizeof(id), "0x%02X", s.canID);
+
+        if (slave != nullptr) {
+            state = STATES[slave->state];
+        }
+
+        printf("%-10s %-8s %-6s %-11s %6llu %6llu %8llu %8llu %8llu %6llu %5llu %6llu %8llu %6s %9.1f %9.1f %6llu %9.1f %9.1f\n", s.name.c_str(),
+               (slave != nullptr) ? uid : "-", (s.canID != 0xFF) ? id : "-", state,
+               (unsigned long long)((slave != nullptr) ? slave->resets : 0), (unsigned long long)((slave != nullptr) ? slave->watchdogResets : 0),
+               (unsigned long long)s.frames, (unsigned long long)s.arbitrationLost, (unsigned long long)s.collisions, (unsigned long long)s.busOffs,
+               (unsigned long long)s.expired, (unsigned long long)s.overruns, (unsigned long long)s.messages.count, "",
+               s.messages.mean(), s.messages.maximum / 1e3, (unsigned long long)s.responses.count, s.responses.mean(), s.responses.maximum / 1e3);
+    }
+
+    printf("\nbus: %llu frames, %llu error frames, %.2f %% utilization\n", (unsigned long long)busFrames, (unsigned long long)busErrors,
+           100.0 * busTime / duration);
+
+    if ((faults.drop > 0.0) || (faults.duplicate > 0.0) || (faults.reorder > 0.0) || (faults.delay > 0.0)) {
+        printf("faults: %llu frames dropped, %llu duplicated, %llu reordered, %llu acknowledges delayed\n", (unsigned long long)dropped,
+               (unsigned long long)duplicated, (unsigned long long)reordered, (unsigned long long)delayed);
+    }
+
+    if (transfers.empty()) {
+        return;
+    }
+
+    static const char* STEPS[] = {
+        "select", "mode", "erase", "job", "write", "describe", "commit", "deselect", "done", "failed"
+    };
+
+    // Sent again: what stop and wait costs on this bus
+    printf("\n%-10s %-8s %-8s %-8s %-14s %8s %10s %9s %9s %8s %8s %8s %9s %8s %6s\n", "transfer", "slave", "asked", "granted", "result", "bytes",
+           "time [ms]", "KiB/s", "writes", "requests", "sent", "again", "overhead", "timeouts", "stale");
+
+    for (auto& t : transfers) {
+        char result[32];
+        char asked[16];
+        char granted[16];
+        Time end = std::min(t->end, duration);
+
+        if (t->step == Transfer::DONE) {
+            snprintf(result, sizeof(result), "done");
+        } else if (t->step == Transfer::FAILED) {
+            snprintf(result, sizeof(result), "%s %02X", STEPS[t->failedAt], static_cast<unsigned>(t->status));
+        } else {
+            snprintf(result, sizeof(result), "%s...", STEPS[t->step]);
+        }
+
+        snprintf(asked, sizeof(asked), "%08X", t->mode);
+        snprintf(granted, sizeof(granted), "%08X", t->granted);
+
+        // The writes alone: the erase takes what the flash takes
+        double   seconds = (end - t->start) / 1e9;
+        double   writing = (t->writeEnd != NEVER) ? (t->writeEnd - t->writeStart) / 1e9 : 0.0;
+        uint64_t again   = t->transmissions - t->requests;
+
+        printf("%-10s %-8u %-8s %-8s %-14s %8zu %10.1f %9.2f %9.2f %8llu %8llu %8llu %8.1f%% %8llu %6llu\n", t->source.c_str(),
+               t->slave, asked, granted, result, t->image.size(), seconds * 1e3,
+               (t->step == Transfer::DONE) ? t->image.size() / 1024.0 / seconds : 0.0,
+               (writing > 0.0) ? t->image.size() / 1024.0 / writing : 0.0, (unsigned long long)t->requests,
+               (unsigned long long)t->transmissions, (unsigned long long)again, (t->requests > 0) ? 100.0 * again / t->requests : 0.0,
+               (unsigned long long)t->timeouts, (unsigned long long)t->stale);
+    }
+} // Simulator::report
+
+bool
+Simulator::transferred() const
+{
+    for (auto& t : transfers) {
+        if (t->step != Transfer::DONE) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//--- SCENARIO ----------------------------------------------------------------
+
+static bool
+load(
+    const std::string& path,
+    Simulator&         simulator
+)
+{
+    std::ifstream file(path);
+    std::string   line;
+    unsigned      number = 0;
+
+    if (!file) {
+        fprintf(stderr, "%s: cannot read it\n", path.c_str());
+        return false;
+    }
+
+    while (std::getline(file, line)) {
+        number++;
+
+        std::istringstream       stream(line.substr(0, line.find('#')));
+        std::vector<std::string> words;
+        std::string              word;
+
+        while (stream >> word) {
+            words.push_back(word);
+        }
+
+        if (words.empty()) {
+            continue;
+        }
+
+        bool ok = true;
+
+        if ((words[0] == "bitrate") && (words.size() == 2)) {
+            rtcan_config.baudrate = strtoul(words[1].c_str(), nullptr, 0);
+            ok = rtcan_config.baudrate > 0;
+        } else if ((words[0] == "duration") && (words.size() == 2)) {
+            ok = parseTime(words[1], simulator.duration);
+        } else if ((words[0] == "restart") && (words.size() == 2)) {
+            ok = parseTime(words[1], simulator.restart);
+        } else if ((words[0] == "fifo") && (words.size() == 2)) {
+            simulator.fifo = strtoul(words[1].c_str(), nullptr, 0);
+        } else if ((words[0] == "seed") && (words.size() == 2)) {
+            simulator.seed = strtoull(words[1].c_str(), nullptr, 0);
+        } else if ((words[0] == "timeout") && (words.size() == 2)) {
+            ok = parseTime(words[1], simulator.timeout);
+        } else if ((words[0] == "retries") && (words.size() == 2)) {
+            simulator.retries = strtoul(words[1].c_str(), nullptr, 0);
+        } else if (words[0] == "faults") {
+            Simulator::Faults& f = simulator.faults;
+
+            // A probability after each, and a time after delay
+            for (std::size_t i = 1; ok && (i < words.size()); i += 2) {
+                double p = (i + 1 < words.size()) ? strtod(words[i + 1].c_str(), nullptr) : -1.0;
+
+                if ((p < 0.0) || (p > 1.0)) {
+                    ok = false;
+                } else if (words[i] == "drop") {
+                    f.drop = p;
+                } else if (words[i] == "duplicate") {
+                    f.duplicate = p;
+                } else if (words[i] == "reorder") {
+                    f.reorder = p;
+                } else if ((words[i] == "delay") && (i + 2 < words.size())) {
+                    f.delay = p;
+                    ok      = parseTime(words[i + 2], f.delayTime);
+                    i++;
+                } else {
+                    ok = false;
+                }
+            }
+        } else if ((words[0] == "master") && (words.size() == 2)) {
+            std::unique_ptr<Master> m(new Master());
+
+            m->id    = strtoul(words[1].c_str(), nullptr, 0);
+            m->name  = "master " + words[1];
+            m->canID = m->id;
+            simulator.masters.push_back(std::move(m));
+        } else if ((words[0] == "slaves") && (words.size() >= 2)) {
+            unsigned        count     = strtoul(words[1].c_str(), nullptr, 0);
+            bool            bootload  = false;
+            unsigned        canID     = 0xFF;
+            Image*          image     = nullptr;
+
+            for (std::size_t i = 2; ok && (i < words.size()); i++) {
+                if (words[i] == "power-on") {
+                    bootload = false;
+                } else if (words[i] == "bootload") {
+                    bootload = true;
+                } else if ((words[i] == "canid") && (i + 1 < words.size())) {
+                    canID = strtoul(words[++i].c_str(), nullptr, 0);
+                } else if ((words[i] == "image") && (i + 1 < words.size())) {
+                    simulator.images.emplace_back(new Image());
+                    image = simulator.images.back().get();
+                    ok    = image->loadIHex(words[++i]) && !image->empty();
+                } else {
+                    ok = false;
+                }
+            }
+
+            for (unsigned n = 0; ok && (n < count); n++) {
+                std::unique_ptr<Slave> s(new Slave());
+                unsigned               index = simulator.slaves.size();
+                uint64_t               a     = mix(index);
+                uint64_t               b     = mix(a);
+
+                memcpy(s->uid.data(), &a, 8);
+                memcpy(s->uid.data() + 8, &b, 4);
+
+                s->name      = "slave " + std::to_string(index);
+                s->moduleUID = bootloader::master::stm32CRC(bootloader::master::STM32_CRC_INITIAL, s->uid.data(), s->uid.size());
+                s->image     = image;
+                s->presetID  = (canID != 0xFF) ? canID + n : 0xFF;
+
+                if (bootload) {
+                    s->resetSource = hw::ResetSource::WATCHDOG;
+                    s->nvr         = hw::Watchdog::Reason::USER_REQUEST;
+                }
+
+                simulator.slaves.push_back(std::move(s));
+            }
+        } else if ((words[0] == "at") && (words.size() >= 4)) {
+            Command     c;
+            std::size_t i = 2;
+
+            c.every = 0;
+            ok      = parseTime(words[1], c.at);
+
+            if (ok && (words[2] == "every") && (words.size() >= 6)) {
+                ok = parseTime(words[3], c.every);
+                i  = 4;
+            }
+
+            c.master = strtoul(words[i].c_str(), nullptr, 0);
+            c.words.assign(words.begin() + i + 1, words.end());
+
+            ok &= !c.words.empty();
+            simulator.commands.push_back(c);
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            fprintf(stderr, "%s:%u: %s\n", path.c_str(), number, line.c_str());
+            return false;
+        }
+    }
+
+    // The commands must refer to what is there
+    for (const Command& c : simulator.commands) {
+        bool found = false;
+
+        for (auto& m : simulator.masters) {
+            found |= m->id == c.master;
+        }
+
+        if (!found) {
+            fprintf(stderr, "%s: there is no master %u\n", path.c_str(), c.master);
+            return false;
+        }
+
+        static const char* VERBS[] = {
+            "advertise", "ignore", "force", "bootload", "identify", "enumerate", "describe-all", "select", "describe", "deselect", "reset", "reset-all",
+            "program"
+        };
+        static const std::size_t ARGUMENTS[] = {
+            0, 1, 1, 0, 1, 2, 3, 1, 1, 1, 1, 0, 2
+        };
+
+        std::size_t v        = 0;
+        bool        program  = (c.words[0] == "program");
+        std::size_t optional = program ? 1 : 0; // The mode
+
+        while ((v < sizeof(VERBS) / sizeof(VERBS[0])) && (c.words[0] != VERBS[v])) {
+            v++;
+        }
+
+        if ((v == sizeof(VERBS) / sizeof(VERBS[0])) || (c.words.size() < ARGUMENTS[v] + 1) || (c.words.size() > ARGUMENTS[v] + optional + 1)) {
+            fprintf(stderr, "%s: not a command: %s\n", path.c_str(), c.words[0].c_str());
+            return false;
+        }
+
+        if (((ARGUMENTS[v] == 1) || program) && (c.words[1] != "all") && (strtoul(c.words[1].c_str(), nullptr, 0) >= simulator.slaves.size())) {
+            fprintf(stderr, "%s: there is no slave %s\n", path.c_str(), c.words[1].c_str());
+            return false;
+        }
+
+        if (!program) {
+            continue;
+        }
+
+        uint32_t mode;
+
+        if ((c.words.size() > 3) && !parseMode(c.words[3], mode)) {
+            fprintf(stderr, "%s: not a mode: %s\n", path.c_str(), c.words[3].c_str());
+            return false;
+        }
+
+        if ((simulator.programs.count(c.words[2]) == 0) && !loadProgram(c.words[2], simulator.programs[c.words[2]])) {
+            fprintf(stderr, "%s: not an image: %s\n", path.c_str(), c.words[2].c_str());
+            return false;
+        }
+    }
+
+    return true;
+} // load
+
+int
+main(
+    int   argc,
+    char* argv[]
+)
+{
+    Simulator   simulator;
+    std::string scenario;
+
+    int persona = personality(0xFFFFFFFF);
+
+    if ((persona != -1) && ((persona & ADDR_NO_RANDOMIZE) == 0) && (personality(persona | ADDR_NO_RANDOMIZE) != -1)) {
+        // It takes effect from the next exec on
+        execv("/proc/self/exe", argv);
+    }
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+
+        if (a == "--trace") {
+            simulator.trace = true;
+        } else if ((a.compare(0, 2, "--") != 0) && scenario.empty()) {
+            scenario = a;
+        } else {
+            scenario.clear();
+            break;
+        }
+    }
+
+    if (scenario.empty()) {
+        fprintf(stderr, "usage: bootloader_simulator [--trace] <scenario>\n");
+        return 2;
+    }
+
+    if (!load(scenario, simulator)) {
+        return 1;
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    bool ok    = simulator.run();
+
+    simulator.cleanup();
+
+    if (!ok) {
+        return 1;
+    }
+
+    simulator.report();
+
+    fprintf(stderr, "%.1f s of host time\n", std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+
+    return simulator.transferred() ? 0 : 1;
+} // main
@@ -0,0 +1,142 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+// Firmware store
+//
+//   bootloader_store [options] <store> add <image.hex> [name]
+//   bootloader_store [options] <store> find <program CRC> <flash size>
+//   bootloader_store [options] <store> diff <from id> <to id>
+//   bootloader_store [options] <store> list
+//
+// Options:
+//   --flash <address> <size>  Program flash of the modules, for add (default 0x08002000 0x1E000)
+//   --page-size <bytes>       Flash page, for add (default 2048)
+//   --binary <address>        The image is a raw binary to be written at address
+//
+// find gives the builds a module may have, out of the flashCRC and the
+// programFlashSize it describes itself with. See FirmwareStore.
+
+#include <core/bootloader/master/FirmwareStore.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace bootloader;
+using namespace bootloader::master;
+
+static int
+usage()
+{
+    std::cerr << "usage: bootloader_store [--flash address size] [--page-size bytes] [--binary address] <store> <command> [arguments]" << std::endl
+              << "commands: add <image> [name] | find <program CRC> <flash size> | diff <from> <to> | list" << std::endl;
+    return 2;
+}
+
+static void
+print(
+    const FirmwareStore::Build& build
+)
+{
+    printf("%s  %08X  %3zu pages  %s\n", build.id.c_str(), build.programCRC, build.pages.size(), build.name.c_str());
+}
+
+int
+main(
+    int   argc,
+    char* argv[]
+)
+{
+    FlashGeometry            geometry = {0x08002000, 0x1E000, 2048};
+    bool                     binary   = false;
+    uint32_t                 address  = 0;
+    std::vector<std::string> arguments;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+
+        if ((a == "--flash") && (i + 2 < argc)) {
+            geometry.address = strtoul(argv[++i], nullptr, 0);
+            geometry.size    = strtoul(argv[++i], nullptr, 0);
+        } else if ((a == "--page-size") && (i + 1 < argc)) {
+            geometry.pageSize = strtoul(argv[++i], nullptr, 0);
+        } else if ((a == "--binary") && (i + 1 < argc)) {
+            binary  = true;
+            address = strtoul(argv[++i], nullptr, 0);
+        } else if (a.compare(0, 2, "--") == 0) {
+            return usage();
+        } else {
+            arguments.push_back(a);
+        }
+    }
+
+    if (arguments.size() < 2) {
+        return usage();
+    }
+
+    std::unique_ptr<FirmwareStore> store = FirmwareStore::open(arguments[0]);
+
+    if (!store) {
+        std::cerr << arguments[0] << ": cannot open the store" << std::endl;
+        return 1;
+    }
+
+    const std::string& command = arguments[1];
+
+    if ((command == "add") && ((arguments.size() == 3) || (arguments.size() == 4))) {
+        Image image;
+        bool  success = binary ? image.loadBinary(arguments[2], address) : image.loadIHex(arguments[2]);
+
+        if (!success || image.empty()) {
+            std::cerr << arguments[2] << ": cannot read the image" << std::endl;
+            return 1;
+        }
+
+        const FirmwareStore::Build* build = store->add(image, geometry, (arguments.size() == 4) ? arguments[3] : arguments[2]);
+
+        if (build == nullptr) {
+            std::cerr << arguments[2] << ": does not fit the flash, or cannot be stored" << std::endl;
+            return 1;
+        }
+
+        print(*build);
+    } else if ((command == "find") && (arguments.size() == 4)) {
+        std::vector<const FirmwareStore::Build*> builds = store->find(strtoul(arguments[2].c_str(), nullptr, 16), strtoul(arguments[3].c_str(), nullptr, 0));
+
+        for (const FirmwareStore::Build* build : builds) {
+            print(*build);
+        }
+
+        return builds.empty() ? 1 : 0;
+    } else if ((command == "diff") && (arguments.size() == 4)) {
+        const FirmwareStore::Build* from = store->build(arguments[2]);
+        const FirmwareStore::Build* to   = store->build(arguments[3]);
+
+        if ((from == nullptr) || (to == nullptr) || !(from->geometry == to->geometry)) {
+            std::cerr << "no such builds, or not for the same flash" << std::endl;
+            return 1;
+        }
+
+        for (uint32_t page : store->differingPages(*from, *to)) {
+            printf("%08X\n", page);
+        }
+    } else if ((command == "list") && (arguments.size() == 2)) {
+        for (const FirmwareStore::Build* build : store->builds()) {
+            print(*build);
+        }
+
+        FirmwareStore::Statistics s = store->statistics();
+
+        printf("%zu builds, %zu pages in %zu objects, %llu KiB of flash in %llu KiB\n", s.builds, s.pages, s.objects,
+               (unsigned long long)s.flashBytes / 1024, (unsigned long long)s.storedBytes / 1024);
+    } else {
+        return usage();
+    }
+
+    return 0;
+} // main
@@ -0,0 +1,87 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+// How fast the host CRCs go
+//
+//   crc_benchmark [--size bytes]
+//
+// Each over --size bytes, the bit at a time reference over a 64th of them.
+// That they agree is up to host/tests/crc_test.cpp.
+
+#include <core/bootloader/master/CRC.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace bootloader::master;
+
+using Clock = std::chrono::steady_clock;
+
+using Function = uint32_t (*)(uint32_t crc, const uint8_t* data, std::size_t length);
+
+struct Method {
+    const char* name;
+    Function    function;
+};
+
+static const Method METHODS[] = {
+    {"reference", stm32CRCReference},
+    {"slice-by-8", stm32CRCSliceBy8},
+    {"carryless", stm32CRCCarryless},
+    {"stm32CRC", stm32CRC}
+};
+
+int
+main(
+    int   argc,
+    char* argv[]
+)
+{
+    std::size_t size = 64 * 1024 * 1024;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string a = argv[i];
+        unsigned    v = strtoul(argv[i + 1], nullptr, 0);
+
+        if (a == "--size") {
+            size = v;
+        } else {
+            fprintf(stderr, "usage: crc_benchmark [--size bytes]\n");
+            return 2;
+        }
+    }
+
+    std::mt19937         random(1);
+    std::vector<uint8_t> data(std::max<std::size_t>(size, 8192) + 16);
+
+    for (uint8_t& b : data) {
+        b = random();
+    }
+
+    printf("%s\n", hasCarrylessCRC() ? "with PCLMULQDQ" : "no PCLMULQDQ");
+
+    for (const Method& m : METHODS) {
+        // The reference would take forever on all of it
+        std::size_t length = (m.function == stm32CRCReference) ? size / 64 : size;
+        uint32_t    crc    = 0;
+        double      best   = 1e9;
+
+        for (int round = 0; round < 3; round++) {
+            Clock::time_point start = Clock::now();
+
+            crc  = m.function(STM32_CRC_INITIAL, data.data(), length);
+            best = std::min(best, std::chrono::duration<double>(Clock::now() - start).count());
+        }
+
+        printf("%-10s %9.1f MiB/s  %08X\n", m.name, length / (1024.0 * 1024.0) / best, crc);
+    }
+
+    return 0;
+} // main
@@ -0,0 +1,164 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+// Scheduling overhead and memory of the coroutine master
+//
+//   engine_benchmark [--sessions n] [--threads n] [--size bytes] [--latency us]
+//
+// Flashes n slaves per thread, each thread with its own Engine and bus. The
+// slaves are simulated in process: they acknowledge everything after the
+// latency, so what is measured is the master, not the bus.
+
+#include <core/bootloader/master/AsyncSession.hpp>
+
+#include "EchoBus.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace bootloader;
+using namespace bootloader::master;
+
+static const ModuleUID FIRST_UID = 0x10000000;
+
+struct Run {
+    Engine::Statistics statistics;
+    unsigned           failed = 0;
+};
+
+static Task<void>
+flashOne(
+    Engine&                engine,
+    ModuleUID              uid,
+    const Image&           image,
+    const Master::Options& options,
+    unsigned&              failed
+)
+{
+    Master::Result result = co_await flash(engine, uid, image, options);
+
+    if (!result.ok()) {
+        failed++;
+    }
+}
+
+static void
+bus(
+    unsigned        sessions,
+    Clock::duration latency,
+    const Image&    image,
+    Run&            run
+)
+{
+    std::vector<ModuleUID> slaves;
+
+    for (unsigned i = 0; i < sessions; i++) {
+        slaves.push_back(FIRST_UID + i);
+    }
+
+    EchoBus         transport(slaves, latency);
+    Engine          engine(transport, 0xF0);
+    Master::Options options;
+
+    options.verify = false;
+
+    for (unsigned i = 0; i < sessions; i++) {
+        engine.spawn(flashOne(engine, FIRST_UID + i, image, options, run.failed));
+    }
+
+    engine.run();
+
+    run.statistics = engine.statistics();
+}
+
+int
+main(
+    int   argc,
+    char* argv[]
+)
+{
+    unsigned sessions = 200;
+    unsigned threads  = 1;
+    unsigned size     = 16 * 1024;
+    unsigned latency  = 0;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string a = argv[i];
+        unsigned    v = strtoul(argv[i + 1], nullptr, 0);
+
+        if (a == "--sessions") {
+            sessions = v;
+        } else if (a == "--threads") {
+            threads = v;
+        } else if (a == "--size") {
+            size = v;
+        } else if (a == "--latency") {
+            latency = v;
+        } else {
+            fprintf(stderr, "usage: engine_benchmark [--sessions n] [--threads n] [--size bytes] [--latency us]\n");
+            return 2;
+        }
+    }
+
+    if ((sessions == 0) || (sessions > 250) || (threads == 0)) {
+        fprintf(stderr, "1 to 250 sessions per thread, one CAN ID each\n");
+        return 2;
+    }
+
+    Image                image;
+    std::vector<uint8_t> data(size);
+
+    for (unsigned i = 0; i < size; i++) {
+        data[i] = i * 7;
+    }
+
+    image.add(0x08000000, data.data(), data.size());
+
+    std::vector<Run>         runs(threads);
+    std::vector<std::thread> workers;
+    Clock::time_point        start = Clock::now();
+
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back(bus, sessions, std::chrono::microseconds(latency), std::cref(image), std::ref(runs[t]));
+    }
+
+    for (std::thread& w : workers) {
+        w.join();
+    }
+
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    Run total;
+
+    for (const Run& r : runs) {
+        total.failed                          += r.failed;
+        total.statistics.finished             += r.statistics.finished;
+        total.statistics.resumes              += r.statistics.resumes;
+        total.statistics.frames               += r.statistics.frames;
+        total.statistics.timeouts             += r.statistics.timeouts;
+        total.statistics.busy                 += r.statistics.busy;
+        total.statistics.coroutines.peakBytes += r.statistics.coroutines.peakBytes;
+        total.statistics.coroutines.allocated += r.statistics.coroutines.allocated;
+    }
+
+    const Engine::Statistics& s     = total.statistics;
+    double                    busy  = std::chrono::duration<double>(s.busy).count();
+    unsigned                  count = sessions * threads;
+
+    printf("sessions          %u on %u thread(s), %u failed\n", count, threads, total.failed);
+    printf("elapsed           %.3f s\n", elapsed);
+    printf("frames            %llu, %.0f/s\n", (unsigned long long)s.frames, s.frames / elapsed);
+    printf("resumes           %llu\n", (unsigned long long)s.resumes);
+    printf("busy              %.3f s, %.0f ns/resume\n", busy, busy * 1e9 / std::max<uint64_t>(s.resumes, 1));
+    printf("timeouts          %llu\n", (unsigned long long)s.timeouts);
+    printf("coroutine frames  %zu bytes peak, %zu bytes/session, %zu allocations\n", s.coroutines.peakBytes, s.coroutines.peakBytes / count, s.coroutines.allocated);
+    printf("session object    %zu bytes\n", sizeof(AsyncSession));
+
+    return (total.failed == 0) ? 0 : 1;
+} // main
@@ -0,0 +1,297 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+// The flash time of an update, with the storage of the host build
+//
+//   flash_benchmark [options] <image> [previous image]
+//
+// Options:
+//   --page-size <bytes>     Flash page (default 2048)
+//   --unit <bytes>          Programmed at once: 2, 4 or 8 (default 2)
+//   --program-time <us>     Of a unit (default 53.5)
+//   --erase-time <ms>       Of a page (default 30)
+//   --no-zero-overwrite     Zeros cannot be programmed over data (parts with ECC)
+//   --resumable             Marks the pages done as they are written, RESUMABLE_WRITES
+//   --binary <address>      The images are raw binaries to be written at address
+//
+// The flash has the previous image (erased if there is none), then each
+// way of writing the image runs on it, the way the bootloader does: the
+// erases, the writes, the CRC of the program and its configuration. The
+// times are the ones of the part, not of the host.
+
+#include <core/bootloader/master/Image.hpp>
+#include <core/bootloader/port/EmulatedFlash.hpp>
+#include <core/stm32_flash/ConfigurationStorage.hpp>
+#include <core/stm32_flash/ProgramStorage.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace bootloader::master;
+using namespace bootloader::port;
+using namespace core::stm32_flash;
+
+struct Strategy {
+    const char* name;
+    bool        eraseAll;   // As ERASE_PROGRAM: every page
+    bool        delta;      // Only the pages that change
+    bool        skipErased; // Units that are erased in the image are not programmed
+};
+
+static const Strategy STRATEGIES[] = {
+    {"erase all", true, false, false},
+    {"erase used", false, false, false},
+    {"delta", false, true, false},
+    {"delta, skip erased", false, true, true}
+};
+
+static FlashSegment         programFlash(PROGRAM_FLASH_FROM, PROGRAM_FLASH_TO);
+static ProgramStorage       programStorage(programFlash);
+static FlashSegment         configurationBank1(CONFIGURATION1_FLASH_FROM, CONFIGURATION1_FLASH_TO);
+static FlashSegment         configurationBank2(CONFIGURATION2_FLASH_FROM, CONFIGURATION2_FLASH_TO);
+static Storage              userStorage(configurationBank1, configurationBank2);
+static ConfigurationStorage configurationStorage(userStorage);
+
+static bool
+isErased(
+    const uint8_t* data,
+    std::size_t    length
+)
+{
+    for (std::size_t i = 0; i < length; i++) {
+        if (data[i] != 0xFF) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Programs the units of the image in the page, as the bootloader gets them
+static bool
+writePage(
+    EmulatedFlash&  flash,
+    const Image&    image,
+    uint32_t        page,
+    const Strategy& strategy
+)
+{
+    const uint32_t pageSize = flash.configuration().pageSize;
+    const uint32_t unit     = flash.configuration().programUnit;
+    bool           success  = true;
+
+    for (const auto& segment : image.segments()) {
+        uint32_t from = std::max<uint32_t>(segment.first, page);
+        uint32_t to   = std::min<uint32_t>(segment.first + segment.second.size(), page + pageSize);
+
+        for (uint32_t address = from - (from % unit); address < to; address += unit) {
+            uint8_t data[8];
+
+            memset(data, 0xFF, sizeof(data));
+
+            for (uint32_t i = 0; i < unit; i++) {
+                if ((address + i >= segment.first) && (address + i < segment.first + segment.second.size())) {
+                    data[i] = segment.second[address + i - segment.first];
+                }
+            }
+
+            if (!strategy.skipErased || !isErased(data, unit)) {
+                success &= programFlash.write(address, data, unit);
+            }
+        }
+    }
+
+    return success;
+} // writePage
+
+static bool
+writeImage(
+    EmulatedFlash&  flash,
+    const Image&    image,
+    const Strategy& strategy,
+    bool            resumable
+)
+{
+    const uint32_t pageSize = flash.configuration().pageSize;
+    const uint32_t unit     = flash.configuration().programUnit;
+    const uint32_t progress = PROGRAM_FLASH_TO - pageSize;
+    bool           success  = programStorage.unlock();
+
+    std::vector<uint8_t>  content(pageSize);
+    std::vector<uint32_t> pages;
+
+    for (uint32_t page = PROGRAM_FLASH_FROM; page < progress; page += pageSize) {
+        image.page(page, content.data(), pageSize);
+
+        bool used    = !isErased(content.data(), pageSize);
+        bool differs = memcmp(flash.data(page), content.data(), pageSize) != 0;
+
+        if (strategy.eraseAll) {
+            success &= flash.erasePage(page);
+        } else if ((!strategy.delta || differs) && !flash.isErased(page, pageSize)) {
+            success &= flash.erasePage(page);
+        }
+
+        if (used && (!strategy.delta || differs)) {
+            pages.push_back(page);
+        }
+    }
+
+    if (strategy.eraseAll) {
+        success &= flash.erasePage(progress);
+    }
+
+    for (uint32_t page : pages) {
+        success &= writePage(flash, image, page, strategy);
+
+        if (resumable) {
+            const uint8_t zeros[8] = {0};
+            success &= programFlash.write(progress + (page - PROGRAM_FLASH_FROM) / pageSize * unit, zeros, unit);
+        }
+    }
+
+    if (resumable && !flash.isErased(progress, pageSize)) {
+        success &= flash.erasePage(progress);
+    }
+
+    success &= configurationStorage.writeProgramCRC(programStorage.updateCRC());
+
+    return success;
+} // writeImage
+
+static bool
+verify(
+    EmulatedFlash& flash,
+    const Image&   image
+)
+{
+    const uint32_t       pageSize = flash.configuration().pageSize;
+    std::vector<uint8_t> content(pageSize);
+
+    for (uint32_t page = PROGRAM_FLASH_FROM; page < PROGRAM_FLASH_TO; page += pageSize) {
+        image.page(page, content.data(), pageSize);
+
+        if (memcmp(flash.data(page), content.data(), pageSize) != 0) {
+            return false;
+        }
+    }
+
+    return configurationStorage.getModuleConfiguration()->imageCRC == programStorage.updateCRC();
+}
+
+static int
+usage()
+{
+    std::cerr << "usage: flash_benchmark [--page-size bytes] [--unit bytes] [--program-time us] [--erase-time ms]" << std::endl
+              << "                       [--no-zero-overwrite] [--resumable] [--binary address] <image> [previous image]" << std::endl;
+    return 2;
+}
+
+int
+main(
+    int   argc,
+    char* argv[]
+)
+{
+    EmulatedFlash::Configuration configuration;
+    bool                         resumable = false;
+    bool                         binary    = false;
+    uint32_t                     address   = 0;
+    std::vector<std::string>     arguments;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+
+        if ((a == "--page-size") && (i + 1 < argc)) {
+            configuration.pageSize = strtoul(argv[++i], nullptr, 0);
+        } else if ((a == "--unit") && (i + 1 < argc)) {
+            configuration.programUnit = strtoul(argv[++i], nullptr, 0);
+        } else if ((a == "--program-time") && (i + 1 < argc)) {
+            configuration.programTime = std::chrono::nanoseconds((long long)(atof(argv[++i]) * 1e3));
+        } else if ((a == "--erase-time") && (i + 1 < argc)) {
+            configuration.eraseTime = std::chrono::nanoseconds((long long)(atof(argv[++i]) * 1e6));
+        } else if (a == "--no-zero-overwrite") {
+            configuration.zeroOverwrite = false;
+        } else if (a == "--resumable") {
+            resumable = true;
+        } else if ((a == "--binary") && (i + 1 < argc)) {
+            binary  = true;
+            address = strtoul(argv[++i], nullptr, 0);
+        } else if (a.compare(0, 2, "--") == 0) {
+            return usage();
+        } else {
+            arguments.push_back(a);
+        }
+    }
+
+    if ((arguments.size() != 1) && (arguments.size() != 2)) {
+        return usage();
+    }
+
+    Image images[2];
+
+    for (std::size_t i = 0; i < arguments.size(); i++) {
+        bool success = binary ? images[i].loadBinary(arguments[i], address) : images[i].loadIHex(arguments[i]);
+
+        if (!success || images[i].empty()) {
+            std::cerr << arguments[i] << ": cannot read the image" << std::endl;
+            return 1;
+        }
+
+        for (uint32_t page : images[i].pages(configuration.pageSize)) {
+            if ((page < PROGRAM_FLASH_FROM) || (page >= PROGRAM_FLASH_TO - configuration.pageSize)) {
+                std::cerr << arguments[i] << ": does not fit the program flash" << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    std::unique_ptr<EmulatedFlash> flash = EmulatedFlash::create(configuration);
+
+    if (!flash) {
+        std::cerr << "cannot map the flash, or the configuration is not valid" << std::endl;
+        return 1;
+    }
+
+    printf("%u B pages, %u B units, %.1f us to program one, %.1f ms to erase a page\n\n", configuration.pageSize, configuration.programUnit,
+           configuration.programTime.count() / 1e3, configuration.eraseTime.count() / 1e6);
+    printf("%-20s %8s %10s %8s %10s %10s  %s\n", "", "erased", "programmed", "refused", "time [ms]", "KiB/s", "result");
+
+    const Strategy* strategy = STRATEGIES;
+
+    for (; strategy != STRATEGIES + sizeof(STRATEGIES) / sizeof(STRATEGIES[0]); strategy++) {
+        // From the previous image each time, its own writing is not counted
+        Strategy previous = {"previous", true, false, true};
+
+        configurationStorage.erase();
+
+        if (arguments.size() == 2) {
+            writeImage(*flash, images[1], previous, false);
+        } else {
+            programStorage.erase();
+        }
+
+        flash->resetStatistics();
+
+        bool success = writeImage(*flash, images[0], *strategy, resumable);
+
+        success &= verify(*flash, images[0]);
+
+        const EmulatedFlash::Statistics& s = flash->statistics();
+        double milliseconds = s.busy.count() / 1e6;
+
+        printf("%-20s %8llu %10llu %8llu %10.1f %10.1f  %s\n", strategy->name, (unsigned long long)s.erased, (unsigned long long)s.programmed,
+               (unsigned long long)s.refused, milliseconds, images[0].size() / 1024.0 / (milliseconds / 1e3), success ? "ok" : "FAILED");
+    }
+
+    return 0;
+} // main
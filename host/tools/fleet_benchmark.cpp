@@ -0,0 +1,142 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+// How the update time of a machine scales with its buses
+//
+//   fleet_benchmark [--buses n] [--slaves n] [--shared n] [--sessions n]
+//                   [--size bytes] [--frame-time us] [--latency us]
+//
+// Each bus has its own slaves, simulated in process. The first --shared
+// slaves of a bus are also reachable from the next one, and can be taken
+// by whichever bus has time first. Every message keeps its bus busy for
+// --frame-time, so one bus cannot go faster than that.
+
+#include <core/bootloader/master/Fleet.hpp>
+
+#include "EchoBus.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+using namespace bootloader;
+using namespace bootloader::master;
+
+int
+main(
+    int   argc,
+    char* argv[]
+)
+{
+    unsigned buses     = 2;
+    unsigned slaves    = 32;
+    unsigned shared    = 8;
+    unsigned sessions  = 32;
+    unsigned size      = 8 * 1024;
+    unsigned frameTime = 100;
+    unsigned latency   = 200;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string a = argv[i];
+        unsigned    v = strtoul(argv[i + 1], nullptr, 0);
+
+        if (a == "--buses") {
+            buses = v;
+        } else if (a == "--slaves") {
+            slaves = v;
+        } else if (a == "--shared") {
+            shared = v;
+        } else if (a == "--sessions") {
+            sessions = v;
+        } else if (a == "--size") {
+            size = v;
+        } else if (a == "--frame-time") {
+            frameTime = v;
+        } else if (a == "--latency") {
+            latency = v;
+        } else {
+            fprintf(stderr, "usage: fleet_benchmark [--buses n] [--slaves n] [--shared n] [--sessions n] [--size bytes] [--frame-time us] [--latency us]\n");
+            return 2;
+        }
+    }
+
+    if ((buses == 0) || (slaves == 0) || (shared > slaves) || (slaves + shared > 250)) {
+        fprintf(stderr, "at most 250 slaves per bus, shared ones included\n");
+        return 2;
+    }
+
+    // Slave i of bus b is (b + 1) << 16 | i
+    std::vector<std::vector<ModuleUID> > onBus(buses);
+
+    for (unsigned b = 0; b < buses; b++) {
+        for (unsigned i = 0; i < slaves; i++) {
+            onBus[b].push_back(((b + 1) << 16) | i);
+        }
+    }
+
+    if (buses > 1) {
+        for (unsigned b = 0; b < buses; b++) {
+            for (unsigned i = 0; i < shared; i++) {
+                onBus[(b + 1) % buses].push_back(onBus[b][i]);
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<EchoBus> > transports;
+    std::vector<ITransport*>               pointers;
+
+    for (unsigned b = 0; b < buses; b++) {
+        transports.emplace_back(new EchoBus(onBus[b], std::chrono::microseconds(latency), std::chrono::microseconds(frameTime)));
+        pointers.push_back(transports.back().get());
+    }
+
+    std::shared_ptr<Image> image(new Image());
+    std::vector<uint8_t>   data(size);
+
+    for (unsigned i = 0; i < size; i++) {
+        data[i] = i * 7;
+    }
+
+    image->add(0x08000000, data.data(), data.size());
+
+    Fleet::Options options;
+
+    options.flash.verify  = false;
+    options.sessionsPerBus = sessions;
+    options.discovery      = std::chrono::milliseconds(10);
+
+    Fleet fleet(pointers, 0xF0, options);
+
+    fleet.discover();
+
+    for (unsigned b = 0; b < buses; b++) {
+        for (unsigned i = 0; i < slaves; i++) {
+            fleet.add(onBus[b][i], image);
+        }
+    }
+
+    Clock::time_point           start    = Clock::now();
+    std::vector<Fleet::Outcome> outcomes = fleet.run();
+    double                      elapsed  = std::chrono::duration<double>(Clock::now() - start).count();
+    unsigned                    failed   = 0;
+
+    for (const Fleet::Outcome& o : outcomes) {
+        if (!o.result.ok()) {
+            failed++;
+        }
+    }
+
+    printf("slaves    %zu on %u bus(es), %u failed\n", outcomes.size(), buses, failed);
+    printf("elapsed   %.3f s, %.1f KiB/s\n", elapsed, outcomes.size() * size / 1024.0 / elapsed);
+
+    for (unsigned b = 0; b < buses; b++) {
+        const Fleet::BusStatistics& s = fleet.statistics()[b];
+
+        printf("bus %-4u  %u jobs, %u stolen, %llu frames, %llu timeouts\n", b, s.jobs, s.stolen, (unsigned long long)s.engine.frames, (unsigned long long)s.engine.timeouts);
+    }
+
+    return (failed == 0) ? 0 : 1;
+} // main
@@ -0,0 +1,181 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+// IHexReader against ihex_read_bytes, and IHexWriter
+//
+//   ihex_benchmark [--size bytes] [--line-length n] [--chunk bytes] [--rounds n]
+//
+// Encodes --size bytes of random data in records of --line-length bytes,
+// then decodes them --rounds times with both readers, in reads of --chunk
+// bytes. Built with src/kk_ihex/kk_ihex_read.c. That they agree is up to
+// host/tests/ihex_test.cpp.
+
+#include <core/bootloader/master/IHex.hpp>
+
+#include <kk_ihex/kk_ihex_read.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace bootloader::master;
+
+using Clock = std::chrono::steady_clock;
+
+// What a reader saw
+struct Digest {
+    uint64_t records = 0;
+    uint64_t bytes   = 0;
+    uint64_t errors  = 0;
+    uint64_t hash    = 14695981039346656037ULL;
+
+    void
+    add(
+        struct ihex_state* ihex,
+        ihex_record_type_t type,
+        ihex_bool_t        error
+    )
+    {
+        records++;
+        errors += (error != 0);
+
+        if (type == IHEX_DATA_RECORD) {
+            uint32_t address = IHEX_LINEAR_ADDRESS(ihex);
+
+            bytes += ihex->length;
+            hash   = (hash ^ address) * 1099511628211ULL;
+
+            for (uint8_t i = 0; i < ihex->length; i++) {
+                hash = (hash ^ ihex->data[i]) * 1099511628211ULL;
+            }
+        }
+    }
+};
+
+static Digest kk;
+
+extern "C" ihex_bool_t
+ihex_data_read(
+    struct ihex_state* ihex,
+    ihex_record_type_t type,
+    ihex_bool_t        checksum_mismatch
+)
+{
+    kk.add(ihex, type, checksum_mismatch);
+    return true;
+}
+
+template <typename F>
+static double
+seconds(
+    F f
+)
+{
+    Clock::time_point start = Clock::now();
+
+    f();
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+int
+main(
+    int   argc,
+    char* argv[]
+)
+{
+    std::size_t size       = 16 * 1024 * 1024;
+    unsigned    lineLength = IHexWriter::DEFAULT_LINE_LENGTH;
+    std::size_t chunk      = 64 * 1024;
+    unsigned    rounds     = 5;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string a = argv[i];
+        unsigned    v = strtoul(argv[i + 1], nullptr, 0);
+
+        if (a == "--size") {
+            size = v;
+        } else if (a == "--line-length") {
+            lineLength = v;
+        } else if (a == "--chunk") {
+            chunk = v;
+        } else if (a == "--rounds") {
+            rounds = v;
+        } else {
+            fprintf(stderr, "usage: ihex_benchmark [--size bytes] [--line-length n] [--chunk bytes] [--rounds n]\n");
+            return 2;
+        }
+    }
+
+    if ((chunk == 0) || (rounds == 0)) {
+        return 2;
+    }
+
+    std::vector<uint8_t> data(size);
+    std::mt19937         random(1);
+
+    for (uint8_t& b : data) {
+        b = random();
+    }
+
+    std::string hex;
+    IHexWriter  writer([&](const char* buffer, const char* end) {
+                           hex.append(buffer, end);
+                       }, lineLength);
+
+    double encode = seconds([&]() {
+                                writer.writeAt(0x08000000);
+                                writer.write(data.data(), data.size());
+                                writer.end();
+                            });
+
+    Digest     fast;
+    IHexReader reader([&](struct ihex_state* ihex, ihex_record_type_t type, ihex_bool_t error) -> ihex_bool_t {
+                          fast.add(ihex, type, error);
+                          return true;
+                      });
+
+    double kkTime   = 1e9;
+    double fastTime = 1e9;
+
+    for (unsigned round = 0; round < rounds; round++) {
+        kk   = Digest();
+        fast = Digest();
+
+        kkTime = std::min(kkTime, seconds([&]() {
+                                              struct ihex_state ihex;
+
+                                              ihex_begin_read(&ihex);
+
+                                              for (std::size_t i = 0; i < hex.size(); i += chunk) {
+                                                  ihex_read_bytes(&ihex, hex.data() + i, std::min(chunk, hex.size() - i));
+                                              }
+
+                                              ihex_end_read(&ihex);
+                                          }));
+
+        fastTime = std::min(fastTime, seconds([&]() {
+                                                  reader.begin();
+
+                                                  for (std::size_t i = 0; i < hex.size(); i += chunk) {
+                                                      reader.read(hex.data() + i, std::min(chunk, hex.size() - i));
+                                                  }
+
+                                                  reader.end();
+                                              }));
+    }
+
+    double mib = hex.size() / (1024.0 * 1024.0);
+
+    printf("text             %.1f MiB, %llu records\n", mib, (unsigned long long)fast.records);
+    printf("IHexWriter       %8.1f MiB/s\n", mib / encode);
+    printf("ihex_read_bytes  %8.1f MiB/s\n", mib / kkTime);
+    printf("IHexReader       %8.1f MiB/s, %.1fx\n", mib / fastTime, kkTime / fastTime);
+
+    return 0;
+} // main
@@ -16,11 +16,41 @@
 #endif
 //-----------------------------------------------------------------------------
 
+//--- TUNING ------------------------------------------------------------------
+/// RAM buffer flash writes are staged in, shares the scratch arena with the reads ///
+#ifndef WRITE_PAGE_SIZE
+#define WRITE_PAGE_SIZE 512
+#endif
+/// Masters a slave can be handed over to, each one costs a CAN filter and 2 receive buffers ///
+#ifndef MAXIMUM_MASTERS
+#define MAXIMUM_MASTERS 2
+#endif
+/// Stores a random CAN ID in the configuration once it has been claimed on the bus ///
+#ifndef PERSIST_CAN_ID
+#define PERSIST_CAN_ID  false
+#endif
+/// Keeps track of the written flash pages in the last page of the program flash, so that
+/// an interrupted transfer can be resumed. The application must not use that page ///
+#ifndef RESUMABLE_WRITES
+#define RESUMABLE_WRITES false
+#endif
+//-----------------------------------------------------------------------------
+
+//--- INSTRUMENTATION ---------------------------------------------------------
+/// Tracks the stack depth reached by each command (costs a stack scan per message) ///
+#ifndef STACK_STATISTICS
+#define STACK_STATISTICS false
+#endif
+//-----------------------------------------------------------------------------
+
 #define CORE_PACKED          __attribute__((packed))
 #define CORE_PACKED_ALIGNED  __attribute__((aligned(4), packed))
+#define CORE_ALIGNED         __attribute__((aligned(4)))
 
+#ifndef CORE_BOOTLOADER_HOST
 extern THD_WORKING_AREA(bootloaderThreadWorkingArea, 4096);
 THD_FUNCTION(bootloaderThread, arg);
+#endif
 
 #include <cstddef>
 #include <core/Array.hpp>
@@ -33,6 +63,8 @@ using ModuleUID  = uint32_t;
 using ModuleType = Array<char, 12>;
 using ModuleName = Array<char, 16>;
 
+static const ModuleUID ANY_MODULE_UID = 0xFFFFFFFF; // MASTER_IGNORE and MASTER_FORCE for every slave
+
 static const uint32_t SHORT_MESSAGE_LENGTH = 8;
 static const uint32_t LONG_MESSAGE_LENGTH  = 48;
 
@@ -44,13 +76,21 @@ static const uint32_t MAXIMUM_MESSAGE_LENGTH = 48;
 #define BOOTLOADER_TOPIC_NAME "BOOTLOADER"
 #define BOOTLOADER_TOPIC_ID ((uint8_t)0xFD)
 
+// Master -> one slave, the low byte of the CAN ID is the one of the slave
+#define BOOTLOADER_DIRECT_TOPIC_NAME "BOOTLOADERDRCT"
+#define BOOTLOADER_DIRECT_TOPIC_ID ((uint8_t)0xFB)
+
 enum class MessageType : uint8_t {
     NONE           = 0x00,
     REQUEST        = 0x01,
     IDENTIFY_SLAVE = 0x02,
+    ENUMERATE      = 0x03,
     SELECT_SLAVE   = 0x10,
     DESELECT_SLAVE = 0x11,
 
+    SELECT_SLAVE_ALIGNED = 0x12, // Opens a session using the aligned layout
+    SELECT_SLAVE_SHARED  = 0x13, // As above, other slaves may be selected at the same time
+
     ERASE_CONFIGURATION      = 0x04,
     ERASE_PROGRAM            = 0x05,
     WRITE_PROGRAM_CRC        = 0x06,
@@ -60,16 +100,26 @@ enum class MessageType : uint8_t {
     // READ_MODULE_NAME    = 0x26,
     WRITE_MODULE_NAME   = 0x27,
     WRITE_MODULE_CAN_ID = 0x28,
+    CLAIM_CAN_ID        = 0x2A,
     DESCRIBE_V1         = 0x29,
     DESCRIBE_V2         = 0x26,
     DESCRIBE_V3         = 0x30,
+    DESCRIBE_ALL        = 0x31,
 
 	TAGS_READ           = 0x40,
 	PROTOCOL_VERSION    = 0x41,
+	STACK_USAGE         = 0x42,
+    SET_SESSION_MODE    = 0x43,
+    RANGE_CRC           = 0x44,
+    JOB_STATUS          = 0x45,
+    WRITE_PROGRESS      = 0x46,
+    RESUME_WRITE        = 0x47,
 
     IHEX_WRITE = 0x50,
     IHEX_READ  = 0x51,
 
+    BINARY_WRITE = 0x58,
+
     RESET            = 0x60,
     RESET_ALL        = 0x61,
     BOOTLOAD         = 0x70,
@@ -95,6 +145,20 @@ enum class AcknowledgeStatus : uint8_t {
     IHEX_OK         = 0x09,
     DO_NOT_ACK      = 0x0A,
 	DONE            = 0x0B,
+    IN_PROGRESS     = 0x0C, // Still running, ask JOB_STATUS
+};
+
+// Optional features, reported by PROTOCOL_VERSION (1.2.0 and later) and
+// enabled for the current session with SET_SESSION_MODE.
+enum Capability : uint32_t {
+    ALIGNED_LAYOUT = 0x00000001, // Naturally aligned master -> slave messages
+    BINARY_WRITE   = 0x00000002, // BINARY_WRITE instead of IHEX_WRITE
+    WINDOWING      = 0x00000004, // Several writes in flight before an acknowledge
+    COMPRESSION    = 0x00000008, // Compressed write payloads
+    RANGE_CRC      = 0x00000010, // RANGE_CRC over program or user flash
+    COMPACT_ACK    = 0x00000020, // Writes are acknowledged with short messages
+    ASYNC_JOBS     = 0x00000040, // Erases and RANGE_CRC answer IN_PROGRESS and run in the background
+    RESUME         = 0x00000080  // Interrupted writes can be resumed, see WRITE_PROGRESS and RESUME_WRITE
 };
 
 struct Message {
@@ -165,6 +229,8 @@ struct Message_:
     using ContainerType = _CONTAINER;
     using PayloadType   = _PAYLOAD;
 
+    static const MessageType TYPE = _TYPE;
+
     Message_() :
         ContainerType(_TYPE)
     {}
@@ -176,6 +242,36 @@ struct Message_:
 
 CORE_PACKED_ALIGNED;
 
+// Where the aligned layout places a payload: the first offset after the header that suits its alignment
+template <typename PAYLOAD>
+constexpr std::size_t
+alignedPayloadOffset()
+{
+    return ((2 + alignof(PAYLOAD) - 1) / alignof(PAYLOAD)) * alignof(PAYLOAD);
+}
+
+// Aligned layout: same header, but the payload is naturally aligned, so that
+// 32 bit fields can be accessed with word loads.
+template <typename _CONTAINER, MessageType _TYPE, typename _PAYLOAD>
+struct AlignedMessage_:
+    public _CONTAINER {
+    static_assert(sizeof(_CONTAINER) == 2, "sizeof(CONTAINER) != 2");
+    using ContainerType = _CONTAINER;
+    using PayloadType   = _PAYLOAD;
+
+    static const MessageType TYPE = _TYPE;
+
+    AlignedMessage_() :
+        ContainerType(_TYPE)
+    {}
+
+    PayloadType data;
+
+    uint8_t padding[ContainerType::MESSAGE_LENGTH - alignedPayloadOffset<PayloadType>() - sizeof(data)];
+}
+
+CORE_ALIGNED;
+
 template <typename CONTAINER>
 class AcknowledgeMessage:
     public CONTAINER
@@ -185,11 +281,20 @@ public:
 
     AcknowledgeMessage() : CONTAINER(MessageType::ACK), status(AcknowledgeStatus::NONE), type(MessageType::NONE) {}
 
+    AcknowledgeMessage(
+        uint8_t           sequence,
+        const Message*    message,
+        AcknowledgeStatus s
+    ) : CONTAINER(MessageType::ACK), status(s), type(message->command)
+    {
+        this->sequenceId = sequence + 1;
+    }
+
     AcknowledgeStatus status;
     MessageType       type;
 }
 
-CORE_PACKED_ALIGNED;
+CORE_ALIGNED;
 
 template <typename CONTAINER, typename PAYLOAD>
 class AcknowledgeMessage_:
@@ -199,12 +304,21 @@ public:
     using ContainerType = CONTAINER;
     using PayloadType   = PAYLOAD;
 
+    AcknowledgeMessage_() {}
+
+    AcknowledgeMessage_(
+        uint8_t           sequence,
+        const Message*    message,
+        AcknowledgeStatus status
+    ) : AcknowledgeMessage<CONTAINER>(sequence, message, status)
+    {}
+
     PAYLOAD data;
 
     uint8_t padding[ContainerType::MESSAGE_LENGTH - sizeof(AcknowledgeMessage<CONTAINER>) - sizeof(data)];
 }
 
-CORE_PACKED_ALIGNED;
+CORE_ALIGNED;
 
 using ShortMessage = MessageBase<8>;
 using LongMessage  = MessageBase<48>;
@@ -45,6 +45,42 @@ struct UIDAndAddress {
     uint32_t  address;
 };
 
+// Slaves whose UID begins with prefix reply, each in the slot given by the
+// next slotBits bits of the UID
+struct Enumerate {
+    uint32_t prefix;
+    uint8_t  prefixLength; // Bits of prefix to match, MSB first
+    uint8_t  slotBits;     // 2^slotBits reply slots
+    uint16_t slotTime;     // Slot width [us]
+};
+
+// Every slave from firstID to lastID replies in the slot given by its CAN ID
+struct DescribeAll {
+    uint8_t  firstID;  // CAN ID replying in the first slot
+    uint8_t  lastID;   // CAN ID replying in the last slot
+    uint16_t slotTime; // Slot width [us]
+};
+
+struct UIDAndMode {
+    ModuleUID uid;
+    uint32_t  capabilities;
+};
+
+struct UIDAndRange {
+    ModuleUID uid;
+    uint32_t  address;
+    uint32_t  length;
+};
+
+struct BinaryData {
+    using Data = uint8_t[38];
+
+    uint32_t address;
+    uint8_t  length; // 0 ends the write
+    uint8_t  reserved;
+    Data     data;
+};
+
 struct IHex {
     enum Type : uint8_t {
         BEGIN = 0x01,
@@ -90,17 +126,69 @@ struct DescribeV3 {
     ModuleType moduleType;
     ModuleName moduleName;
 };
+
+struct Inventory {
+    ModuleUID  uid;
+    uint32_t   imageCRC;
+    uint32_t   programFlashSize;
+    uint8_t    programValid;
+    uint8_t    userValid;
+    uint8_t    moduleId;
+    ModuleType moduleType;
+    ModuleName moduleName;
+};
+
+struct JobStatus {
+    ModuleUID   uid;
+    uint32_t    done;    // [bytes]
+    uint32_t    total;   // [bytes]
+    uint32_t    crc;     // RANGE_CRC result
+    MessageType command; // What the job is running
+};
+
+struct Progress {
+    ModuleUID uid;
+    uint32_t  address;  // Where the first page of the bitmap begins
+    uint16_t  pageSize; // [bytes]
+    uint16_t  pages;    // Pages in the bitmap
+    uint8_t   done[32]; // A bit per page, LSB first, set once the page is written and verified
+};
+
+struct ProtocolVersion {
+    char     version[16];      // All that 1.0.0 and 1.1.0 send, the rest is undefined there
+    uint32_t capabilities;     // Supported Capability bits
+    uint16_t maxMessageLength; // Longest message the slave accepts
+    uint16_t writePageSize;    // Writes are staged and committed by this size
+};
+
+struct StackUsage {
+    uint16_t    bootloaderSize;
+    uint16_t    bootloaderUsed;
+    uint16_t    blinkerSize;
+    uint16_t    blinkerUsed;
+    uint16_t    deepestCommandUsed;
+    MessageType deepestCommand;
+};
 }
 
 namespace messages {
 // SLAVE -> MASTER
 using Announce = Message_<ShortMessage, MessageType::REQUEST, payload::Announce>;
 
+// MASTER -> SLAVES, sent with the CAN ID of the master
+using MasterIgnore = Message_<ShortMessage, MessageType::MASTER_IGNORE, payload::UID>;
+using MasterForce  = Message_<ShortMessage, MessageType::MASTER_FORCE, payload::UID>;
+
+// SLAVE -> SLAVE, sent with the claimed CAN ID
+using ClaimCanID = Message_<ShortMessage, MessageType::CLAIM_CAN_ID, payload::UID>;
+
 // MASTER -> SLAVE
 using Bootload       = Message_<LongMessage, MessageType::BOOTLOAD, payload::EMPTY>;
 using BootloadByName = Message_<LongMessage, MessageType::BOOTLOAD_BY_NAME, payload::NAME>;
 
 using IdentifySlave = Message_<LongMessage, MessageType::IDENTIFY_SLAVE, payload::UID>;
+using Enumerate     = Message_<LongMessage, MessageType::ENUMERATE, payload::Enumerate>;
+using DescribeAll   = Message_<LongMessage, MessageType::DESCRIBE_ALL, payload::DescribeAll>;
 using SelectSlave   = Message_<LongMessage, MessageType::SELECT_SLAVE, payload::UIDAndMaster>;
 using DeselectSlave = Message_<LongMessage, MessageType::DESELECT_SLAVE, payload::UID>;
 
@@ -113,10 +201,18 @@ using DescribeV3   = Message_<LongMessage, MessageType::DESCRIBE_V3, payload::UI
 
 using ProtocolVersion = Message_<LongMessage, MessageType::PROTOCOL_VERSION, payload::UID>;
 using TagsRead = Message_<LongMessage, MessageType::TAGS_READ, payload::UIDAndAddress>;
+using StackUsage = Message_<LongMessage, MessageType::STACK_USAGE, payload::UID>;
+using SetSessionMode = Message_<LongMessage, MessageType::SET_SESSION_MODE, payload::UIDAndMode>;
+using RangeCRC = Message_<LongMessage, MessageType::RANGE_CRC, payload::UIDAndRange>;
+using JobStatus = Message_<LongMessage, MessageType::JOB_STATUS, payload::UID>;
+using WriteProgress = Message_<LongMessage, MessageType::WRITE_PROGRESS, payload::UIDAndAddress>;
+using ResumeWrite = Message_<LongMessage, MessageType::RESUME_WRITE, payload::UID>;
+
+using IHexData = Message_<LongMessage, MessageType::IHEX_WRITE, payload::IHex>;
 
-using IHexData = Message_<LongMessage, MessageType::IHEX_READ, payload::IHex>;
+using IHexRead = Message_<LongMessage, MessageType::IHEX_READ, payload::UIDAndAddress>;
 
-using IHexRead = Message_<LongMessage, MessageType::IHEX_WRITE, payload::UIDAndAddress>;
+using BinaryData = Message_<LongMessage, MessageType::BINARY_WRITE, payload::BinaryData>;
 
 using Reset = Message_<LongMessage, MessageType::RESET, payload::UID>;
 using ResetAll = Message_<LongMessage, MessageType::RESET_ALL, payload::EMPTY>;
@@ -124,6 +220,44 @@ using ResetAll = Message_<LongMessage, MessageType::RESET_ALL, payload::EMPTY>;
 // using ReadName = Message_<LongMessage, MessageType::READ_MODULE_NAME, payload::UID>;
 using WriteModuleName = Message_<LongMessage, MessageType::WRITE_MODULE_NAME, payload::UIDAndName>;
 using WriteModuleID   = Message_<LongMessage, MessageType::WRITE_MODULE_CAN_ID, payload::UIDAndID>;
+
+// MASTER -> SLAVE, aligned layout (sessions opened with SelectSlave)
+namespace aligned {
+using IdentifySlave = AlignedMessage_<LongMessage, MessageType::IDENTIFY_SLAVE, payload::UID>;
+using Enumerate     = AlignedMessage_<LongMessage, MessageType::ENUMERATE, payload::Enumerate>;
+using DescribeAll   = AlignedMessage_<LongMessage, MessageType::DESCRIBE_ALL, payload::DescribeAll>;
+using SelectSlave   = AlignedMessage_<LongMessage, MessageType::SELECT_SLAVE_ALIGNED, payload::UIDAndMaster>;
+using SelectShared  = AlignedMessage_<LongMessage, MessageType::SELECT_SLAVE_SHARED, payload::UIDAndMaster>;
+using DeselectSlave = AlignedMessage_<LongMessage, MessageType::DESELECT_SLAVE, payload::UID>;
+
+using EraseConfiguration     = AlignedMessage_<LongMessage, MessageType::ERASE_CONFIGURATION, payload::UID>;
+using EraseUserConfiguration = AlignedMessage_<LongMessage, MessageType::ERASE_USER_CONFIGURATION, payload::UID>;
+using EraseProgram           = AlignedMessage_<LongMessage, MessageType::ERASE_PROGRAM, payload::UID>;
+using WriteProgramCrc        = AlignedMessage_<LongMessage, MessageType::WRITE_PROGRAM_CRC, payload::UIDAndCRC>;
+using DescribeV1 = AlignedMessage_<LongMessage, MessageType::DESCRIBE_V1, payload::UID>;
+using DescribeV2 = AlignedMessage_<LongMessage, MessageType::DESCRIBE_V2, payload::UID>;
+using DescribeV3 = AlignedMessage_<LongMessage, MessageType::DESCRIBE_V3, payload::UID>;
+
+using ProtocolVersion = AlignedMessage_<LongMessage, MessageType::PROTOCOL_VERSION, payload::UID>;
+using TagsRead        = AlignedMessage_<LongMessage, MessageType::TAGS_READ, payload::UIDAndAddress>;
+using StackUsage      = AlignedMessage_<LongMessage, MessageType::STACK_USAGE, payload::UID>;
+using SetSessionMode  = AlignedMessage_<LongMessage, MessageType::SET_SESSION_MODE, payload::UIDAndMode>;
+using RangeCRC        = AlignedMessage_<LongMessage, MessageType::RANGE_CRC, payload::UIDAndRange>;
+using JobStatus       = AlignedMessage_<LongMessage, MessageType::JOB_STATUS, payload::UID>;
+using WriteProgress   = AlignedMessage_<LongMessage, MessageType::WRITE_PROGRESS, payload::UIDAndAddress>;
+using ResumeWrite     = AlignedMessage_<LongMessage, MessageType::RESUME_WRITE, payload::UID>;
+
+using IHexData = AlignedMessage_<LongMessage, MessageType::IHEX_WRITE, payload::IHex>;
+using IHexRead = AlignedMessage_<LongMessage, MessageType::IHEX_READ, payload::UIDAndAddress>;
+
+using BinaryData = AlignedMessage_<LongMessage, MessageType::BINARY_WRITE, payload::BinaryData>;
+
+using Reset    = AlignedMessage_<LongMessage, MessageType::RESET, payload::UID>;
+using ResetAll = AlignedMessage_<LongMessage, MessageType::RESET_ALL, payload::EMPTY>;
+
+using WriteModuleName = AlignedMessage_<LongMessage, MessageType::WRITE_MODULE_NAME, payload::UIDAndName>;
+using WriteModuleID   = AlignedMessage_<LongMessage, MessageType::WRITE_MODULE_CAN_ID, payload::UIDAndID>;
+}
 }
 
 
@@ -136,12 +270,9 @@ public:
         const Message*    message,
         AcknowledgeStatus status,
         ModuleUID         uid
-    )
+    ) : AcknowledgeMessage_(sequence, message, status)
     {
-        this->sequenceId = sequence + 1;
-        this->type       = static_cast<MessageType>(message->command);
-        this->data.uid   = uid;
-        this->status     = status;
+        this->data.uid = uid;
     }
 
     AcknowledgeUID(
@@ -149,16 +280,11 @@ public:
         const Message&    message,
         AcknowledgeStatus status,
         ModuleUID         uid
-    )
-    {
-        this->sequenceId = sequence + 1;
-        this->type       = static_cast<MessageType>(message.command);
-        this->data.uid   = uid;
-        this->status     = status;
-    }
+    ) : AcknowledgeUID(sequence, &message, status, uid)
+    {}
 }
 
-CORE_PACKED_ALIGNED;
+CORE_ALIGNED;
 
 class AcknowledgeDescribeV1:
     public AcknowledgeMessage_<LongMessage, payload::DescribeV1>
@@ -173,12 +299,8 @@ public:
         const char*       module_name,
         uint32_t          user_flash_size,
         uint32_t          program_flash_size
-    )
+    ) : AcknowledgeMessage_(sequence, message, status)
     {
-        this->sequenceId = sequence + 1;
-        this->type       = static_cast<MessageType>(message->command);
-        this->status     = status;
-
         if (status == AcknowledgeStatus::OK) {
             this->data.moduleId = moduleId;
             this->data.moduleType.copyFrom(module_type);
@@ -199,25 +321,11 @@ public:
         const char*       module_name,
         uint32_t          user_flash_size,
         uint32_t          program_flash_size
-    )
-    {
-        this->sequenceId = sequence + 1;
-        this->type       = static_cast<MessageType>(message.command);
-        this->status     = status;
-
-        if (status == AcknowledgeStatus::OK) {
-            this->data.moduleId = moduleId;
-            this->data.moduleType.copyFrom(module_type);
-            this->data.moduleName.copyFrom(module_name);
-            this->data.userFlashSize    = user_flash_size;
-            this->data.programFlashSize = program_flash_size;
-        } else {
-            memset(&this->data, 0, sizeof(this->data));
-        }
-    }
+    ) : AcknowledgeDescribeV1(sequence, &message, status, moduleId, module_type, module_name, user_flash_size, program_flash_size)
+    {}
 }
 
-CORE_PACKED_ALIGNED;
+CORE_ALIGNED;
 
 class AcknowledgeDescribeV2:
     public AcknowledgeMessage_<LongMessage, payload::DescribeV2>
@@ -234,12 +342,8 @@ public:
         uint32_t          program_flash_size,
         uint32_t          conf_crc,
         uint32_t          flash_crc
-    )
+    ) : AcknowledgeMessage_(sequence, message, status)
     {
-        this->sequenceId = sequence + 1;
-        this->type       = static_cast<MessageType>(message->command);
-        this->status     = status;
-
         if (status == AcknowledgeStatus::OK) {
             this->data.moduleId = moduleId;
             this->data.moduleType.copyFrom(module_type);
@@ -264,27 +368,11 @@ public:
         uint32_t          program_flash_size,
         uint32_t          conf_crc,
         uint32_t          flash_crc
-    )
-    {
-        this->sequenceId = sequence + 1;
-        this->type       = static_cast<MessageType>(message.command);
-        this->status     = status;
-
-        if (status == AcknowledgeStatus::OK) {
-            this->data.moduleId = moduleId;
-            this->data.moduleType.copyFrom(module_type);
-            this->data.moduleName.copyFrom(module_name);
-            this->data.userFlashSize    = user_flash_size;
-            this->data.programFlashSize = program_flash_size;
-            this->data.confCRC          = conf_crc;
-            this->data.flashCRC         = flash_crc;
-        } else {
-            memset(&this->data, 0, sizeof(this->data));
-        }
-    }
+    ) : AcknowledgeDescribeV2(sequence, &message, status, moduleId, module_type, module_name, user_flash_size, program_flash_size, conf_crc, flash_crc)
+    {}
 }
 
-CORE_PACKED_ALIGNED;
+CORE_ALIGNED;
 
 class AcknowledgeDescribeV3:
     public AcknowledgeMessage_<LongMessage, payload::DescribeV3>
@@ -301,13 +389,9 @@ public:
         uint32_t          program_flash_size,
         uint32_t          tags_flash_size,
         bool              program_valid,
-		bool              user_valid
-    )
+        bool              user_valid
+    ) : AcknowledgeMessage_(sequence, message, status)
     {
-        this->sequenceId = sequence + 1;
-        this->type       = static_cast<MessageType>(message->command);
-        this->status     = status;
-
         if (status == AcknowledgeStatus::OK) {
             this->data.moduleId = moduleId;
             this->data.moduleType.copyFrom(module_type);
@@ -333,29 +417,44 @@ public:
         uint32_t          program_flash_size,
         uint32_t          tags_flash_size,
         bool              program_valid,
-		bool              user_valid
-    )
-    {
-        this->sequenceId = sequence + 1;
-        this->type       = static_cast<MessageType>(message.command);
-        this->status     = status;
+        bool              user_valid
+    ) : AcknowledgeDescribeV3(sequence, &message, status, moduleId, module_type, module_name, user_flash_size, program_flash_size, tags_flash_size, program_valid, user_valid)
+    {}
+}
 
-        if (status == AcknowledgeStatus::OK) {
-            this->data.moduleId = moduleId;
-            this->data.moduleType.copyFrom(module_type);
-            this->data.moduleName.copyFrom(module_name);
-            this->data.userFlashSize    = user_flash_size;
-            this->data.programFlashSize = program_flash_size;
-            this->data.tagsFlashSize    = tags_flash_size;
-            this->data.programValid     = program_valid ? 1 : 0;
-            this->data.userValid        = user_valid ? 1 : 0;
-        } else {
-            memset(&this->data, 0, sizeof(this->data));
-        }
+CORE_ALIGNED;
+
+// Reply to DESCRIBE_ALL, sent by unselected slaves: carries the UID
+class AcknowledgeInventory:
+    public AcknowledgeMessage_<LongMessage, payload::Inventory>
+{
+public:
+    AcknowledgeInventory(
+        uint8_t           sequence,
+        const Message*    message,
+        AcknowledgeStatus status,
+        ModuleUID         uid,
+        uint8_t           moduleId,
+        const char*       module_type,
+        const char*       module_name,
+        uint32_t          program_flash_size,
+        uint32_t          image_crc,
+        bool              program_valid,
+        bool              user_valid
+    ) : AcknowledgeMessage_(sequence, message, status)
+    {
+        this->data.uid      = uid;
+        this->data.moduleId = moduleId;
+        this->data.moduleType.copyFrom(module_type);
+        this->data.moduleName.copyFrom(module_name);
+        this->data.programFlashSize = program_flash_size;
+        this->data.imageCRC         = image_crc;
+        this->data.programValid     = program_valid ? 1 : 0;
+        this->data.userValid        = user_valid ? 1 : 0;
     }
 }
 
-CORE_PACKED_ALIGNED;
+CORE_ALIGNED;
 
 class AcknowledgeString:
     public AcknowledgeMessage_<LongMessage, char[44]>
@@ -367,10 +466,8 @@ public:
         AcknowledgeStatus status,
         const char*       string,
         size_t&           offset
-    )
+    ) : AcknowledgeMessage_(sequence, message, status)
     {
-        this->sequenceId = sequence + 1;
-        this->type       = static_cast<MessageType>(message->command);
         std::size_t i   = offset;
         std::size_t cnt = 0;
 
@@ -388,14 +485,11 @@ public:
                     cnt++;
                 }
 
-                this->status = AcknowledgeStatus::OK;
-                offset       = 0;
+                offset = 0;
             } else {
                 this->status = AcknowledgeStatus::IHEX_OK;
                 offset       = i;
             }
-        } else {
-            this->status = status;
         }
     }
 
@@ -404,10 +498,8 @@ public:
         const Message&    message,
         AcknowledgeStatus status,
         const char*       string
-    )
+    ) : AcknowledgeMessage_(sequence, &message, status)
     {
-        this->sequenceId = sequence + 1;
-        this->type       = static_cast<MessageType>(message.command);
         std::size_t i = 0;
 
         while (string[i] != 0) {
@@ -419,12 +511,10 @@ public:
             this->data[i] = 0;
             i++;
         }
-
-        this->status = status;
     }
 }
 
-CORE_PACKED_ALIGNED;
+CORE_ALIGNED;
 
 class AcknowledgeTags:
     public AcknowledgeMessage_<LongMessage, char[16]>
@@ -435,20 +525,290 @@ public:
         const Message*    message,
         AcknowledgeStatus status,
         const char*       string
-    )
+    ) : AcknowledgeMessage_(sequence, message, status)
     {
-        this->sequenceId = sequence + 1;
-        this->type       = static_cast<MessageType>(message->command);
         std::size_t i = 0;
 
         while (i < sizeof(this->data)) {
             this->data[i] = string[i];
             i++;
         }
+    }
+}
+
+CORE_ALIGNED;
+class AcknowledgeProtocolVersion:
+    public AcknowledgeMessage_<LongMessage, payload::ProtocolVersion>
+{
+public:
+    AcknowledgeProtocolVersion(
+        uint8_t           sequence,
+        const Message*    message,
+        AcknowledgeStatus status,
+        const char*       version,
+        uint32_t          capabilities
+    ) : AcknowledgeMessage_(sequence, message, status)
+    {
+        std::size_t i = 0;
+
+        while ((i < sizeof(this->data.version)) && (version[i] != '\0')) {
+            this->data.version[i] = version[i];
+            i++;
+        }
+
+        while (i < sizeof(this->data.version)) {
+            this->data.version[i++] = '\0';
+        }
 
-        this->status = status;
+        this->data.capabilities     = capabilities;
+        this->data.maxMessageLength = MAXIMUM_MESSAGE_LENGTH;
+        this->data.writePageSize    = WRITE_PAGE_SIZE;
     }
 }
 
-CORE_PACKED_ALIGNED;
+CORE_ALIGNED;
+
+class AcknowledgeMode:
+    public AcknowledgeMessage_<LongMessage, payload::UIDAndMode>
+{
+public:
+    AcknowledgeMode(
+        uint8_t           sequence,
+        const Message*    message,
+        AcknowledgeStatus status,
+        ModuleUID         uid,
+        uint32_t          capabilities
+    ) : AcknowledgeMessage_(sequence, message, status)
+    {
+        this->data.uid          = uid;
+        this->data.capabilities = capabilities;
+    }
+}
+
+CORE_ALIGNED;
+
+class AcknowledgeCRC:
+    public AcknowledgeMessage_<LongMessage, payload::UIDAndCRC>
+{
+public:
+    AcknowledgeCRC(
+        uint8_t           sequence,
+        const Message*    message,
+        AcknowledgeStatus status,
+        ModuleUID         uid,
+        uint32_t          crc
+    ) : AcknowledgeMessage_(sequence, message, status)
+    {
+        this->data.uid = uid;
+        this->data.crc = crc;
+    }
+}
+
+CORE_ALIGNED;
+
+class AcknowledgeJobStatus:
+    public AcknowledgeMessage_<LongMessage, payload::JobStatus>
+{
+public:
+    AcknowledgeJobStatus(
+        uint8_t           sequence,
+        const Message*    message,
+        AcknowledgeStatus status,
+        ModuleUID         uid,
+        MessageType       command,
+        uint32_t          done,
+        uint32_t          total,
+        uint32_t          crc
+    ) : AcknowledgeMessage_(sequence, message, status)
+    {
+        this->data.uid     = uid;
+        this->data.command = command;
+        this->data.done    = done;
+        this->data.total   = total;
+        this->data.crc     = crc;
+    }
+}
+
+CORE_ALIGNED;
+
+class AcknowledgeProgress:
+    public AcknowledgeMessage_<LongMessage, payload::Progress>
+{
+public:
+    AcknowledgeProgress(
+        uint8_t           sequence,
+        const Message*    message,
+        AcknowledgeStatus status,
+        ModuleUID         uid,
+        uint32_t          address,
+        uint16_t          pageSize
+    ) : AcknowledgeMessage_(sequence, message, status)
+    {
+        this->data.uid      = uid;
+        this->data.address  = address;
+        this->data.pageSize = pageSize;
+        this->data.pages    = 0;
+        memset(this->data.done, 0, sizeof(this->data.done));
+    }
+
+    void
+    add(
+        bool done
+    )
+    {
+        if (done) {
+            this->data.done[this->data.pages / 8] |= 1 << (this->data.pages % 8);
+        }
+
+        this->data.pages++;
+    }
+
+    bool
+    isFull() const
+    {
+        return this->data.pages == sizeof(this->data.done) * 8;
+    }
+}
+
+CORE_ALIGNED;
+
+// Single frame acknowledge, used for the writes when COMPACT_ACK is enabled
+class AcknowledgeCompact:
+    public AcknowledgeMessage_<ShortMessage, payload::UID>
+{
+public:
+    AcknowledgeCompact(
+        uint8_t           sequence,
+        const Message*    message,
+        AcknowledgeStatus status,
+        ModuleUID         uid
+    ) : AcknowledgeMessage_(sequence, message, status)
+    {
+        this->data.uid = uid;
+    }
+}
+
+CORE_ALIGNED;
+
+class AcknowledgeStackUsage:
+    public AcknowledgeMessage_<LongMessage, payload::StackUsage>
+{
+public:
+    AcknowledgeStackUsage(
+        uint8_t           sequence,
+        const Message*    message,
+        AcknowledgeStatus status,
+        const payload::StackUsage& usage
+    ) : AcknowledgeMessage_(sequence, message, status)
+    {
+        this->data = usage;
+    }
+}
+
+CORE_ALIGNED;
+
+// LAYOUT CHECKS --------------------------------------------------------------
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Winvalid-offsetof"
+
+template <typename MESSAGE>
+constexpr bool
+hasWireLength()
+{
+    return sizeof(MESSAGE) == MESSAGE::MESSAGE_LENGTH;
+}
+
+template <typename MESSAGE>
+constexpr bool
+isNaturallyAligned()
+{
+    return (alignof(MESSAGE) == 4) && ((offsetof(MESSAGE, data) % alignof(typename MESSAGE::PayloadType)) == 0);
+}
+
+template <typename MESSAGE>
+constexpr bool
+hasAlignedLayout()
+{
+    return hasWireLength<MESSAGE>() && isNaturallyAligned<MESSAGE>() && (offsetof(MESSAGE, data) == alignedPayloadOffset<typename MESSAGE::PayloadType>());
+}
+
+static_assert(hasWireLength<messages::Announce>(), "messages::Announce");
+static_assert(hasWireLength<messages::ClaimCanID>(), "messages::ClaimCanID");
+static_assert(hasWireLength<messages::MasterIgnore>(), "messages::MasterIgnore");
+static_assert(hasWireLength<messages::MasterForce>(), "messages::MasterForce");
+static_assert(hasWireLength<messages::Bootload>(), "messages::Bootload");
+static_assert(hasWireLength<messages::BootloadByName>(), "messages::BootloadByName");
+static_assert(hasWireLength<messages::IdentifySlave>(), "messages::IdentifySlave");
+static_assert(hasWireLength<messages::Enumerate>(), "messages::Enumerate");
+static_assert(hasWireLength<messages::DescribeAll>(), "messages::DescribeAll");
+static_assert(hasWireLength<messages::SelectSlave>(), "messages::SelectSlave");
+static_assert(hasWireLength<messages::DeselectSlave>(), "messages::DeselectSlave");
+static_assert(hasWireLength<messages::EraseConfiguration>(), "messages::EraseConfiguration");
+static_assert(hasWireLength<messages::EraseProgram>(), "messages::EraseProgram");
+static_assert(hasWireLength<messages::WriteProgramCrc>(), "messages::WriteProgramCrc");
+static_assert(hasWireLength<messages::DescribeV1>(), "messages::DescribeV1");
+static_assert(hasWireLength<messages::DescribeV2>(), "messages::DescribeV2");
+static_assert(hasWireLength<messages::DescribeV3>(), "messages::DescribeV3");
+static_assert(hasWireLength<messages::ProtocolVersion>(), "messages::ProtocolVersion");
+static_assert(hasWireLength<messages::TagsRead>(), "messages::TagsRead");
+static_assert(hasWireLength<messages::StackUsage>(), "messages::StackUsage");
+static_assert(hasWireLength<messages::SetSessionMode>(), "messages::SetSessionMode");
+static_assert(hasWireLength<messages::RangeCRC>(), "messages::RangeCRC");
+static_assert(hasWireLength<messages::JobStatus>(), "messages::JobStatus");
+static_assert(hasWireLength<messages::WriteProgress>(), "messages::WriteProgress");
+static_assert(hasWireLength<messages::ResumeWrite>(), "messages::ResumeWrite");
+static_assert(hasWireLength<messages::BinaryData>(), "messages::BinaryData");
+static_assert(hasWireLength<messages::IHexData>(), "messages::IHexData");
+static_assert(hasWireLength<messages::IHexRead>(), "messages::IHexRead");
+static_assert(hasWireLength<messages::Reset>(), "messages::Reset");
+static_assert(hasWireLength<messages::ResetAll>(), "messages::ResetAll");
+static_assert(hasWireLength<messages::WriteModuleName>(), "messages::WriteModuleName");
+static_assert(hasWireLength<messages::WriteModuleID>(), "messages::WriteModuleID");
+
+static_assert(hasAlignedLayout<messages::aligned::IdentifySlave>(), "messages::aligned::IdentifySlave");
+static_assert(hasAlignedLayout<messages::aligned::Enumerate>(), "messages::aligned::Enumerate");
+static_assert(hasAlignedLayout<messages::aligned::DescribeAll>(), "messages::aligned::DescribeAll");
+static_assert(hasAlignedLayout<messages::aligned::SelectSlave>(), "messages::aligned::SelectSlave");
+static_assert(hasAlignedLayout<messages::aligned::SelectShared>(), "messages::aligned::SelectShared");
+static_assert(hasAlignedLayout<messages::aligned::DeselectSlave>(), "messages::aligned::DeselectSlave");
+static_assert(hasAlignedLayout<messages::aligned::EraseConfiguration>(), "messages::aligned::EraseConfiguration");
+static_assert(hasAlignedLayout<messages::aligned::EraseUserConfiguration>(), "messages::aligned::EraseUserConfiguration");
+static_assert(hasAlignedLayout<messages::aligned::EraseProgram>(), "messages::aligned::EraseProgram");
+static_assert(hasAlignedLayout<messages::aligned::WriteProgramCrc>(), "messages::aligned::WriteProgramCrc");
+static_assert(hasAlignedLayout<messages::aligned::DescribeV1>(), "messages::aligned::DescribeV1");
+static_assert(hasAlignedLayout<messages::aligned::DescribeV2>(), "messages::aligned::DescribeV2");
+static_assert(hasAlignedLayout<messages::aligned::DescribeV3>(), "messages::aligned::DescribeV3");
+static_assert(hasAlignedLayout<messages::aligned::ProtocolVersion>(), "messages::aligned::ProtocolVersion");
+static_assert(hasAlignedLayout<messages::aligned::TagsRead>(), "messages::aligned::TagsRead");
+static_assert(hasAlignedLayout<messages::aligned::StackUsage>(), "messages::aligned::StackUsage");
+static_assert(hasAlignedLayout<messages::aligned::SetSessionMode>(), "messages::aligned::SetSessionMode");
+static_assert(hasAlignedLayout<messages::aligned::RangeCRC>(), "messages::aligned::RangeCRC");
+static_assert(hasAlignedLayout<messages::aligned::JobStatus>(), "messages::aligned::JobStatus");
+static_assert(hasAlignedLayout<messages::aligned::WriteProgress>(), "messages::aligned::WriteProgress");
+static_assert(hasAlignedLayout<messages::aligned::ResumeWrite>(), "messages::aligned::ResumeWrite");
+static_assert(hasAlignedLayout<messages::aligned::BinaryData>(), "messages::aligned::BinaryData");
+static_assert(hasAlignedLayout<messages::aligned::IHexData>(), "messages::aligned::IHexData");
+static_assert(hasAlignedLayout<messages::aligned::IHexRead>(), "messages::aligned::IHexRead");
+static_assert(hasAlignedLayout<messages::aligned::Reset>(), "messages::aligned::Reset");
+static_assert(hasAlignedLayout<messages::aligned::ResetAll>(), "messages::aligned::ResetAll");
+static_assert(hasAlignedLayout<messages::aligned::WriteModuleName>(), "messages::aligned::WriteModuleName");
+static_assert(hasAlignedLayout<messages::aligned::WriteModuleID>(), "messages::aligned::WriteModuleID");
+
+// Acknowledges were always naturally aligned, the wire layout must not change
+static_assert(hasWireLength<AcknowledgeUID>() && isNaturallyAligned<AcknowledgeUID>() && (offsetof(AcknowledgeUID, data) == 4), "AcknowledgeUID");
+static_assert(hasWireLength<AcknowledgeDescribeV1>() && isNaturallyAligned<AcknowledgeDescribeV1>() && (offsetof(AcknowledgeDescribeV1, data) == 4), "AcknowledgeDescribeV1");
+static_assert(hasWireLength<AcknowledgeDescribeV2>() && isNaturallyAligned<AcknowledgeDescribeV2>() && (offsetof(AcknowledgeDescribeV2, data) == 4), "AcknowledgeDescribeV2");
+static_assert(hasWireLength<AcknowledgeDescribeV3>() && isNaturallyAligned<AcknowledgeDescribeV3>() && (offsetof(AcknowledgeDescribeV3, data) == 4), "AcknowledgeDescribeV3");
+static_assert(hasWireLength<AcknowledgeInventory>() && isNaturallyAligned<AcknowledgeInventory>() && (offsetof(AcknowledgeInventory, data) == 4), "AcknowledgeInventory");
+static_assert(hasWireLength<AcknowledgeString>() && (offsetof(AcknowledgeString, data) == 4), "AcknowledgeString");
+static_assert(hasWireLength<AcknowledgeTags>() && (offsetof(AcknowledgeTags, data) == 4), "AcknowledgeTags");
+static_assert(hasWireLength<AcknowledgeProtocolVersion>() && isNaturallyAligned<AcknowledgeProtocolVersion>() && (offsetof(AcknowledgeProtocolVersion, data) == 4), "AcknowledgeProtocolVersion");
+static_assert(hasWireLength<AcknowledgeMode>() && isNaturallyAligned<AcknowledgeMode>() && (offsetof(AcknowledgeMode, data) == 4), "AcknowledgeMode");
+static_assert(hasWireLength<AcknowledgeCRC>() && isNaturallyAligned<AcknowledgeCRC>() && (offsetof(AcknowledgeCRC, data) == 4), "AcknowledgeCRC");
+static_assert(hasWireLength<AcknowledgeJobStatus>() && isNaturallyAligned<AcknowledgeJobStatus>() && (offsetof(AcknowledgeJobStatus, data) == 4), "AcknowledgeJobStatus");
+static_assert(hasWireLength<AcknowledgeProgress>() && isNaturallyAligned<AcknowledgeProgress>() && (offsetof(AcknowledgeProgress, data) == 4), "AcknowledgeProgress");
+static_assert(hasWireLength<AcknowledgeCompact>() && isNaturallyAligned<AcknowledgeCompact>() && (offsetof(AcknowledgeCompact, data) == 4), "AcknowledgeCompact");
+static_assert(hasWireLength<AcknowledgeStackUsage>() && isNaturallyAligned<AcknowledgeStackUsage>() && (offsetof(AcknowledgeStackUsage, data) == 4), "AcknowledgeStackUsage");
+
+#pragma GCC diagnostic pop
 }
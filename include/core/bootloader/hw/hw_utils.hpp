@@ -7,11 +7,20 @@
 #pragma once
 
 #include <stdint.h>
+#include <cstddef>
 #include <core/Array.hpp>
 
 // The following overrides the watchdog - useful only during debugging!
 //#define OVERRIDE_WATCHDOG 1
 
+#ifndef HW_FLASH_PAGE_SIZE
+#if defined(STM32F091xC) || defined(STM32F072xB) || defined(STM32F303xC) || defined(STM32F303x8)
+#define HW_FLASH_PAGE_SIZE 2048
+#else
+#define HW_FLASH_PAGE_SIZE 1024
+#endif
+#endif
+
 namespace hw {
 typedef enum {
     HARDWARE, WATCHDOG, SOFTWARE, OTHER
@@ -70,6 +79,51 @@ public:
     reload();
 };
 
+class Stack
+{
+public:
+    // Same pattern ChibiOS uses when CH_DBG_FILL_THREADS is enabled
+    static const uint32_t FILL = 0x55555555;
+
+    // Paints the part of the stack below the caller, must be called by the thread owning it
+    static void
+    paint(
+        void*       base,
+        std::size_t size
+    );
+
+    // Bytes at the bottom of the stack that were not touched since they were painted
+    static std::size_t
+    unused(
+        const void* base,
+        std::size_t size
+    );
+};
+
+class Flash
+{
+public:
+    static const std::size_t PAGE_SIZE = HW_FLASH_PAGE_SIZE;
+
+    // Erases the page that begins at address, the flash must have been unlocked
+    static bool
+    erasePage(
+        uint32_t address
+    );
+};
+
+class CRCUnit
+{
+public:
+    // Continues crc over data with the CRC unit, as core::stm32_crc configured it
+    static uint32_t
+    update(
+        uint32_t        crc,
+        const uint32_t* data,
+        std::size_t     words
+    );
+};
+
 typedef void (* pFunction)(
     void
 );
@@ -8,6 +8,7 @@
 #include <hal.h>
 
 #include <core/bootloader/blinker.hpp>
+#include <core/bootloader/hw/hw_utils.hpp>
 
 static const uint8_t led_default[] = {
     LED_ON(10), LED_OFF(950), LED_LOOP()
@@ -51,6 +52,8 @@ THD_FUNCTION(blinkerThread, arg) {
     static const uint8_t* oldPattern = 0;
     static uint8_t        id = 0;
 
+    hw::Stack::paint(blinkerThreadWorkingArea, sizeof(blinkerThreadWorkingArea));
+
     while (1) {
         if (_pattern != oldPattern) {
             oldPattern = _pattern;
@@ -16,7 +16,6 @@
 #include <core/bootloader/hw/hw_utils.hpp>
 #include "kk_ihex/kk_ihex.h"
 #include "kk_ihex/kk_ihex_read.h"
-#include "kk_ihex/kk_ihex_write.h"
 #include <rtcan.h>
 #include <rtcan_lld_can.h>
 #include <core/stm32_flash/ConfigurationStorage.hpp>
@@ -78,8 +77,25 @@ static core::stm32_flash::ConfigurationStorage configurationStorage(_userStorage
 
 static bool flashWriteSuccess = false; // Will be = true in eraseProgram (as we do not know if the program flash has already been cleared...
 
+// Program flash CRC, only recomputed after the program flash has changed
+static uint32_t programCRC      = 0;
+static bool     programCRCValid = false;
+
+static uint32_t
+cachedProgramCRC()
+{
+    if (!programCRCValid) {
+        programCRC      = programStorage.updateCRC();
+        programCRCValid = true;
+    }
+
+    return programCRC;
+}
+
 static thread_reference_t trp = nullptr; // Bootloader thread
 static const auto         RESUME_BOOTLOADER = (msg_t)0xCACCAB0B;     // Message used to resume the bootloader thread
+static const auto         RESUME_DEFEND     = (msg_t)0xCACCAB0C;     // Someone else claimed our CAN ID
+static const auto         RESUME_MASTER     = (msg_t)0xCACCAB0D;     // A master asked for a hand-over
 
 static bootloader::ModuleUID _moduleUID; // Module UID
 static uint8_t _canID; // CAN ID
@@ -87,16 +103,265 @@ static uint8_t _canID; // CAN ID
 //LFSR<uint16_t, 0x82EEu> rng(0); // PRNG
 LFSR<uint32_t, 0x80000ACDu> rng(0); // PRNG
 
-uint8_t data[bootloader::MAXIMUM_MESSAGE_LENGTH];
+// The LFSR moves one bit a step: the low bits of two slaves that agree once
+// keep agreeing for the next steps. The multiply mixes the whole state in
+static inline uint8_t
+randomByte()
+{
+    return (rng() * 2654435761u) >> 24;
+}
+
+// SCRATCH --------------------------------------------------------------------
+// Only one operation runs at a time, so they all lease the same RAM.
+// Acquiring a lease starts a new operation and ends the previous one.
+
+struct ReadbackLease {
+    char   buffer[80]; // Extended address, 16 bytes data and end of file records
+    size_t offset;     // Next character to send
+};
+
+struct TagsLease {
+    char buffer[16];
+};
+
+struct WriteLease {
+    ihex_state ihex;
+    uint32_t   address; // Address of the first staged halfword
+    uint16_t   count;   // Number of staged halfwords
+    uint16_t   page[WRITE_PAGE_SIZE / sizeof(uint16_t)];
+};
+
+static_assert((WRITE_PAGE_SIZE & (WRITE_PAGE_SIZE - 1)) == 0, "WRITE_PAGE_SIZE must be a power of 2");
+
+class ScratchArena
+{
+public:
+    ScratchArena() : _owner(Owner::NONE) {}
+
+    template <typename LEASE>
+    LEASE*
+    acquire()
+    {
+        static_assert(sizeof(LEASE) <= sizeof(Storage), "Lease does not fit the arena");
+
+        _owner = owner<LEASE>();
+
+        return reinterpret_cast<LEASE*>(&_storage);
+    }
+
+    // Returns the lease if the operation it belongs to is still running
+    template <typename LEASE>
+    LEASE*
+    get()
+    {
+        return (_owner == owner<LEASE>()) ? reinterpret_cast<LEASE*>(&_storage) : nullptr;
+    }
+
+    void
+    release()
+    {
+        _owner = Owner::NONE;
+    }
+
+private:
+    enum class Owner : uint8_t {
+        NONE, READBACK, TAGS, WRITE
+    };
+
+    union Storage {
+        ReadbackLease readback;
+        TagsLease     tags;
+        WriteLease    write;
+    };
+
+    template <typename LEASE>
+    static constexpr Owner
+    owner();
+
+    Storage _storage;
+    Owner   _owner;
+};
+
+template <>
+constexpr ScratchArena::Owner
+ScratchArena::owner<ReadbackLease>()
+{
+    return Owner::READBACK;
+}
+
+template <>
+constexpr ScratchArena::Owner
+ScratchArena::owner<TagsLease>()
+{
+    return Owner::TAGS;
+}
+
+template <>
+constexpr ScratchArena::Owner
+ScratchArena::owner<WriteLease>()
+{
+    return Owner::WRITE;
+}
+
+static ScratchArena scratch;
 
 // TAGS
-static char   tagsBuffer[16];
 static size_t tagsReadOffset = 0;
 
+// PROGRESS -------------------------------------------------------------------
+// A half word per flash page of the program: 0xFFFF until the page has been
+// written and verified, then 0x0000. A programmed half word can always be
+// overwritten with 0x0000, so the record is never erased while writing.
+// Erasing the program also clears the record.
+static const uint32_t PROGRESS_RECORD = core::stm32_flash::PROGRAM_FLASH_TO - hw::Flash::PAGE_SIZE;
+static const uint32_t PROGRESS_PAGES  = (PROGRESS_RECORD - core::stm32_flash::PROGRAM_FLASH_FROM) / hw::Flash::PAGE_SIZE;
+static const uint32_t NO_PAGE         = 0xFFFFFFFF;
+
+static uint32_t progressPage    = NO_PAGE; // Page being written
+static bool     progressSuccess = false;   // Every write to progressPage, and its readback, succeeded
+
+static bool
+isPageDone(
+    uint32_t page
+)
+{
+    return reinterpret_cast<const volatile uint16_t*>(PROGRESS_RECORD)[page] == 0x0000;
+}
+
+static bool
+isPageBlank(
+    uint32_t address
+)
+{
+    const volatile uint32_t* word = reinterpret_cast<const volatile uint32_t*>(address);
+
+    for (std::size_t i = 0; i < hw::Flash::PAGE_SIZE / sizeof(uint32_t); i++) {
+        if (word[i] != 0xFFFFFFFF) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool
+markPageDone(
+    uint32_t page
+)
+{
+    if (isPageDone(page)) {
+        return true;
+    }
+
+    if (!programStorage.isReady()) {
+        programStorage.beginWrite();
+    }
+
+    return programStorage.write16(PROGRESS_RECORD + page * sizeof(uint16_t), 0x0000);
+}
+
+// Called before writing to the program flash: once the writes move to a
+// following page, the previous one is complete. It is done only if all its
+// writes succeeded, a failed page stays pending and is erased by RESUME_WRITE.
+static bool
+trackProgress(
+    uint32_t address
+)
+{
+    uint32_t page    = (address - core::stm32_flash::PROGRAM_FLASH_FROM) / hw::Flash::PAGE_SIZE;
+    bool     success = true;
+
+    if (page >= PROGRESS_PAGES) {
+        // The record is not part of the program
+        return false;
+    }
+
+    if (page != progressPage) {
+        if ((progressPage != NO_PAGE) && (progressPage < page) && progressSuccess) {
+            success = markPageDone(progressPage);
+        }
+
+        // If the writes went backwards the previous page stays pending, and it will be sent again
+        progressPage    = page;
+        progressSuccess = true;
+    }
+
+    return success;
+} // trackProgress
+
 // IHEX -----------------------------------------------------------------------
-static char   ihexBuffer[256];
-static size_t ihexBufferReadOffset = 0;
-static char*  ihexBufferWPtr       = nullptr;
+static bool
+flushWritePage(
+    WriteLease* lease
+)
+{
+    bool     success = true;
+    uint32_t address = lease->address;
+
+    for (uint16_t i = 0; i < lease->count; i++) {
+        if (programStorage.isAddressValid(address)) {
+            // We want to write into flash
+            if (!programStorage.isReady()) {
+                programStorage.beginWrite();
+            }
+
+            programCRCValid = false;
+
+            if (RESUMABLE_WRITES) {
+                success &= trackProgress(address);
+            }
+
+            bool written = programStorage.write16(address, lease->page[i]);
+
+            written         &= (*reinterpret_cast<const volatile uint16_t*>(address) == lease->page[i]);
+            progressSuccess &= written;
+            success         &= written;
+        } else if (configurationStorage.isUserAddressValid(address)) {
+            // We want to write into user storage
+            if (!configurationStorage.isReady()) {
+                configurationStorage.beginWrite();
+            }
+
+            success &= configurationStorage.writeUserData16(address, lease->page[i]);
+        } else {
+            // We want to write in a not allowed location
+            success = false;
+        }
+
+        address += 2;
+    }
+
+    lease->count = 0;
+
+    return success;
+} // flushWritePage
+
+static bool
+stageWrite16(
+    WriteLease* lease,
+    uint32_t    address,
+    uint16_t    data
+)
+{
+    bool success = true;
+
+    if (lease->count > 0) {
+        bool contiguous = (address == lease->address + lease->count * sizeof(uint16_t));
+        bool samePage   = ((address & ~(WRITE_PAGE_SIZE - 1)) == (lease->address & ~(WRITE_PAGE_SIZE - 1)));
+
+        if (!contiguous || !samePage) {
+            success = flushWritePage(lease);
+        }
+    }
+
+    if (lease->count == 0) {
+        lease->address = address;
+    }
+
+    lease->page[lease->count++] = data;
+
+    return success;
+}
 
 ihex_bool_t
 ihex_data_read(
@@ -126,31 +391,16 @@ ihex_data_read(
         uint16_t data;
         uint8_t* x = (uint8_t*)((void*)(&data));
 
-        if (flashWriteSuccess) {
+        WriteLease* lease = scratch.get<WriteLease>();
+
+        if (flashWriteSuccess && (lease != nullptr)) {
             // We can write, as everything went well up to now
-            for (int i = 0; i < ihex->length; i += 2) {
-                // Write every word
+            for (int i = 0; (i < ihex->length) && flashWriteSuccess; i += 2) {
+                // Stage every word, full pages go to flash
                 x[0] = ihex->data[i];
                 x[1] = ihex->data[i + 1];
 
-                if (programStorage.isAddressValid(address)) {
-                    // We want to write into flash
-                    if (!programStorage.isReady()) {
-                        programStorage.beginWrite();
-                    }
-
-                    flashWriteSuccess &= programStorage.write16(address, data);
-                } else if (configurationStorage.isUserAddressValid(address)) {
-                    // We want to write into user storage
-                    if (!configurationStorage.isReady()) {
-                        configurationStorage.beginWrite();
-                    }
-
-                    flashWriteSuccess &= configurationStorage.writeUserData16(address, data);
-                } else {
-                    // We want to write in a not allowed location
-                    flashWriteSuccess = false;
-                }
+                flashWriteSuccess &= stageWrite16(lease, address, data);
 
                 address += 2;
             }
@@ -168,21 +418,53 @@ ihex_data_read(
     return false;
 } // ihex_data_read
 
-void
-ihex_flush_buffer(
-    struct ihex_state* ihex,
-    char*              buffer,
-    char*              eptr
+// Minimal IHEX record writer, all we need to read back a 16 bytes line
+static char*
+ihex_put_byte(
+    char*    w,
+    uint8_t  byte,
+    uint8_t& sum
 )
 {
-    *eptr = '\0';
+    static const char HEX[] = "0123456789ABCDEF";
 
-    while (buffer != eptr) {
-        // just copy the buffer into a local copy
-        *ihexBufferWPtr++ = *buffer++;
-    }
+    sum += byte;
+    *w++ = HEX[byte >> 4];
+    *w++ = HEX[byte & 0x0F];
+
+    return w;
 }
 
+static char*
+ihex_put_record(
+    char*              w,
+    ihex_record_type_t type,
+    uint16_t           address,
+    const uint8_t*     data,
+    uint8_t            length
+)
+{
+    uint8_t sum = 0;
+
+    *w++ = ':';
+    w    = ihex_put_byte(w, length, sum);
+    w    = ihex_put_byte(w, address >> 8, sum);
+    w    = ihex_put_byte(w, address & 0xFF, sum);
+    w    = ihex_put_byte(w, type, sum);
+
+    for (uint8_t i = 0; i < length; i++) {
+        w = ihex_put_byte(w, data[i], sum);
+    }
+
+    w = ihex_put_byte(w, ~sum + 1, sum);
+
+    for (const char* r = IHEX_NEWLINE_STRING; *r != '\0'; r++) {
+        *w++ = *r;
+    }
+
+    return w;
+} // ihex_put_record
+
 //-----------------------------------------------------------------------------
 
 namespace bootloader {
@@ -199,7 +481,11 @@ public:
     isInitialized() = 0;
 
     virtual bool
-	isBusy();
+	isBusy() = 0;
+
+    // True if the last received message was sent to this slave only
+    virtual bool
+    isDirect() = 0;
 
     virtual bool
     transmit(
@@ -222,12 +508,22 @@ public:
         IProtocolTransport& transport
     ) :
         _selected(false),
+        _shared(false),
+        _mode(0),
         _sequence(0),
         _muted(false),
+        _enumerated(false),
         _loading(false),
         _transport(transport),
-        _ihex()
-    {}
+        _deepestUsed(0),
+        _deepestCommand(MessageType::NONE)
+    {
+        _job.command = MessageType::NONE;
+        _job.status  = AcknowledgeStatus::NONE;
+
+        _replay.command = MessageType::NONE;
+        _replay.caching = false;
+    }
 
 public:
     bool
@@ -269,14 +565,14 @@ public:
     {
         AcknowledgeStatus status = AcknowledgeStatus::DISCARD;
 
-        LongMessage rxMessage;
+        uint32_t rxBuffer[LongMessage::MESSAGE_LENGTH / sizeof(uint32_t)];
 
         const Message* inMessage;
 
         if (message == nullptr) {
-            inMessage = &rxMessage;
+            inMessage = reinterpret_cast<const Message*>(rxBuffer);
 
-            if (!_transport.receive(&rxMessage, LongMessage::MESSAGE_LENGTH)) {
+            if (!_transport.receive(reinterpret_cast<Message*>(rxBuffer), LongMessage::MESSAGE_LENGTH)) {
                 return;
             }
         } else {
@@ -304,18 +600,17 @@ public:
     {
         AcknowledgeStatus status = AcknowledgeStatus::DISCARD;
 
-        LongMessage rxMessage;
+        // Word aligned, so that the handlers can access the payload fields directly
+        uint32_t rxBuffer[LongMessage::MESSAGE_LENGTH / sizeof(uint32_t)];
 
-        const Message* inMessage;
+        Message* inMessage = reinterpret_cast<Message*>(rxBuffer);
 
         if (message == nullptr) {
-            inMessage = &rxMessage;
-
-            if (!_transport.receive(&rxMessage, LongMessage::MESSAGE_LENGTH)) {
+            if (!_transport.receive(reinterpret_cast<Message*>(rxBuffer), LongMessage::MESSAGE_LENGTH)) {
                 return;
             }
         } else {
-            inMessage = reinterpret_cast<const Message*>(message);
+            memcpy(rxBuffer, message, LongMessage::MESSAGE_LENGTH);
         }
 
 #ifdef LOOPBACK
@@ -323,161 +618,126 @@ public:
         AcknowledgeMessage ack(_sequence, m, AcknowledgeStatus::OK);
         _transport.transmit(ack.asMessage(), AcknowledgeMessage::MESSAGE_LENGTH);
 #else
-        switch (inMessage->command) {
-          // implemented as a switch to keep it simple...
-          case MessageType::REQUEST:
+#if STACK_STATISTICS
+        hw::Stack::paint(bootloaderThreadWorkingArea, sizeof(bootloaderThreadWorkingArea));
+#endif
 
-              while (1) {}
+        const Command& command = findCommand(inMessage->command);
 
-              break;
-          case MessageType::ACK:
-              status = AcknowledgeStatus::DISCARD;
-              break;
-          case MessageType::IHEX_WRITE:
-              status = iHexWriteMessage(inMessage);
-              break;
-          case MessageType::IHEX_READ:
-              status = iHexReadMessage(inMessage);
-              break;
-          case MessageType::IDENTIFY_SLAVE:
-              status = identifyMessage(inMessage);
-              break;
-          case MessageType::SELECT_SLAVE:
-              status = selectMessage(inMessage);
-              break;
-          case MessageType::DESELECT_SLAVE:
-              status = deselectMessage(inMessage);
-              break;
-          case MessageType::ERASE_CONFIGURATION:
-              status = eraseConfigurationMessage(inMessage);
-              break;
-          case MessageType::ERASE_USER_CONFIGURATION:
-              status = eraseUserConfigurationMessage(inMessage);
-              break;
-          case MessageType::ERASE_PROGRAM:
-              status = eraseProgramMessage(inMessage);
-              break;
-          case MessageType::WRITE_PROGRAM_CRC:
-              status = writeProgramCRCMessage(inMessage);
-              break;
-          case MessageType::WRITE_MODULE_NAME:
-              status = writeModuleNameMessage(inMessage);
-              break;
-          case MessageType::WRITE_MODULE_CAN_ID:
-              status = writeCanIDMessaqe(inMessage);
-              break;
-          case MessageType::DESCRIBE_V2:
-              status = describeV2Messaqe(inMessage);
-              break;
-          case MessageType::DESCRIBE_V3:
-              status = describeV3Messaqe(inMessage);
-              break;
-          case MessageType::PROTOCOL_VERSION:
-              status = protocolVersion(inMessage);
-              break;
-          case MessageType::TAGS_READ:
-              status = TagsReadMessage(inMessage);
-              break;
-          case MessageType::BOOTLOAD:
-              status = AcknowledgeStatus::DISCARD;
-              break;
-          case MessageType::RESET:
-              status = resetMessage(inMessage);
-              break;
-          case MessageType::RESET_ALL:
-              status = resetAllMessage(inMessage);
-              break;
-          default:
-              status = notImplemented(inMessage);
-        } // switch
+        if (!isAlignedLayout(command.type)) {
+            // Legacy layout: move the payload where the handlers expect it
+            uint8_t* buffer = reinterpret_cast<uint8_t*>(rxBuffer);
+            memmove(buffer + command.payloadOffset, buffer + LEGACY_PAYLOAD_OFFSET, LongMessage::MESSAGE_LENGTH - command.payloadOffset);
+        }
+
+        status = admit(command.policy, inMessage);
+
+        if (status == AcknowledgeStatus::NONE) {
+            // The message passed the addressing and sequencing checks, run it
+            status = (this->*command.handler)(inMessage);
+
+            // Keep the acknowledge of a sequenced command, in case the master does not get it
+            _replay.caching = (command.policy & SEQUENCED);
+            _replay.command = _replay.caching ? inMessage->command : _replay.command;
+        }
 
         if ((status != AcknowledgeStatus::DISCARD) && (status != AcknowledgeStatus::DO_NOT_ACK)) {
-            switch (inMessage->command) {
-              // implemented as a switch to keep it simple...
-              case MessageType::PROTOCOL_VERSION:
-              {
-                  AcknowledgeTags txMessage = AcknowledgeTags(_sequence, inMessage, status, "1.0.0");
-                  _transport.transmit(txMessage.asMessage(), AcknowledgeTags::MESSAGE_LENGTH, BOOTLOADER_TOPIC_ID);
-              }
-              break;
-              case MessageType::TAGS_READ:
-              {
-                  AcknowledgeTags txMessage = AcknowledgeTags(_sequence, inMessage, status, tagsBuffer);
-                  _transport.transmit(txMessage.asMessage(), AcknowledgeTags::MESSAGE_LENGTH, BOOTLOADER_TOPIC_ID);
-              }
-              break;
-              case MessageType::IHEX_READ:
-              {
-                  AcknowledgeString txMessage = AcknowledgeString(_sequence, inMessage, status, ihexBuffer, ihexBufferReadOffset);
-                  _transport.transmit(txMessage.asMessage(), AcknowledgeString::MESSAGE_LENGTH, BOOTLOADER_TOPIC_ID);
-              }
-              break;
-              case MessageType::DESCRIBE_V2:
-              {
-                  AcknowledgeDescribeV2 txMessage = AcknowledgeDescribeV2(_sequence, inMessage, status,
-                                                                      configurationStorage.getModuleConfiguration()->canID,
-                                                                      DEFAULT_MODULE_NAME,
-                                                                      configurationStorage.getModuleConfiguration()->name,
-                                                                      configurationStorage.userDataSize(), programStorage.size(),
-                                                                      configurationStorage.getModuleConfiguration()->imageCRC, programStorage.updateCRC()
-                                                  );
-                  _transport.transmit(txMessage.asMessage(), AcknowledgeDescribeV2::MESSAGE_LENGTH, BOOTLOADER_TOPIC_ID);
-              }
-              break;
-              case MessageType::DESCRIBE_V3:
-              {
-                  uint32_t imageCRC = configurationStorage.getModuleConfiguration()->imageCRC;
-                  uint32_t flashCRC = programStorage.updateCRC();
-
-                  AcknowledgeDescribeV3 txMessage = AcknowledgeDescribeV3(_sequence, inMessage, status,
-                                                                      configurationStorage.getModuleConfiguration()->canID,
-                                                                      DEFAULT_MODULE_NAME,
-                                                                      configurationStorage.getModuleConfiguration()->name,
-                                                                      configurationStorage.userDataSize(), programStorage.size(),
-																	  core::stm32_flash::TAGS_FLASH_SIZE,
-																	  imageCRC == flashCRC, configurationStorage.isValid()
-                                                  );
-                  _transport.transmit(txMessage.asMessage(), AcknowledgeDescribeV3::MESSAGE_LENGTH, BOOTLOADER_TOPIC_ID);
-              }
-              break;
-              case MessageType::IHEX_WRITE:
-              case MessageType::IDENTIFY_SLAVE:
-              case MessageType::SELECT_SLAVE:
-              case MessageType::DESELECT_SLAVE:
-              case MessageType::ERASE_CONFIGURATION:
-              case MessageType::ERASE_USER_CONFIGURATION:
-              case MessageType::ERASE_PROGRAM:
-              case MessageType::WRITE_PROGRAM_CRC:
-              case MessageType::WRITE_MODULE_NAME:
-              case MessageType::WRITE_MODULE_CAN_ID:
-              case MessageType::RESET:
-              case MessageType::RESET_ALL:
-              default:
-              {
-                  AcknowledgeUID txMessage = AcknowledgeUID(_sequence, inMessage, status, _moduleUID);
-                  _transport.transmit(txMessage.asMessage(), AcknowledgeUID::MESSAGE_LENGTH, BOOTLOADER_TOPIC_ID);
-
-                  if(inMessage->command == MessageType::RESET) {
-                	  while(_transport.isBusy()) {
-                		  osalThreadSleep(MS2ST(10));
-                	  }
-
-                	  hw::reset();
-                  }
-              }
-            } // switch
-        } else if (status == AcknowledgeStatus::DISCARD) {
+            (this->*command.acknowledge)(inMessage, status);
         } else {
             // The message was not for us...
         }
+
+        _replay.caching = false;
+
+#if STACK_STATISTICS
+        uint16_t used = sizeof(bootloaderThreadWorkingArea) - hw::Stack::unused(bootloaderThreadWorkingArea, sizeof(bootloaderThreadWorkingArea));
+
+        if (used > _deepestUsed) {
+            _deepestUsed    = used;
+            _deepestCommand = inMessage->command;
+        }
+#endif
 #endif // ifdef LOOPBACK
     } // processMessage
 
 public:
+    bool
+    isWorking() const
+    {
+        return _job.status == AcknowledgeStatus::IN_PROGRESS;
+    }
+
+    // Runs one step of the current job, returns true if there is more to do
+    bool
+    runJob()
+    {
+        if (!isWorking()) {
+            return false;
+        }
+
+        bool success = true;
+
+        hw::Watchdog::reload();
+
+        _job.pause = STEP_PAUSE;
+
+        switch (_job.command) {
+          case MessageType::ERASE_PROGRAM:
+              // A page at a time, it takes tens of ms each
+              success         = hw::Flash::erasePage(_job.next);
+              _job.next      += hw::Flash::PAGE_SIZE;
+              _job.pause      = ERASE_PAUSE;
+              programCRCValid = false;
+              break;
+          case MessageType::RESUME_WRITE:
+              if (!isPageDone((_job.next - _job.from) / hw::Flash::PAGE_SIZE) && !isPageBlank(_job.next)) {
+                  success         = hw::Flash::erasePage(_job.next);
+                  _job.pause      = ERASE_PAUSE;
+                  programCRCValid = false;
+              }
+
+              _job.next += hw::Flash::PAGE_SIZE;
+              break;
+          case MessageType::ERASE_CONFIGURATION:
+              success   = configurationStorage.erase();
+              _job.next = _job.to;
+              break;
+          case MessageType::RANGE_CRC: {
+              uint32_t length = ((_job.to - _job.next) < CRC_STEP) ? (_job.to - _job.next) : CRC_STEP;
+
+              _job.crc   = hw::CRCUnit::update(_job.crc, reinterpret_cast<const uint32_t*>(_job.next), length / sizeof(uint32_t));
+              _job.next += length;
+          }
+          break;
+          default:
+              success = false;
+              break;
+        } // switch
+
+        if (!success) {
+            _job.status = AcknowledgeStatus::ERROR;
+        } else if (_job.next >= _job.to) {
+            _job.status = AcknowledgeStatus::OK;
+
+            if ((_job.command == MessageType::ERASE_PROGRAM) || (_job.command == MessageType::RESUME_WRITE)) {
+                flashWriteSuccess = true; // The program flash is clean, it can be written
+            }
+        }
+
+        return isWorking();
+    } // runJob
+
+    // How long to listen for messages before the next step of the job [ms]
+    uint32_t
+    jobPause() const
+    {
+        return _job.pause;
+    }
+
     void
     announce()
     {
-        if (!_selected && !_muted) {
+        if (!_selected && !_muted && !_enumerated) {
             messages::Announce m;
             m.command    = MessageType::REQUEST;
             m.sequenceId = 0x00;
@@ -486,31 +746,241 @@ public:
         }
     }
 
-public:
-    AcknowledgeStatus
-    identifyMessage(
-        const Message* message
-    )
-    {
-        const messages::IdentifySlave* m = reinterpret_cast<const messages::IdentifySlave*>(message);
+private:
+    // Checks applied by processLongMessage before a handler is run
+    enum Policy : uint8_t {
+        UNCHECKED = 0x00, // The handler takes care of everything
+        ADDRESSED = 0x01, // The payload begins with the UID of the addressed slave
+        SELECTED  = 0x02, // The slave must be selected
+        SEQUENCED  = 0x04, // The sequence number must follow the previous one
+        SESSION    = ADDRESSED | SELECTED | SEQUENCED,
+        CONCURRENT = 0x08  // Allowed while a job is running
+    };
 
-        if (m->data.uid == _moduleUID) {
-            return identify(true);
-        } else {
-            return identify(false);
-        }
-    }
+    using Handler     = AcknowledgeStatus (SlaveProtocol::*)(const Message*);
+    using Acknowledge = void (SlaveProtocol::*)(const Message*, AcknowledgeStatus);
 
-    AcknowledgeStatus
-    selectMessage(
-        const Message* message
+    struct Command {
+        MessageType type;
+        uint8_t     policy;
+        uint8_t     payloadOffset; // Where the handler expects the payload
+        Handler     handler;
+        Acknowledge acknowledge;
+    };
+
+    // What this slave can do, WINDOWING and COMPRESSION are not supported
+    static const uint32_t CAPABILITIES = ALIGNED_LAYOUT | BINARY_WRITE | RANGE_CRC | COMPACT_ACK | ASYNC_JOBS | (RESUMABLE_WRITES ? static_cast<uint32_t>(RESUME) : static_cast<uint32_t>(0));
+
+    // Long running command, executed a step at a time
+    struct Job {
+        MessageType       command; // NONE if no job was started
+        AcknowledgeStatus status;  // IN_PROGRESS, then the result
+        uint32_t          from;
+        uint32_t          next;
+        uint32_t          to;
+        uint32_t          crc;
+        uint8_t           pause; // [ms] after the last step
+    };
+
+    // Last acknowledge of a sequenced command
+    struct Replay {
+        uint32_t    buffer[LongMessage::MESSAGE_LENGTH / sizeof(uint32_t)];
+        std::size_t length;
+        MessageType command; // NONE if there is nothing to replay
+        bool        caching; // The acknowledge being sent must be kept
+    };
+
+    // Bytes a RANGE_CRC step goes through
+    static const uint32_t CRC_STEP = 4096;
+
+    // Between two job steps [ms]. An erase stalls the CPU, and the CAN with it:
+    // a JOB_STATUS sent meanwhile is lost, so the master gets a window to poll in.
+    // It outlasts the 100 ms a master waits for an acknowledge: a request sent
+    // again because its acknowledge was lost does not land in the next erase
+    static const uint8_t STEP_PAUSE  = 1;
+    static const uint8_t ERASE_PAUSE = 80;
+
+    // At most 256 reply slots per enumeration round
+    static const uint8_t MAXIMUM_SLOT_BITS = 8;
+
+    // The end of a round of ENUMERATE or DESCRIBE_ALL replies [us]. The thread
+    // sleeps until its own slot, that must end well within the watchdog period
+    static const uint32_t MAXIMUM_ROUND = 2000000;
+
+    // The payload of the legacy layout follows the 2 bytes header
+    static const std::size_t LEGACY_PAYLOAD_OFFSET = 2;
+
+    template <typename MESSAGE>
+    static constexpr Command
+    command(
+        uint8_t     policy,
+        Handler     handler,
+        Acknowledge acknowledge
     )
     {
-        const messages::SelectSlave* m = reinterpret_cast<const messages::SelectSlave*>(message);
+        return {MESSAGE::TYPE, policy, alignedPayloadOffset<typename MESSAGE::PayloadType>(), handler, acknowledge};
+    }
+
+    // Every addressed message carries the UID right after the header
+    using Addressed = AlignedMessage_<LongMessage, MessageType::NONE, payload::UID>;
+
+    static const Command     COMMANDS[];
+    static const std::size_t COMMANDS_COUNT;
+    static const Command     NOT_IMPLEMENTED;
+
+    static constexpr bool
+    isSortedByType();
+
+    static inline const Command&
+    findCommand(
+        MessageType type
+    );
+
+    // Messages that are not exchanged within a session are always sent with the legacy layout
+    bool
+    isAlignedLayout(
+        MessageType type
+    ) const
+    {
+        switch (type) {
+          case MessageType::SELECT_SLAVE_ALIGNED:
+          case MessageType::SELECT_SLAVE_SHARED:
+              return true;
+          case MessageType::IDENTIFY_SLAVE:
+          case MessageType::ENUMERATE:
+          case MessageType::DESCRIBE_ALL:
+          case MessageType::SELECT_SLAVE:
+              return false;
+          default:
+              return (_mode & ALIGNED_LAYOUT) != 0;
+        }
+    }
+
+    // Returns NONE if the message must be handled, the status to reply with otherwise
+    AcknowledgeStatus
+    admit(
+        uint8_t        policy,
+        const Message* message
+    )
+    {
+        const Addressed* m = reinterpret_cast<const Addressed*>(message);
+
+        if (policy & ADDRESSED) {
+            if (m->data.uid != _moduleUID) {
+                // In a shared session the message is most likely for another selected slave
+                return (_selected && !_shared) ? AcknowledgeStatus::WRONG_UID : AcknowledgeStatus::DISCARD;
+            }
+        }
+
+        if (policy & SELECTED) {
+            if (!_selected) {
+                return (policy & ADDRESSED) ? AcknowledgeStatus::NOT_SELECTED : AcknowledgeStatus::DISCARD;
+            }
+
+            if (_shared && !(policy & ADDRESSED) && !_transport.isDirect()) {
+                // Only the CAN ID tells who it is for
+                return AcknowledgeStatus::DISCARD;
+            }
+        }
+
+        if (policy & SEQUENCED) {
+            if ((m->sequenceId == _sequence) && (m->command == _replay.command)) {
+                // The master did not get our acknowledge and sent the command again: do not run it twice
+                _transport.transmit(reinterpret_cast<const Message*>(_replay.buffer), _replay.length, BOOTLOADER_TOPIC_ID);
+                return AcknowledgeStatus::DO_NOT_ACK;
+            }
+
+            if (m->sequenceId != (uint8_t)(_sequence + 2)) {
+                return AcknowledgeStatus::WRONG_SEQUENCE;
+            }
+
+            _sequence = m->sequenceId;
+        }
+
+        if ((policy & SELECTED) && !(policy & CONCURRENT) && isWorking()) {
+            // Flash is being erased or read, come back later
+            return AcknowledgeStatus::IN_PROGRESS;
+        }
+
+        return AcknowledgeStatus::NONE;
+    } // admit
+
+public:
+    AcknowledgeStatus
+    identifyMessage(
+        const Message* message
+    )
+    {
+        const messages::aligned::IdentifySlave* m = reinterpret_cast<const messages::aligned::IdentifySlave*>(message);
+
+        if (m->data.uid == _moduleUID) {
+            return identify(true);
+        } else {
+            return identify(false);
+        }
+    }
+
+    AcknowledgeStatus
+    enumerateMessage(
+        const Message* message
+    )
+    {
+        const messages::aligned::Enumerate* m = reinterpret_cast<const messages::aligned::Enumerate*>(message);
+
+        if (_selected || (m->data.prefixLength > 32) || (m->data.slotBits > MAXIMUM_SLOT_BITS)) {
+            return AcknowledgeStatus::DISCARD;
+        }
+
+        if (((uint32_t)1 << m->data.slotBits) * m->data.slotTime > MAXIMUM_ROUND) {
+            return AcknowledgeStatus::DISCARD;
+        }
+
+        uint32_t mask = (m->data.prefixLength == 0) ? 0 : (0xFFFFFFFF << (32 - m->data.prefixLength));
+
+        if (((_moduleUID ^ m->data.prefix) & mask) != 0) {
+            // Not in the branch the master is exploring
+            return AcknowledgeStatus::DISCARD;
+        }
+
+        _enumerated = true; // The master knows about us, no need to announce anymore
+
+        return AcknowledgeStatus::OK;
+    } // enumerateMessage
+
+    AcknowledgeStatus
+    describeAllMessage(
+        const Message* message
+    )
+    {
+        const messages::aligned::DescribeAll* m = reinterpret_cast<const messages::aligned::DescribeAll*>(message);
+
+        if ((_canID < m->data.firstID) || (_canID > m->data.lastID)) {
+            // Not in the range the master is asking
+            return AcknowledgeStatus::DISCARD;
+        }
+
+        if ((uint32_t)(m->data.lastID - m->data.firstID + 1) * m->data.slotTime > MAXIMUM_ROUND) {
+            return AcknowledgeStatus::DISCARD;
+        }
+
+        return AcknowledgeStatus::OK;
+    }
+
+    AcknowledgeStatus
+    selectMessage(
+        const Message* message
+    )
+    {
+        const messages::aligned::SelectSlave* m = reinterpret_cast<const messages::aligned::SelectSlave*>(message);
 
         if (m->data.uid == _moduleUID) {
             _sequence = m->sequenceId; // The sequence number is re-aligned
+            _mode     = (m->command == MessageType::SELECT_SLAVE) ? static_cast<uint32_t>(0) : static_cast<uint32_t>(ALIGNED_LAYOUT);
+            _shared   = (m->command == MessageType::SELECT_SLAVE_SHARED);
             return select();
+        } else if (m->command == MessageType::SELECT_SLAVE_SHARED) {
+            // The master works with several slaves at once, we are not involved
+            return AcknowledgeStatus::DISCARD;
         } else {
             // The master selected another slave, we must deselct and mute ourselves
             deselect();
@@ -524,22 +994,31 @@ public:
         const Message* message
     )
     {
-        const messages::DeselectSlave* m = reinterpret_cast<const messages::DeselectSlave*>(message);
+        const messages::aligned::DeselectSlave* m = reinterpret_cast<const messages::aligned::DeselectSlave*>(message);
 
         if (m->data.uid == _moduleUID) {
             if (_selected) {
                 if (m->sequenceId != (uint8_t)(_sequence + 2)) {
                     return AcknowledgeStatus::WRONG_SEQUENCE;
                 } else {
-                    _sequence = m->sequenceId;
-                    return deselect();
+                    uint32_t          layout = _mode & ALIGNED_LAYOUT;
+                    AcknowledgeStatus status = deselect();
+
+                    // Until the next session, the master may send it again, in the same layout
+                    _sequence       = m->sequenceId;
+                    _mode           = layout;
+                    _replay.command = MessageType::DESELECT_SLAVE;
+                    return status;
                 }
+            } else if ((m->sequenceId == _sequence) && (_replay.command == MessageType::DESELECT_SLAVE)) {
+                // The master did not get our acknowledge, we are still deselected
+                return AcknowledgeStatus::OK;
             } else {
                 return AcknowledgeStatus::DISCARD;
             }
         } else {
             if (_selected) {
-                return AcknowledgeStatus::WRONG_UID;
+                return _shared ? AcknowledgeStatus::DISCARD : AcknowledgeStatus::WRONG_UID;
             } else {
                 // The message was for someone else... We can now start again to advertise
                 mute(false);
@@ -553,289 +1032,118 @@ public:
         const Message* message
     )
     {
-        const messages::EraseConfiguration* m = reinterpret_cast<const messages::EraseConfiguration*>(message);
-
-        if (m->data.uid == _moduleUID) {
-            if (_selected) {
-                if (m->sequenceId != (uint8_t)(_sequence + 2)) {
-                    return AcknowledgeStatus::WRONG_SEQUENCE;
-                } else {
-                    _sequence = m->sequenceId;
-                    return eraseConfiguration();
-                }
-            } else {
-                return AcknowledgeStatus::NOT_SELECTED;
-            }
-        } else {
-            if (_selected) {
-                return AcknowledgeStatus::WRONG_UID;
-            } else {
-                return AcknowledgeStatus::DISCARD;
-            }
-        }
-    } // eraseConfigurationMessage
+        return eraseConfiguration();
+    }
 
     AcknowledgeStatus
     eraseUserConfigurationMessage(
         const Message* message
     )
     {
-        const messages::EraseConfiguration* m = reinterpret_cast<const messages::EraseConfiguration*>(message);
-
-        if (m->data.uid == _moduleUID) {
-            if (_selected) {
-                if (m->sequenceId != (uint8_t)(_sequence + 2)) {
-                    return AcknowledgeStatus::WRONG_SEQUENCE;
-                } else {
-                    _sequence = m->sequenceId;
-                    return eraseUserConfiguration();
-                }
-            } else {
-                return AcknowledgeStatus::NOT_SELECTED;
-            }
-        } else {
-            if (_selected) {
-                return AcknowledgeStatus::WRONG_UID;
-            } else {
-                return AcknowledgeStatus::DISCARD;
-            }
-        }
-    } // eraseUserConfigurationMessage
+        return eraseUserConfiguration();
+    }
 
     AcknowledgeStatus
     eraseProgramMessage(
         const Message* message
     )
     {
-        const messages::EraseProgram* m = reinterpret_cast<const messages::EraseProgram*>(message);
-
-        if (m->data.uid == _moduleUID) {
-            if (_selected) {
-                if (m->sequenceId != (uint8_t)(_sequence + 2)) {
-                    return AcknowledgeStatus::WRONG_SEQUENCE;
-                } else {
-                    _sequence = m->sequenceId;
-                    return eraseProgram();
-                }
-            } else {
-                return AcknowledgeStatus::NOT_SELECTED;
-            }
-        } else {
-            if (_selected) {
-                return AcknowledgeStatus::WRONG_UID;
-            } else {
-                return AcknowledgeStatus::DISCARD;
-            }
-        }
-    } // eraseProgramMessage
+        return eraseProgram();
+    }
 
     AcknowledgeStatus
     writeProgramCRCMessage(
         const Message* message
     )
     {
-        const messages::WriteProgramCrc* m = reinterpret_cast<const messages::WriteProgramCrc*>(message);
+        const messages::aligned::WriteProgramCrc* m = reinterpret_cast<const messages::aligned::WriteProgramCrc*>(message);
 
-        if (m->data.uid == _moduleUID) {
-            if (_selected) {
-                if (m->sequenceId != (uint8_t)(_sequence + 2)) {
-                    return AcknowledgeStatus::WRONG_SEQUENCE;
-                } else {
-                    _sequence = m->sequenceId;
-                    return writeProgramCRC(m->data.crc);
-                }
-            } else {
-                return AcknowledgeStatus::NOT_SELECTED;
-            }
-        } else {
-            if (_selected) {
-                return AcknowledgeStatus::WRONG_UID;
-            } else {
-                return AcknowledgeStatus::DISCARD;
-            }
-        }
-    } // writeProgramCRCMessage
+        return writeProgramCRC(m->data.crc);
+    }
 
     AcknowledgeStatus
-    writeModuleNameMessage(
+    setSessionModeMessage(
         const Message* message
     )
     {
-        const messages::WriteModuleName* m = reinterpret_cast<const messages::WriteModuleName*>(message);
+        const messages::aligned::SetSessionMode* m = reinterpret_cast<const messages::aligned::SetSessionMode*>(message);
 
-        if (m->data.uid == _moduleUID) {
-            if (_selected) {
-                if (m->sequenceId != (uint8_t)(_sequence + 2)) {
-                    return AcknowledgeStatus::WRONG_SEQUENCE;
-                } else {
-                    _sequence = m->sequenceId;
-                    return writeModuleName(m->data.name);
-                }
-            } else {
-                return AcknowledgeStatus::NOT_SELECTED;
-            }
-        } else {
-            if (_selected) {
-                return AcknowledgeStatus::WRONG_UID;
-            } else {
-                return AcknowledgeStatus::DISCARD;
-            }
-        }
-    } // writeModuleNameMessage
+        // The best mode both ends support, the acknowledge tells the master what it got
+        _mode = m->data.capabilities & CAPABILITIES;
+
+        return AcknowledgeStatus::OK;
+    }
 
     AcknowledgeStatus
-    writeCanIDMessaqe(
+    rangeCRCMessage(
         const Message* message
     )
     {
-        const messages::WriteModuleID* m = reinterpret_cast<const messages::WriteModuleID*>(message);
+        const messages::aligned::RangeCRC* m = reinterpret_cast<const messages::aligned::RangeCRC*>(message);
 
-        if (m->data.uid == _moduleUID) {
-            if (_selected) {
-                if (m->sequenceId != (uint8_t)(_sequence + 2)) {
-                    return AcknowledgeStatus::WRONG_SEQUENCE;
-                } else {
-                    _sequence = m->sequenceId;
-                    return writeCanID(m->data.id);
-                }
-            } else {
-                return AcknowledgeStatus::NOT_SELECTED;
-            }
-        } else {
-            if (_selected) {
-                return AcknowledgeStatus::WRONG_UID;
-            } else {
-                return AcknowledgeStatus::DISCARD;
-            }
+        if ((_mode & RANGE_CRC) == 0) {
+            return AcknowledgeStatus::NOT_IMPLEMENTED;
         }
-    } // writeProgramCRCMessage
+
+        return rangeCRC(m->data.address, m->data.length);
+    }
 
     AcknowledgeStatus
-    describeV2Messaqe(
+    writeModuleNameMessage(
         const Message* message
     )
     {
-        const messages::DescribeV2* m = reinterpret_cast<const messages::DescribeV2*>(message);
+        const messages::aligned::WriteModuleName* m = reinterpret_cast<const messages::aligned::WriteModuleName*>(message);
 
-        if (m->data.uid == _moduleUID) {
-            if (_selected) {
-                if (m->sequenceId != (uint8_t)(_sequence + 2)) {
-                    return AcknowledgeStatus::WRONG_SEQUENCE;
-                } else {
-                    _sequence = m->sequenceId;
-                    return AcknowledgeStatus::OK;
-                }
-            } else {
-                return AcknowledgeStatus::NOT_SELECTED;
-            }
-        } else {
-            if (_selected) {
-                return AcknowledgeStatus::WRONG_UID;
-            } else {
-                return AcknowledgeStatus::DISCARD;
-            }
-        }
+        return writeModuleName(m->data.name);
     }
 
     AcknowledgeStatus
-    describeV3Messaqe(
+    writeCanIDMessaqe(
         const Message* message
     )
     {
-        const messages::DescribeV3* m = reinterpret_cast<const messages::DescribeV3*>(message);
+        const messages::aligned::WriteModuleID* m = reinterpret_cast<const messages::aligned::WriteModuleID*>(message);
 
-        if (m->data.uid == _moduleUID) {
-            if (_selected) {
-                if (m->sequenceId != (uint8_t)(_sequence + 2)) {
-                    return AcknowledgeStatus::WRONG_SEQUENCE;
-                } else {
-                    _sequence = m->sequenceId;
-                    return AcknowledgeStatus::OK;
-                }
-            } else {
-                return AcknowledgeStatus::NOT_SELECTED;
-            }
-        } else {
-            if (_selected) {
-                return AcknowledgeStatus::WRONG_UID;
-            } else {
-                return AcknowledgeStatus::DISCARD;
-            }
-        }
+        return writeCanID(m->data.id);
     }
 
     AcknowledgeStatus
-    protocolVersion(
+    TagsReadMessage(
         const Message* message
     )
     {
-        const messages::ProtocolVersion* m = reinterpret_cast<const messages::ProtocolVersion*>(message);
+        const messages::aligned::TagsRead* m = reinterpret_cast<const messages::aligned::TagsRead*>(message);
 
-        if (m->data.uid == _moduleUID) {
-            if (_selected) {
-                if (m->sequenceId != (uint8_t)(_sequence + 2)) {
-                    return AcknowledgeStatus::WRONG_SEQUENCE;
-                } else {
-                    _sequence = m->sequenceId;
-                    return AcknowledgeStatus::OK;
-                }
-            } else {
-                return AcknowledgeStatus::NOT_SELECTED;
-            }
-        } else {
-            if (_selected) {
-                return AcknowledgeStatus::WRONG_UID;
-            } else {
-                return AcknowledgeStatus::DISCARD;
-            }
-        }
+        return tagsRead(m->data.address, scratch.acquire<TagsLease>()->buffer);
     }
 
     AcknowledgeStatus
-    TagsReadMessage(
+    iHexWriteMessage(
         const Message* message
     )
     {
-        const messages::TagsRead* m = reinterpret_cast<const messages::TagsRead*>(message);
+        const messages::aligned::IHexData* m = reinterpret_cast<const messages::aligned::IHexData*>(message);
 
-        if (m->data.uid == _moduleUID) {
-            if (_selected) {
-                if (m->sequenceId != (uint8_t)(_sequence + 2)) {
-                    return AcknowledgeStatus::WRONG_SEQUENCE;
-                } else {
-                    _sequence = m->sequenceId;
-
-                    return tagsRead(m->data.address, tagsBuffer);
-                }
-            } else {
-                return AcknowledgeStatus::NOT_SELECTED;
-            }
-        } else {
-            if (_selected) {
-                return AcknowledgeStatus::WRONG_UID;
-            } else {
-                return AcknowledgeStatus::DISCARD;
-            }
-        }
-    } // iHexReadMessage
+        return ihexWrite(m->data.type, m->data.string);
+    }
 
     AcknowledgeStatus
-    iHexWriteMessage(
+    binaryWriteMessage(
         const Message* message
     )
     {
-        const messages::IHexData* m = reinterpret_cast<const messages::IHexData*>(message);
+        const messages::aligned::BinaryData* m = reinterpret_cast<const messages::aligned::BinaryData*>(message);
 
-        if (_selected) {
-            if (m->sequenceId != (uint8_t)(_sequence + 2)) {
-                return AcknowledgeStatus::WRONG_SEQUENCE;
-            } else {
-                _sequence = m->sequenceId;
-                return ihexWrite(m->data.type, m->data.string);
-            }
-        } else {
-            return AcknowledgeStatus::DISCARD;
+        if ((_mode & BINARY_WRITE) == 0) {
+            return AcknowledgeStatus::NOT_IMPLEMENTED;
+        }
+
+        if (m->data.length > sizeof(m->data.data)) {
+            return AcknowledgeStatus::BROKEN;
         }
+
+        return binaryWrite(m->data.address, m->data.data, m->data.length);
     }
 
     AcknowledgeStatus
@@ -843,32 +1151,16 @@ public:
         const Message* message
     )
     {
-        const messages::IHexRead* m = reinterpret_cast<const messages::IHexRead*>(message);
-
-        if (m->data.uid == _moduleUID) {
-            if (_selected) {
-                if (m->sequenceId != (uint8_t)(_sequence + 2)) {
-                    return AcknowledgeStatus::WRONG_SEQUENCE;
-                } else {
-                    _sequence = m->sequenceId;
+        const messages::aligned::IHexRead* m = reinterpret_cast<const messages::aligned::IHexRead*>(message);
 
-                    if (m->data.address == 0xFFFFFFFF) {
-                        // We want to continue to read the buffer
-                        return AcknowledgeStatus::OK;
-                    } else {
-                        ihexBufferReadOffset = 0; // reset the read buffer offset
-                        return ihexRead(m->data.address, ihexBuffer);
-                    }
-                }
-            } else {
-                return AcknowledgeStatus::NOT_SELECTED;
-            }
+        if (m->data.address == 0xFFFFFFFF) {
+            // We want to continue to read the buffer, if nothing else has taken its place
+            return (scratch.get<ReadbackLease>() != nullptr) ? AcknowledgeStatus::OK : AcknowledgeStatus::ERROR;
         } else {
-            if (_selected) {
-                return AcknowledgeStatus::WRONG_UID;
-            } else {
-                return AcknowledgeStatus::DISCARD;
-            }
+            ReadbackLease* lease = scratch.acquire<ReadbackLease>();
+
+            lease->offset = 0; // reset the read buffer offset
+            return ihexRead(m->data.address, lease->buffer);
         }
     } // iHexReadMessage
 
@@ -900,55 +1192,345 @@ public:
         const Message* message
     )
     {
-        const messages::Reset* m = reinterpret_cast<const messages::Reset*>(message);
-
-        if (m->data.uid == _moduleUID) {
-            if (_selected) {
-                if (m->sequenceId != (uint8_t)(_sequence + 2)) {
-                    return AcknowledgeStatus::WRONG_SEQUENCE;
-                } else {
-                    _sequence = m->sequenceId;
-                    return reset();
-                }
-            } else {
-                return AcknowledgeStatus::NOT_SELECTED;
-            }
-        } else {
-            if (_selected) {
-                return AcknowledgeStatus::WRONG_UID;
-            } else {
-                return AcknowledgeStatus::DISCARD;
-            }
-        }
-    } // resetMessage
+        return reset();
+    }
 
     AcknowledgeStatus
     resetAllMessage(
         const Message* message
     )
     {
-    	hw::reset();
+        hw::reset();
+
+        return AcknowledgeStatus::DO_NOT_ACK;
     } // resetAllMessage
 
+    AcknowledgeStatus
+    writeProgressMessage(
+        const Message* message
+    )
+    {
+        const messages::aligned::WriteProgress* m = reinterpret_cast<const messages::aligned::WriteProgress*>(message);
+
+        if (!RESUMABLE_WRITES) {
+            return AcknowledgeStatus::NOT_IMPLEMENTED;
+        }
+
+        if ((m->data.address < core::stm32_flash::PROGRAM_FLASH_FROM) || (m->data.address >= PROGRESS_RECORD)) {
+            return AcknowledgeStatus::ERROR;
+        }
+
+        return AcknowledgeStatus::OK;
+    }
+
+    AcknowledgeStatus
+    resumeWriteMessage(
+        const Message* message
+    )
+    {
+        return resumeWrite();
+    }
+
+    AcknowledgeStatus
+    jobStatusMessage(
+        const Message* message
+    )
+    {
+        // The acknowledge carries the progress
+        return (_job.command == MessageType::NONE) ? AcknowledgeStatus::ERROR : _job.status;
+    }
+
+    AcknowledgeStatus
+    okMessage(
+        const Message* message
+    )
+    {
+        // Nothing to do, the reply carries the information
+        return AcknowledgeStatus::OK;
+    }
+
+    AcknowledgeStatus
+    discardMessage(
+        const Message* message
+    )
+    {
+        return AcknowledgeStatus::DISCARD;
+    }
+
     AcknowledgeStatus
     notImplemented(
         const Message* message
     )
     {
-    	const LongMessage* m = reinterpret_cast<const LongMessage*>(message);
+        return AcknowledgeStatus::NOT_IMPLEMENTED;
+    }
+
+private:
+    void
+    reply(
+        const Message* message,
+        std::size_t    length
+    )
+    {
+        if (_replay.caching) {
+            memcpy(_replay.buffer, message, length);
+            _replay.length = length;
+        }
+
+        _transport.transmit(message, length, BOOTLOADER_TOPIC_ID);
+    }
+
+    void
+    acknowledgeUID(
+        const Message*    message,
+        AcknowledgeStatus status
+    )
+    {
+        AcknowledgeUID txMessage = AcknowledgeUID(_sequence, message, status, _moduleUID);
+        reply(txMessage.asMessage(), AcknowledgeUID::MESSAGE_LENGTH);
+    }
+
+    // Until the slot begins. US2ST() would overflow past a few hundred ms
+    void
+    waitSlot(
+        uint32_t slot,
+        uint16_t slotTime
+    )
+    {
+        uint32_t time = slot * slotTime; // [us]
+
+        if (time > 0) {
+            osalThreadSleep(MS2ST(time / 1000) + US2ST(time % 1000));
+        }
+    }
+
+    void
+    acknowledgeEnumerate(
+        const Message*    message,
+        AcknowledgeStatus status
+    )
+    {
+        const messages::aligned::Enumerate* m = reinterpret_cast<const messages::aligned::Enumerate*>(message);
+
+        // The bits right after the prefix pick the slot, so the replies do not come in a burst
+        uint32_t rest = (m->data.prefixLength < 32) ? (_moduleUID << m->data.prefixLength) : 0;
+        uint32_t slot = (m->data.slotBits > 0) ? (rest >> (32 - m->data.slotBits)) : 0;
+
+        waitSlot(slot, m->data.slotTime);
+
+        // Acknowledged as in a session, so that the master can tell the rounds apart
+        AcknowledgeCompact txMessage = AcknowledgeCompact(m->sequenceId, message, status, _moduleUID);
+        reply(txMessage.asMessage(), AcknowledgeCompact::MESSAGE_LENGTH);
+    }
+
+    void
+    acknowledgeInventory(
+        const Message*    message,
+        AcknowledgeStatus status
+    )
+    {
+        const messages::aligned::DescribeAll* m = reinterpret_cast<const messages::aligned::DescribeAll*>(message);
+
+        // CAN IDs are unique on the bus, so are the slots. describeAllMessage
+        // took only the ones from firstID to lastID
+        uint8_t slot = _canID - m->data.firstID;
+
+        // The flash CRC may take longer than a slot, it is computed before waiting for ours
+        uint32_t imageCRC = configurationStorage.getModuleConfiguration()->imageCRC;
+        bool     valid    = (imageCRC == cachedProgramCRC());
+
+        waitSlot(slot, m->data.slotTime);
+
+        AcknowledgeInventory txMessage = AcknowledgeInventory(m->sequenceId, message, status, _moduleUID, _canID,
+                                                              DEFAULT_MODULE_NAME,
+                                                              configurationStorage.getModuleConfiguration()->name,
+                                                              programStorage.size(), imageCRC,
+                                                              valid, configurationStorage.isValid()
+                                         );
+        reply(txMessage.asMessage(), AcknowledgeInventory::MESSAGE_LENGTH);
+    }
+
+    void
+    acknowledgeReset(
+        const Message*    message,
+        AcknowledgeStatus status
+    )
+    {
+        acknowledgeUID(message, status);
+
+        while (_transport.isBusy()) {
+            osalThreadSleep(MS2ST(10));
+        }
+
+        hw::reset();
+    }
+
+    void
+    acknowledgeVersion(
+        const Message*    message,
+        AcknowledgeStatus status
+    )
+    {
+        AcknowledgeProtocolVersion txMessage = AcknowledgeProtocolVersion(_sequence, message, status, "1.2.0", CAPABILITIES);
+        reply(txMessage.asMessage(), AcknowledgeProtocolVersion::MESSAGE_LENGTH);
+    }
+
+    void
+    acknowledgeMode(
+        const Message*    message,
+        AcknowledgeStatus status
+    )
+    {
+        AcknowledgeMode txMessage = AcknowledgeMode(_sequence, message, status, _moduleUID, _mode);
+        reply(txMessage.asMessage(), AcknowledgeMode::MESSAGE_LENGTH);
+    }
+
+    void
+    acknowledgeRangeCRC(
+        const Message*    message,
+        AcknowledgeStatus status
+    )
+    {
+        AcknowledgeCRC txMessage = AcknowledgeCRC(_sequence, message, status, _moduleUID, _job.crc);
+        reply(txMessage.asMessage(), AcknowledgeCRC::MESSAGE_LENGTH);
+    }
+
+    void
+    acknowledgeProgress(
+        const Message*    message,
+        AcknowledgeStatus status
+    )
+    {
+        const messages::aligned::WriteProgress* m = reinterpret_cast<const messages::aligned::WriteProgress*>(message);
+
+        uint32_t page = (m->data.address - core::stm32_flash::PROGRAM_FLASH_FROM) / hw::Flash::PAGE_SIZE;
+
+        AcknowledgeProgress txMessage = AcknowledgeProgress(_sequence, message, status, _moduleUID,
+                                                            core::stm32_flash::PROGRAM_FLASH_FROM + page * hw::Flash::PAGE_SIZE, hw::Flash::PAGE_SIZE);
+
+        if (status == AcknowledgeStatus::OK) {
+            while ((page < PROGRESS_PAGES) && !txMessage.isFull()) {
+                txMessage.add(isPageDone(page++));
+            }
+        }
+
+        reply(txMessage.asMessage(), AcknowledgeProgress::MESSAGE_LENGTH);
+    }
+
+    void
+    acknowledgeJobStatus(
+        const Message*    message,
+        AcknowledgeStatus status
+    )
+    {
+        AcknowledgeJobStatus txMessage = AcknowledgeJobStatus(_sequence, message, status, _moduleUID, _job.command, _job.next - _job.from, _job.to - _job.from, _job.crc);
+        reply(txMessage.asMessage(), AcknowledgeJobStatus::MESSAGE_LENGTH);
+    }
+
+    void
+    acknowledgeWrite(
+        const Message*    message,
+        AcknowledgeStatus status
+    )
+    {
+        if (_mode & COMPACT_ACK) {
+            AcknowledgeCompact txMessage = AcknowledgeCompact(_sequence, message, status, _moduleUID);
+            reply(txMessage.asMessage(), AcknowledgeCompact::MESSAGE_LENGTH);
+        } else {
+            acknowledgeUID(message, status);
+        }
+    }
+
+    void
+    acknowledgeTags(
+        const Message*    message,
+        AcknowledgeStatus status
+    )
+    {
+        // A rejected read never acquired the lease
+        TagsLease*  lease = scratch.get<TagsLease>();
+        char        none[sizeof(TagsLease::buffer)] = {0};
+        const char* tags  = ((status == AcknowledgeStatus::OK) && (lease != nullptr)) ? lease->buffer : none;
+
+        AcknowledgeTags txMessage = AcknowledgeTags(_sequence, message, status, tags);
+        reply(txMessage.asMessage(), AcknowledgeTags::MESSAGE_LENGTH);
+    }
+
+    void
+    acknowledgeIHex(
+        const Message*    message,
+        AcknowledgeStatus status
+    )
+    {
+        ReadbackLease* lease  = scratch.get<ReadbackLease>();
+        std::size_t    offset = 0;
+
+        AcknowledgeString txMessage = (lease != nullptr) ? AcknowledgeString(_sequence, message, status, lease->buffer, lease->offset)
+                                                         : AcknowledgeString(_sequence, message, status, "", offset);
+        reply(txMessage.asMessage(), AcknowledgeString::MESSAGE_LENGTH);
+    }
+
+    void
+    acknowledgeStackUsage(
+        const Message*    message,
+        AcknowledgeStatus status
+    )
+    {
+        payload::StackUsage usage;
+
+        usage.bootloaderSize     = sizeof(bootloaderThreadWorkingArea);
+        usage.bootloaderUsed     = sizeof(bootloaderThreadWorkingArea) - hw::Stack::unused(bootloaderThreadWorkingArea, sizeof(bootloaderThreadWorkingArea));
+        usage.blinkerSize        = sizeof(blinkerThreadWorkingArea);
+        usage.blinkerUsed        = sizeof(blinkerThreadWorkingArea) - hw::Stack::unused(blinkerThreadWorkingArea, sizeof(blinkerThreadWorkingArea));
+        usage.deepestCommandUsed = _deepestUsed;
+        usage.deepestCommand     = _deepestCommand;
+
+        if (usage.bootloaderUsed < _deepestUsed) {
+            // The stack is repainted before each command, the peak is the deepest command
+            usage.bootloaderUsed = _deepestUsed;
+        }
 
-		if (_selected) {
-			if (m->sequenceId != (uint8_t)(_sequence + 2)) {
-				return AcknowledgeStatus::WRONG_SEQUENCE;
-			} else {
-				_sequence = m->sequenceId;
-				return AcknowledgeStatus::NOT_IMPLEMENTED;
-			}
-		} else {
-			return AcknowledgeStatus::DISCARD;
-		}
+        AcknowledgeStackUsage txMessage = AcknowledgeStackUsage(_sequence, message, status, usage);
+        reply(txMessage.asMessage(), AcknowledgeStackUsage::MESSAGE_LENGTH);
     }
 
+    void
+    acknowledgeDescribeV2(
+        const Message*    message,
+        AcknowledgeStatus status
+    )
+    {
+        AcknowledgeDescribeV2 txMessage = AcknowledgeDescribeV2(_sequence, message, status,
+                                                                configurationStorage.getModuleConfiguration()->canID,
+                                                                DEFAULT_MODULE_NAME,
+                                                                configurationStorage.getModuleConfiguration()->name,
+                                                                configurationStorage.userDataSize(), programStorage.size(),
+                                                                configurationStorage.getModuleConfiguration()->imageCRC, cachedProgramCRC()
+                                          );
+        reply(txMessage.asMessage(), AcknowledgeDescribeV2::MESSAGE_LENGTH);
+    }
+
+    void
+    acknowledgeDescribeV3(
+        const Message*    message,
+        AcknowledgeStatus status
+    )
+    {
+        uint32_t imageCRC = configurationStorage.getModuleConfiguration()->imageCRC;
+        uint32_t flashCRC = cachedProgramCRC();
+
+        AcknowledgeDescribeV3 txMessage = AcknowledgeDescribeV3(_sequence, message, status,
+                                                                configurationStorage.getModuleConfiguration()->canID,
+                                                                DEFAULT_MODULE_NAME,
+                                                                configurationStorage.getModuleConfiguration()->name,
+                                                                configurationStorage.userDataSize(), programStorage.size(),
+                                                                core::stm32_flash::TAGS_FLASH_SIZE,
+                                                                imageCRC == flashCRC, configurationStorage.isValid()
+                                          );
+        reply(txMessage.asMessage(), AcknowledgeDescribeV3::MESSAGE_LENGTH);
+    }
+
+public:
     AcknowledgeStatus
     identify(
         bool me
@@ -969,8 +1551,14 @@ public:
     AcknowledgeStatus
     select()
     {
-        _selected = true;
-        _muted    = false;
+        _selected       = true;
+        _muted          = false;
+        _replay.command = MessageType::NONE; // A new session, nothing to replay
+        _job.command    = MessageType::NONE; // ... and no job of the previous one
+        _job.status     = AcknowledgeStatus::NONE;
+
+        // A write the previous session did not commit must not leak into this one
+        scratch.release();
 
         updateLed();
 
@@ -980,7 +1568,14 @@ public:
     AcknowledgeStatus
     deselect()
     {
-        _selected = false;
+        _selected       = false;
+        _shared         = false;
+        _mode           = 0;
+        _replay.command = MessageType::NONE;
+        _job.command    = MessageType::NONE;
+        _job.status     = AcknowledgeStatus::NONE;
+
+        scratch.release();
 
         updateLed();
 
@@ -990,11 +1585,7 @@ public:
     AcknowledgeStatus
     eraseConfiguration()
     {
-        if (configurationStorage.erase()) {
-            return AcknowledgeStatus::OK;
-        } else {
-            return AcknowledgeStatus::ERROR;
-        }
+        return startJob(MessageType::ERASE_CONFIGURATION, 0, 1);
     }
 
     AcknowledgeStatus
@@ -1011,14 +1602,36 @@ public:
     AcknowledgeStatus
     eraseProgram()
     {
-        if (programStorage.unlock() && programStorage.erase()) {
-            flashWriteSuccess = true;
-            return AcknowledgeStatus::OK;
-        } else {
+        programCRCValid = false;
+        progressPage    = NO_PAGE;
+
+        // What is still staged belongs to the program being erased
+        scratch.release();
+
+        if (!programStorage.unlock()) {
             return AcknowledgeStatus::ERROR;
         }
 
-        return AcknowledgeStatus::OK;
+        return startJob(MessageType::ERASE_PROGRAM, core::stm32_flash::PROGRAM_FLASH_FROM, core::stm32_flash::PROGRAM_FLASH_TO);
+    }
+
+    AcknowledgeStatus
+    resumeWrite()
+    {
+        if (!RESUMABLE_WRITES) {
+            return AcknowledgeStatus::NOT_IMPLEMENTED;
+        }
+
+        progressPage = NO_PAGE;
+
+        scratch.release();
+
+        if (!programStorage.unlock()) {
+            return AcknowledgeStatus::ERROR;
+        }
+
+        // The pages that were not completed are erased, the master sends them again
+        return startJob(MessageType::RESUME_WRITE, core::stm32_flash::PROGRAM_FLASH_FROM, PROGRESS_RECORD);
     }
 
     AcknowledgeStatus
@@ -1098,51 +1711,180 @@ public:
         const char          string[44]
     )
     {
-        const char* data = string;
+        const char* data  = string;
+        WriteLease* lease = nullptr;
 
         switch (type) {
           case payload::IHex::Type::BEGIN:
               blinkerSetActive(false);
               flashWriteSuccess = true; // Reset the success flag
-              ihex_begin_read(&_ihex);
+              lease = scratch.acquire<WriteLease>();
+              lease->count = 0;
+              ihex_begin_read(&lease->ihex);
               break;
           case payload::IHex::Type::DATA:
+              lease = scratch.get<WriteLease>();
+
+              if (lease == nullptr) {
+                  // Something else took over the scratch arena, the write is lost
+                  flashWriteSuccess = false;
+                  break;
+              }
+
               blinkerForce(true);
-              ihex_read_bytes(&_ihex, data, std::strlen(data));
+              ihex_read_bytes(&lease->ihex, data, std::strlen(data));
               blinkerForce(false);
               break;
           case payload::IHex::Type::END:
-              ihex_end_read(&_ihex);
+              lease = scratch.get<WriteLease>();
+
+              if (lease != nullptr) {
+                  ihex_end_read(&lease->ihex);
+              }
+
+              return commitWrite(lease);
+          default:
+              return AcknowledgeStatus::BROKEN;
+        } // switch
+
+        if (flashWriteSuccess) {
+            return AcknowledgeStatus::OK;
+        } else {
+            return AcknowledgeStatus::ERROR;
+        }
+    } // ihexWrite
+
+    AcknowledgeStatus
+    binaryWrite(
+        uint32_t       address,
+        const uint8_t* data,
+        uint8_t        length
+    )
+    {
+        WriteLease* lease = scratch.get<WriteLease>();
+
+        if (length == 0) {
+            return commitWrite(lease);
+        }
+
+        if (((address & 0x00000001) != 0) || ((length & 0x01) != 0)) {
+            return AcknowledgeStatus::BROKEN;
+        }
+
+        if (lease == nullptr) {
+            // First chunk of a write
+            blinkerSetActive(false);
+            flashWriteSuccess = true;
+            lease        = scratch.acquire<WriteLease>();
+            lease->count = 0;
+        }
+
+        if (flashWriteSuccess) {
+            blinkerForce(true);
+
+            for (uint8_t i = 0; (i < length) && flashWriteSuccess; i += 2) {
+                flashWriteSuccess &= stageWrite16(lease, address + i, data[i] | (data[i + 1] << 8));
+            }
+
+            blinkerForce(false);
+        }
+
+        if (flashWriteSuccess) {
+            return AcknowledgeStatus::OK;
+        } else {
+            return AcknowledgeStatus::ERROR;
+        }
+    } // binaryWrite
 
-              if (programStorage.isReady()) {
-                  flashWriteSuccess &= programStorage.endWrite();
-              }
+    // Ends a write: what is still staged goes to flash
+    AcknowledgeStatus
+    commitWrite(
+        WriteLease* lease
+    )
+    {
+        if (lease != nullptr) {
+            // After a failure, what is staged is not written
+            flashWriteSuccess = flashWriteSuccess && flushWritePage(lease);
+            scratch.release();
+        } else {
+            flashWriteSuccess = false;
+        }
 
-              if (configurationStorage.isReady()) {
-                  flashWriteSuccess &= configurationStorage.endWrite();
-              }
+        // Before endWrite(), that locks the flash again
+        if (RESUMABLE_WRITES && (progressPage != NO_PAGE)) {
+            if (flashWriteSuccess) {
+                // The program is complete, the record must read as erased flash again
+                flashWriteSuccess &= hw::Flash::erasePage(PROGRESS_RECORD);
+            }
 
-              blinkerSetActive(true);
+            progressPage = NO_PAGE;
+        }
 
-              if (flashWriteSuccess) {
-                  return AcknowledgeStatus::OK;
-              } else {
-                  return AcknowledgeStatus::ERROR;
-              }
+        if (programStorage.isReady()) {
+            flashWriteSuccess &= programStorage.endWrite();
+        }
 
-              flashWriteSuccess = false; // Prohibit any attempt to write again
+        if (configurationStorage.isReady()) {
+            flashWriteSuccess &= configurationStorage.endWrite();
+        }
 
-              break;
-          default:
-              return AcknowledgeStatus::BROKEN;
-        } // switch
+        blinkerSetActive(true);
 
         if (flashWriteSuccess) {
             return AcknowledgeStatus::OK;
         } else {
             return AcknowledgeStatus::ERROR;
         }
-    } // ihexWrite
+    } // commitWrite
+
+    AcknowledgeStatus
+    rangeCRC(
+        uint32_t address,
+        uint32_t length
+    )
+    {
+        const uint32_t* from;
+
+        if (((address & 0x00000003) != 0) || ((length & 0x00000003) != 0) || (length == 0)) {
+            return AcknowledgeStatus::BROKEN;
+        }
+
+        if (programStorage.isAddressValid(address) && programStorage.isAddressValid(address + length - 1)) {
+            from = reinterpret_cast<const uint32_t*>(address);
+        } else if (configurationStorage.isUserAddressValid(address) && configurationStorage.isUserAddressValid(address + length - 1)) {
+            from = reinterpret_cast<const uint32_t*>(reinterpret_cast<uintptr_t>(configurationStorage.getUserConfiguration()) + address);
+        } else {
+            return AcknowledgeStatus::ERROR;
+        }
+
+        return startJob(MessageType::RANGE_CRC, reinterpret_cast<uintptr_t>(from), reinterpret_cast<uintptr_t>(from) + length);
+    } // rangeCRC
+
+    AcknowledgeStatus
+    startJob(
+        MessageType command,
+        uint32_t    from,
+        uint32_t    to
+    )
+    {
+        _job.command = command;
+        _job.status  = AcknowledgeStatus::IN_PROGRESS;
+        _job.from    = from;
+        _job.next    = from;
+        _job.to      = to;
+        _job.crc     = 0xFFFFFFFF;
+        _job.pause   = STEP_PAUSE;
+
+        if (_mode & ASYNC_JOBS) {
+            // The master polls JOB_STATUS, runJob() is called by the bootloader thread
+            return AcknowledgeStatus::IN_PROGRESS;
+        }
+
+        // Legacy masters wait for the result
+        while (runJob()) {}
+
+        return _job.status;
+    } // startJob
 
     AcknowledgeStatus
     ihexRead(
@@ -1150,22 +1892,28 @@ public:
         char*    buffer
     )
     {
-        ihexBufferWPtr = buffer;
-
-        ihex_init(&_ihex);
-        ihex_write_at_address(&_ihex, address);
+        const uint8_t* from;
 
         if (programStorage.isAddressValid(address)) {
-            ihex_write_bytes(&_ihex, reinterpret_cast<void*>(address), 16);
-            ihex_set_output_line_length(&_ihex, 16);
+            from = reinterpret_cast<const uint8_t*>(address);
         } else if (configurationStorage.isUserAddressValid(address)) {
-            ihex_write_bytes(&_ihex, reinterpret_cast<void*>(((uint32_t)configurationStorage.getUserConfiguration()) + address), 16);
-            ihex_set_output_line_length(&_ihex, 16);
+            from = reinterpret_cast<const uint8_t*>(reinterpret_cast<uintptr_t>(configurationStorage.getUserConfiguration()) + address);
         } else {
             return AcknowledgeStatus::ERROR;
         }
 
-        ihex_end_write(&_ihex);
+        char* w = buffer;
+
+        if ((address >> 16) != 0) {
+            const uint8_t high[] = {
+                (uint8_t)(address >> 24), (uint8_t)(address >> 16)
+            };
+            w = ihex_put_record(w, IHEX_EXTENDED_LINEAR_ADDRESS_RECORD, 0, high, sizeof(high));
+        }
+
+        w  = ihex_put_record(w, IHEX_DATA_RECORD, address & 0xFFFF, from, 16);
+        w  = ihex_put_record(w, IHEX_END_OF_FILE_RECORD, 0, nullptr, 0);
+        *w = '\0';
 
         return AcknowledgeStatus::OK;
     } // ihexRead
@@ -1230,11 +1978,93 @@ private:
 
 private:
     bool    _selected;
+    bool    _shared; // Other slaves may be selected, session messages come on the direct topic
+    uint32_t _mode;     // Capabilities enabled for the current session
+    Job      _job;
+    Replay   _replay;
     uint8_t _sequence;
     bool    _muted;
+    bool    _enumerated; // A master found us with ENUMERATE
     bool    _loading;
     IProtocolTransport& _transport;
-    ihex_state          _ihex;
+    uint16_t            _deepestUsed; // Deepest stack usage while handling a command
+    MessageType         _deepestCommand;
+};
+
+// Dispatch table, sorted by type: findCommand() searches it
+constexpr SlaveProtocol::Command SlaveProtocol::COMMANDS[] = {
+    {MessageType::REQUEST, UNCHECKED, LEGACY_PAYLOAD_OFFSET, &SlaveProtocol::discardMessage, &SlaveProtocol::acknowledgeUID},
+    command<messages::aligned::IdentifySlave>(UNCHECKED, &SlaveProtocol::identifyMessage, &SlaveProtocol::acknowledgeUID),
+    command<messages::aligned::Enumerate>(UNCHECKED, &SlaveProtocol::enumerateMessage, &SlaveProtocol::acknowledgeEnumerate),
+    command<messages::aligned::EraseConfiguration>(SESSION, &SlaveProtocol::eraseConfigurationMessage, &SlaveProtocol::acknowledgeUID),
+    command<messages::aligned::EraseProgram>(SESSION, &SlaveProtocol::eraseProgramMessage, &SlaveProtocol::acknowledgeUID),
+    command<messages::aligned::WriteProgramCrc>(SESSION, &SlaveProtocol::writeProgramCRCMessage, &SlaveProtocol::acknowledgeUID),
+    command<messages::aligned::EraseUserConfiguration>(SESSION, &SlaveProtocol::eraseUserConfigurationMessage, &SlaveProtocol::acknowledgeUID),
+    {MessageType::SELECT_SLAVE, UNCHECKED, alignedPayloadOffset<payload::UIDAndMaster>(), &SlaveProtocol::selectMessage, &SlaveProtocol::acknowledgeUID},
+    command<messages::aligned::DeselectSlave>(UNCHECKED, &SlaveProtocol::deselectMessage, &SlaveProtocol::acknowledgeUID),
+    command<messages::aligned::SelectSlave>(UNCHECKED, &SlaveProtocol::selectMessage, &SlaveProtocol::acknowledgeUID),
+    command<messages::aligned::SelectShared>(UNCHECKED, &SlaveProtocol::selectMessage, &SlaveProtocol::acknowledgeUID),
+    command<messages::aligned::DescribeV2>(SESSION | CONCURRENT, &SlaveProtocol::okMessage, &SlaveProtocol::acknowledgeDescribeV2),
+    command<messages::aligned::WriteModuleName>(SESSION, &SlaveProtocol::writeModuleNameMessage, &SlaveProtocol::acknowledgeUID),
+    command<messages::aligned::WriteModuleID>(SESSION, &SlaveProtocol::writeCanIDMessaqe, &SlaveProtocol::acknowledgeUID),
+    command<messages::aligned::DescribeV3>(SESSION | CONCURRENT, &SlaveProtocol::okMessage, &SlaveProtocol::acknowledgeDescribeV3),
+    command<messages::aligned::DescribeAll>(UNCHECKED, &SlaveProtocol::describeAllMessage, &SlaveProtocol::acknowledgeInventory),
+    command<messages::aligned::TagsRead>(SESSION | CONCURRENT, &SlaveProtocol::TagsReadMessage, &SlaveProtocol::acknowledgeTags),
+    command<messages::aligned::ProtocolVersion>(SESSION | CONCURRENT, &SlaveProtocol::okMessage, &SlaveProtocol::acknowledgeVersion),
+    command<messages::aligned::StackUsage>(SESSION | CONCURRENT, &SlaveProtocol::okMessage, &SlaveProtocol::acknowledgeStackUsage),
+    command<messages::aligned::SetSessionMode>(SESSION, &SlaveProtocol::setSessionModeMessage, &SlaveProtocol::acknowledgeMode),
+    command<messages::aligned::RangeCRC>(SESSION, &SlaveProtocol::rangeCRCMessage, &SlaveProtocol::acknowledgeRangeCRC),
+    command<messages::aligned::JobStatus>(SESSION | CONCURRENT, &SlaveProtocol::jobStatusMessage, &SlaveProtocol::acknowledgeJobStatus),
+    command<messages::aligned::WriteProgress>(SESSION | CONCURRENT, &SlaveProtocol::writeProgressMessage, &SlaveProtocol::acknowledgeProgress),
+    command<messages::aligned::ResumeWrite>(SESSION, &SlaveProtocol::resumeWriteMessage, &SlaveProtocol::acknowledgeUID),
+    command<messages::aligned::IHexData>(SELECTED | SEQUENCED, &SlaveProtocol::iHexWriteMessage, &SlaveProtocol::acknowledgeWrite),
+    command<messages::aligned::IHexRead>(SESSION | CONCURRENT, &SlaveProtocol::iHexReadMessage, &SlaveProtocol::acknowledgeIHex),
+    command<messages::aligned::BinaryData>(SELECTED | SEQUENCED, &SlaveProtocol::binaryWriteMessage, &SlaveProtocol::acknowledgeWrite),
+    command<messages::aligned::Reset>(SESSION, &SlaveProtocol::resetMessage, &SlaveProtocol::acknowledgeReset),
+    command<messages::aligned::ResetAll>(UNCHECKED, &SlaveProtocol::resetAllMessage, &SlaveProtocol::acknowledgeUID),
+    {MessageType::BOOTLOAD, UNCHECKED, LEGACY_PAYLOAD_OFFSET, &SlaveProtocol::discardMessage, &SlaveProtocol::acknowledgeUID},
+    {MessageType::ACK, UNCHECKED, LEGACY_PAYLOAD_OFFSET, &SlaveProtocol::discardMessage, &SlaveProtocol::acknowledgeUID},
+};
+
+constexpr std::size_t SlaveProtocol::COMMANDS_COUNT = sizeof(SlaveProtocol::COMMANDS) / sizeof(SlaveProtocol::Command);
+
+constexpr bool
+SlaveProtocol::isSortedByType()
+{
+    for (std::size_t i = 1; i < COMMANDS_COUNT; i++) {
+        if (!(COMMANDS[i - 1].type < COMMANDS[i].type)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+inline const SlaveProtocol::Command&
+SlaveProtocol::findCommand(
+    MessageType type
+)
+{
+    static_assert(isSortedByType(), "COMMANDS must be sorted by type, one entry each");
+
+    std::size_t low  = 0;
+    std::size_t high = COMMANDS_COUNT;
+
+    while (low < high) {
+        std::size_t middle = (low + high) / 2;
+
+        if (COMMANDS[middle].type < type) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return ((low < COMMANDS_COUNT) && (COMMANDS[low].type == type)) ? COMMANDS[low] : NOT_IMPLEMENTED;
+}
+
+const SlaveProtocol::Command SlaveProtocol::NOT_IMPLEMENTED = {
+    MessageType::NONE, SELECTED | SEQUENCED, LEGACY_PAYLOAD_OFFSET, &SlaveProtocol::notImplemented, &SlaveProtocol::acknowledgeUID
 };
 
 class CANTransport:
@@ -1244,10 +2074,21 @@ public:
     CANTransport() :
         _readBufferShort(nullptr),
         _readBufferLong(nullptr),
+        _readDirect(false),
+        _direct(false),
         _filterId(0x0000),
+        _owned(false),
+        _switch(false),
+        _switchOwned(false),
+        _switchTo(0x00),
+        _masterCount(0),
+        _claiming(false),
+        _conflict(false),
+        _defend(false),
         _state(State::INITIALIZING)
-
-    {}
+    {
+        memset(_ignoredBy, 0, sizeof(_ignoredBy));
+    }
 
     ~CANTransport()
     {
@@ -1311,7 +2152,8 @@ public:
             rtcan_msg_p->id   = topic << 8 | _canID;
             rtcan_msg_p->size = s;
 
-            rtcanTransmit(&RTCAND1, &_messageTx, MS2ST(100));
+            // Two probes of the same ID collide until their deadline, keep it short
+            rtcanTransmit(&RTCAND1, &_messageTx, _claiming ? MS2ST(CLAIM_DEADLINE) : MS2ST(100));
 
             return true;
         } else {
@@ -1343,6 +2185,7 @@ public:
 
                 memcpy(m, _readBufferLong, s);
 
+                _direct         = _readDirect;
                 _readBufferLong = nullptr; // swap() will set it!
 
                 return true;
@@ -1352,6 +2195,19 @@ public:
         }
     } // receive
 
+    bool
+    isDirect()
+    {
+        return _direct;
+    }
+
+    // A long message was received and not read yet
+    bool
+    isPending()
+    {
+        return _readBufferLong != nullptr;
+    }
+
     bool
     waitForMaster()
     {
@@ -1393,19 +2249,316 @@ public:
         rtcan_msg_p->status   = RTCAN_MSG_READY;
         rtcan_msg_p->rx_isr   = nullptr;
 
-        rtcan_msg_p           = &_messageRxLong;
-        rtcan_msg_p->id       = (BOOTLOADER_TOPIC_ID << 8) | _filterId;
+        return link(_filterId) != nullptr;
+    } // setFilter
+
+    // Applies a hand-over requested by a master, returns true if the master changed
+    bool
+    switchMaster()
+    {
+        if (!_switch) {
+            return false;
+        }
+
+        _switch = false;
+
+        if (_switchOwned) {
+            if (link(_switchTo) == nullptr) {
+                // No room for another master, stay with the current one
+                return false;
+            }
+
+            _filterId = _switchTo;
+        }
+
+        _owned = _switchOwned;
+
+        return true;
+    } // switchMaster
+
+    // Messages the master sends to us only, must follow claimID()
+    bool
+    setDirectFilter()
+    {
+        if (_state != State::INITIALIZED) {
+            return false;
+        }
+
+        rtcan_msg_t* rtcan_msg_p;
+
+        rtcan_msg_p           = &_messageRxDirect;
+        rtcan_msg_p->id       = (BOOTLOADER_DIRECT_TOPIC_ID << 8) | _canID;
         rtcan_msg_p->callback = reinterpret_cast<rtcan_msgcallback_t>(CANTransport::recv_cb);
         rtcan_msg_p->params   = this;
         rtcan_msg_p->size     = LONG_MESSAGE_LENGTH;
-        rtcan_msg_p->data     = reinterpret_cast<uint8_t*>(&_bufferRxLong0);
+        rtcan_msg_p->data     = reinterpret_cast<uint8_t*>(&_bufferRxDirect0);
         rtcan_msg_p->status   = RTCAN_MSG_READY;
         rtcan_msg_p->rx_isr   = nullptr;
 
-        rtcanReceive(&RTCAND1, &_messageRxLong);
+        rtcanReceive(&RTCAND1, &_messageRxDirect);
 
         return true;
-    } // setFilter
+    } // setDirectFilter
+
+    // Makes sure nobody else on the bus uses _canID, picks another one otherwise
+    void
+    claimID()
+    {
+        bool configured = (configurationStorage.getModuleConfiguration()->canID != 0xFF);
+
+        for (uint8_t attempt = 0; attempt < CLAIM_ATTEMPTS; attempt++) {
+            if (attempt > 0) {
+                // Try again with another one
+                do {
+                    _canID = randomByte();
+                } while (!isUsable(_canID));
+            }
+
+            // A probe that did not make it stays on the controller until its deadline
+            while (isBusy()) {
+                osalThreadSleep(MS2ST(CLAIM_WINDOW));
+            }
+
+            _conflict = !isUsable(_canID);
+            _claiming = true;
+
+            for (uint8_t probe = 0; (probe < CLAIM_PROBES) && !_conflict; probe++) {
+                // Two slaves probing the same ID at the same time send the same
+                // identifier with different data: the frames collide, neither
+                // hears the other. A backoff of their own keeps them apart...
+                osalThreadSleep(MS2ST(1) + (randomByte() % MS2ST(CLAIM_BACKOFF)));
+
+                // ... and a probe that did not go out means someone else is there
+                if (!transmitClaim()) {
+                    _conflict = true;
+                    break;
+                }
+
+                osalThreadSleep(MS2ST(CLAIM_WINDOW));
+
+                if (_messageTx.status != RTCAN_MSG_READY) {
+                    _conflict = true;
+                }
+            }
+
+            _claiming = false;
+
+            if (!_conflict) {
+                break;
+            }
+        }
+
+        if (_conflict) {
+            // Every candidate is taken, joining the bus would break another node
+            osalSysHalt("No free CAN ID");
+        }
+
+#if PERSIST_CAN_ID
+        // A configured ID is kept, even if it was in use this time
+        if (!configured) {
+            configurationStorage.writeCanID(_canID);
+        }
+#else
+        (void)configured;
+#endif
+    } // claimID
+
+    // Replies to a claim of our CAN ID, if there was one
+    void
+    defendID()
+    {
+        if (_defend) {
+            _defend = false;
+            transmitClaim();
+        }
+    }
+
+private:
+    // 0xFF is reserved, the master has its own
+    bool
+    isUsable(
+        uint8_t id
+    ) const
+    {
+        return (id != 0xFF) && (id != (_filterId & 0xFF));
+    }
+
+    bool
+    transmitClaim()
+    {
+        messages::ClaimCanID m;
+        m.sequenceId = 0x00;
+        m.data.uid   = _moduleUID;
+        return transmit(&m, messages::ClaimCanID::MESSAGE_LENGTH, BOOTLOADER_MASTER_TOPIC_ID);
+    }
+
+    // Long messages from a master, registered the first time we follow it
+    struct MasterLink {
+        rtcan_msg_t message;
+        uint8_t     buffer0[LONG_MESSAGE_LENGTH];
+        uint8_t     buffer1[LONG_MESSAGE_LENGTH];
+        uint8_t     master;
+    };
+
+    MasterLink*
+    link(
+        uint8_t master
+    )
+    {
+        for (uint8_t i = 0; i < _masterCount; i++) {
+            if (_masters[i].master == master) {
+                return &_masters[i];
+            }
+        }
+
+        if (_masterCount == MAXIMUM_MASTERS) {
+            return nullptr;
+        }
+
+        MasterLink*  l = &_masters[_masterCount++];
+        rtcan_msg_t* rtcan_msg_p;
+
+        l->master = master;
+
+        rtcan_msg_p           = &l->message;
+        rtcan_msg_p->id       = (BOOTLOADER_TOPIC_ID << 8) | master;
+        rtcan_msg_p->callback = reinterpret_cast<rtcan_msgcallback_t>(CANTransport::recv_cb);
+        rtcan_msg_p->params   = this;
+        rtcan_msg_p->size     = LONG_MESSAGE_LENGTH;
+        rtcan_msg_p->data     = reinterpret_cast<uint8_t*>(&l->buffer0);
+        rtcan_msg_p->status   = RTCAN_MSG_READY;
+        rtcan_msg_p->rx_isr   = nullptr;
+
+        rtcanReceive(&RTCAND1, &l->message);
+
+        return l;
+    } // link
+
+    // The long message comes from the master we follow
+    MasterLink*
+    ownerLinkI(
+        const rtcan_msg_t& rtcan_msg
+    )
+    {
+        for (uint8_t i = 0; i < _masterCount; i++) {
+            if (&_masters[i].message == &rtcan_msg) {
+                return (_owned && (_masters[i].master == _filterId)) ? &_masters[i] : nullptr;
+            }
+        }
+
+        return nullptr;
+    }
+
+    // The CAN ID of a direct message is ours, not the one of its master: it
+    // is taken while we follow one, and not while a hand-over is pending
+    inline bool
+    directOwnedI() const
+    {
+        return _owned && !_switch;
+    }
+
+    inline bool
+    isIgnoredBy(
+        uint8_t master
+    )
+    {
+        return (_ignoredBy[master >> 3] & (1 << (master & 0x07))) != 0;
+    }
+
+    inline void
+    setIgnoredBy(
+        uint8_t master,
+        bool    ignored
+    )
+    {
+        if (ignored) {
+            _ignoredBy[master >> 3] |= (1 << (master & 0x07));
+        } else {
+            _ignoredBy[master >> 3] &= ~(1 << (master & 0x07));
+        }
+    }
+
+    // MASTER_ADVERTISE, MASTER_IGNORE and MASTER_FORCE, once we follow a master
+    void
+    masterControlI(
+        rtcan_msg_t& rtcan_msg
+    )
+    {
+        uint8_t     master  = rtcan_msg.id & 0x00FF;
+        MessageType command = static_cast<MessageType>(rtcan_msg.data[0]);
+        ModuleUID   uid;
+
+        memcpy(&uid, &rtcan_msg.data[2], sizeof(uid));
+
+        bool forUs = (uid == _moduleUID) || (uid == ANY_MODULE_UID);
+
+        switch (command) {
+          case MessageType::MASTER_ADVERTISE:
+              // A released slave follows the first master that does not ignore it
+              if (!_owned && !isIgnoredBy(master)) {
+                  requestSwitchI(true, master);
+              }
+              break;
+          case MessageType::MASTER_IGNORE:
+              if (forUs) {
+                  setIgnoredBy(master, true);
+
+                  if (_owned && (master == _filterId)) {
+                      requestSwitchI(false, master);
+                  }
+              }
+              break;
+          case MessageType::MASTER_FORCE:
+              if (forUs) {
+                  setIgnoredBy(master, false);
+
+                  if (!_owned || (master != _filterId)) {
+                      requestSwitchI(true, master);
+                  }
+              }
+              break;
+          default:
+              break;
+        } // switch
+    } // masterControlI
+
+    void
+    requestSwitchI(
+        bool    owned,
+        uint8_t master
+    )
+    {
+        _switchOwned = owned;
+        _switchTo    = master;
+        _switch      = true;
+
+        osalThreadResumeI(&trp, RESUME_MASTER);
+    }
+
+    // A short message was sent by another node with our CAN ID
+    void
+    checkClaimI(
+        rtcan_msg_t& rtcan_msg
+    )
+    {
+        if ((rtcan_msg.id & 0x00FF) != _canID) {
+            return;
+        }
+
+        MessageType command = static_cast<MessageType>(rtcan_msg.data[0]);
+        ModuleUID   uid;
+
+        memcpy(&uid, &rtcan_msg.data[2], sizeof(uid));
+
+        if (((command != MessageType::CLAIM_CAN_ID) && (command != MessageType::REQUEST)) || (uid != _moduleUID)) {
+            if (_claiming) {
+                _conflict = true;
+            } else if (command == MessageType::CLAIM_CAN_ID) {
+                _defend = true;
+                osalThreadResumeI(&trp, RESUME_DEFEND);
+            }
+        }
+    } // checkClaimI
 
 private:
     static void
@@ -1421,22 +2574,49 @@ private:
                 // We have received a message...
                 ShortMessage* m = reinterpret_cast<ShortMessage*>(_this->_readBufferShort);
 
-                // If a master advertises itself...
-                if (m->command == MessageType::MASTER_ADVERTISE) {
-                    _this->_filterId = rtcan_msg.id & 0x00FF;
+                uint8_t   master = rtcan_msg.id & 0x00FF;
+                ModuleUID uid;
+
+                memcpy(&uid, _this->_readBufferShort + 2, sizeof(uid));
+
+                bool forUs = (uid == _moduleUID) || (uid == ANY_MODULE_UID);
+
+                if ((m->command == MessageType::MASTER_FORCE) && forUs) {
+                    // A master that wants us, even if it told us to ignore it before
+                    _this->setIgnoredBy(master, false);
+                }
+
+                // If a master advertises itself, or forces us...
+                if (((m->command == MessageType::MASTER_ADVERTISE) && !_this->isIgnoredBy(master)) || ((m->command == MessageType::MASTER_FORCE) && forUs)) {
+                    _this->_filterId = master;
+                    _this->_owned    = true;
                     _this->_state    = State::INITIALIZED;
                     osalThreadResumeI(&trp, RESUME_BOOTLOADER); // resume the bootloader thread with message
+                } else if ((m->command == MessageType::MASTER_IGNORE) && forUs) {
+                    // ... unless it does not want us
+                    _this->setIgnoredBy(master, true);
                 }
             }
         } else if (_this->_state == State::INITIALIZED) {
-            if ((rtcan_msg.status == RTCAN_MSG_BUSY) && (rtcan_msg.size == LONG_MESSAGE_LENGTH)) {
-                _this->swapLong();
+            if ((rtcan_msg.status == RTCAN_MSG_BUSY) && (rtcan_msg.size == LONG_MESSAGE_LENGTH) && (&rtcan_msg == &_this->_messageRxDirect)) {
+                if (_this->directOwnedI()) {
+                    _this->swapDirect();
+
+                    // The master sent it to us only
+                    osalThreadResumeI(&trp, RESUME_BOOTLOADER);
+                }
+            } else if ((rtcan_msg.status == RTCAN_MSG_BUSY) && (rtcan_msg.size == LONG_MESSAGE_LENGTH)) {
+                MasterLink* link = _this->ownerLinkI(rtcan_msg);
 
                 // We have received a message...
-                if (rtcan_msg.id == ((BOOTLOADER_TOPIC_ID << 8) | _this->_filterId)) {
-                    // That was interesting
+                if (link != nullptr) {
+                    // ... from the master we follow, that was interesting
+                    _this->swapLong(link);
                     osalThreadResumeI(&trp, RESUME_BOOTLOADER); // resume the bootloader thread with message
                 }
+            } else if ((rtcan_msg.status == RTCAN_MSG_BUSY) && (rtcan_msg.size == SHORT_MESSAGE_LENGTH)) {
+                _this->masterControlI(rtcan_msg);
+                _this->checkClaimI(rtcan_msg);
             }
         }
 
@@ -1448,17 +2628,38 @@ private:
 
     uint8_t _bufferRxShort0[SHORT_MESSAGE_LENGTH];
     uint8_t _bufferRxShort1[SHORT_MESSAGE_LENGTH];
-    uint8_t _bufferRxLong0[LONG_MESSAGE_LENGTH];
-    uint8_t _bufferRxLong1[LONG_MESSAGE_LENGTH];
+    uint8_t _bufferRxDirect0[LONG_MESSAGE_LENGTH];
+    uint8_t _bufferRxDirect1[LONG_MESSAGE_LENGTH];
 
     rtcan_msg_t _messageTx;
     rtcan_msg_t _messageRxShort;
-    rtcan_msg_t _messageRxLong;
+    rtcan_msg_t _messageRxDirect;
 
     uint8_t* _readBufferShort;
     uint8_t* _readBufferLong;
+    bool     _readDirect; // _readBufferLong came from the direct topic
+    bool     _direct;     // The last received message did
+
+    rtcan_id_t _filterId; // The master we follow
+
+    MasterLink _masters[MAXIMUM_MASTERS];
+    uint8_t    _ignoredBy[256 / 8]; // Masters that told us to ignore them
+
+    volatile bool    _owned;       // We follow _filterId
+    volatile bool    _switch;      // A master asked for a hand-over
+    volatile bool    _switchOwned; // ... to _switchTo, or to nobody
+    volatile uint8_t _switchTo;
+    uint8_t          _masterCount;
 
-    rtcan_id_t _filterId;
+    static const uint8_t CLAIM_ATTEMPTS = 8;
+    static const uint8_t CLAIM_PROBES   = 2;
+    static const uint8_t CLAIM_WINDOW   = 50; // [ms] for a defender to reply
+    static const uint8_t CLAIM_BACKOFF  = 20; // [ms] at most, before each probe
+    static const uint8_t CLAIM_DEADLINE = 10; // [ms] for a probe to go out
+
+    volatile bool _claiming; // We are probing _canID
+    volatile bool _conflict; // Someone else uses it
+    volatile bool _defend;   // Someone else wants it
 
     enum class State {
         INITIALIZING,
@@ -1484,18 +2685,39 @@ private:
     }
 
     inline void
-    swapLong()
+    swapLong(
+        MasterLink* link
+    )
+    {
+        uint8_t* buffer0 = reinterpret_cast<uint8_t*>(&link->buffer0);
+        uint8_t* buffer1 = reinterpret_cast<uint8_t*>(&link->buffer1);
+
+        if (link->message.data == buffer0) {
+            link->message.data = buffer1;
+            _readBufferLong    = buffer0;
+        } else {
+            link->message.data = buffer0;
+            _readBufferLong    = buffer1;
+        }
+
+        _readDirect = false;
+    }
+
+    inline void
+    swapDirect()
     {
-        uint8_t* buffer0 = reinterpret_cast<uint8_t*>(&_bufferRxLong0);
-        uint8_t* buffer1 = reinterpret_cast<uint8_t*>(&_bufferRxLong1);
+        uint8_t* buffer0 = reinterpret_cast<uint8_t*>(&_bufferRxDirect0);
+        uint8_t* buffer1 = reinterpret_cast<uint8_t*>(&_bufferRxDirect1);
 
-        if (_messageRxLong.data == buffer0) {
-            _messageRxLong.data = buffer1;
-            _readBufferLong     = buffer0;
+        if (_messageRxDirect.data == buffer0) {
+            _messageRxDirect.data = buffer1;
+            _readBufferLong       = buffer0;
         } else {
-            _messageRxLong.data = buffer0;
-            _readBufferLong     = buffer1;
+            _messageRxDirect.data = buffer0;
+            _readBufferLong       = buffer1;
         }
+
+        _readDirect = true;
     }
 };
 }
@@ -1536,6 +2758,8 @@ boot()
 
 THD_WORKING_AREA(bootloaderThreadWorkingArea, 4096);
 THD_FUNCTION(bootloaderThread, arg) {
+    hw::Stack::paint(bootloaderThreadWorkingArea, sizeof(bootloaderThreadWorkingArea));
+
     hw::Watchdog::enable(hw::Watchdog::Period::_6400_ms);
     hw::Watchdog::reload();
 
@@ -1560,7 +2784,7 @@ THD_FUNCTION(bootloaderThread, arg) {
     _canID = configurationStorage.getModuleConfiguration()->canID;
 
     while (_canID == 0xFF) {
-        _canID = rng();
+        _canID = randomByte();
     }
 
     // Done
@@ -1634,6 +2858,9 @@ THD_FUNCTION(bootloaderThread, arg) {
     if (bootload) {
         // We must bootload
 
+        transport.claimID();
+        transport.setDirectFilter();
+
         proto.start();
 
         uint8_t cnt = 0;
@@ -1658,19 +2885,41 @@ THD_FUNCTION(bootloaderThread, arg) {
 #endif
             osalSysLock();
 
-            msg = osalThreadSuspendTimeoutS(&trp, MS2ST(timeout));
+            if (transport.isPending()) {
+                // It arrived while a job step was running, nobody was waiting for it
+                msg = RESUME_BOOTLOADER;
+            } else if (!proto.isWorking()) {
+                msg = osalThreadSuspendTimeoutS(&trp, MS2ST(timeout));
+            } else {
+                // A job step follows an acknowledge as soon as it is out
+                msg = osalThreadSuspendTimeoutS(&trp, MS2ST(transport.isBusy() ? 1 : proto.jobPause()));
+            }
 
-            if (msg != RESUME_BOOTLOADER) {
-                if ((cnt & 0x03) == 0x03) {
+            if (msg == RESUME_BOOTLOADER) {
+                proto.processLongMessage();
+            } else if (msg == MSG_TIMEOUT) {
+                // Every 4th timeout, in a phase that depends on the UID, so that not all the slaves announce together
+                if (((cnt + _moduleUID) & 0x03) == 0x03) {
                     proto.announce();
                 }
 
                 cnt++;
-            } else {
-                proto.processLongMessage();
+            }
+
+            transport.defendID(); // If someone claimed our CAN ID
+
+            if (transport.switchMaster()) {
+                // The session, if any, belonged to the previous master
+                proto.deselect();
             }
 
             osalSysUnlock();
+
+            // With the interrupts enabled, the CAN must be served in the meanwhile. Not while a
+            // message is going out: the flash stalls the CPU, the acknowledge would miss its deadline
+            if (!transport.isBusy()) {
+                proto.runJob();
+            }
         }
     } else {
         // We were not requested to bootload...
@@ -132,6 +132,83 @@ Watchdog::reload()
 #endif
 }
 
+void
+Stack::paint(
+    void*       base,
+    std::size_t size
+)
+{
+    static const std::size_t GUARD = 16; // [words] keep clear of our own frame
+
+    uint32_t* from = reinterpret_cast<uint32_t*>(base);
+    uint32_t* to   = reinterpret_cast<uint32_t*>(__builtin_frame_address(0)) - GUARD;
+
+    if ((to <= from) || (to >= (from + size / sizeof(uint32_t)))) {
+        // We are not running on this stack
+        return;
+    }
+
+    while (from < to) {
+        *(from++) = FILL;
+    }
+}
+
+std::size_t
+Stack::unused(
+    const void* base,
+    std::size_t size
+)
+{
+    const uint32_t* from = reinterpret_cast<const uint32_t*>(base);
+    const uint32_t* to   = from + size / sizeof(uint32_t);
+    const uint32_t* p    = from;
+
+    while ((p < to) && (*p == FILL)) {
+        p++;
+    }
+
+    return (p - from) * sizeof(uint32_t);
+}
+
+bool
+Flash::erasePage(
+    uint32_t address
+)
+{
+    while (FLASH->SR & FLASH_SR_BSY) {}
+
+    FLASH->SR  = FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPERR; // clear the previous results
+    FLASH->CR |= FLASH_CR_PER;
+    FLASH->AR  = address;
+    FLASH->CR |= FLASH_CR_STRT;
+
+    while (FLASH->SR & FLASH_SR_BSY) {}
+
+    FLASH->CR &= ~FLASH_CR_PER;
+
+    return (FLASH->SR & (FLASH_SR_PGERR | FLASH_SR_WRPERR)) == 0;
+}
+
+uint32_t
+CRCUnit::update(
+    uint32_t        crc,
+    const uint32_t* data,
+    std::size_t     words
+)
+{
+    CRC->INIT = crc;
+    CRC->CR  |= CRC_CR_RESET; // DR = INIT
+
+    while (words-- > 0) {
+        CRC->DR = *(data++);
+    }
+
+    crc       = CRC->DR;
+    CRC->INIT = 0xFFFFFFFF; // the reset value, other users expect it
+
+    return crc;
+}
+
 int32_t
 jumptoapp(
     uint32_t addr
@@ -0,0 +1,63 @@
+#!/bin/sh
+# COPYRIGHT (c) 2016-2018 Nova Labs SRL
+#
+# All rights reserved. All use of this software and documentation is
+# subject to the License Agreement located in the file LICENSE.
+#
+# Reports the flash footprint of a bootloader image and fails if it does not
+# fit the space reserved in front of PROGRAM_FLASH_FROM.
+#
+# Usage: size_budget.sh <bootloader.elf> <budget in bytes> [symbols to list]
+#
+# The budget can also be given through BOOTLOADER_FLASH_BUDGET, the toolchain
+# prefix through CROSS_COMPILE (default: arm-none-eabi-).
+# Hook it as a post-build step of the bootloader target, e.g. with CMake:
+#   add_custom_command(TARGET bootloader POST_BUILD
+#     COMMAND ${CORE_BOOTLOADER_ROOT}/tools/size_budget.sh $<TARGET_FILE:bootloader> 16384)
+
+ELF="$1"
+BUDGET="${2:-$BOOTLOADER_FLASH_BUDGET}"
+TOP="${3:-30}"
+PREFIX="${CROSS_COMPILE-arm-none-eabi-}"
+
+if [ -z "$ELF" ] || [ -z "$BUDGET" ]; then
+    echo "usage: $0 <bootloader.elf> <budget in bytes> [symbols to list]" >&2
+    exit 2
+fi
+
+if [ ! -f "$ELF" ]; then
+    echo "$0: $ELF not found" >&2
+    exit 2
+fi
+
+# Per-symbol report, largest last: everything that ends up in flash (code,
+# read only data and the initializers of .data)
+echo "--- Largest flash symbols in $ELF ---"
+"${PREFIX}nm" --print-size --size-sort --radix=d -C "$ELF" |
+    awk '$3 ~ /^[tTrRdD]$/ { printf "%8d  %s  ", $2, $3; for (i = 4; i <= NF; i++) printf "%s ", $i; printf "\n" }' |
+    tail -n "$TOP"
+
+# Flash = text + data (the latter is copied from flash at startup)
+SIZES=$("${PREFIX}size" -B "$ELF" | awk 'NR == 2 { print $1, $2, $3 }')
+
+if [ -z "$SIZES" ]; then
+    echo "$0: cannot read the section sizes of $ELF" >&2
+    exit 2
+fi
+
+set -- $SIZES
+TEXT=$1
+DATA=$2
+BSS=$3
+FLASH=$((TEXT + DATA))
+
+echo "--- Bootloader footprint ---"
+echo "flash: $FLASH bytes (text $TEXT + data $DATA), budget $BUDGET bytes, $((BUDGET - FLASH)) bytes free"
+echo "ram:   $((DATA + BSS)) bytes (data $DATA + bss $BSS)"
+
+if [ "$FLASH" -gt "$BUDGET" ]; then
+    echo "$0: bootloader exceeds its flash budget by $((FLASH - BUDGET)) bytes" >&2
+    exit 1
+fi
+
+exit 0